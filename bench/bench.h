@@ -0,0 +1,51 @@
+/*
+
+  bench.h - minimal timing harness for the host benchmarks.
+
+*/
+
+#ifndef MODBUSTER_BENCH_H
+#define MODBUSTER_BENCH_H
+
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+
+namespace bench {
+
+// Keep the compiler from optimizing a computed value away.
+template <typename T> inline void keep(const T &value) {
+  asm volatile("" : : "g"(&value) : "memory");
+}
+
+// Make the compiler assume memory was modified.
+inline void clobber() { asm volatile("" : : : "memory"); }
+
+/**
+Time a callable.
+
+Doubles the iteration count until one run takes at least u32MinNs, then
+reports the time per call of that run.
+
+@param f callable to time
+@param u32MinNs shortest run to trust [nanoseconds]
+@return time per call [nanoseconds]
+*/
+template <typename F> double nsPerOp(F f, uint32_t u32MinNs = 20000000) {
+  typedef std::chrono::steady_clock Clock;
+  for (uint32_t u32Iterations = 1;; u32Iterations *= 2) {
+    Clock::time_point start = Clock::now();
+    for (uint32_t i = 0; i < u32Iterations; i++) {
+      f();
+      clobber();
+    }
+    double ns = std::chrono::duration<double, std::nano>(Clock::now() - start)
+                    .count();
+    if (ns >= u32MinNs || u32Iterations >= (1u << 30))
+      return ns / u32Iterations;
+  }
+}
+
+} // namespace bench
+
+#endif // MODBUSTER_BENCH_H
@@ -0,0 +1,145 @@
+/*
+
+  bench_bank.cpp - FC03 requests served from a ModbusRegisterBank while
+  application threads update it, against the same map guarded by a mutex.
+
+  The bank holds 50 32-bit values, each an update group of two registers;
+  writers store (n, ~n) pairs, so a torn read shows as a pair whose halves
+  do not match. Each line reports the time per 100-register request, the
+  updates per second the writers managed meanwhile and, for the bank, how
+  many group copies had to be repeated.
+
+*/
+
+#include "Arduino.h"
+#include "ModbusterPdu.h"
+#include "ModbusterRegisterBank.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace ModBuster;
+
+static const uint16_t kRegisters = 100;
+static const int kRunMs = 300;
+
+struct Result {
+  double nsPerRequest;
+  double updatesPerSecond;
+  uint32_t u32Torn;
+};
+
+// One 100-register FC03 request through the slave handlers; counts torn
+// pairs in the response.
+static uint32_t serve(ModbusRegisterMap &map) {
+  uint8_t au8Pdu[ku16MaxPDUSize] = {ku8MBReadHoldingRegisters, 0, 0, 0,
+                                    kRegisters};
+  ModbusPduHandler pdu(au8Pdu, sizeof(au8Pdu), ku8MaxReadRegisters);
+  pdu.serve(map, 5);
+
+  uint32_t u32Torn = 0;
+  for (uint16_t i = 0; i < kRegisters; i += 2) {
+    uint16_t u16High = word(au8Pdu[2 + 2 * i], au8Pdu[3 + 2 * i]);
+    uint16_t u16Low = word(au8Pdu[4 + 2 * i], au8Pdu[5 + 2 * i]);
+    if (u16High != (uint16_t)~u16Low)
+      u32Torn++;
+  }
+  return u32Torn;
+}
+
+// Serve requests for kRunMs while `writers` threads call update().
+template <typename Update>
+static Result run(ModbusRegisterMap &map, std::mutex *mutex, int writers,
+                  Update update) {
+  std::atomic<bool> stop(false);
+  std::atomic<uint64_t> updates(0);
+  std::vector<std::thread> threads;
+  for (int w = 0; w < writers; w++) {
+    threads.emplace_back([&, w]() {
+      uint64_t n = 0;
+      for (uint16_t u16Value = (uint16_t)w; !stop; u16Value += 7, n++)
+        update((uint16_t)(2 * (n % (kRegisters / 2))), u16Value);
+      updates += n;
+    });
+  }
+
+  typedef std::chrono::steady_clock Clock;
+  Clock::time_point start = Clock::now(), end = start;
+  uint64_t requests = 0;
+  uint32_t u32Torn = 0;
+  while (end - start < std::chrono::milliseconds(kRunMs)) {
+    for (int i = 0; i < 64; i++) {
+      if (mutex) {
+        std::lock_guard<std::mutex> lock(*mutex);
+        u32Torn += serve(map);
+      } else {
+        u32Torn += serve(map);
+      }
+    }
+    requests += 64;
+    end = Clock::now();
+  }
+  stop = true;
+  for (std::thread &thread : threads)
+    thread.join();
+
+  double seconds = std::chrono::duration<double>(end - start).count();
+  return {seconds * 1e9 / requests, updates / seconds, u32Torn};
+}
+
+int main() {
+  int failures = 0;
+  int maxWriters = (int)std::thread::hardware_concurrency() - 1;
+  if (maxWriters < 1)
+    maxWriters = 1;
+
+  printf("%-8s %8s %12s %14s %12s %6s\n", "map", "writers", "ns/request",
+         "updates/s", "retries/1k", "torn");
+  for (int writers = 0; writers <= maxWriters && writers <= 4;
+       writers = writers ? 2 * writers : 1) {
+    // seqlock bank, no lock on either side
+    ModbusRegisterBank bank(kRegisters);
+    for (uint16_t i = 0; i < kRegisters; i += 2)
+      bank.group(i, 2);
+    uint16_t au16Init[kRegisters];
+    for (uint16_t i = 0; i < kRegisters; i++)
+      au16Init[i] = (i & 1) ? 0xFFFF : 0;
+    bank.write(0, au16Init, kRegisters);
+    ModbusRegion regions[1];
+    ModbusRegisterMap map(regions, 1);
+    map.addHoldingRegisters(0, kRegisters, bank);
+
+    Result seq = run(map, nullptr, writers,
+                     [&bank](uint16_t u16Offset, uint16_t u16Value) {
+                       uint16_t au16Pair[2] = {u16Value, (uint16_t)~u16Value};
+                       bank.write(u16Offset, au16Pair, 2);
+                     });
+    double retries =
+        bank.reads() ? 1000.0 * bank.retries() / bank.reads() : 0.0;
+    printf("%-8s %8d %12.1f %14.0f %12.2f %6u\n", "seqlock", writers,
+           seq.nsPerRequest, seq.updatesPerSecond, retries, seq.u32Torn);
+    failures += seq.u32Torn != 0;
+
+    // plain memory, both sides take a mutex
+    static uint16_t au16Plain[kRegisters];
+    memcpy(au16Plain, au16Init, sizeof(au16Plain));
+    ModbusRegion plainRegions[1];
+    ModbusRegisterMap plain(plainRegions, 1);
+    plain.addHoldingRegisters(0, kRegisters, au16Plain);
+    std::mutex mutex;
+
+    Result locked = run(plain, &mutex, writers,
+                        [&mutex](uint16_t u16Offset, uint16_t u16Value) {
+                          std::lock_guard<std::mutex> lock(mutex);
+                          au16Plain[u16Offset] = u16Value;
+                          au16Plain[u16Offset + 1] = (uint16_t)~u16Value;
+                        });
+    printf("%-8s %8d %12.1f %14.0f %12s %6u\n", "mutex", writers,
+           locked.nsPerRequest, locked.updatesPerSecond, "-", locked.u32Torn);
+    failures += locked.u32Torn != 0;
+  }
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,93 @@
+/*
+
+  bench_bits.cpp - coil packing kernels against the per-bit loops they
+  replace, for 1, 16, 256 and 2000 coils at several start offsets.
+
+  Each case is first checked against the per-bit reference, then both are
+  timed; the speedup column is reference time / kernel time.
+
+*/
+
+#include "Arduino.h"
+#include "ModbusterKernels.h"
+#include "bench.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+using namespace ModBuster;
+
+static const uint16_t kCounts[] = {1, 16, 256, 2000};
+static const uint16_t kOffsets[] = {0, 1, 3, 8, 13};
+
+// per-bit copy as done by the slave handlers before the kernels
+static void referenceExtract(uint8_t *au8Dst, const uint8_t *au8Src,
+                             uint16_t u16SrcBit, uint16_t u16Count) {
+  memset(au8Dst, 0, (u16Count + 7) >> 3);
+  for (uint16_t i = 0; i < u16Count; i++) {
+    uint16_t u16Bit = u16SrcBit + i;
+    bitWrite(au8Dst[i / 8], i % 8, bitRead(au8Src[u16Bit / 8], u16Bit % 8));
+  }
+}
+
+static void referenceInsert(uint8_t *au8Dst, uint16_t u16DstBit,
+                            const uint8_t *au8Src, uint16_t u16Count) {
+  for (uint16_t i = 0; i < u16Count; i++) {
+    uint16_t u16Bit = u16DstBit + i;
+    bitWrite(au8Dst[u16Bit / 8], u16Bit % 8, bitRead(au8Src[i / 8], i % 8));
+  }
+}
+
+int main() {
+  uint8_t au8Table[300], au8Frame[300], au8Expected[300], au8Actual[300];
+  int failures = 0;
+
+  srand(1);
+  for (size_t i = 0; i < sizeof(au8Table); i++)
+    au8Table[i] = (uint8_t)rand();
+  for (size_t i = 0; i < sizeof(au8Frame); i++)
+    au8Frame[i] = (uint8_t)rand();
+
+  printf("%-8s %6s %6s %12s %12s %8s\n", "kernel", "coils", "offset",
+         "per-bit ns", "kernel ns", "speedup");
+
+  for (uint16_t u16Count : kCounts) {
+    for (uint16_t u16Offset : kOffsets) {
+      // extract: coils into a response
+      referenceExtract(au8Expected, au8Table, u16Offset, u16Count);
+      memset(au8Actual, 0xA5, sizeof(au8Actual));
+      bits_extract(au8Actual, au8Table, u16Offset, u16Count);
+      if (memcmp(au8Expected, au8Actual, (u16Count + 7) >> 3)) {
+        printf("extract mismatch: %u coils at %u\n", u16Count, u16Offset);
+        failures++;
+      }
+      double ref = bench::nsPerOp([&]() {
+        referenceExtract(au8Actual, au8Table, u16Offset, u16Count);
+      });
+      double fast = bench::nsPerOp([&]() {
+        bits_extract(au8Actual, au8Table, u16Offset, u16Count);
+      });
+      printf("%-8s %6u %6u %12.1f %12.1f %7.1fx\n", "extract", u16Count,
+             u16Offset, ref, fast, ref / fast);
+
+      // insert: a FC0F request into the coils
+      memcpy(au8Expected, au8Table, sizeof(au8Table));
+      memcpy(au8Actual, au8Table, sizeof(au8Table));
+      referenceInsert(au8Expected, u16Offset, au8Frame, u16Count);
+      bits_insert(au8Actual, u16Offset, au8Frame, u16Count);
+      if (memcmp(au8Expected, au8Actual, sizeof(au8Table))) {
+        printf("insert mismatch: %u coils at %u\n", u16Count, u16Offset);
+        failures++;
+      }
+      ref = bench::nsPerOp([&]() {
+        referenceInsert(au8Actual, u16Offset, au8Frame, u16Count);
+      });
+      fast = bench::nsPerOp([&]() {
+        bits_insert(au8Actual, u16Offset, au8Frame, u16Count);
+      });
+      printf("%-8s %6u %6u %12.1f %12.1f %7.1fx\n", "insert", u16Count,
+             u16Offset, ref, fast, ref / fast);
+    }
+  }
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,396 @@
+/*
+
+  bench_core.cpp - protocol core: CRC, master transactions, slave request
+  handlers and master/slave round trips, all in memory.
+
+  usage: bench_core [--json]
+
+  crc        ModBuster::crc() over 8 to 256 bytes
+  handler    ModbusPduHandler::serve() for every function code, request
+             copied into the PDU buffer first
+  master     ModbusServer transactions against a stream answering with a
+             canned response: large writes time request assembly, from the
+             transmit buffer or from application memory ("span"), large
+             reads response disassembly into the response buffer or
+             into application memory ("span")
+  roundtrip  ModbusServer and ModbusClient talking through a pair of
+             in-memory streams, the slave answering from a
+             ModbusRegisterMap
+
+  The host clock is simulated while timing the transactions, so T3.5 and
+  timeouts pass without sleeping and only the protocol work is measured.
+  bytes is what a call moves: the frame for crc, request plus response
+  otherwise. allocs/op counts operator new calls, expected to be 0. --json
+  prints the results as one JSON object, to compare them across commits.
+  Each case is checked once before it is timed; the exit code is 1 if one
+  fails.
+
+*/
+
+#include "Arduino.h"
+#include "ModbusterClient.h"
+#include "ModbusterPdu.h"
+#include "ModbusterServer.h"
+#include "bench.h"
+
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+using namespace ModBuster;
+
+static uint64_t u64Allocations = 0; ///< operator new calls so far
+
+void *operator new(size_t size) {
+  u64Allocations++;
+  void *p = malloc(size ? size : 1);
+  if (!p)
+    throw std::bad_alloc();
+  return p;
+}
+
+void operator delete(void *p) noexcept { free(p); }
+
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+struct Result {
+  const char *group;
+  const char *name;
+  uint32_t u32Bytes;
+  double ns;
+  double allocs;
+};
+
+static std::vector<Result> results;
+static int failures = 0;
+
+/**
+Check a case once, count its allocations and time it.
+
+@param group case group
+@param name case within the group
+@param u32Bytes bytes moved by one call
+@param f callable returning true on success
+*/
+template <typename F>
+static void run(const char *group, const char *name, uint32_t u32Bytes, F f) {
+  if (!f()) {
+    printf("%s %s failed\n", group, name);
+    failures++;
+    return;
+  }
+  const uint32_t kCalls = 1000;
+  uint64_t u64Before = u64Allocations;
+  for (uint32_t i = 0; i < kCalls; i++)
+    f();
+  double allocs = (double)(u64Allocations - u64Before) / kCalls;
+  double ns = bench::nsPerOp([&]() { bench::keep(f()); });
+  results.push_back({group, name, u32Bytes, ns, allocs});
+}
+
+/**
+Master side stream answering every request with the same response, which
+becomes readable once the request has been flushed.
+*/
+class CannedStream : public Stream {
+public:
+  void respond(const uint8_t *au8Frame, uint16_t u16Length) {
+    memcpy(_au8Response, au8Frame, u16Length);
+    uint16_t u16CRC = crc(_au8Response, u16Length);
+    _au8Response[u16Length++] = highByte(u16CRC);
+    _au8Response[u16Length++] = lowByte(u16CRC);
+    _u16Length = u16Length;
+    _u16Read = u16Length;
+  }
+
+  // request plus response [bytes]
+  uint32_t traffic() const { return _u32Written + _u16Length; }
+
+  int available() override { return _u16Length - _u16Read; }
+  int read() override {
+    return _u16Read < _u16Length ? _au8Response[_u16Read++] : -1;
+  }
+  int peek() override {
+    return _u16Read < _u16Length ? _au8Response[_u16Read] : -1;
+  }
+  size_t write(uint8_t) override { return write(nullptr, 1); }
+  size_t write(const uint8_t *, size_t size) override {
+    if (_bFlushed) {
+      _u32Written = 0;
+      _bFlushed = false;
+    }
+    _u32Written += size;
+    return size;
+  }
+  void flush() override {
+    _u16Read = 0;
+    _bFlushed = true;
+  }
+
+private:
+  uint8_t _au8Response[ku16MaxADUSize];
+  uint16_t _u16Length = 0;
+  uint16_t _u16Read = 0;
+  uint32_t _u32Written = 0;
+  bool _bFlushed = true;
+};
+
+/**
+One end of an in-memory line: bytes written arrive at the peer. Flushing
+the master end runs the slave, which answers right away.
+*/
+class MemoryStream : public Stream {
+public:
+  MemoryStream *peer = nullptr;
+  ModbusClient *client = nullptr; ///< slave to run on flush()
+  ModbusRegisterMap *map = nullptr;
+  uint32_t u32Traffic = 0; ///< bytes written by both ends
+
+  int available() override { return _u16Tail - _u16Head; }
+  int read() override {
+    if (_u16Head == _u16Tail)
+      return -1;
+    uint8_t u8Byte = _au8Rx[_u16Head++];
+    if (_u16Head == _u16Tail)
+      _u16Head = _u16Tail = 0;
+    return u8Byte;
+  }
+  int peek() override { return _u16Head < _u16Tail ? _au8Rx[_u16Head] : -1; }
+  size_t write(uint8_t u8Byte) override { return write(&u8Byte, 1); }
+  size_t write(const uint8_t *buffer, size_t size) override {
+    MemoryStream *far = peer;
+    if (far->_u16Tail + size > sizeof(far->_au8Rx))
+      return 0;
+    memcpy(far->_au8Rx + far->_u16Tail, buffer, size);
+    far->_u16Tail += (uint16_t)size;
+    u32Traffic += size;
+    return size;
+  }
+  void flush() override {
+    if (client) {
+      uint8_t u8Status;
+      client->poll(*map, u8Status);
+    }
+  }
+
+private:
+  uint8_t _au8Rx[2 * ku16MaxADUSize];
+  uint16_t _u16Head = 0;
+  uint16_t _u16Tail = 0;
+};
+
+static void benchCrc() {
+  static const uint16_t kLengths[] = {8, 16, 32, 64, 128, 256};
+  static const char *const kNames[] = {"8", "16", "32", "64", "128", "256"};
+  uint8_t au8Frame[256];
+  for (size_t i = 0; i < sizeof(au8Frame); i++)
+    au8Frame[i] = (uint8_t)rand();
+
+  for (size_t i = 0; i < sizeof(kLengths) / sizeof(kLengths[0]); i++) {
+    uint16_t u16Length = kLengths[i];
+    run("crc", kNames[i], u16Length, [&]() {
+      bench::keep(crc(au8Frame, u16Length));
+      return true;
+    });
+  }
+}
+
+static void benchHandlers(ModbusRegisterMap &map) {
+  struct Case {
+    const char *name;
+    uint8_t au8Header[10]; ///< request up to the byte count
+    uint8_t u8HeaderLength;
+    uint8_t u8Data;        ///< data bytes following the header
+  };
+  static const Case kCases[] = {
+      {"FC01 x2000", {0x01, 0x00, 0x00, 0x07, 0xD0}, 5, 0},
+      {"FC02 x2000", {0x02, 0x00, 0x00, 0x07, 0xD0}, 5, 0},
+      {"FC03 x1", {0x03, 0x00, 0x00, 0x00, 0x01}, 5, 0},
+      {"FC03 x125", {0x03, 0x00, 0x00, 0x00, 0x7D}, 5, 0},
+      {"FC04 x125", {0x04, 0x00, 0x00, 0x00, 0x7D}, 5, 0},
+      {"FC05", {0x05, 0x00, 0x05, 0xFF, 0x00}, 5, 0},
+      {"FC06", {0x06, 0x00, 0x05, 0x12, 0x34}, 5, 0},
+      {"FC0F x1968", {0x0F, 0x00, 0x00, 0x07, 0xB0, 0xF6}, 6, 0xF6},
+      {"FC10 x123", {0x10, 0x00, 0x00, 0x00, 0x7B, 0xF6}, 6, 0xF6},
+      {"FC16", {0x16, 0x00, 0x05, 0xFF, 0x00, 0x00, 0x12}, 7, 0},
+      {"FC17 x125/121",
+       {0x17, 0x00, 0x00, 0x00, 0x7D, 0x00, 0x00, 0x00, 0x79, 0xF2},
+       10,
+       0xF2},
+  };
+
+  for (const Case &c : kCases) {
+    uint8_t au8Request[ku16MaxPDUSize], au8Pdu[ku16MaxPDUSize];
+    uint16_t u16Length = c.u8HeaderLength + c.u8Data;
+    memcpy(au8Request, c.au8Header, c.u8HeaderLength);
+    for (uint8_t i = 0; i < c.u8Data; i++)
+      au8Request[c.u8HeaderLength + i] = (uint8_t)rand();
+
+    // response length, found by serving the request once
+    ModbusPduHandler probe(au8Pdu, sizeof(au8Pdu), ku8MaxReadRegisters);
+    memcpy(au8Pdu, au8Request, u16Length);
+    probe.serve(map, u16Length);
+
+    run("handler", c.name, u16Length + probe.length(), [&]() {
+      memcpy(au8Pdu, au8Request, u16Length);
+      ModbusPduHandler pdu(au8Pdu, sizeof(au8Pdu), ku8MaxReadRegisters);
+      return pdu.serve(map, u16Length) == ku8MBSuccess;
+    });
+  }
+}
+
+static void benchMaster() {
+  static ModbusServer master;
+  static CannedStream line;
+  uint8_t au8Response[ku16MaxADUSize];
+  uint16_t au16Values[ku8MaxReadRegisters];
+  uint8_t au8Bits[246];
+
+  master.begin(1, line);
+  for (uint16_t &u16Value : au16Values)
+    u16Value = (uint16_t)rand();
+  for (uint8_t &u8Bits : au8Bits)
+    u8Bits = (uint8_t)rand();
+  for (uint8_t i = 0; i < master.bufferSize(); i++)
+    master.setTransmitBuffer(i, (uint16_t)rand());
+
+  // assembly: the response is a short echo
+  const uint8_t au8Echo[] = {0x01, 0x10, 0x00, 0x00, 0x00, 0x7B};
+  line.respond(au8Echo, sizeof(au8Echo));
+  master.writeMultipleRegisters(0, 123);
+  run("master", "FC10 x123", line.traffic(), [&]() {
+    return master.writeMultipleRegisters(0, 123) == ku8MBSuccess;
+  });
+  run("master", "FC10 x123 span", line.traffic(), [&]() {
+    return master.writeMultipleRegisters(0, au16Values, 123) == ku8MBSuccess;
+  });
+
+  const uint8_t au8CoilEcho[] = {0x01, 0x0F, 0x00, 0x00, 0x07, 0xB0};
+  line.respond(au8CoilEcho, sizeof(au8CoilEcho));
+  master.writeMultipleCoils(0, 1968);
+  run("master", "FC0F x1968", line.traffic(), [&]() {
+    return master.writeMultipleCoils(0, 1968) == ku8MBSuccess;
+  });
+  run("master", "FC0F x1968 span", line.traffic(), [&]() {
+    return master.writeMultipleCoils(0, au8Bits, 1968) == ku8MBSuccess;
+  });
+
+  // disassembly: the request is 8 bytes
+  au8Response[0] = 0x01;
+  au8Response[1] = ku8MBReadHoldingRegisters;
+  au8Response[2] = 250;
+  for (uint16_t i = 0; i < 250; i++)
+    au8Response[3 + i] = (uint8_t)rand();
+  line.respond(au8Response, 253);
+  master.readHoldingRegisters(0, 125);
+  run("master", "FC03 x125", line.traffic(), [&]() {
+    return master.readHoldingRegisters(0, 125) == ku8MBSuccess;
+  });
+  run("master", "FC03 x125 span", line.traffic(), [&]() {
+    return master.readHoldingRegisters(0, 125, au16Values) == ku8MBSuccess;
+  });
+
+  au8Response[1] = ku8MBReadCoils;
+  line.respond(au8Response, 253);
+  master.readCoils(0, 2000);
+  run("master", "FC01 x2000", line.traffic(), [&]() {
+    return master.readCoils(0, 2000) == ku8MBSuccess;
+  });
+  run("master", "FC01 x2000 span", line.traffic(), [&]() {
+    return master.readCoils(0, 2000, au16Values) == ku8MBSuccess;
+  });
+}
+
+static void benchRoundTrip(ModbusRegisterMap &map) {
+  static ModbusServer master;
+  static ModbusClient client;
+  static MemoryStream masterEnd, slaveEnd;
+
+  masterEnd.peer = &slaveEnd;
+  slaveEnd.peer = &masterEnd;
+  masterEnd.client = &client;
+  masterEnd.map = &map;
+  master.begin(1, masterEnd);
+  client.begin(1, slaveEnd);
+  for (uint8_t i = 0; i < master.bufferSize(); i++)
+    master.setTransmitBuffer(i, (uint16_t)rand());
+
+  struct Case {
+    const char *name;
+    uint8_t (*transaction)(ModbusServer &master);
+  };
+  static const Case kCases[] = {
+      {"FC03 x1",
+       [](ModbusServer &m) { return m.readHoldingRegisters(0, 1); }},
+      {"FC03 x125",
+       [](ModbusServer &m) { return m.readHoldingRegisters(0, 125); }},
+      {"FC06",
+       [](ModbusServer &m) { return m.writeSingleRegister(5, 0x1234); }},
+      {"FC10 x123",
+       [](ModbusServer &m) { return m.writeMultipleRegisters(0, 123); }},
+      {"FC01 x2000", [](ModbusServer &m) { return m.readCoils(0, 2000); }},
+  };
+
+  for (const Case &c : kCases) {
+    uint32_t u32Before = masterEnd.u32Traffic + slaveEnd.u32Traffic;
+    c.transaction(master);
+    uint32_t u32Bytes = masterEnd.u32Traffic + slaveEnd.u32Traffic - u32Before;
+    run("roundtrip", c.name, u32Bytes,
+        [&]() { return c.transaction(master) == ku8MBSuccess; });
+  }
+}
+
+static void printText() {
+  printf("%-10s %-16s %6s %10s %10s %9s\n", "group", "case", "bytes", "ns/op",
+         "MB/s", "allocs/op");
+  for (const Result &r : results) {
+    printf("%-10s %-16s %6u %10.1f %10.1f %9.2f\n", r.group, r.name,
+           (unsigned)r.u32Bytes, r.ns, r.u32Bytes * 1e3 / r.ns, r.allocs);
+  }
+}
+
+static void printJson() {
+  printf("{\n  \"benchmark\": \"bench_core\",\n  \"results\": [\n");
+  for (size_t i = 0; i < results.size(); i++) {
+    const Result &r = results[i];
+    printf("    {\"group\": \"%s\", \"case\": \"%s\", \"bytes\": %u, "
+           "\"ns_per_op\": %.2f, \"bytes_per_s\": %.0f, "
+           "\"allocs_per_op\": %.2f}%s\n",
+           r.group, r.name, (unsigned)r.u32Bytes, r.ns,
+           r.u32Bytes * 1e9 / r.ns, r.allocs,
+           i + 1 < results.size() ? "," : "");
+  }
+  printf("  ]\n}\n");
+}
+
+int main(int argc, char **argv) {
+  bool bJson = argc > 1 && !strcmp(argv[1], "--json");
+  if (argc > 1 && !bJson) {
+    fprintf(stderr, "usage: bench_core [--json]\n");
+    return 2;
+  }
+
+  static uint8_t au8Coils[250], au8Inputs[250];
+  static uint16_t au16Holding[125], au16Input[125];
+  ModbusRegion regions[4];
+  ModbusRegisterMap map(regions, 4);
+  map.addCoils(0, 2000, au8Coils);
+  map.addDiscreteInputs(0, 2000, au8Inputs);
+  map.addHoldingRegisters(0, 125, au16Holding);
+  map.addInputRegisters(0, 125, au16Input);
+
+  srand(1);
+  simulateClock(true);
+  benchCrc();
+  benchHandlers(map);
+  benchMaster();
+  benchRoundTrip(map);
+  simulateClock(false);
+
+  if (bJson)
+    printJson();
+  else
+    printText();
+  return failures ? 1 : 0;
+}
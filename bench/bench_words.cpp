@@ -0,0 +1,82 @@
+/*
+
+  bench_words.cpp - register marshalling kernels against the highByte/
+  lowByte and word() loops they replace, for 1 to 125 registers.
+
+  Each case is first checked against the per-byte reference, then both are
+  timed; the speedup column is reference time / kernel time.
+
+*/
+
+#include "Arduino.h"
+#include "ModbusterKernels.h"
+#include "bench.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+using namespace ModBuster;
+
+static const uint16_t kCounts[] = {1, 4, 16, 64, 125};
+
+// per-byte encode as done by putRegisters before the kernels
+static void referenceToWire(uint8_t *au8Dst, const uint16_t *au16Src,
+                            uint16_t u16Count) {
+  for (uint16_t i = 0; i < u16Count; i++) {
+    au8Dst[2 * i] = highByte(au16Src[i]);
+    au8Dst[2 * i + 1] = lowByte(au16Src[i]);
+  }
+}
+
+static void referenceFromWire(uint16_t *au16Dst, const uint8_t *au8Src,
+                              uint16_t u16Count) {
+  for (uint16_t i = 0; i < u16Count; i++) {
+    au16Dst[i] = word(au8Src[2 * i], au8Src[2 * i + 1]);
+  }
+}
+
+int main() {
+  uint16_t au16Regs[128], au16Expected[128], au16Actual[128];
+  uint8_t au8Frame[256 + 1], au8Expected[256], au8Actual[256];
+  int failures = 0;
+
+  srand(1);
+  for (size_t i = 0; i < 128; i++)
+    au16Regs[i] = (uint16_t)rand();
+  for (size_t i = 0; i < sizeof(au8Frame); i++)
+    au8Frame[i] = (uint8_t)rand();
+
+  printf("%-10s %6s %12s %12s %8s\n", "kernel", "regs", "per-byte ns",
+         "kernel ns", "speedup");
+
+  for (uint16_t u16Count : kCounts) {
+    // encode: a read response or FC10 request; odd frame offset as in ADU+3
+    referenceToWire(au8Expected, au16Regs, u16Count);
+    words_to_wire(au8Actual + 1, au16Regs, u16Count);
+    if (memcmp(au8Expected, au8Actual + 1, 2 * u16Count)) {
+      printf("to_wire mismatch: %u registers\n", u16Count);
+      failures++;
+    }
+    double ref = bench::nsPerOp(
+        [&]() { referenceToWire(au8Actual + 1, au16Regs, u16Count); });
+    double fast = bench::nsPerOp(
+        [&]() { words_to_wire(au8Actual + 1, au16Regs, u16Count); });
+    printf("%-10s %6u %12.1f %12.1f %7.1fx\n", "to_wire", u16Count, ref,
+           fast, ref / fast);
+
+    // decode: a read response into the response buffer
+    referenceFromWire(au16Expected, au8Frame + 1, u16Count);
+    words_from_wire(au16Actual, au8Frame + 1, u16Count);
+    if (memcmp(au16Expected, au16Actual, 2 * u16Count)) {
+      printf("from_wire mismatch: %u registers\n", u16Count);
+      failures++;
+    }
+    ref = bench::nsPerOp(
+        [&]() { referenceFromWire(au16Actual, au8Frame + 1, u16Count); });
+    fast = bench::nsPerOp(
+        [&]() { words_from_wire(au16Actual, au8Frame + 1, u16Count); });
+    printf("%-10s %6u %12.1f %12.1f %7.1fx\n", "from_wire", u16Count, ref,
+           fast, ref / fast);
+  }
+  return failures ? 1 : 0;
+}
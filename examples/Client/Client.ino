@@ -53,12 +53,15 @@ void setup() {
   memset(regs, 0, sizeof(regs));
   swSerial.begin(BAUDRATE);
   client.begin(ID, swSerial);
+  // delimit frames by the spec's T1.5/T3.5 for this line speed
+  client.timing().begin(BAUDRATE);
 }
 
 void loop() {
-  // Receive the given registers state update from master
+  // Receive the given registers state update from master; poll() never
+  // blocks, it returns true once a complete request has been handled
   uint8_t result;
-  bool processed = client.ModbusClientTransaction(regs, ModBusNumRegisters, result);
+  bool processed = client.poll(regs, ModBusNumRegisters, result);
 
   // Check if read was successful
   if (result == ModBuster::ku8MBSuccess)
@@ -89,5 +92,5 @@ void loop() {
     Serial.println(result, HEX);
   }
 
-  delay(500);
+  // ... other time-critical work of the sketch goes here ...
 }
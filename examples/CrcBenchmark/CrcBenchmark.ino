@@ -0,0 +1,60 @@
+/*
+
+  CrcBenchmark.ino - measures the throughput of every CRC-16 engine
+  variant shipped with the library and prints bytes/s for each one.
+
+  The variant used by the library itself is selected at compile time with
+  MODBUSTER_CRC (see ModbusterCrc.h); this sketch calls all of them
+  directly so they can be compared on the same board.
+
+*/
+
+#include <Modbuster.h>
+
+using namespace ModBuster;
+
+// typical full-size RTU frame
+const uint16_t FRAME_SIZE = 256;
+const uint16_t ROUNDS = 64;
+
+uint8_t frame[FRAME_SIZE];
+
+void report(const char *name, uint32_t elapsed, uint16_t result) {
+  uint32_t bytes = (uint32_t)FRAME_SIZE * ROUNDS;
+  Serial.print(name);
+  Serial.print(": ");
+  Serial.print(elapsed ? (uint32_t)((uint64_t)bytes * 1000000 / elapsed) : 0);
+  Serial.print(" bytes/s (crc 0x");
+  Serial.print(result, HEX);
+  Serial.println(")");
+}
+
+void benchmark(const char *name, uint16_t (*update)(uint16_t, uint8_t)) {
+  uint16_t u16CRC = ku16CRCInit;
+  uint32_t start = micros();
+  for (uint16_t r = 0; r < ROUNDS; r++) {
+    for (uint16_t i = 0; i < FRAME_SIZE; i++)
+      u16CRC = update(u16CRC, frame[i]);
+  }
+  report(name, micros() - start, u16CRC);
+}
+
+void setup() {
+  Serial.begin(115200);
+  for (uint16_t i = 0; i < FRAME_SIZE; i++)
+    frame[i] = (uint8_t)(i * 7 + 3);
+
+  benchmark("bitwise", crc_update_bitwise);
+  benchmark("nibble ", crc_update_nibble);
+  benchmark("table  ", crc_update_table);
+
+#if !defined(__AVR__)
+  uint16_t u16CRC = ku16CRCInit;
+  uint32_t start = micros();
+  for (uint16_t r = 0; r < ROUNDS; r++)
+    u16CRC = crc_update_slice8(u16CRC, frame, FRAME_SIZE);
+  report("slice8 ", micros() - start, u16CRC);
+#endif
+}
+
+void loop() {}
@@ -0,0 +1,121 @@
+/*
+
+  Footprint.ino - prints the RAM taken by the library objects in a few
+  configurations and, on AVR, the stack peak of a master transaction and
+  of a slave answering a request.
+
+  Object sizes are all the static RAM the library needs: every buffer is a
+  member sized by template parameters, nothing is allocated. Compare the
+  default master, which stages data in response and transmit buffers, with
+  the compact one (ModbusServerT<0, NAdu>), which only holds its frame
+  buffer and moves data straight between it and the application's arrays.
+
+  The stack peak is measured by painting the free RAM before the call and
+  looking for the lowest byte overwritten afterwards. It does not depend
+  on the configuration, since no buffer lives on the stack.
+
+*/
+
+#include <ModbusterClient.h>
+#include <ModbusterScheduler.h>
+#include <ModbusterServer.h>
+
+using namespace ModBuster;
+
+// compact master for reads and writes of up to 16 registers
+typedef ModbusServerT<0, 9 + 2 * 16> CompactServer;
+
+// Stream that swallows what is written and has the given bytes to read.
+class ScriptStream : public Stream {
+public:
+  void load(const uint8_t *au8Bytes, uint8_t u8Length) {
+    _au8Bytes = au8Bytes;
+    _u8Length = u8Length;
+    _u8Read = 0;
+  }
+  int available() { return _u8Length - _u8Read; }
+  int read() { return _u8Read < _u8Length ? _au8Bytes[_u8Read++] : -1; }
+  int peek() { return _u8Read < _u8Length ? _au8Bytes[_u8Read] : -1; }
+  size_t write(uint8_t) { return 1; }
+  size_t write(const uint8_t *, size_t size) { return size; }
+
+private:
+  const uint8_t *_au8Bytes = nullptr;
+  uint8_t _u8Length = 0;
+  uint8_t _u8Read = 0;
+};
+
+// FC03 request for 16 registers of slave 1
+const uint8_t kRequest[] = {0x01, 0x03, 0x00, 0x00, 0x00, 0x10, 0x44, 0x06};
+
+ScriptStream line;
+CompactServer master;
+ModbusClientT<16> slave;
+ModbusRegion regions[1];
+ModbusRegisterMap map(regions, 1);
+uint16_t registers[16];
+
+void report(const char *name, size_t size) {
+  Serial.print(name);
+  Serial.print(": ");
+  Serial.print((unsigned long)size);
+  Serial.println(" bytes");
+}
+
+void runMaster() { master.readHoldingRegisters(0, 16, registers); }
+
+void runSlave() {
+  uint8_t result;
+  line.load(kRequest, sizeof(kRequest));
+  for (uint8_t i = 0; i < 4 && !slave.poll(map, result); i++)
+    ;
+}
+
+#if defined(__AVR__)
+extern uint8_t __heap_start, *__brkval;
+
+// bytes of stack used by run(), call included
+uint16_t stackPeak(void (*run)()) {
+  uint8_t *sp = (uint8_t *)SP;
+  uint8_t *bottom = __brkval ? __brkval : &__heap_start;
+  // stay clear of this function's own frame
+  for (uint8_t *p = bottom; p < sp - 32; p++)
+    *p = 0xA5;
+  run();
+  uint8_t *p = bottom;
+  while (p < sp && *p == 0xA5)
+    p++;
+  return sp - p;
+}
+#endif
+
+void setup() {
+  Serial.begin(115200);
+
+  report("ModbusServer (default)", sizeof(ModbusServer));
+  report("ModbusServerT<16>", sizeof(ModbusServerT<16>));
+  report("ModbusServerT<0, 41> (compact)", sizeof(CompactServer));
+  report("ModbusClient (default)", sizeof(ModbusClient));
+  report("ModbusClientT<16>", sizeof(ModbusClientT<16>));
+  report("ModbusRegisterMap", sizeof(ModbusRegisterMap));
+  report("  per ModbusRegion", sizeof(ModbusRegion));
+  report("ModbusScheduler", sizeof(ModbusScheduler));
+  report("  per ModbusPollItem", sizeof(ModbusPollItem));
+  report("  per ModbusWriteItem", sizeof(ModbusWriteItem));
+
+  map.addHoldingRegisters(0, 16, registers);
+  master.begin(1, line);
+  master.setResponseTimeOut(10);
+  slave.begin(1, line);
+
+#if defined(__AVR__)
+  report("stack, master transaction", stackPeak(runMaster));
+  report("stack, slave poll", stackPeak(runSlave));
+#else
+  runMaster();
+  runSlave();
+  Serial.println("stack: build with -fstack-usage for per-function frames");
+#endif
+}
+
+void loop() {}
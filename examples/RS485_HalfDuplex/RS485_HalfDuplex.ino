@@ -64,6 +64,8 @@ void setup()
 
   // Modbus slave ID 1
   node.begin(1, Serial);
+  // end a stalled response after T3.5 rather than the response timeout
+  node.timing().begin(115200);
   // Callbacks allow us to configure the RS485 transceiver correctly
   node.preTransmission(preTransmission);
   node.postTransmission(postTransmission);
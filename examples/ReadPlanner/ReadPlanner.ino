@@ -0,0 +1,45 @@
+/*
+
+  ReadPlanner.ino - example using ModbusReadPlanner to merge several small
+  reads of nearby registers into as few frames as possible.
+
+*/
+
+#include <ModbusterPlanner.h>
+
+using namespace ModBuster;
+
+ModbusServer node;
+
+ModbusReadRequest requests[8];
+ModbusReadFrame frames[8];
+ModbusReadPlanner planner(requests, 8, frames, 8);
+
+uint16_t voltage[2];  // holding registers 0..1
+uint16_t current[2];  // holding registers 4..5
+uint16_t power[2];    // holding registers 8..9
+uint16_t energy[4];   // holding registers 20..23
+uint16_t relays[1];   // coils 0..7
+
+void setup() {
+  Serial.begin(9600);
+  node.begin(1, Serial);
+
+  // bridge gaps of up to 12 registers and 64 coils
+  planner.setGap(12, 64);
+
+  planner.add(1, ku8MBReadHoldingRegisters, 0, 2, voltage);
+  planner.add(1, ku8MBReadHoldingRegisters, 4, 2, current);
+  planner.add(1, ku8MBReadHoldingRegisters, 8, 2, power);
+  planner.add(1, ku8MBReadHoldingRegisters, 20, 4, energy);
+  planner.add(1, ku8MBReadCoils, 0, 8, relays);
+
+  // two frames instead of five: registers 0..23 and coils 0..7
+  planner.plan();
+}
+
+void loop() {
+  // every buffer above now holds its own slice of the merged reads
+  planner.execute(node);
+  delay(1000);
+}
@@ -0,0 +1,50 @@
+/*
+ * ModbusRtu client (slave) exposing a realistic device map without staging
+ * copies: every region of the map is bound to the variables the sketch
+ * already uses.
+ *
+ *   coils 0..7              relay outputs
+ *   discrete inputs 0..15   digital inputs
+ *   holding 40..43          setpoints
+ *   holding 1000..1001      configuration
+ *   input registers 0..3    measurements
+ */
+#include <ModbusterClient.h>
+
+#define ID 1
+#define BAUDRATE 19200
+
+using namespace ModBuster;
+
+ModbusClient client;
+
+uint8_t relays = 0;
+uint8_t inputs[2];
+uint16_t setpoints[4] = {200, 250, 300, 350};
+uint16_t config[2] = {ID, BAUDRATE / 100};
+uint16_t measurements[4];
+
+ModbusRegion regions[5];
+ModbusRegisterMap map(regions, 5);
+
+void setup() {
+  Serial.begin(BAUDRATE);
+  client.begin(ID, Serial);
+  client.timing().begin(BAUDRATE);
+
+  map.addCoils(0, 8, &relays);
+  map.addDiscreteInputs(0, 16, inputs);
+  map.addHoldingRegisters(40, 4, setpoints);
+  map.addHoldingRegisters(1000, 2, config);
+  map.addInputRegisters(0, 4, measurements);
+}
+
+void loop() {
+  // sample the inputs; the map reads the variables directly
+  for (uint8_t i = 0; i < 4; i++)
+    measurements[i] = analogRead(A0 + i);
+  inputs[0] = (uint8_t)millis();
+
+  uint8_t result;
+  client.poll(map, result);
+}
@@ -0,0 +1,56 @@
+/*
+
+  Scheduler.ino - example using ModbusScheduler to poll several slaves on
+  one RS485 segment at individual periods, without hand-written loops.
+
+*/
+
+#include <ModbusterScheduler.h>
+
+using namespace ModBuster;
+
+ModbusServer bus;
+
+// room for 8 cyclic reads and 4 pending writes
+ModbusPollItem pollItems[8];
+ModbusWriteItem writeQueue[4];
+ModbusScheduler scheduler(pollItems, 8, writeQueue, 4);
+
+uint16_t drive1Status[4];
+uint16_t drive2Status[4];
+uint16_t meterValues[16];
+uint16_t alarmFlags[1];
+uint16_t setpoint;
+
+void setup() {
+  pinMode(LED_BUILTIN, OUTPUT);
+  Serial.begin(19200);
+  bus.begin(1, Serial);
+  bus.setResponseTimeOut(100);
+  scheduler.begin(bus);
+
+  // slave, function, address, quantity, period [ms], priority, destination
+  scheduler.addPoll(1, ku8MBReadHoldingRegisters, 0x0000, 4, 50, 0,
+                    drive1Status);
+  scheduler.addPoll(2, ku8MBReadHoldingRegisters, 0x0000, 4, 50, 0,
+                    drive2Status);
+  scheduler.addPoll(10, ku8MBReadInputRegisters, 0x0100, 16, 1000, 2,
+                    meterValues);
+  scheduler.addPoll(10, ku8MBReadDiscreteInputs, 0x0000, 12, 200, 1,
+                    alarmFlags);
+}
+
+void loop() {
+  // keep the bus busy: each call runs the most urgent due transaction
+  scheduler.task();
+
+  // urgent writes jump ahead of every queued read
+  if (drive1Status[0] != setpoint) {
+    setpoint = drive1Status[0];
+    scheduler.queueWrite(2, ku8MBWriteSingleRegister, 0x0010, 1, &setpoint);
+  }
+
+  // light the LED while the drive 1 poll misses its period by over 20 ms
+  const ModbusPollStats &stats = scheduler.stats(0);
+  digitalWrite(LED_BUILTIN, stats.u16JitterAvg > 20 ? HIGH : LOW);
+}
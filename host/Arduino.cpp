@@ -0,0 +1,66 @@
+#include "Arduino.h"
+
+#include <time.h>
+
+static uint64_t monotonicMicros() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static bool bSimulated = false;     ///< see simulateClock()
+static uint64_t u64SimulatedMicros; ///< simulated time [microseconds]
+
+// Time is counted from the first call, like the Arduino counters that
+// start at reset.
+static uint64_t elapsedMicros() {
+  static const uint64_t u64Start = monotonicMicros();
+  if (bSimulated)
+    return u64SimulatedMicros;
+  return monotonicMicros() - u64Start;
+}
+
+void simulateClock(bool bSimulate) {
+  // carry on from the time reached, so no counter jumps back
+  if (bSimulate && !bSimulated)
+    u64SimulatedMicros = elapsedMicros();
+  bSimulated = bSimulate;
+}
+
+uint32_t millis() { return (uint32_t)(elapsedMicros() / 1000); }
+
+uint32_t micros() { return (uint32_t)elapsedMicros(); }
+
+void delay(unsigned long ms) {
+  if (bSimulated) {
+    u64SimulatedMicros += (uint64_t)ms * 1000;
+    return;
+  }
+  struct timespec ts;
+  ts.tv_sec = ms / 1000;
+  ts.tv_nsec = (long)(ms % 1000) * 1000000;
+  while (nanosleep(&ts, &ts) != 0)
+    continue;
+}
+
+void delayMicroseconds(unsigned int us) {
+  if (bSimulated) {
+    u64SimulatedMicros += us;
+    return;
+  }
+  struct timespec ts;
+  ts.tv_sec = us / 1000000;
+  ts.tv_nsec = (long)(us % 1000000) * 1000;
+  while (nanosleep(&ts, &ts) != 0)
+    continue;
+}
+
+size_t Print::write(const uint8_t *buffer, size_t size) {
+  size_t n = 0;
+  while (size--) {
+    if (!write(*buffer++))
+      break;
+    n++;
+  }
+  return n;
+}
@@ -0,0 +1,91 @@
+#ifndef MODBUSTER_HOST_ARDUINO_H
+#define MODBUSTER_HOST_ARDUINO_H
+
+// Minimal subset of the Arduino core API used by the library, so that the
+// sources under src/ build unchanged on POSIX hosts.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef MODBUSTER_HOST
+#define MODBUSTER_HOST 1
+#endif
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define HIGH 0x1
+#define LOW 0x0
+#define INPUT 0x0
+#define OUTPUT 0x1
+
+// Serial frame formats, same encoding as the AVR core.
+#define SERIAL_7N1 0x04
+#define SERIAL_8N1 0x06
+#define SERIAL_7N2 0x0C
+#define SERIAL_8N2 0x0E
+#define SERIAL_7E1 0x24
+#define SERIAL_8E1 0x26
+#define SERIAL_7E2 0x2C
+#define SERIAL_8E2 0x2E
+#define SERIAL_7O1 0x34
+#define SERIAL_8O1 0x36
+#define SERIAL_7O2 0x3C
+#define SERIAL_8O2 0x3E
+
+#define lowByte(w) ((uint8_t)((w)&0xff))
+#define highByte(w) ((uint8_t)((w) >> 8))
+
+#define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+#define bitSet(value, bit) ((value) |= (1UL << (bit)))
+#define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+#define bitWrite(value, bit, bitvalue)                                         \
+  ((bitvalue) ? bitSet(value, bit) : bitClear(value, bit))
+
+static inline uint16_t word(uint16_t w) { return w; }
+static inline uint16_t word(uint8_t h, uint8_t l) {
+  return (uint16_t)((h << 8) | l);
+}
+
+// 32-bit counters wrapping like on the boards, where unsigned long is
+// 32 bits wide.
+uint32_t millis();
+uint32_t micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+// Host extension: run millis() and micros() on a simulated clock that
+// only delay() and delayMicroseconds() advance, without sleeping, e.g. to
+// time whole transactions through in-memory streams. Switch it before
+// starting threads.
+void simulateClock(bool bSimulated);
+
+static inline void pinMode(uint8_t, uint8_t) {}
+static inline void digitalWrite(uint8_t, uint8_t) {}
+
+class Print {
+public:
+  virtual ~Print() {}
+
+  virtual size_t write(uint8_t) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size);
+  virtual void flush() {}
+};
+
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+
+  // Host extension: block until at least one byte is available or the
+  // timeout expires, instead of spinning on available().
+  // Returns true if data is available.
+  virtual bool waitAvailable(uint32_t u32TimeoutUs) {
+    (void)u32TimeoutUs;
+    return available() > 0;
+  }
+};
+
+#endif // MODBUSTER_HOST_ARDUINO_H
@@ -0,0 +1,356 @@
+#include "ModbusterAsync.h"
+
+#include "Arduino.h"
+#include "ModbusterKernels.h"
+
+using namespace ModBuster;
+
+static void putWord(uint8_t *au8Dst, uint16_t u16Value) {
+  au8Dst[0] = highByte(u16Value);
+  au8Dst[1] = lowByte(u16Value);
+}
+
+/**
+Modbus function 0x01 Read Coils.
+
+@param target handle returned by addTarget() or addPort()
+@param u8Unit unit ID
+@param u16ReadAddress address of first coil (0x0000..0xFFFF)
+@param u16BitQty quantity of coils to read (1..2000)
+@param callback completion; the coils arrive packed 16 per word
+@return true if the request has been queued
+@ingroup discrete
+*/
+bool ModbusAsyncServer::readCoils(int target, uint8_t u8Unit,
+                                uint16_t u16ReadAddress, uint16_t u16BitQty,
+                                ModbusCallback callback) {
+  if (!u16BitQty || u16BitQty > 2000)
+    return false;
+  ModbusRequest *request = this->request(target, u8Unit, ku8MBReadCoils);
+  if (!request)
+    return false;
+  putWord(request->au8Pdu + PDU_ADD_HI, u16ReadAddress);
+  putWord(request->au8Pdu + PDU_NB_HI, u16BitQty);
+  request->u16Length = 5;
+  request->u16Qty = u16BitQty;
+  request->callback = std::move(callback);
+  return submit(request);
+}
+
+/**
+Modbus function 0x02 Read Discrete Inputs.
+
+@see ModbusAsyncServer::readCoils()
+@ingroup discrete
+*/
+bool ModbusAsyncServer::readDiscreteInputs(int target, uint8_t u8Unit,
+                                         uint16_t u16ReadAddress,
+                                         uint16_t u16BitQty,
+                                         ModbusCallback callback) {
+  if (!u16BitQty || u16BitQty > 2000)
+    return false;
+  ModbusRequest *request = this->request(target, u8Unit, ku8MBReadDiscreteInputs);
+  if (!request)
+    return false;
+  putWord(request->au8Pdu + PDU_ADD_HI, u16ReadAddress);
+  putWord(request->au8Pdu + PDU_NB_HI, u16BitQty);
+  request->u16Length = 5;
+  request->u16Qty = u16BitQty;
+  request->callback = std::move(callback);
+  return submit(request);
+}
+
+/**
+Modbus function 0x03 Read Holding Registers.
+
+@param target handle returned by addTarget() or addPort()
+@param u8Unit unit ID
+@param u16ReadAddress address of the first holding register (0x0000..0xFFFF)
+@param u16ReadQty quantity of holding registers to read (1..125)
+@param callback completion
+@return true if the request has been queued
+@ingroup register
+*/
+bool ModbusAsyncServer::readHoldingRegisters(int target, uint8_t u8Unit,
+                                           uint16_t u16ReadAddress,
+                                           uint16_t u16ReadQty,
+                                           ModbusCallback callback) {
+  if (!u16ReadQty || u16ReadQty > ku8MaxReadRegisters)
+    return false;
+  ModbusRequest *request =
+      this->request(target, u8Unit, ku8MBReadHoldingRegisters);
+  if (!request)
+    return false;
+  putWord(request->au8Pdu + PDU_ADD_HI, u16ReadAddress);
+  putWord(request->au8Pdu + PDU_NB_HI, u16ReadQty);
+  request->u16Length = 5;
+  request->u16Qty = u16ReadQty;
+  request->callback = std::move(callback);
+  return submit(request);
+}
+
+/**
+Modbus function 0x04 Read Input Registers.
+
+@see ModbusAsyncServer::readHoldingRegisters()
+@ingroup register
+*/
+bool ModbusAsyncServer::readInputRegisters(int target, uint8_t u8Unit,
+                                         uint16_t u16ReadAddress,
+                                         uint16_t u16ReadQty,
+                                         ModbusCallback callback) {
+  if (!u16ReadQty || u16ReadQty > ku8MaxReadRegisters)
+    return false;
+  ModbusRequest *request = this->request(target, u8Unit, ku8MBReadInputRegisters);
+  if (!request)
+    return false;
+  putWord(request->au8Pdu + PDU_ADD_HI, u16ReadAddress);
+  putWord(request->au8Pdu + PDU_NB_HI, u16ReadQty);
+  request->u16Length = 5;
+  request->u16Qty = u16ReadQty;
+  request->callback = std::move(callback);
+  return submit(request);
+}
+
+/**
+Modbus function 0x05 Write Single Coil.
+
+@param target handle returned by addTarget() or addPort()
+@param u8Unit unit ID
+@param u16WriteAddress address of the coil (0x0000..0xFFFF)
+@param u8State 0=OFF, non-zero=ON
+@param callback completion
+@return true if the request has been queued
+@ingroup discrete
+*/
+bool ModbusAsyncServer::writeSingleCoil(int target, uint8_t u8Unit,
+                                      uint16_t u16WriteAddress,
+                                      uint8_t u8State,
+                                      ModbusCallback callback) {
+  ModbusRequest *request = this->request(target, u8Unit, ku8MBWriteSingleCoil);
+  if (!request)
+    return false;
+  putWord(request->au8Pdu + PDU_ADD_HI, u16WriteAddress);
+  putWord(request->au8Pdu + PDU_NB_HI, u8State ? 0xFF00 : 0x0000);
+  request->u16Length = 5;
+  request->callback = std::move(callback);
+  return submit(request);
+}
+
+/**
+Modbus function 0x06 Write Single Register.
+
+@param target handle returned by addTarget() or addPort()
+@param u8Unit unit ID
+@param u16WriteAddress address of the holding register (0x0000..0xFFFF)
+@param u16WriteValue value to be written to holding register (0x0000..0xFFFF)
+@param callback completion
+@return true if the request has been queued
+@ingroup register
+*/
+bool ModbusAsyncServer::writeSingleRegister(int target, uint8_t u8Unit,
+                                          uint16_t u16WriteAddress,
+                                          uint16_t u16WriteValue,
+                                          ModbusCallback callback) {
+  ModbusRequest *request =
+      this->request(target, u8Unit, ku8MBWriteSingleRegister);
+  if (!request)
+    return false;
+  putWord(request->au8Pdu + PDU_ADD_HI, u16WriteAddress);
+  putWord(request->au8Pdu + PDU_NB_HI, u16WriteValue);
+  request->u16Length = 5;
+  request->callback = std::move(callback);
+  return submit(request);
+}
+
+/**
+Modbus function 0x0F Write Multiple Coils.
+
+@param target handle returned by addTarget() or addPort()
+@param u8Unit unit ID
+@param u16WriteAddress address of the first coil (0x0000..0xFFFF)
+@param u16BitQty quantity of coils to write (1..1968)
+@param au16Bits coil values, 16 per word, LSB first
+@param callback completion
+@return true if the request has been queued
+@ingroup discrete
+*/
+bool ModbusAsyncServer::writeMultipleCoils(int target, uint8_t u8Unit,
+                                         uint16_t u16WriteAddress,
+                                         uint16_t u16BitQty,
+                                         const uint16_t *au16Bits,
+                                         ModbusCallback callback) {
+  if (!u16BitQty || u16BitQty > 1968)
+    return false;
+  ModbusRequest *request = this->request(target, u8Unit, ku8MBWriteMultipleCoils);
+  if (!request)
+    return false;
+  uint8_t u8Bytes = (uint8_t)((u16BitQty + 7) >> 3);
+  putWord(request->au8Pdu + PDU_ADD_HI, u16WriteAddress);
+  putWord(request->au8Pdu + PDU_NB_HI, u16BitQty);
+  request->au8Pdu[PDU_BYTE_CNT] = u8Bytes;
+  bits_from_words(request->au8Pdu + PDU_BYTE_CNT + 1, au16Bits, u16BitQty);
+  request->u16Length = 6 + u8Bytes;
+  request->callback = std::move(callback);
+  return submit(request);
+}
+
+/**
+Modbus function 0x10 Write Multiple Registers.
+
+@param target handle returned by addTarget() or addPort()
+@param u8Unit unit ID
+@param u16WriteAddress address of the first holding register
+(0x0000..0xFFFF)
+@param u16WriteQty quantity of holding registers to write (1..123)
+@param au16Values register values
+@param callback completion
+@return true if the request has been queued
+@ingroup register
+*/
+bool ModbusAsyncServer::writeMultipleRegisters(int target, uint8_t u8Unit,
+                                             uint16_t u16WriteAddress,
+                                             uint16_t u16WriteQty,
+                                             const uint16_t *au16Values,
+                                             ModbusCallback callback) {
+  if (!u16WriteQty || u16WriteQty > 123)
+    return false;
+  ModbusRequest *request =
+      this->request(target, u8Unit, ku8MBWriteMultipleRegisters);
+  if (!request)
+    return false;
+  putWord(request->au8Pdu + PDU_ADD_HI, u16WriteAddress);
+  putWord(request->au8Pdu + PDU_NB_HI, u16WriteQty);
+  request->au8Pdu[PDU_BYTE_CNT] = (uint8_t)(2 * u16WriteQty);
+  words_to_wire(request->au8Pdu + PDU_BYTE_CNT + 1, au16Values, u16WriteQty);
+  request->u16Length = 6 + 2 * u16WriteQty;
+  request->callback = std::move(callback);
+  return submit(request);
+}
+
+/**
+Modbus function 0x16 Mask Write Register.
+
+@param target handle returned by addTarget() or addPort()
+@param u8Unit unit ID
+@param u16WriteAddress address of the holding register (0x0000..0xFFFF)
+@param u16AndMask AND mask (0x0000..0xFFFF)
+@param u16OrMask OR mask (0x0000..0xFFFF)
+@param callback completion
+@return true if the request has been queued
+@ingroup register
+*/
+bool ModbusAsyncServer::maskWriteRegister(int target, uint8_t u8Unit,
+                                        uint16_t u16WriteAddress,
+                                        uint16_t u16AndMask,
+                                        uint16_t u16OrMask,
+                                        ModbusCallback callback) {
+  ModbusRequest *request = this->request(target, u8Unit, ku8MBMaskWriteRegister);
+  if (!request)
+    return false;
+  putWord(request->au8Pdu + PDU_ADD_HI, u16WriteAddress);
+  putWord(request->au8Pdu + 3, u16AndMask);
+  putWord(request->au8Pdu + 5, u16OrMask);
+  request->u16Length = 7;
+  request->callback = std::move(callback);
+  return submit(request);
+}
+
+/**
+Modbus function 0x17 Read Write Multiple Registers.
+
+@param target handle returned by addTarget() or addPort()
+@param u8Unit unit ID
+@param u16ReadAddress address of the first holding register to read
+@param u16ReadQty quantity of holding registers to read (1..125)
+@param u16WriteAddress address of the first holding register to write
+@param u16WriteQty quantity of holding registers to write (1..121)
+@param au16Values register values to write
+@param callback completion with the registers read
+@return true if the request has been queued
+@ingroup register
+*/
+bool ModbusAsyncServer::readWriteMultipleRegisters(
+    int target, uint8_t u8Unit, uint16_t u16ReadAddress, uint16_t u16ReadQty,
+    uint16_t u16WriteAddress, uint16_t u16WriteQty,
+    const uint16_t *au16Values, ModbusCallback callback) {
+  if (!u16ReadQty || u16ReadQty > ku8MaxReadRegisters || !u16WriteQty ||
+      u16WriteQty > 121)
+    return false;
+  ModbusRequest *request =
+      this->request(target, u8Unit, ku8MBReadWriteMultipleRegisters);
+  if (!request)
+    return false;
+  putWord(request->au8Pdu + 1, u16ReadAddress);
+  putWord(request->au8Pdu + 3, u16ReadQty);
+  putWord(request->au8Pdu + 5, u16WriteAddress);
+  putWord(request->au8Pdu + 7, u16WriteQty);
+  request->au8Pdu[9] = (uint8_t)(2 * u16WriteQty);
+  words_to_wire(request->au8Pdu + 10, au16Values, u16WriteQty);
+  request->u16Length = 10 + 2 * u16WriteQty;
+  request->u16Qty = u16ReadQty;
+  request->callback = std::move(callback);
+  return submit(request);
+}
+
+/**
+Check a response against the request and decode it.
+
+@param u8Status status so far; kept if there is no response
+@param au8Pdu response PDU; nullptr if the request failed
+@param u16Length bytes in au8Pdu
+*/
+void ModbusRequest::complete(uint8_t u8Status, const uint8_t *au8Pdu,
+                             uint16_t u16Length) {
+  u16Count = 0;
+  if (au8Pdu) {
+    uint8_t u8Function = this->au8Pdu[PDU_FUNC];
+    if (u16Length >= 2 && au8Pdu[PDU_FUNC] == (u8Function | 0x80)) {
+      u8Status = au8Pdu[1];
+    } else if (!u16Length || au8Pdu[PDU_FUNC] != u8Function) {
+      u8Status = ku8MBInvalidFunction;
+    } else {
+      switch (u8Function) {
+      case ku8MBReadCoils:
+      case ku8MBReadDiscreteInputs:
+        if (u16Length != 2 + ((u16Qty + 7) >> 3) ||
+            au8Pdu[1] != u16Length - 2) {
+          u8Status = ku8MBInvalidFunction;
+          break;
+        }
+        bits_to_words(au16Data, au8Pdu + 2, u16Qty);
+        u16Count = u16Qty;
+        break;
+      case ku8MBReadHoldingRegisters:
+      case ku8MBReadInputRegisters:
+      case ku8MBReadWriteMultipleRegisters:
+        if (u16Length != 2 + 2 * u16Qty || au8Pdu[1] != 2 * u16Qty) {
+          u8Status = ku8MBInvalidFunction;
+          break;
+        }
+        words_from_wire(au16Data, au8Pdu + 2, u16Qty);
+        u16Count = u16Qty;
+        break;
+      case ku8MBMaskWriteRegister:
+        if (u16Length != 7)
+          u8Status = ku8MBInvalidFunction;
+        break;
+      default:
+        if (u16Length != 5)
+          u8Status = ku8MBInvalidFunction;
+        break;
+      }
+    }
+  }
+  this->u8Status = u8Status;
+}
+
+/**
+Call the callback once; it may queue new requests.
+*/
+void ModbusRequest::report() {
+  ModbusCallback done;
+  done.swap(callback);
+  if (done)
+    done(u8Status, u16Count ? au16Data : nullptr, u16Count);
+}
@@ -0,0 +1,108 @@
+#ifndef MODBUSTER_ASYNC_H
+#define MODBUSTER_ASYNC_H
+
+#include "ModbusterPdu.h"
+
+#include <functional>
+
+namespace ModBuster {
+
+/**
+Completion of a request queued on a non-blocking master.
+
+@param u8Status ku8MBSuccess, a Modbus exception code or one of the
+ModbusServer status codes
+@param au16Data registers read, or coils/inputs packed 16 per word, LSB
+first; nullptr for writes and failures
+@param u16Count number of registers, or of coils/inputs, in au16Data
+*/
+typedef std::function<void(uint8_t u8Status, const uint16_t *au16Data,
+                           uint16_t u16Count)>
+    ModbusCallback;
+
+/**
+Request of a non-blocking master: the PDU to send, the decoded response
+and the completion to call.
+*/
+struct ModbusRequest {
+  uint8_t u8Unit;                           ///< unit ID
+  uint16_t u16Length;                       ///< bytes in au8Pdu
+  uint16_t u16Qty;                          ///< coils/registers to read
+  uint8_t u8Status;                         ///< completion status
+  uint16_t u16Count;                        ///< items in au16Data
+  uint8_t au8Pdu[ku16MaxPDUSize];           ///< request PDU
+  uint16_t au16Data[ku8MaxReadRegisters];   ///< decoded response
+  ModbusCallback callback;                  ///< completion
+
+  void complete(uint8_t u8Status, const uint8_t *au8Pdu, uint16_t u16Length);
+  void report();
+};
+
+/**
+Request functions shared by the non-blocking masters.
+
+Each function checks its arguments, encodes the request PDU and hands it
+to the transport, which sends it and calls the callback once the response
+has arrived or the request has failed. The first argument selects the
+slave in the transport's terms: a TCP target, a serial port.
+*/
+class ModbusAsyncServer {
+public:
+  bool readCoils(int target, uint8_t u8Unit, uint16_t u16ReadAddress,
+                 uint16_t u16BitQty, ModbusCallback callback);
+  bool readDiscreteInputs(int target, uint8_t u8Unit, uint16_t u16ReadAddress,
+                          uint16_t u16BitQty, ModbusCallback callback);
+  bool readHoldingRegisters(int target, uint8_t u8Unit,
+                            uint16_t u16ReadAddress, uint16_t u16ReadQty,
+                            ModbusCallback callback);
+  bool readInputRegisters(int target, uint8_t u8Unit, uint16_t u16ReadAddress,
+                          uint16_t u16ReadQty, ModbusCallback callback);
+  bool writeSingleCoil(int target, uint8_t u8Unit, uint16_t u16WriteAddress,
+                       uint8_t u8State, ModbusCallback callback);
+  bool writeSingleRegister(int target, uint8_t u8Unit,
+                           uint16_t u16WriteAddress, uint16_t u16WriteValue,
+                           ModbusCallback callback);
+  bool writeMultipleCoils(int target, uint8_t u8Unit, uint16_t u16WriteAddress,
+                          uint16_t u16BitQty, const uint16_t *au16Bits,
+                          ModbusCallback callback);
+  bool writeMultipleRegisters(int target, uint8_t u8Unit,
+                              uint16_t u16WriteAddress, uint16_t u16WriteQty,
+                              const uint16_t *au16Values,
+                              ModbusCallback callback);
+  bool maskWriteRegister(int target, uint8_t u8Unit, uint16_t u16WriteAddress,
+                         uint16_t u16AndMask, uint16_t u16OrMask,
+                         ModbusCallback callback);
+  bool readWriteMultipleRegisters(int target, uint8_t u8Unit,
+                                  uint16_t u16ReadAddress, uint16_t u16ReadQty,
+                                  uint16_t u16WriteAddress,
+                                  uint16_t u16WriteQty,
+                                  const uint16_t *au16Values,
+                                  ModbusCallback callback);
+
+protected:
+  ModbusAsyncServer() {}
+  virtual ~ModbusAsyncServer() {}
+
+  /**
+  A fresh request, function code in place.
+
+  @return nullptr if the target is unknown or the master is not running
+  */
+  virtual ModbusRequest *request(int target, uint8_t u8Unit,
+                                 uint8_t u8Function) = 0;
+
+  /**
+  Queue a request returned by request() and filled in.
+
+  @return true if the request has been queued
+  */
+  virtual bool submit(ModbusRequest *request) = 0;
+
+private:
+  ModbusAsyncServer(const ModbusAsyncServer &) = delete;
+  ModbusAsyncServer &operator=(const ModbusAsyncServer &) = delete;
+};
+
+} // namespace ModBuster
+
+#endif // MODBUSTER_ASYNC_H
@@ -0,0 +1,250 @@
+#include "ModbusterGateway.h"
+
+#include "Arduino.h"
+
+#include <string.h>
+
+using namespace ModBuster;
+
+struct ModbusGateway::Job {
+  ModbusTcpTicket ticket;          ///< where the response goes
+  uint32_t u32Queued;              ///< micros() when queued
+  uint16_t u16Length;              ///< bytes in au8Pdu
+  uint8_t au8Pdu[ku16MaxPDUSize];  ///< request, then response
+};
+
+struct ModbusGateway::Bus {
+  ModbusServer master;             ///< transaction engine
+  std::thread worker;              ///< runs the queue
+  mutable std::mutex mutex;        ///< guards everything below
+  std::condition_variable ready;   ///< signalled when a job is queued
+  bool bStop;                      ///< worker shall exit
+  std::unordered_map<uint32_t, std::deque<Job>> queues; ///< per connection
+  std::deque<uint32_t> turns;      ///< connections with queued jobs
+  ModbusGatewayStats stats;        ///< traffic
+};
+
+ModbusGateway::ModbusGateway() : _u16QueueLimit(32) {
+  memset(_ai8Route, -1, sizeof(_ai8Route));
+}
+
+ModbusGateway::~ModbusGateway() {
+  end();
+  for (Bus *bus : _buses)
+    delete bus;
+}
+
+/**
+Add a serial bus.
+
+@param &serial port the bus is attached to, already opened
+@return bus number for route() and master(); -1 if there are 127 buses
+already
+@ingroup setup
+*/
+int ModbusGateway::addBus(Stream &serial) {
+  if (_buses.size() >= 127)
+    return -1;
+  Bus *bus = new Bus();
+  bus->master.begin(1, serial);
+  bus->bStop = false;
+  memset(&bus->stats, 0, sizeof(bus->stats));
+  _buses.push_back(bus);
+  return (int)_buses.size() - 1;
+}
+
+/**
+Transaction engine of a bus, to configure its timing, response timeout or
+transceiver callbacks before begin().
+
+@param bus bus number returned by addBus()
+@ingroup setup
+*/
+ModbusServer &ModbusGateway::master(int bus) { return _buses[bus]->master; }
+
+/**
+Route a range of unit IDs to a bus.
+
+@param u8FirstUnit first unit ID of the range
+@param u8LastUnit last unit ID of the range
+@param bus bus number returned by addBus()
+@return true on success
+@ingroup setup
+*/
+bool ModbusGateway::route(uint8_t u8FirstUnit, uint8_t u8LastUnit, int bus) {
+  if (bus < 0 || bus >= (int)_buses.size() || u8FirstUnit > u8LastUnit)
+    return false;
+  for (uint16_t u16Unit = u8FirstUnit; u16Unit <= u8LastUnit; u16Unit++)
+    _ai8Route[u16Unit] = (int8_t)bus;
+  return true;
+}
+
+/**
+Set the number of requests that may wait for a bus; further ones are
+refused with ku8MBGatewayPathUnavailable.
+
+@param u16Requests requests per bus (default 32)
+@ingroup setup
+*/
+void ModbusGateway::queueLimit(uint16_t u16Requests) {
+  _u16QueueLimit = u16Requests;
+}
+
+/**
+Start the bus workers and listen for TCP masters.
+
+@param u16Port TCP port; 0 picks a free one, see port()
+@param address local IPv4 address to bind; nullptr for all interfaces
+@return true on success
+@ingroup setup
+*/
+bool ModbusGateway::begin(uint16_t u16Port, const char *address) {
+  end();
+  if (!_tcp.begin(u16Port, address))
+    return false;
+  _tcp.onForward([this](const ModbusTcpTicket &ticket, const uint8_t *au8Pdu,
+                        uint16_t u16Length) {
+    return forward(ticket, au8Pdu, u16Length);
+  });
+
+  for (Bus *bus : _buses) {
+    bus->bStop = false;
+    memset(&bus->stats, 0, sizeof(bus->stats));
+    bus->worker = std::thread(&ModbusGateway::run, this, bus);
+  }
+  return _tcp.start();
+}
+
+/**
+Close the TCP side and stop the bus workers; queued requests are dropped.
+
+@ingroup setup
+*/
+void ModbusGateway::end() {
+  // the workers reply through the TCP side, so they go first
+  for (Bus *bus : _buses) {
+    {
+      std::lock_guard<std::mutex> lock(bus->mutex);
+      bus->bStop = true;
+    }
+    bus->ready.notify_one();
+    if (bus->worker.joinable())
+      bus->worker.join();
+  }
+  _tcp.end();
+
+  // including whatever the TCP side queued while the workers stopped
+  for (Bus *bus : _buses) {
+    std::lock_guard<std::mutex> lock(bus->mutex);
+    bus->queues.clear();
+    bus->turns.clear();
+    bus->stats.u16Queued = 0;
+  }
+}
+
+/**
+Traffic of a bus since begin(). Throughput is the change of u32Forwarded
+between two calls, the mean queue wait u64WaitUs / u32Forwarded and the
+bus utilisation the change of u64BusyUs over the time between two calls.
+
+@param bus bus number returned by addBus()
+@return statistics
+*/
+ModbusGatewayStats ModbusGateway::stats(int bus) const {
+  std::lock_guard<std::mutex> lock(_buses[bus]->mutex);
+  return _buses[bus]->stats;
+}
+
+// Queue a request for its bus; runs in the thread of the TCP slave.
+bool ModbusGateway::forward(const ModbusTcpTicket &ticket,
+                            const uint8_t *au8Pdu, uint16_t u16Length) {
+  int8_t i8Bus = _ai8Route[ticket.u8Unit];
+  if (i8Bus < 0) {
+    refuse(ticket, au8Pdu[PDU_FUNC], ku8MBGatewayPathUnavailable);
+    return true;
+  }
+
+  Bus *bus = _buses[i8Bus];
+  {
+    std::lock_guard<std::mutex> lock(bus->mutex);
+    ModbusGatewayStats &stats = bus->stats;
+    if (stats.u16Queued >= _u16QueueLimit) {
+      stats.u32Rejected++;
+    } else {
+      std::deque<Job> &queue = bus->queues[ticket.u32Connection];
+      if (queue.empty())
+        bus->turns.push_back(ticket.u32Connection);
+      queue.emplace_back();
+      Job &job = queue.back();
+      job.ticket = ticket;
+      job.u32Queued = micros();
+      job.u16Length = u16Length;
+      memcpy(job.au8Pdu, au8Pdu, u16Length);
+      if (++stats.u16Queued > stats.u16MaxQueued)
+        stats.u16MaxQueued = stats.u16Queued;
+      bus->ready.notify_one();
+      return true;
+    }
+  }
+  refuse(ticket, au8Pdu[PDU_FUNC], ku8MBGatewayPathUnavailable);
+  return true;
+}
+
+void ModbusGateway::refuse(const ModbusTcpTicket &ticket, uint8_t u8Function,
+                           uint8_t u8Exception) {
+  uint8_t au8Pdu[2] = {(uint8_t)(u8Function | 0x80), u8Exception};
+  _tcp.reply(ticket, au8Pdu, sizeof(au8Pdu));
+}
+
+// Worker of a bus: take turns between connections, one request each.
+void ModbusGateway::run(Bus *bus) {
+  Job job;
+  std::unique_lock<std::mutex> lock(bus->mutex);
+  for (;;) {
+    bus->ready.wait(lock, [bus]() { return bus->bStop || !bus->turns.empty(); });
+    if (bus->bStop)
+      return;
+
+    uint32_t u32Connection = bus->turns.front();
+    bus->turns.pop_front();
+    auto it = bus->queues.find(u32Connection);
+    job = it->second.front();
+    it->second.pop_front();
+    if (it->second.empty())
+      bus->queues.erase(it);
+    else
+      bus->turns.push_back(u32Connection);
+    bus->stats.u16Queued--;
+    lock.unlock();
+
+    uint32_t u32Start = micros();
+    bus->master.setSlaveID(job.ticket.u8Unit);
+    uint8_t u8Status = bus->master.ModbusPduTransaction(
+        job.au8Pdu, job.u16Length, sizeof(job.au8Pdu));
+    uint32_t u32End = micros();
+    if (u8Status) {
+      // broadcasts the master refuses are answered like unknown functions
+      job.au8Pdu[PDU_FUNC] |= 0x80;
+      job.au8Pdu[1] = u8Status == ku8MBInvalidSlaveID
+                          ? ku8MBIllegalFunction
+                          : ku8MBGatewayTargetFailed;
+      job.u16Length = 2;
+    }
+    // broadcasts that went out are not answered
+    if (job.u16Length)
+      _tcp.reply(job.ticket, job.au8Pdu, job.u16Length);
+
+    lock.lock();
+    ModbusGatewayStats &stats = bus->stats;
+    uint32_t u32Wait = u32Start - job.u32Queued;
+    stats.u32Forwarded++;
+    if (u8Status)
+      stats.u32Failed++;
+    else
+      stats.u32Answered++;
+    stats.u64WaitUs += u32Wait;
+    if (u32Wait > stats.u32MaxWaitUs)
+      stats.u32MaxWaitUs = u32Wait;
+    stats.u64BusyUs += u32End - u32Start;
+  }
+}
@@ -0,0 +1,80 @@
+#ifndef MODBUSTER_GATEWAY_H
+#define MODBUSTER_GATEWAY_H
+
+#include "ModbusterServer.h"
+#include "ModbusterTcpClient.h"
+
+#include <condition_variable>
+#include <deque>
+
+namespace ModBuster {
+
+/**
+Traffic of one gateway bus since begin().
+*/
+struct ModbusGatewayStats {
+  uint32_t u32Forwarded; ///< requests sent on the bus
+  uint32_t u32Answered;  ///< valid responses, exception responses included
+  uint32_t u32Failed;    ///< no valid response, answered with 0x0B
+  uint32_t u32Rejected;  ///< queue full, answered with 0x0A
+  uint16_t u16Queued;    ///< requests waiting now
+  uint16_t u16MaxQueued; ///< most requests waiting at once
+  uint64_t u64WaitUs;    ///< queue wait of all forwarded requests [us]
+  uint32_t u32MaxWaitUs; ///< longest queue wait [us]
+  uint64_t u64BusyUs;    ///< time spent in bus transactions [us]
+};
+
+/**
+Modbus TCP to RTU gateway.
+
+TCP masters connect to a ModbusTcpClient; each request is routed by its
+unit ID to one of several serial buses and queued there. Every bus has a
+worker thread running the ModbusServer transaction engine. Its queue is
+fair between TCP connections: they take turns, one request each, so a
+master flooding the gateway cannot starve the others.
+
+Requests to unrouted unit IDs, and requests finding their bus queue full,
+are answered at once with ku8MBGatewayPathUnavailable (0x0A); requests the
+slave does not answer validly with ku8MBGatewayTargetFailed (0x0B).
+Writes routed to unit ID 0 are broadcast and not answered; anything else
+sent to unit ID 0 is answered with ku8MBIllegalFunction (0x01).
+*/
+class ModbusGateway {
+public:
+  ModbusGateway();
+  ~ModbusGateway();
+
+  int addBus(Stream &serial);
+  ModbusServer &master(int bus);
+  bool route(uint8_t u8FirstUnit, uint8_t u8LastUnit, int bus);
+  void queueLimit(uint16_t u16Requests);
+
+  bool begin(uint16_t u16Port = ku16MBTcpPort, const char *address = nullptr);
+  void end();
+
+  uint16_t port() const { return _tcp.port(); }
+  int buses() const { return (int)_buses.size(); }
+  ModbusGatewayStats stats(int bus) const;
+
+private:
+  struct Job;
+  struct Bus;
+
+  ModbusGateway(const ModbusGateway &) = delete;
+  ModbusGateway &operator=(const ModbusGateway &) = delete;
+
+  ModbusTcpClient _tcp;       ///< TCP side
+  std::vector<Bus *> _buses;  ///< serial side
+  int8_t _ai8Route[256];      ///< bus of each unit ID, -1 for none
+  uint16_t _u16QueueLimit;    ///< requests waiting per bus
+
+  bool forward(const ModbusTcpTicket &ticket, const uint8_t *au8Pdu,
+               uint16_t u16Length);
+  void refuse(const ModbusTcpTicket &ticket, uint8_t u8Function,
+              uint8_t u8Exception);
+  void run(Bus *bus);
+};
+
+} // namespace ModBuster
+
+#endif // MODBUSTER_GATEWAY_H
@@ -0,0 +1,65 @@
+#ifndef MODBUSTER_MBAP_H
+#define MODBUSTER_MBAP_H
+
+#include "ModbusterPdu.h"
+
+namespace ModBuster {
+
+// MBAP header: transaction ID, protocol ID, length, unit ID [bytes]
+const uint8_t ku8MBAPHeaderSize = 7;
+
+// Largest Modbus TCP frame: MBAP header and a 253 byte PDU [bytes]
+const uint16_t ku16MaxTcpADUSize = ku8MBAPHeaderSize + ku16MaxPDUSize;
+
+// Well-known Modbus TCP port
+const uint16_t ku16MBTcpPort = 502;
+
+/**
+Write an MBAP header in front of a PDU.
+
+@param au8Frame frame buffer; the PDU starts at ku8MBAPHeaderSize
+@param u16Transaction transaction ID
+@param u8Unit unit ID
+@param u16PduLength PDU length [bytes]
+*/
+inline void mbap_encode(uint8_t *au8Frame, uint16_t u16Transaction,
+                        uint8_t u8Unit, uint16_t u16PduLength) {
+  au8Frame[0] = (uint8_t)(u16Transaction >> 8);
+  au8Frame[1] = (uint8_t)u16Transaction;
+  au8Frame[2] = 0;
+  au8Frame[3] = 0;
+  au8Frame[4] = (uint8_t)((u16PduLength + 1) >> 8);
+  au8Frame[5] = (uint8_t)(u16PduLength + 1);
+  au8Frame[6] = u8Unit;
+}
+
+/**
+Length of the Modbus TCP frame starting a receive buffer.
+
+@param au8Frame bytes received so far
+@param u16Received number of bytes in au8Frame
+@return frame length including the MBAP header [bytes]; 0 while the header
+is incomplete; 0xFFFF if the header is invalid and the stream can no
+longer be delimited
+*/
+inline uint16_t mbap_frame_length(const uint8_t *au8Frame,
+                                  uint16_t u16Received) {
+  if (u16Received < ku8MBAPHeaderSize)
+    return 0;
+  uint16_t u16Length = (uint16_t)((au8Frame[4] << 8) | au8Frame[5]);
+  if (au8Frame[2] || au8Frame[3] || u16Length < 2 ||
+      u16Length > ku16MaxPDUSize + 1)
+    return 0xFFFF;
+  return 6 + u16Length;
+}
+
+/**
+Transaction ID of a Modbus TCP frame.
+*/
+inline uint16_t mbap_transaction(const uint8_t *au8Frame) {
+  return (uint16_t)((au8Frame[0] << 8) | au8Frame[1]);
+}
+
+} // namespace ModBuster
+
+#endif // MODBUSTER_MBAP_H
@@ -0,0 +1,448 @@
+#include "ModbusterMultiServer.h"
+
+#include "ModbusterCrc.h"
+
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+using namespace ModBuster;
+
+// epoll_wait() batch size
+static const int kEvents = 64;
+
+// epoll data of a port's timer; its serial descriptor has the bit clear
+static const uint64_t kTimerTag = 1;
+
+// Line state of a port
+enum PortState : uint8_t {
+  PORT_IDLE = 0, ///< nothing to do
+  PORT_SILENCE,  ///< request waiting for T3.5 after the last frame
+  PORT_RESPONSE  ///< request sent, collecting the response
+};
+
+struct ModbusMultiServer::Request : ModbusRequest {
+  Port *port;                               ///< line the slave is on
+};
+
+struct ModbusMultiServer::Port {
+  PosixStream *serial;                      ///< serial line
+  int fdTimer;                              ///< T3.5 and response timeout
+  ModbusTiming timing;                      ///< frame delimiting
+  uint32_t u32CharUs;                       ///< character time, 0 unknown
+  bool bDown;                               ///< line hung up
+  bool bBroadcast;                          ///< last request was a broadcast
+  uint8_t u8State;                          ///< PortState
+  Request *current;                         ///< request on the line
+  std::deque<Request *> queue;              ///< requests not yet sent
+  uint32_t u32BusTime;                      ///< micros() of last activity
+  uint32_t u32Deadline;                     ///< micros() of the timeout
+  uint16_t u16Rx;                           ///< bytes in au8Rx
+  uint16_t u16Expected;                     ///< response length, 0 unknown
+  uint16_t u16CRC;                          ///< running CRC of au8Rx
+  uint8_t au8Rx[ku16MaxADUSize];            ///< response received so far
+};
+
+// Microseconds from u32Now until u32Time; 0 once it has passed.
+static uint32_t until(uint32_t u32Now, uint32_t u32Time) {
+  int32_t i32Left = (int32_t)(u32Time - u32Now);
+  return i32Left > 0 ? (uint32_t)i32Left : 0;
+}
+
+ModbusMultiServer::ModbusMultiServer()
+    : _fdEpoll(-1), _u16ResponseTimeout(ku16MBResponseTimeout),
+      _u16TurnaroundDelay(100), _pending(0) {}
+
+ModbusMultiServer::~ModbusMultiServer() { end(); }
+
+/**
+Initialize the event loop.
+
+@return true on success
+@ingroup setup
+*/
+bool ModbusMultiServer::begin() {
+  end();
+  _fdEpoll = epoll_create1(EPOLL_CLOEXEC);
+  return _fdEpoll >= 0;
+}
+
+/**
+Forget ports and pending requests; their callbacks are not called. The
+streams are left open.
+
+@ingroup setup
+*/
+void ModbusMultiServer::end() {
+  for (Port *port : _ports) {
+    close(port->fdTimer);
+    delete port->current;
+    for (Request *request : port->queue)
+      delete request;
+    delete port;
+  }
+  for (Request *request : _done)
+    delete request;
+  for (Request *request : _free)
+    delete request;
+  _ports.clear();
+  _done.clear();
+  _free.clear();
+  _pending = 0;
+  if (_fdEpoll >= 0)
+    close(_fdEpoll);
+  _fdEpoll = -1;
+}
+
+/**
+Add a serial line.
+
+@param serial open stream, e.g. from PosixStream::begin(); it must stay
+open while the master runs
+@param u32Baud line speed, which sets T3.5 and the time frames spend on
+the wire; 0 for transports of unknown speed such as pseudo-terminals
+@return port handle for the request functions; -1 on failure
+@ingroup setup
+*/
+int ModbusMultiServer::addPort(PosixStream &serial, uint32_t u32Baud) {
+  if (_fdEpoll < 0 || serial.fd() < 0)
+    return -1;
+  int fdTimer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (fdTimer < 0)
+    return -1;
+
+  Port *port = new Port();
+  port->serial = &serial;
+  port->fdTimer = fdTimer;
+  if (u32Baud)
+    port->timing.begin(u32Baud);
+  port->u32CharUs = u32Baud ? ku8RTUCharBits * 1000000UL / u32Baud : 0;
+  port->bDown = false;
+  port->bBroadcast = false;
+  port->u8State = PORT_IDLE;
+  port->current = nullptr;
+  port->u32BusTime = micros() - port->timing.t35();
+  port->u16Rx = 0;
+
+  uint64_t u64Index = (uint64_t)_ports.size() << 1;
+  struct epoll_event event;
+  event.events = EPOLLIN;
+  event.data.u64 = u64Index;
+  if (epoll_ctl(_fdEpoll, EPOLL_CTL_ADD, serial.fd(), &event)) {
+    close(fdTimer);
+    delete port;
+    return -1;
+  }
+  event.data.u64 = u64Index | kTimerTag;
+  if (epoll_ctl(_fdEpoll, EPOLL_CTL_ADD, fdTimer, &event)) {
+    epoll_ctl(_fdEpoll, EPOLL_CTL_DEL, serial.fd(), nullptr);
+    close(fdTimer);
+    delete port;
+    return -1;
+  }
+
+  _ports.push_back(port);
+  return (int)_ports.size() - 1;
+}
+
+/**
+Set the time a slave may take to answer, from the end of the request on
+the wire.
+
+@param u16TimeoutMs timeout [milliseconds] (default 2000)
+@ingroup setup
+*/
+void ModbusMultiServer::setResponseTimeOut(uint16_t u16TimeoutMs) {
+  _u16ResponseTimeout = u16TimeoutMs;
+}
+
+/**
+Time the slaves get to execute a broadcast.
+
+Broadcasts complete as soon as they have been sent; the next request on
+the port waits until this much time has passed since, instead of T3.5.
+
+@param u16TurnaroundDelay delay after a broadcast [milliseconds]; 100 by
+default, the protocol suggests 100 to 200
+@ingroup setup
+*/
+void ModbusMultiServer::setTurnaroundDelay(uint16_t u16TurnaroundDelay) {
+  _u16TurnaroundDelay = u16TurnaroundDelay;
+}
+
+/**
+Receive responses, send queued requests and report completions.
+
+@param timeoutMs time to wait for activity [milliseconds]; -1 to wait
+forever
+@return number of callbacks called; -1 if begin() has not been called
+*/
+int ModbusMultiServer::poll(int timeoutMs) {
+  if (_fdEpoll < 0)
+    return -1;
+
+  struct epoll_event events[kEvents];
+  int n = epoll_wait(_fdEpoll, events, kEvents, _done.empty() ? timeoutMs : 0);
+  for (int i = 0; i < n; i++) {
+    Port *port = _ports[events[i].data.u64 >> 1];
+    if (events[i].data.u64 & kTimerTag) {
+      uint64_t u64Expirations;
+      if (read(port->fdTimer, &u64Expirations, sizeof(u64Expirations)) > 0)
+        expire(port);
+    } else {
+      if (events[i].events & EPOLLIN)
+        receive(port);
+      if ((events[i].events & (EPOLLERR | EPOLLHUP)) &&
+          !port->serial->available())
+        hangUp(port);
+    }
+  }
+  return report();
+}
+
+/* _____PRIVATE FUNCTIONS____________________________________________________ */
+
+// A fresh request for a port, function code in place.
+ModbusRequest *ModbusMultiServer::request(int port, uint8_t u8Unit,
+                                          uint8_t u8Function) {
+  if (_fdEpoll < 0 || port < 0 || port >= (int)_ports.size())
+    return nullptr;
+
+  Request *request;
+  if (_free.empty()) {
+    request = new Request();
+  } else {
+    request = _free.back();
+    _free.pop_back();
+  }
+  request->port = _ports[port];
+  request->u8Unit = u8Unit;
+  request->u16Qty = 0;
+  request->u16Count = 0;
+  request->u8Status = ku8MBSuccess;
+  request->au8Pdu[PDU_FUNC] = u8Function;
+  return request;
+}
+
+bool ModbusMultiServer::submit(ModbusRequest *pending) {
+  Request *request = static_cast<Request *>(pending);
+  Port *port = request->port;
+  _pending++;
+  if (port->bDown) {
+    request->complete(ku8MBConnectionFailed, nullptr, 0);
+    _done.push_back(request);
+    return true;
+  }
+  // only writes can be broadcast, nothing answers them
+  if (!request->u8Unit &&
+      !ModbusPduHandler::broadcastable(request->au8Pdu[PDU_FUNC])) {
+    request->complete(ku8MBInvalidSlaveID, nullptr, 0);
+    _done.push_back(request);
+    return true;
+  }
+  port->queue.push_back(request);
+  start(port);
+  return true;
+}
+
+// Put the next queued request on an idle line, once T3.5, or the
+// turnaround delay after a broadcast, has passed. Nothing goes out on a
+// line that hung up: hangUp() fails the queue.
+void ModbusMultiServer::start(Port *port) {
+  if (port->u8State != PORT_IDLE || port->queue.empty() || port->bDown)
+    return;
+
+  uint32_t u32Now = micros();
+  uint32_t u32Wait = until(u32Now, port->u32BusTime + port->timing.t35());
+  if (port->bBroadcast) {
+    uint32_t u32Turnaround =
+        until(u32Now, port->u32BusTime + 1000UL * _u16TurnaroundDelay);
+    if (u32Turnaround > u32Wait)
+      u32Wait = u32Turnaround;
+  }
+  if (u32Wait) {
+    port->u8State = PORT_SILENCE;
+    arm(port, u32Wait);
+    return;
+  }
+  transmit(port);
+}
+
+void ModbusMultiServer::transmit(Port *port) {
+  Request *request = port->queue.front();
+  port->queue.pop_front();
+  port->current = request;
+
+  uint8_t au8Frame[ku16MaxADUSize];
+  uint16_t u16Size = 0;
+  au8Frame[u16Size++] = request->u8Unit;
+  memcpy(au8Frame + u16Size, request->au8Pdu, request->u16Length);
+  u16Size += request->u16Length;
+  uint16_t u16CRC = crc(au8Frame, u16Size);
+  au8Frame[u16Size++] = highByte(u16CRC);
+  au8Frame[u16Size++] = lowByte(u16CRC);
+
+  // stale bytes belong to no transaction
+  while (port->serial->read() != -1)
+    ;
+  port->serial->write(au8Frame, u16Size);
+
+  // the frame is still on the wire; count T3.5 and the timeout from its end
+  port->u32BusTime = micros() + u16Size * port->u32CharUs;
+  port->bBroadcast = !request->u8Unit;
+  if (port->bBroadcast) {
+    // slaves do not answer broadcasts; start() holds the next request for
+    // the turnaround delay
+    finish(port, ku8MBSuccess);
+    return;
+  }
+  port->u8State = PORT_RESPONSE;
+  port->u16Rx = 0;
+  port->u16Expected = 0;
+  port->u16CRC = ku16CRCInit;
+  port->u32Deadline = port->u32BusTime + _u16ResponseTimeout * 1000UL;
+  arm(port, until(micros(), port->u32Deadline));
+}
+
+// Collect response bytes; anything else on the line only marks activity.
+void ModbusMultiServer::receive(Port *port) {
+  if (!port->serial->available())
+    return;
+  uint32_t u32Now = micros();
+  port->u32BusTime = u32Now;
+
+  while (port->serial->available()) {
+    uint8_t ch = (uint8_t)port->serial->read();
+    if (port->u8State != PORT_RESPONSE)
+      continue;
+    if (!port->u16Rx && ch != port->current->u8Unit)
+      continue;
+    if (port->u16Rx >= sizeof(port->au8Rx)) {
+      finish(port, ku8MBFrameTooLarge);
+      continue;
+    }
+    port->au8Rx[port->u16Rx++] = ch;
+    port->u16CRC = crc_update(port->u16CRC, ch);
+
+    // slave ID and CRC around the PDU
+    if (!port->u16Expected && port->u16Rx >= 2) {
+      port->u16Expected = ModbusPduHandler::responseLength(port->au8Rx + 1,
+                                                           port->u16Rx - 1);
+      if (port->u16Expected)
+        port->u16Expected += 3;
+    }
+    if (port->u16Expected && port->u16Rx == port->u16Expected)
+      finish(port, ku8MBSuccess);
+  }
+
+  if (port->u8State == PORT_RESPONSE && port->u16Rx) {
+    // a response that stalls for T3.5 is over, however short it is
+    uint32_t u32Wait = until(u32Now, port->u32Deadline);
+    if (port->timing.t35() < u32Wait)
+      u32Wait = port->timing.t35();
+    arm(port, u32Wait);
+  } else if (port->u8State == PORT_IDLE) {
+    start(port);
+  }
+}
+
+// The port's timer has fired.
+void ModbusMultiServer::expire(Port *port) {
+  switch (port->u8State) {
+  case PORT_SILENCE:
+    port->u8State = PORT_IDLE;
+    start(port);
+    break;
+
+  case PORT_RESPONSE: {
+    // bytes that raced the timer count
+    receive(port);
+    if (port->u8State != PORT_RESPONSE)
+      break;
+
+    uint32_t u32Now = micros();
+    uint32_t u32Wait = until(u32Now, port->u32Deadline);
+    if (port->u16Rx) {
+      uint32_t u32Silence =
+          until(u32Now, port->u32BusTime + port->timing.t35());
+      if (!u32Silence) {
+        // T3.5 delimits responses of unknown length; any other one stalled
+        finish(port, !port->u16Expected && port->u16Rx >= 4
+                         ? ku8MBSuccess
+                         : ku8MBResponseTimedOut);
+        break;
+      }
+      if (u32Silence < u32Wait)
+        u32Wait = u32Silence;
+    }
+    if (!u32Wait)
+      finish(port, ku8MBResponseTimedOut);
+    else
+      arm(port, u32Wait);
+    break;
+  }
+  }
+}
+
+// Complete the request on the line and move on to the next one.
+void ModbusMultiServer::finish(Port *port, uint8_t u8Status) {
+  Request *request = port->current;
+  const uint8_t *au8Pdu = nullptr;
+  if (!u8Status && request->u8Unit) {
+    if (port->u16CRC != ku16CRCResidue)
+      u8Status = ku8MBInvalidCRC;
+    else
+      au8Pdu = port->au8Rx + 1;
+  }
+  request->complete(u8Status, au8Pdu, au8Pdu ? port->u16Rx - 3 : 0);
+  _done.push_back(request);
+
+  port->current = nullptr;
+  port->u16Rx = 0;
+  port->u8State = PORT_IDLE;
+  start(port);
+}
+
+// The line is gone: fail its requests, now and from now on. bDown is set
+// first, so finishing the current request starts no other one.
+void ModbusMultiServer::hangUp(Port *port) {
+  epoll_ctl(_fdEpoll, EPOLL_CTL_DEL, port->serial->fd(), nullptr);
+  port->bDown = true;
+  if (port->current) {
+    port->u16Rx = 0;
+    finish(port, ku8MBConnectionFailed);
+  }
+  while (!port->queue.empty()) {
+    Request *request = port->queue.front();
+    port->queue.pop_front();
+    request->complete(ku8MBConnectionFailed, nullptr, 0);
+    _done.push_back(request);
+  }
+  port->u8State = PORT_IDLE;
+}
+
+// Fire the port's timer in u32Us microseconds, replacing any earlier
+// setting. A timer left over from a finished transaction is harmless:
+// expire() ignores idle ports.
+void ModbusMultiServer::arm(Port *port, uint32_t u32Us) {
+  if (!u32Us)
+    u32Us = 1;
+  struct itimerspec spec;
+  memset(&spec, 0, sizeof(spec));
+  spec.it_value.tv_sec = u32Us / 1000000;
+  spec.it_value.tv_nsec = (long)(u32Us % 1000000) * 1000;
+  timerfd_settime(port->fdTimer, 0, &spec, nullptr);
+}
+
+// Call the callbacks of completed requests, which may queue new ones.
+int ModbusMultiServer::report() {
+  std::vector<Request *> done;
+  done.swap(_done);
+  for (Request *request : done) {
+    _pending--;
+    request->report();
+    _free.push_back(request);
+  }
+  return (int)done.size();
+}
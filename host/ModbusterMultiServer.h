@@ -0,0 +1,77 @@
+#ifndef MODBUSTER_MULTI_SERVER_H
+#define MODBUSTER_MULTI_SERVER_H
+
+#include "ModbusterAsync.h"
+#include "ModbusterPosix.h"
+
+#include <deque>
+#include <stddef.h>
+#include <vector>
+
+namespace ModBuster {
+
+/**
+Modbus RTU master driving many serial lines from one thread.
+
+Every port added with addPort() has its own request queue and one
+transaction on the line at a time; the ports run side by side, so a scan
+of all of them takes as long as the slowest bus rather than the sum of
+all. Serial descriptors and one timerfd per port, which keeps T3.5 and the
+response timeout, are multiplexed by epoll; nothing blocks while a frame
+is on the wire.
+
+The request functions are those of ModbusAsyncServer; their first argument
+is a handle returned by addPort(). Responses end when their predicted
+length has arrived, or after T3.5 of silence for unknown function codes.
+Writes to unit ID 0 are broadcast, as with ModbusServer; anything else
+to unit ID 0 fails with ku8MBInvalidSlaveID. T1.5 is not checked: one
+thread waking up for many lines cannot time single characters.
+Everything, callbacks included, runs in the thread calling poll(); the
+object is not thread-safe.
+*/
+class ModbusMultiServer : public ModbusAsyncServer {
+public:
+  ModbusMultiServer();
+  ~ModbusMultiServer();
+
+  bool begin();
+  void end();
+
+  int addPort(PosixStream &serial, uint32_t u32Baud = 0);
+  void setResponseTimeOut(uint16_t u16TimeoutMs);
+  void setTurnaroundDelay(uint16_t u16TurnaroundDelay);
+
+  int poll(int timeoutMs);
+  size_t pending() const { return _pending; }
+
+private:
+  struct Request;
+  struct Port;
+
+  ModbusMultiServer(const ModbusMultiServer &) = delete;
+  ModbusMultiServer &operator=(const ModbusMultiServer &) = delete;
+
+  int _fdEpoll;                    ///< epoll instance, -1 when closed
+  uint16_t _u16ResponseTimeout;    ///< response timeout [milliseconds]
+  uint16_t _u16TurnaroundDelay;    ///< silence after a broadcast [ms]
+  size_t _pending;                 ///< requests not completed yet
+  std::vector<Port *> _ports;      ///< serial lines, indexed by addPort()
+  std::vector<Request *> _done;    ///< completions to report
+  std::vector<Request *> _free;    ///< recycled requests
+
+  ModbusRequest *request(int port, uint8_t u8Unit,
+                         uint8_t u8Function) override;
+  bool submit(ModbusRequest *request) override;
+  void start(Port *port);
+  void transmit(Port *port);
+  void receive(Port *port);
+  void expire(Port *port);
+  void finish(Port *port, uint8_t u8Status);
+  void hangUp(Port *port);
+  void arm(Port *port, uint32_t u32Us);
+  int report();
+};
+
+} // namespace ModBuster
+
+#endif // MODBUSTER_MULTI_SERVER_H
@@ -0,0 +1,319 @@
+#include "ModbusterPosix.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+using namespace ModBuster;
+
+static speed_t baudToSpeed(uint32_t u32Baud) {
+  switch (u32Baud) {
+  case 1200:
+    return B1200;
+  case 2400:
+    return B2400;
+  case 4800:
+    return B4800;
+  case 9600:
+    return B9600;
+  case 19200:
+    return B19200;
+  case 38400:
+    return B38400;
+  case 57600:
+    return B57600;
+  case 115200:
+    return B115200;
+  case 230400:
+    return B230400;
+#ifdef B460800
+  case 460800:
+    return B460800;
+#endif
+#ifdef B921600
+  case 921600:
+    return B921600;
+#endif
+  default:
+    return B0;
+  }
+}
+
+static bool setNonBlocking(int fd) {
+  int flags = fcntl(fd, F_GETFL, 0);
+  return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+// Put a terminal into raw 8-bit mode, so the line discipline does not
+// echo or translate any byte of the frames.
+static bool setRaw(int fd) {
+  struct termios tio;
+  if (tcgetattr(fd, &tio) != 0)
+    return false;
+  cfmakeraw(&tio);
+  tio.c_cc[VMIN] = 0;
+  tio.c_cc[VTIME] = 0;
+  return tcsetattr(fd, TCSANOW, &tio) == 0;
+}
+
+PosixStream::PosixStream()
+    : _fd(-1), _bSerial(false), _u16RxHead(0), _u16RxTail(0) {}
+
+PosixStream::~PosixStream() { end(); }
+
+/**
+Open a serial port.
+
+@param path device path, e.g. "/dev/ttyUSB0"
+@param u32Baud line speed (1200..921600)
+@param u8Config character format, SERIAL_8N1 and friends
+@return true on success
+@ingroup setup
+*/
+bool PosixStream::begin(const char *path, uint32_t u32Baud, uint8_t u8Config) {
+  speed_t speed = baudToSpeed(u32Baud);
+  if (speed == B0)
+    return false;
+
+  end();
+  int fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (fd < 0)
+    return false;
+
+  struct termios tio;
+  if (tcgetattr(fd, &tio) != 0) {
+    close(fd);
+    return false;
+  }
+  cfmakeraw(&tio);
+  tio.c_cflag &= ~(CSIZE | PARENB | PARODD | CSTOPB | CRTSCTS);
+  tio.c_cflag |= CLOCAL | CREAD;
+  switch ((u8Config >> 1) & 0x03) {
+  case 0:
+    tio.c_cflag |= CS5;
+    break;
+  case 1:
+    tio.c_cflag |= CS6;
+    break;
+  case 2:
+    tio.c_cflag |= CS7;
+    break;
+  default:
+    tio.c_cflag |= CS8;
+    break;
+  }
+  if (u8Config & 0x08)
+    tio.c_cflag |= CSTOPB;
+  switch ((u8Config >> 4) & 0x03) {
+  case 2:
+    tio.c_cflag |= PARENB;
+    break;
+  case 3:
+    tio.c_cflag |= PARENB | PARODD;
+    break;
+  }
+  tio.c_cc[VMIN] = 0;
+  tio.c_cc[VTIME] = 0;
+  cfsetispeed(&tio, speed);
+  cfsetospeed(&tio, speed);
+  if (tcsetattr(fd, TCSANOW, &tio) != 0) {
+    close(fd);
+    return false;
+  }
+  tcflush(fd, TCIOFLUSH);
+
+  _fd = fd;
+  _bSerial = true;
+  return true;
+}
+
+/**
+Take ownership of an already open descriptor.
+
+@param fd descriptor of a terminal, pipe or stream socket
+@return true on success
+@ingroup setup
+*/
+bool PosixStream::begin(int fd) {
+  end();
+  if (fd < 0 || !setNonBlocking(fd))
+    return false;
+  _fd = fd;
+  return true;
+}
+
+/**
+Open the controlling side of a new pseudo-terminal.
+
+The other side appears as a regular serial device, e.g. /dev/pts/3, that
+another program (or a second PosixStream) can open.
+
+@param name optional buffer receiving the path of the terminal side
+@param size size of name
+@return true on success
+@ingroup setup
+*/
+bool PosixStream::beginPty(char *name, size_t size) {
+  end();
+  int fd = posix_openpt(O_RDWR | O_NOCTTY);
+  if (fd < 0)
+    return false;
+  if (grantpt(fd) != 0 || unlockpt(fd) != 0 || !setRaw(fd) ||
+      !setNonBlocking(fd) || (name && ptsname_r(fd, name, size) != 0)) {
+    close(fd);
+    return false;
+  }
+  _fd = fd;
+  return true;
+}
+
+/**
+Close the descriptor.
+
+@ingroup setup
+*/
+void PosixStream::end() {
+  if (_fd >= 0)
+    close(_fd);
+  _fd = -1;
+  _bSerial = false;
+  _u16RxHead = _u16RxTail = 0;
+}
+
+/**
+Connect two streams through a pseudo-terminal, so that the whole stack can
+be exercised on a machine without serial hardware.
+
+@return true on success
+@ingroup setup
+*/
+bool PosixStream::openPtyPair(PosixStream &a, PosixStream &b) {
+  char name[64];
+  if (!a.beginPty(name, sizeof(name)))
+    return false;
+  int fd = open(name, O_RDWR | O_NOCTTY | O_NONBLOCK);
+  if (fd < 0 || !setRaw(fd) || !b.begin(fd)) {
+    if (fd >= 0)
+      close(fd);
+    a.end();
+    return false;
+  }
+  return true;
+}
+
+/**
+Connect two streams through a UNIX domain socket pair.
+
+@return true on success
+@ingroup setup
+*/
+bool PosixStream::openSocketPair(PosixStream &a, PosixStream &b) {
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+    return false;
+  if (!a.begin(fds[0])) {
+    close(fds[0]);
+    close(fds[1]);
+    return false;
+  }
+  if (!b.begin(fds[1])) {
+    close(fds[1]);
+    a.end();
+    return false;
+  }
+  return true;
+}
+
+bool PosixStream::fill() {
+  if (_u16RxHead < _u16RxTail)
+    return true;
+  if (_fd < 0)
+    return false;
+
+  ssize_t n;
+  do {
+    n = ::read(_fd, _au8Rx, sizeof(_au8Rx));
+  } while (n < 0 && errno == EINTR);
+
+  _u16RxHead = 0;
+  _u16RxTail = n > 0 ? (uint16_t)n : 0;
+  return n > 0;
+}
+
+int PosixStream::available() {
+  fill();
+  return _u16RxTail - _u16RxHead;
+}
+
+int PosixStream::read() {
+  if (!fill())
+    return -1;
+  return _au8Rx[_u16RxHead++];
+}
+
+int PosixStream::peek() {
+  if (!fill())
+    return -1;
+  return _au8Rx[_u16RxHead];
+}
+
+size_t PosixStream::write(uint8_t u8Byte) { return write(&u8Byte, 1); }
+
+size_t PosixStream::write(const uint8_t *buffer, size_t size) {
+  size_t written = 0;
+  while (_fd >= 0 && written < size) {
+    ssize_t n = ::write(_fd, buffer + written, size - written);
+    if (n > 0) {
+      written += n;
+    } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      struct pollfd pfd = {_fd, POLLOUT, 0};
+      poll(&pfd, 1, -1);
+    } else if (n < 0 && errno == EINTR) {
+      continue;
+    } else {
+      break;
+    }
+  }
+  return written;
+}
+
+/**
+Wait until all written bytes have left the serial line.
+
+@ingroup buffer
+*/
+void PosixStream::flush() {
+  if (_bSerial)
+    tcdrain(_fd);
+}
+
+/**
+Sleep in poll() until data arrives or the timeout expires.
+
+@param u32TimeoutUs maximum time to wait [microseconds]
+@return true if data is available
+@ingroup buffer
+*/
+bool PosixStream::waitAvailable(uint32_t u32TimeoutUs) {
+  if (available())
+    return true;
+  if (_fd < 0)
+    return false;
+
+  struct pollfd pfd = {_fd, POLLIN, 0};
+  struct timespec ts;
+  ts.tv_sec = u32TimeoutUs / 1000000;
+  ts.tv_nsec = (long)(u32TimeoutUs % 1000000) * 1000;
+  int rc = ppoll(&pfd, 1, &ts, nullptr);
+  if (rc > 0 && !(pfd.revents & POLLIN)) {
+    // Peer hung up: nothing will arrive, but do not let the caller spin.
+    nanosleep(&ts, nullptr);
+    return false;
+  }
+  return rc > 0 && available() > 0;
+}
@@ -0,0 +1,53 @@
+#ifndef MODBUSTER_POSIX_H
+#define MODBUSTER_POSIX_H
+
+#include "Arduino.h"
+
+namespace ModBuster {
+
+/**
+Stream over a POSIX file descriptor: termios serial port, pseudo-terminal
+or socket.
+
+Reception is buffered, so available()/read() do not issue a system call
+per byte, and waitAvailable() sleeps in poll() rather than spinning.
+*/
+class PosixStream : public Stream {
+public:
+  PosixStream();
+  ~PosixStream();
+
+  bool begin(const char *path, uint32_t u32Baud, uint8_t u8Config = SERIAL_8N1);
+  bool begin(int fd);
+  bool beginPty(char *name = nullptr, size_t size = 0);
+  void end();
+
+  static bool openPtyPair(PosixStream &a, PosixStream &b);
+  static bool openSocketPair(PosixStream &a, PosixStream &b);
+
+  int fd() const { return _fd; }
+
+  int available() override;
+  int read() override;
+  int peek() override;
+  size_t write(uint8_t u8Byte) override;
+  size_t write(const uint8_t *buffer, size_t size) override;
+  void flush() override;
+  bool waitAvailable(uint32_t u32TimeoutUs) override;
+
+private:
+  PosixStream(const PosixStream &) = delete;
+  PosixStream &operator=(const PosixStream &) = delete;
+
+  int _fd;            ///< file descriptor, -1 when closed
+  bool _bSerial;      ///< true if _fd is a real serial line (drain on flush)
+  uint8_t _au8Rx[256]; ///< receive buffer
+  uint16_t _u16RxHead; ///< next byte to read from _au8Rx
+  uint16_t _u16RxTail; ///< end of valid data in _au8Rx
+
+  bool fill();
+};
+
+} // namespace ModBuster
+
+#endif // MODBUSTER_POSIX_H
@@ -0,0 +1,218 @@
+#include "ModbusterRegisterBank.h"
+
+#include "Arduino.h"
+
+#include <thread>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace ModBuster;
+
+// Wait for a writer to finish: spin briefly, then give the CPU away in
+// case the writer has been preempted.
+static inline void relax(uint32_t &u32Spins) {
+  if (++u32Spins < 64) {
+#if defined(__SSE2__)
+    _mm_pause();
+#endif
+  } else {
+    std::this_thread::yield();
+  }
+}
+
+/**
+Constructor; all registers start at 0, each in a group of its own.
+
+@param u16Count number of registers
+@ingroup setup
+*/
+ModbusRegisterBank::ModbusRegisterBank(uint16_t u16Count)
+    : _u16Count(u16Count), _au16Values(new std::atomic<uint16_t>[u16Count]),
+      _au16Group(new uint16_t[u16Count]), _au16Size(new uint16_t[u16Count]),
+      _au32Sequence(new std::atomic<uint32_t>[u16Count]), _u64Reads(0),
+      _u64Retries(0) {
+  for (uint16_t i = 0; i < u16Count; i++) {
+    _au16Values[i].store(0, std::memory_order_relaxed);
+    _au16Group[i] = i;
+    _au16Size[i] = 1;
+    _au32Sequence[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+ModbusRegisterBank::~ModbusRegisterBank() {
+  delete[] _au16Values;
+  delete[] _au16Group;
+  delete[] _au16Size;
+  delete[] _au32Sequence;
+}
+
+/**
+Make consecutive registers one update group: readers see all of them from
+the same write() or request. Call before the bank is shared.
+
+@param u16First first register of the group
+@param u16Count number of registers
+@return true on success; false if the range leaves the bank or cuts
+through another group
+@ingroup setup
+*/
+bool ModbusRegisterBank::group(uint16_t u16First, uint16_t u16Count) {
+  uint32_t u32End = (uint32_t)u16First + u16Count;
+  if (!u16Count || u32End > _u16Count)
+    return false;
+  if ((u16First && _au16Group[u16First - 1] == _au16Group[u16First]) ||
+      (u32End < _u16Count && _au16Group[u32End - 1] == _au16Group[u32End]))
+    return false;
+  for (uint32_t i = u16First; i < u32End; i++)
+    _au16Group[i] = u16First;
+  _au16Size[u16First] = u16Count;
+  return true;
+}
+
+/**
+Update registers; every group touched is updated as a whole, so readers
+see either none or all of the values written to it.
+
+@param u16Offset first register
+@param au16Values new values
+@param u16Qty number of registers
+@return true on success; false if the range leaves the bank
+*/
+bool ModbusRegisterBank::write(uint16_t u16Offset, const uint16_t *au16Values,
+                               uint16_t u16Qty) {
+  if ((uint32_t)u16Offset + u16Qty > _u16Count)
+    return false;
+  writeGroups(u16Offset, u16Qty, [&](uint16_t i) {
+    _au16Values[i].store(au16Values[i - u16Offset], std::memory_order_relaxed);
+  });
+  return true;
+}
+
+/**
+Copy registers, each group consistent.
+
+@param u16Offset first register
+@param au16Values destination
+@param u16Qty number of registers
+@return true on success; false if the range leaves the bank
+*/
+bool ModbusRegisterBank::read(uint16_t u16Offset, uint16_t *au16Values,
+                              uint16_t u16Qty) {
+  if ((uint32_t)u16Offset + u16Qty > _u16Count)
+    return false;
+  readGroups(u16Offset, u16Qty, [&](uint16_t i) {
+    au16Values[i - u16Offset] = _au16Values[i].load(std::memory_order_relaxed);
+  });
+  return true;
+}
+
+void ModbusRegisterBank::load(uint16_t u16Offset, uint8_t *au8Wire,
+                              uint16_t u16Qty) {
+  readGroups(u16Offset, u16Qty, [&](uint16_t i) {
+    uint16_t u16Value = _au16Values[i].load(std::memory_order_relaxed);
+    uint8_t *pu8Dst = au8Wire + 2 * (i - u16Offset);
+    pu8Dst[0] = highByte(u16Value);
+    pu8Dst[1] = lowByte(u16Value);
+  });
+}
+
+void ModbusRegisterBank::store(uint16_t u16Offset, const uint8_t *au8Wire,
+                               uint16_t u16Qty) {
+  writeGroups(u16Offset, u16Qty, [&](uint16_t i) {
+    const uint8_t *pu8Src = au8Wire + 2 * (i - u16Offset);
+    _au16Values[i].store(word(pu8Src[0], pu8Src[1]),
+                         std::memory_order_relaxed);
+  });
+}
+
+void ModbusRegisterBank::modify(uint16_t u16Offset, uint16_t u16AndMask,
+                                uint16_t u16OrMask) {
+  writeGroups(u16Offset, 1, [&](uint16_t i) {
+    uint16_t u16Value = _au16Values[i].load(std::memory_order_relaxed);
+    _au16Values[i].store((u16Value & u16AndMask) | (u16OrMask & ~u16AndMask),
+                         std::memory_order_relaxed);
+  });
+}
+
+/* _____PRIVATE FUNCTIONS____________________________________________________ */
+
+// End of the part of [u16Register, u16End) in the group of u16Register.
+uint16_t ModbusRegisterBank::groupEnd(uint16_t u16Register,
+                                      uint16_t u16End) const {
+  uint32_t u32GroupEnd = (uint32_t)_au16Group[u16Register] +
+                         _au16Size[_au16Group[u16Register]];
+  return u32GroupEnd < u16End ? (uint16_t)u32GroupEnd : u16End;
+}
+
+// Make the sequence of a group odd, waiting for another writer to finish.
+uint32_t ModbusRegisterBank::lock(uint16_t u16Group) {
+  std::atomic<uint32_t> &sequence = _au32Sequence[u16Group];
+  uint32_t u32Sequence = sequence.load(std::memory_order_relaxed);
+  uint32_t u32Spins = 0;
+  for (;;) {
+    if (u32Sequence & 1) {
+      relax(u32Spins);
+      u32Sequence = sequence.load(std::memory_order_relaxed);
+    } else if (sequence.compare_exchange_weak(u32Sequence, u32Sequence + 1,
+                                              std::memory_order_acquire,
+                                              std::memory_order_relaxed)) {
+      break;
+    }
+  }
+  // the values must not be stored before readers can see the odd sequence
+  std::atomic_thread_fence(std::memory_order_release);
+  return u32Sequence;
+}
+
+void ModbusRegisterBank::unlock(uint16_t u16Group, uint32_t u32Sequence) {
+  _au32Sequence[u16Group].store(u32Sequence + 2, std::memory_order_release);
+}
+
+template <typename Copy>
+void ModbusRegisterBank::readGroups(uint16_t u16Offset, uint16_t u16Qty,
+                                    Copy copy) {
+  uint16_t u16End = u16Offset + u16Qty;
+  uint32_t u32Retries = 0, u32Reads = 0;
+  for (uint16_t u16From = u16Offset; u16From < u16End;) {
+    uint16_t u16To = groupEnd(u16From, u16End);
+    std::atomic<uint32_t> &sequence = _au32Sequence[_au16Group[u16From]];
+    uint32_t u32Spins = 0;
+    for (;;) {
+      uint32_t u32Before = sequence.load(std::memory_order_acquire);
+      if (u32Before & 1) {
+        u32Retries++;
+        relax(u32Spins);
+        continue;
+      }
+      for (uint16_t i = u16From; i < u16To; i++)
+        copy(i);
+      // the values must be loaded before the sequence is checked again
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (sequence.load(std::memory_order_relaxed) == u32Before)
+        break;
+      u32Retries++;
+    }
+    u32Reads++;
+    u16From = u16To;
+  }
+  _u64Reads.fetch_add(u32Reads, std::memory_order_relaxed);
+  if (u32Retries)
+    _u64Retries.fetch_add(u32Retries, std::memory_order_relaxed);
+}
+
+template <typename Copy>
+void ModbusRegisterBank::writeGroups(uint16_t u16Offset, uint16_t u16Qty,
+                                     Copy copy) {
+  uint16_t u16End = u16Offset + u16Qty;
+  for (uint16_t u16From = u16Offset; u16From < u16End;) {
+    uint16_t u16To = groupEnd(u16From, u16End);
+    uint16_t u16Group = _au16Group[u16From];
+    uint32_t u32Sequence = lock(u16Group);
+    for (uint16_t i = u16From; i < u16To; i++)
+      copy(i);
+    unlock(u16Group, u32Sequence);
+    u16From = u16To;
+  }
+}
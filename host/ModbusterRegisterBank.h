@@ -0,0 +1,86 @@
+#ifndef MODBUSTER_REGISTER_BANK_H
+#define MODBUSTER_REGISTER_BANK_H
+
+#include "ModbusterRegisterMap.h"
+
+#include <atomic>
+
+namespace ModBuster {
+
+/**
+Registers shared between application threads and a slave, without locks
+on the read path.
+
+Registers are arranged in update groups, by default one per register;
+group() joins consecutive registers, e.g. the two halves of a 32-bit value,
+into one. Each group is guarded by a sequence lock: a writer makes the
+sequence odd, stores and makes it even again; a reader copies the group
+and retries if the sequence was odd or has moved meanwhile. Readers,
+the slave serving a request included, therefore never wait for a lock
+and never see half of an update, and writers never wait for readers.
+Writers to the same group take turns with a compare-and-swap.
+
+A read spanning several groups is consistent within every group; values
+of different groups may stem from different updates.
+
+Bind the bank with ModbusRegisterMap::addHoldingRegisters() or
+addInputRegisters(); offsets below count from the first register of the
+bank.
+*/
+class ModbusRegisterBank : public ModbusRegisterAccess {
+public:
+  explicit ModbusRegisterBank(uint16_t u16Count);
+  ~ModbusRegisterBank();
+
+  uint16_t count() const { return _u16Count; }
+  bool group(uint16_t u16First, uint16_t u16Count);
+
+  bool write(uint16_t u16Offset, const uint16_t *au16Values,
+             uint16_t u16Qty);
+  bool read(uint16_t u16Offset, uint16_t *au16Values, uint16_t u16Qty);
+
+  /**
+  Consistent reads so far, one per group copied.
+  */
+  uint64_t reads() const { return _u64Reads.load(std::memory_order_relaxed); }
+
+  /**
+  Group copies repeated because a writer got in the way.
+  */
+  uint64_t retries() const {
+    return _u64Retries.load(std::memory_order_relaxed);
+  }
+
+  void load(uint16_t u16Offset, uint8_t *au8Wire, uint16_t u16Qty) override;
+  void store(uint16_t u16Offset, const uint8_t *au8Wire,
+             uint16_t u16Qty) override;
+  void modify(uint16_t u16Offset, uint16_t u16AndMask,
+              uint16_t u16OrMask) override;
+
+private:
+  ModbusRegisterBank(const ModbusRegisterBank &) = delete;
+  ModbusRegisterBank &operator=(const ModbusRegisterBank &) = delete;
+
+  uint16_t _u16Count;                    ///< registers
+  std::atomic<uint16_t> *_au16Values;    ///< register values
+  uint16_t *_au16Group;                  ///< first register of the group
+                                         ///< of each register
+  uint16_t *_au16Size;                   ///< registers of each group, at
+                                         ///< its first register
+  std::atomic<uint32_t> *_au32Sequence;  ///< sequence of each group, at
+                                         ///< its first register
+  std::atomic<uint64_t> _u64Reads;       ///< see reads()
+  std::atomic<uint64_t> _u64Retries;     ///< see retries()
+
+  uint16_t groupEnd(uint16_t u16Register, uint16_t u16End) const;
+  uint32_t lock(uint16_t u16Group);
+  void unlock(uint16_t u16Group, uint32_t u32Sequence);
+  template <typename Copy>
+  void readGroups(uint16_t u16Offset, uint16_t u16Qty, Copy copy);
+  template <typename Copy>
+  void writeGroups(uint16_t u16Offset, uint16_t u16Qty, Copy copy);
+};
+
+} // namespace ModBuster
+
+#endif // MODBUSTER_REGISTER_BANK_H
@@ -0,0 +1,528 @@
+#include "ModbusterTcpClient.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <vector>
+
+using namespace ModBuster;
+
+// Responses queued on a connection before it stops reading requests, so a
+// master that does not read its answers cannot grow the queue without
+// bound [bytes]
+static const size_t kTxBacklog = 16 * ku16MaxTcpADUSize;
+
+// epoll_wait() batch size
+static const int kEvents = 64;
+
+// Map of begin() without a map: every address is illegal
+static ModbusRegisterMap emptyMap(nullptr, 0);
+
+struct ModbusTcpClient::Connection {
+  int fd;                                 ///< connected socket
+  uint32_t u32Id;                         ///< ModbusTcpTicket::u32Connection
+  Connection *prev, *next;                ///< list of open connections
+  uint32_t u32Events;                     ///< epoll events registered
+  uint16_t u16Rx;                         ///< bytes in au8Rx
+  uint8_t au8Rx[2 * ku16MaxTcpADUSize];   ///< requests received so far
+  std::vector<uint8_t> tx;                ///< responses not yet sent
+  size_t txHead;                          ///< first unsent byte of tx
+
+  size_t backlog() const { return tx.size() - txHead; }
+};
+
+ModbusTcpClient::ModbusTcpClient()
+    : _fdListen(-1), _fdEpoll(-1), _fdWake(-1), _map(nullptr),
+      _mapMutex(nullptr), _i16Unit(-1), _u16MaxConnections(1024),
+      _u16Connections(0), _connections(nullptr), _onRequest(nullptr),
+      _u32NextId(1), _bRunning(false) {}
+
+ModbusTcpClient::~ModbusTcpClient() { end(); }
+
+/**
+Listen for masters.
+
+@param &map registers served to the masters
+@param u16Port TCP port; 0 picks a free one, see port()
+@param address local IPv4 address to bind; nullptr for all interfaces
+@return true on success
+@ingroup setup
+*/
+bool ModbusTcpClient::begin(ModbusRegisterMap &map, uint16_t u16Port,
+                            const char *address) {
+  end();
+  _map = &map;
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(u16Port);
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (address && inet_pton(AF_INET, address, &addr.sin_addr) != 1)
+    return false;
+
+  int one = 1;
+  _fdListen = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  _fdEpoll = epoll_create1(EPOLL_CLOEXEC);
+  _fdWake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (_fdListen < 0 || _fdEpoll < 0 || _fdWake < 0 ||
+      setsockopt(_fdListen, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) ||
+      bind(_fdListen, (struct sockaddr *)&addr, sizeof(addr)) ||
+      listen(_fdListen, SOMAXCONN)) {
+    end();
+    return false;
+  }
+
+  // the listening socket is tagged nullptr, the wake-up eventfd this
+  struct epoll_event event;
+  event.events = EPOLLIN;
+  event.data.ptr = nullptr;
+  if (epoll_ctl(_fdEpoll, EPOLL_CTL_ADD, _fdListen, &event)) {
+    end();
+    return false;
+  }
+  event.data.ptr = this;
+  if (epoll_ctl(_fdEpoll, EPOLL_CTL_ADD, _fdWake, &event)) {
+    end();
+    return false;
+  }
+  return true;
+}
+
+/**
+Listen for masters, without a register map; every request has to be
+answered by the onRequest() or onForward() hooks, e.g. in a gateway.
+Requests they leave are answered with ku8MBIllegalDataAddress.
+
+@param u16Port TCP port; 0 picks a free one, see port()
+@param address local IPv4 address to bind; nullptr for all interfaces
+@return true on success
+@ingroup setup
+*/
+bool ModbusTcpClient::begin(uint16_t u16Port, const char *address) {
+  return begin(emptyMap, u16Port, address);
+}
+
+/**
+Stop listening and close every connection.
+
+@ingroup setup
+*/
+void ModbusTcpClient::end() {
+  stop();
+  while (_connections)
+    drop(_connections);
+  if (_fdListen >= 0)
+    close(_fdListen);
+  if (_fdEpoll >= 0)
+    close(_fdEpoll);
+  _fdListen = _fdEpoll = -1;
+
+  // reply() writes the wake descriptor under the same lock, from any thread
+  std::lock_guard<std::mutex> lock(_replyMutex);
+  if (_fdWake >= 0)
+    close(_fdWake);
+  _fdWake = -1;
+  _replies.clear();
+}
+
+/**
+Serve a single unit ID; requests to other units are ignored. By default
+every unit ID is served, as usual for a device reached directly over TCP.
+
+@param u8Unit unit ID to answer
+@ingroup setup
+*/
+void ModbusTcpClient::unitId(uint8_t u8Unit) { _i16Unit = u8Unit; }
+
+/**
+Limit the connections open at once; further masters are disconnected as
+soon as they connect.
+
+@param u16Max number of connections (default 1024)
+@ingroup setup
+*/
+void ModbusTcpClient::maxConnections(uint16_t u16Max) {
+  _u16MaxConnections = u16Max;
+}
+
+/**
+Lock a mutex while a request reads or writes the register map, so the map
+can be shared with an RTU slave or the application in other threads.
+
+@param &mutex mutex guarding the map
+@ingroup setup
+*/
+void ModbusTcpClient::guard(std::mutex &mutex) { _mapMutex = &mutex; }
+
+/**
+Set a hook run for every request before the register map.
+
+The hook receives the unit ID and the request PDU. It returns false to
+have the request served from the map, or true once it has replaced the
+request with its own response and set u16Length to the response length;
+a length of 0 sends no response.
+
+@param hook function to call with each request
+@ingroup setup
+*/
+void ModbusTcpClient::onRequest(bool (*hook)(uint8_t u8Unit, uint8_t *au8Pdu,
+                                             uint16_t &u16Length)) {
+  _onRequest = hook;
+}
+
+/**
+Set a hook taking requests to answer later, e.g. after forwarding them to
+a serial bus. It runs after onRequest() and before the register map.
+
+The hook receives a ticket, the request PDU and its length. It returns
+false to leave the request to the map, or true once it has taken the
+request; the response is then sent by calling reply() with the ticket,
+from any thread.
+
+@param hook function to call with each request
+@ingroup setup
+*/
+void ModbusTcpClient::onForward(ModbusTcpForward hook) {
+  _onForward = std::move(hook);
+}
+
+/**
+Answer a request taken by the onForward() hook. May be called from any
+thread; the response is sent by the thread running poll().
+
+@param ticket ticket passed to the hook
+@param au8Pdu response PDU, function code first
+@param u16Length response length [bytes]
+@return false if the response is too long; a response to a connection
+closed meanwhile is dropped silently
+*/
+bool ModbusTcpClient::reply(const ModbusTcpTicket &ticket,
+                            const uint8_t *au8Pdu, uint16_t u16Length) {
+  if (!u16Length || u16Length > ku16MaxPDUSize)
+    return false;
+
+  // queued as connection ID, then the whole frame; the lock also keeps
+  // end() from closing _fdWake under the write
+  std::lock_guard<std::mutex> lock(_replyMutex);
+  size_t at = _replies.size();
+  _replies.resize(at + 4 + ku8MBAPHeaderSize + u16Length);
+  memcpy(&_replies[at], &ticket.u32Connection, 4);
+  mbap_encode(&_replies[at + 4], ticket.u16Transaction, ticket.u8Unit,
+              u16Length);
+  memcpy(&_replies[at + 4 + ku8MBAPHeaderSize], au8Pdu, u16Length);
+
+  uint64_t u64One = 1;
+  return _fdWake < 0 || write(_fdWake, &u64One, sizeof(u64One)) > 0 ||
+         errno == EAGAIN;
+}
+
+/**
+Accept connections, receive requests and send responses.
+
+@param timeoutMs time to wait for activity [milliseconds]; -1 to wait
+forever
+@return number of requests answered; -1 if the slave is not listening
+*/
+int ModbusTcpClient::poll(int timeoutMs) {
+  if (_fdEpoll < 0)
+    return -1;
+
+  struct epoll_event events[kEvents];
+  int n = epoll_wait(_fdEpoll, events, kEvents, timeoutMs);
+  if (n < 0)
+    return errno == EINTR ? 0 : -1;
+
+  int served = 0;
+  bool bWake = false;
+  for (int i = 0; i < n; i++) {
+    void *ptr = events[i].data.ptr;
+    if (!ptr) {
+      accept();
+      continue;
+    }
+    if (ptr == this) {
+      bWake = true;
+      continue;
+    }
+
+    Connection *connection = static_cast<Connection *>(ptr);
+    uint32_t u32Events = events[i].events;
+    if ((u32Events & EPOLLERR) ||
+        ((u32Events & EPOLLOUT) && !transmit(connection)) ||
+        ((u32Events & (EPOLLIN | EPOLLHUP | EPOLLRDHUP)) &&
+         !receive(connection))) {
+      drop(connection);
+      continue;
+    }
+    int count = process(connection);
+    if (count < 0 || !transmit(connection)) {
+      drop(connection);
+      continue;
+    }
+    served += count;
+    watch(connection);
+  }
+
+  // deliver() may drop connections, so it only runs once no event of the
+  // batch can point at them any more
+  if (bWake) {
+    uint64_t u64Count;
+    while (read(_fdWake, &u64Count, sizeof(u64Count)) > 0)
+      continue;
+    deliver();
+  }
+  return served;
+}
+
+/**
+Serve masters from a thread of its own until stop() or end().
+
+@return true if the thread has been started
+@ingroup setup
+*/
+bool ModbusTcpClient::start() {
+  if (_fdEpoll < 0 || _thread.joinable())
+    return false;
+  _bRunning = true;
+  _thread = std::thread([this]() {
+    while (_bRunning)
+      poll(-1);
+  });
+  return true;
+}
+
+/**
+Stop the thread of start(); connections stay open.
+
+@ingroup setup
+*/
+void ModbusTcpClient::stop() {
+  if (!_thread.joinable())
+    return;
+  _bRunning = false;
+  uint64_t u64One = 1;
+  if (write(_fdWake, &u64One, sizeof(u64One)) < 0)
+    return;
+  _thread.join();
+}
+
+/**
+Port the slave listens on, e.g. after begin() with port 0.
+
+@return TCP port; 0 if not listening
+*/
+uint16_t ModbusTcpClient::port() const {
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+  if (_fdListen < 0 ||
+      getsockname(_fdListen, (struct sockaddr *)&addr, &len))
+    return 0;
+  return ntohs(addr.sin_port);
+}
+
+void ModbusTcpClient::accept() {
+  for (;;) {
+    int fd = accept4(_fdListen, nullptr, nullptr,
+                     SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0)
+      return;
+    if (_u16Connections >= _u16MaxConnections) {
+      close(fd);
+      continue;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    Connection *connection = new Connection();
+    connection->fd = fd;
+    connection->u32Id = _u32NextId++;
+    connection->u32Events = EPOLLIN | EPOLLRDHUP;
+    connection->u16Rx = 0;
+    connection->txHead = 0;
+
+    struct epoll_event event;
+    event.events = connection->u32Events;
+    event.data.ptr = connection;
+    if (epoll_ctl(_fdEpoll, EPOLL_CTL_ADD, fd, &event)) {
+      close(fd);
+      delete connection;
+      continue;
+    }
+    connection->prev = nullptr;
+    connection->next = _connections;
+    if (_connections)
+      _connections->prev = connection;
+    _connections = connection;
+    _byId[connection->u32Id] = connection;
+    _u16Connections++;
+  }
+}
+
+// Send the responses passed to reply().
+void ModbusTcpClient::deliver() {
+  std::vector<uint8_t> replies;
+  {
+    std::lock_guard<std::mutex> lock(_replyMutex);
+    replies.swap(_replies);
+  }
+
+  std::vector<uint32_t> touched;
+  for (size_t at = 0; at < replies.size();) {
+    uint32_t u32Id;
+    memcpy(&u32Id, &replies[at], 4);
+    uint16_t u16Frame = mbap_frame_length(&replies[at + 4], 0xFFFF);
+    const uint8_t *au8Frame = &replies[at + 4];
+    at += 4 + u16Frame;
+
+    auto it = _byId.find(u32Id);
+    if (it == _byId.end())
+      continue;
+    Connection *connection = it->second;
+    connection->tx.insert(connection->tx.end(), au8Frame,
+                          au8Frame + u16Frame);
+    touched.push_back(u32Id);
+  }
+
+  // one send per connection for all of its responses
+  for (uint32_t u32Id : touched) {
+    auto it = _byId.find(u32Id);
+    if (it == _byId.end() || !it->second->backlog())
+      continue;
+    if (!transmit(it->second))
+      drop(it->second);
+    else
+      watch(it->second);
+  }
+}
+
+// Read what the socket holds; false once the master has gone.
+bool ModbusTcpClient::receive(Connection *connection) {
+  size_t free = sizeof(connection->au8Rx) - connection->u16Rx;
+  if (!free)
+    return true;
+
+  ssize_t n;
+  do {
+    n = recv(connection->fd, connection->au8Rx + connection->u16Rx, free, 0);
+  } while (n < 0 && errno == EINTR);
+  if (n > 0) {
+    connection->u16Rx += (uint16_t)n;
+    return true;
+  }
+  return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+// Answer every complete request of the receive buffer; -1 if the stream
+// can no longer be delimited.
+int ModbusTcpClient::process(Connection *connection) {
+  uint16_t u16Head = 0;
+  int served = 0;
+
+  while (connection->backlog() < kTxBacklog) {
+    const uint8_t *au8Frame = connection->au8Rx + u16Head;
+    uint16_t u16Frame =
+        mbap_frame_length(au8Frame, connection->u16Rx - u16Head);
+    if (u16Frame == 0xFFFF)
+      return -1;
+    if (!u16Frame || u16Frame > connection->u16Rx - u16Head)
+      break;
+    u16Head += u16Frame;
+
+    uint8_t u8Unit = au8Frame[6];
+    if (_i16Unit >= 0 && u8Unit != _i16Unit)
+      continue;
+
+    uint16_t u16Length = u16Frame - ku8MBAPHeaderSize;
+    memcpy(_au8Pdu, au8Frame + ku8MBAPHeaderSize, u16Length);
+    bool bAnswered = _onRequest && _onRequest(u8Unit, _au8Pdu, u16Length);
+    if (!bAnswered && _onForward &&
+        _onForward({connection->u32Id, mbap_transaction(au8Frame), u8Unit},
+                   _au8Pdu, u16Length))
+      continue;
+    if (!bAnswered) {
+      ModbusPduHandler pdu(_au8Pdu, sizeof(_au8Pdu), ku8MaxReadRegisters);
+      if (_mapMutex) {
+        std::lock_guard<std::mutex> lock(*_mapMutex);
+        pdu.serve(*_map, u16Length);
+      } else {
+        pdu.serve(*_map, u16Length);
+      }
+      u16Length = pdu.length();
+    }
+    if (!u16Length)
+      continue;
+
+    // the response echoes transaction and unit ID of the request
+    size_t at = connection->tx.size();
+    connection->tx.resize(at + ku8MBAPHeaderSize + u16Length);
+    mbap_encode(&connection->tx[at], mbap_transaction(au8Frame), u8Unit,
+                u16Length);
+    memcpy(&connection->tx[at + ku8MBAPHeaderSize], _au8Pdu, u16Length);
+    served++;
+  }
+
+  memmove(connection->au8Rx, connection->au8Rx + u16Head,
+          connection->u16Rx - u16Head);
+  connection->u16Rx -= u16Head;
+  return served;
+}
+
+// Send queued responses as far as the socket takes them; false on error.
+bool ModbusTcpClient::transmit(Connection *connection) {
+  while (connection->backlog()) {
+    ssize_t n = send(connection->fd, &connection->tx[connection->txHead],
+                     connection->backlog(), MSG_NOSIGNAL);
+    if (n > 0) {
+      connection->txHead += n;
+    } else if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return true;
+    } else {
+      return false;
+    }
+  }
+  connection->tx.clear();
+  connection->txHead = 0;
+  return true;
+}
+
+// Wait for output room while responses are queued, and stop reading while
+// the queue is full.
+void ModbusTcpClient::watch(Connection *connection) {
+  uint32_t u32Events = 0;
+  if (connection->backlog() < kTxBacklog)
+    u32Events |= EPOLLIN | EPOLLRDHUP;
+  if (connection->backlog())
+    u32Events |= EPOLLOUT;
+  if (u32Events == connection->u32Events)
+    return;
+
+  struct epoll_event event;
+  event.events = u32Events;
+  event.data.ptr = connection;
+  if (!epoll_ctl(_fdEpoll, EPOLL_CTL_MOD, connection->fd, &event))
+    connection->u32Events = u32Events;
+}
+
+void ModbusTcpClient::drop(Connection *connection) {
+  epoll_ctl(_fdEpoll, EPOLL_CTL_DEL, connection->fd, nullptr);
+  close(connection->fd);
+  _byId.erase(connection->u32Id);
+  if (connection->prev)
+    connection->prev->next = connection->next;
+  else
+    _connections = connection->next;
+  if (connection->next)
+    connection->next->prev = connection->prev;
+  delete connection;
+  _u16Connections--;
+}
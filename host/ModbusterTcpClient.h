@@ -0,0 +1,103 @@
+#ifndef MODBUSTER_TCP_CLIENT_H
+#define MODBUSTER_TCP_CLIENT_H
+
+#include "ModbusterMbap.h"
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace ModBuster {
+
+/**
+Identifies a request answered later with ModbusTcpClient::reply().
+*/
+struct ModbusTcpTicket {
+  uint32_t u32Connection; ///< connection the request arrived on
+  uint16_t u16Transaction; ///< MBAP transaction ID
+  uint8_t u8Unit;          ///< unit ID
+};
+
+/**
+Hook taking a request to answer later; returns false to leave it to the
+register map.
+*/
+typedef std::function<bool(const ModbusTcpTicket &ticket,
+                           const uint8_t *au8Pdu, uint16_t u16Length)>
+    ModbusTcpForward;
+
+/**
+Modbus TCP slave.
+
+Serves a ModbusRegisterMap to any number of TCP masters from one epoll
+loop, with the same PDU handlers as the RTU slave. Each connection keeps
+its own receive buffer, so requests split across segments or pipelined in
+one segment are both handled; answers to one read are sent with a single
+system call.
+*/
+class ModbusTcpClient {
+public:
+  ModbusTcpClient();
+  ~ModbusTcpClient();
+
+  bool begin(ModbusRegisterMap &map, uint16_t u16Port = ku16MBTcpPort,
+             const char *address = nullptr);
+  bool begin(uint16_t u16Port = ku16MBTcpPort, const char *address = nullptr);
+  void end();
+
+  void unitId(uint8_t u8Unit);
+  void maxConnections(uint16_t u16Max);
+  void guard(std::mutex &mutex);
+  void onRequest(bool (*)(uint8_t u8Unit, uint8_t *au8Pdu,
+                          uint16_t &u16Length));
+  void onForward(ModbusTcpForward hook);
+  bool reply(const ModbusTcpTicket &ticket, const uint8_t *au8Pdu,
+             uint16_t u16Length);
+
+  int poll(int timeoutMs);
+  bool start();
+  void stop();
+
+  uint16_t port() const;
+  uint16_t connections() const { return _u16Connections; }
+
+private:
+  struct Connection;
+
+  ModbusTcpClient(const ModbusTcpClient &) = delete;
+  ModbusTcpClient &operator=(const ModbusTcpClient &) = delete;
+
+  int _fdListen;                 ///< listening socket, -1 when closed
+  int _fdEpoll;                  ///< epoll instance
+  int _fdWake;                   ///< eventfd waking poll() for stop()
+  ModbusRegisterMap *_map;       ///< registers served
+  std::mutex *_mapMutex;         ///< held while a request touches _map
+  int16_t _i16Unit;              ///< unit ID served, -1 for any
+  uint16_t _u16MaxConnections;   ///< connections accepted at once
+  uint16_t _u16Connections;      ///< connections open
+  Connection *_connections;      ///< list of open connections
+  bool (*_onRequest)(uint8_t, uint8_t *, uint16_t &);
+  ModbusTcpForward _onForward;   ///< takes requests answered by reply()
+  uint32_t _u32NextId;           ///< ID of the next connection accepted
+  std::unordered_map<uint32_t, Connection *> _byId; ///< open connections
+  std::mutex _replyMutex;        ///< guards _replies
+  std::vector<uint8_t> _replies; ///< frames passed to reply(), ID first
+  std::atomic<bool> _bRunning;   ///< start() thread keeps polling
+  std::thread _thread;           ///< thread of start()
+  uint8_t _au8Pdu[ku16MaxPDUSize]; ///< request, then response
+
+  void accept();
+  void deliver();
+  bool receive(Connection *connection);
+  int process(Connection *connection);
+  bool transmit(Connection *connection);
+  void watch(Connection *connection);
+  void drop(Connection *connection);
+};
+
+} // namespace ModBuster
+
+#endif // MODBUSTER_TCP_CLIENT_H
@@ -0,0 +1,527 @@
+#include "ModbusterTcpServer.h"
+
+#include "Arduino.h"
+
+#include <algorithm>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace ModBuster;
+
+// Pause after a failed connection attempt; requests to the target fail
+// right away meanwhile [milliseconds]
+static const uint32_t kRetryMs = 1000;
+
+// epoll_wait() batch size
+static const int kEvents = 64;
+
+struct ModbusTcpServer::Request : ModbusRequest {
+  Target *target;                           ///< slave addressed
+  uint16_t u16Transaction;                  ///< MBAP transaction ID
+  uint32_t u32Deadline;                     ///< millis() of the timeout
+};
+
+struct ModbusTcpServer::Link {
+  int fd;                                   ///< socket
+  Target *target;                           ///< slave connected to
+  bool bConnected;                          ///< connect() has completed
+  bool bDirty;                              ///< listed in _dirty
+  uint32_t u32Events;                       ///< epoll events registered
+  uint16_t u16NextTransaction;              ///< next MBAP transaction ID
+  uint16_t u16Rx;                           ///< bytes in au8Rx
+  uint8_t au8Rx[2 * ku16MaxTcpADUSize];     ///< responses received so far
+  std::vector<uint8_t> tx;                  ///< requests not yet sent
+  size_t txHead;                            ///< first unsent byte of tx
+  std::deque<Request *> inFlight;           ///< sent, awaiting response
+
+  size_t backlog() const { return tx.size() - txHead; }
+};
+
+struct ModbusTcpServer::Target {
+  struct sockaddr_in addr;                  ///< slave address
+  std::deque<Request *> queue;              ///< requests not yet sent
+  std::vector<Link *> links;                ///< connection pool
+  uint32_t u32RetryAt;                      ///< millis() of next attempt
+  bool bBackoff;                            ///< last attempt failed
+};
+
+// true once millis() has reached u32Time
+static bool reached(uint32_t u32Now, uint32_t u32Time) {
+  return (int32_t)(u32Now - u32Time) >= 0;
+}
+
+ModbusTcpServer::ModbusTcpServer()
+    : _fdEpoll(-1), _u16ResponseTimeout(ku16MBResponseTimeout),
+      _u8PipelineDepth(16), _u8Connections(1), _pending(0) {}
+
+ModbusTcpServer::~ModbusTcpServer() { end(); }
+
+/**
+Initialize the event loop.
+
+@return true on success
+@ingroup setup
+*/
+bool ModbusTcpServer::begin() {
+  end();
+  _fdEpoll = epoll_create1(EPOLL_CLOEXEC);
+  return _fdEpoll >= 0;
+}
+
+/**
+Close every connection and forget targets and pending requests; their
+callbacks are not called.
+
+@ingroup setup
+*/
+void ModbusTcpServer::end() {
+  for (Target *target : _targets) {
+    for (Link *link : target->links) {
+      close(link->fd);
+      for (Request *request : link->inFlight)
+        delete request;
+      delete link;
+    }
+    for (Request *request : target->queue)
+      delete request;
+    delete target;
+  }
+  for (Request *request : _done)
+    delete request;
+  for (Request *request : _free)
+    delete request;
+  _targets.clear();
+  _dirty.clear();
+  _done.clear();
+  _free.clear();
+  _pending = 0;
+  if (_fdEpoll >= 0)
+    close(_fdEpoll);
+  _fdEpoll = -1;
+}
+
+/**
+Register a slave; connections are opened when the first request is made.
+
+@param host IPv4 address or host name
+@param u16Port TCP port
+@return target handle for the request functions; -1 if the host cannot be
+resolved
+@ingroup setup
+*/
+int ModbusTcpServer::addTarget(const char *host, uint16_t u16Port) {
+  struct addrinfo hints, *result;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host, nullptr, &hints, &result))
+    return -1;
+
+  Target *target = new Target();
+  memcpy(&target->addr, result->ai_addr, sizeof(target->addr));
+  target->addr.sin_port = htons(u16Port);
+  target->u32RetryAt = 0;
+  target->bBackoff = false;
+  freeaddrinfo(result);
+
+  _targets.push_back(target);
+  return (int)_targets.size() - 1;
+}
+
+/**
+Set the time a request may take, from the call queueing it to its
+response, including the connection set-up.
+
+@param u16TimeoutMs timeout [milliseconds] (default 2000)
+@ingroup setup
+*/
+void ModbusTcpServer::setResponseTimeOut(uint16_t u16TimeoutMs) {
+  _u16ResponseTimeout = u16TimeoutMs;
+}
+
+/**
+Set the number of requests sent on a connection before the first of them
+has been answered.
+
+@param u8Depth requests in flight per connection (1..255, default 16); 1
+waits for each response before sending the next request
+@ingroup setup
+*/
+void ModbusTcpServer::pipelineDepth(uint8_t u8Depth) {
+  _u8PipelineDepth = u8Depth ? u8Depth : 1;
+}
+
+/**
+Set the size of the connection pool of each target. Further connections
+are opened while every open one has pipelineDepth() requests in flight.
+
+@param u8Connections connections per target (1..255, default 1)
+@ingroup setup
+*/
+void ModbusTcpServer::connectionsPerTarget(uint8_t u8Connections) {
+  _u8Connections = u8Connections ? u8Connections : 1;
+}
+
+/**
+Send queued requests, receive responses and report completions.
+
+@param timeoutMs time to wait for activity [milliseconds]; -1 to wait
+forever
+@return number of callbacks called; -1 if begin() has not been called
+*/
+int ModbusTcpServer::poll(int timeoutMs) {
+  if (_fdEpoll < 0)
+    return -1;
+
+  flush();
+  uint32_t u32Now = millis();
+  int wait = _done.empty() ? nextTimeout(u32Now, timeoutMs) : 0;
+
+  struct epoll_event events[kEvents];
+  int n = epoll_wait(_fdEpoll, events, kEvents, wait);
+  for (int i = 0; i < n; i++) {
+    Link *link = static_cast<Link *>(events[i].data.ptr);
+    uint32_t u32Events = events[i].events;
+
+    if (!link->bConnected) {
+      int error = 0;
+      socklen_t len = sizeof(error);
+      if (getsockopt(link->fd, SOL_SOCKET, SO_ERROR, &error, &len) || error)
+        fail(link, ku8MBConnectionFailed);
+      else if (u32Events & (EPOLLOUT | EPOLLERR | EPOLLHUP))
+        established(link);
+      continue;
+    }
+    if ((u32Events & EPOLLERR) ||
+        ((u32Events & (EPOLLIN | EPOLLHUP)) && !receive(link)) ||
+        ((u32Events & EPOLLOUT) && !transmit(link))) {
+      fail(link, ku8MBConnectionFailed);
+      continue;
+    }
+    watch(link);
+  }
+
+  expire(millis());
+  int count = report();
+  flush();
+  return count;
+}
+
+/* _____PRIVATE FUNCTIONS____________________________________________________ */
+
+// A fresh request for a target, function code in place.
+ModbusRequest *ModbusTcpServer::request(int target, uint8_t u8Unit,
+                                        uint8_t u8Function) {
+  if (_fdEpoll < 0 || target < 0 || target >= (int)_targets.size())
+    return nullptr;
+
+  Request *request;
+  if (_free.empty()) {
+    request = new Request();
+  } else {
+    request = _free.back();
+    _free.pop_back();
+  }
+  request->target = _targets[target];
+  request->u8Unit = u8Unit;
+  request->u16Qty = 0;
+  request->u16Count = 0;
+  request->u8Status = ku8MBSuccess;
+  request->au8Pdu[PDU_FUNC] = u8Function;
+  return request;
+}
+
+bool ModbusTcpServer::submit(ModbusRequest *pending) {
+  Request *request = static_cast<Request *>(pending);
+  uint32_t u32Now = millis();
+  request->u32Deadline = u32Now + _u16ResponseTimeout;
+  request->target->queue.push_back(request);
+  _pending++;
+  dispatch(request->target, u32Now);
+  return true;
+}
+
+// Move queued requests onto the least busy connection with room, opening
+// connections as needed.
+void ModbusTcpServer::dispatch(Target *target, uint32_t u32Now) {
+  while (!target->queue.empty()) {
+    Link *best = nullptr;
+    bool bConnecting = false;
+    for (Link *link : target->links) {
+      if (!link->bConnected)
+        bConnecting = true;
+      else if (link->inFlight.size() < _u8PipelineDepth &&
+               (!best || link->inFlight.size() < best->inFlight.size()))
+        best = link;
+    }
+
+    if (!best) {
+      if (bConnecting || target->links.size() >= _u8Connections)
+        return;
+      if (target->bBackoff && !reached(u32Now, target->u32RetryAt)) {
+        // the slave is unreachable; fail rather than wait for a timeout
+        if (target->links.empty()) {
+          while (!target->queue.empty()) {
+            Request *request = target->queue.front();
+            target->queue.pop_front();
+            complete(request, ku8MBConnectionFailed, nullptr, 0);
+          }
+        }
+        return;
+      }
+      if (!connect(target)) {
+        target->bBackoff = true;
+        target->u32RetryAt = u32Now + kRetryMs;
+      }
+      continue;
+    }
+
+    Request *request = target->queue.front();
+    target->queue.pop_front();
+    request->u16Transaction = best->u16NextTransaction++;
+
+    size_t at = best->tx.size();
+    best->tx.resize(at + ku8MBAPHeaderSize + request->u16Length);
+    mbap_encode(&best->tx[at], request->u16Transaction, request->u8Unit,
+                request->u16Length);
+    memcpy(&best->tx[at + ku8MBAPHeaderSize], request->au8Pdu,
+           request->u16Length);
+    best->inFlight.push_back(request);
+    if (!best->bDirty) {
+      best->bDirty = true;
+      _dirty.push_back(best);
+    }
+  }
+}
+
+bool ModbusTcpServer::connect(Target *target) {
+  int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return false;
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  if (::connect(fd, (struct sockaddr *)&target->addr, sizeof(target->addr)) &&
+      errno != EINPROGRESS) {
+    close(fd);
+    return false;
+  }
+
+  Link *link = new Link();
+  link->fd = fd;
+  link->target = target;
+  link->bConnected = false;
+  link->bDirty = false;
+  link->u32Events = EPOLLOUT;
+  link->u16NextTransaction = 1;
+  link->u16Rx = 0;
+  link->txHead = 0;
+
+  struct epoll_event event;
+  event.events = link->u32Events;
+  event.data.ptr = link;
+  if (epoll_ctl(_fdEpoll, EPOLL_CTL_ADD, fd, &event)) {
+    close(fd);
+    delete link;
+    return false;
+  }
+  target->links.push_back(link);
+  return true;
+}
+
+void ModbusTcpServer::established(Link *link) {
+  link->bConnected = true;
+  link->target->bBackoff = false;
+  dispatch(link->target, millis());
+  watch(link);
+}
+
+// Read responses and complete their requests; false once the slave has
+// gone or the stream can no longer be delimited.
+bool ModbusTcpServer::receive(Link *link) {
+  size_t free = sizeof(link->au8Rx) - link->u16Rx;
+  ssize_t n;
+  do {
+    n = recv(link->fd, link->au8Rx + link->u16Rx, free, 0);
+  } while (n < 0 && errno == EINTR);
+  if (n == 0)
+    return false;
+  if (n < 0)
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+  link->u16Rx += (uint16_t)n;
+
+  uint16_t u16Head = 0;
+  for (;;) {
+    const uint8_t *au8Frame = link->au8Rx + u16Head;
+    uint16_t u16Frame = mbap_frame_length(au8Frame, link->u16Rx - u16Head);
+    if (u16Frame == 0xFFFF)
+      return false;
+    if (!u16Frame || u16Frame > link->u16Rx - u16Head)
+      break;
+    u16Head += u16Frame;
+
+    // responses may arrive in any order; late ones match nothing
+    uint16_t u16Transaction = mbap_transaction(au8Frame);
+    auto it = std::find_if(link->inFlight.begin(), link->inFlight.end(),
+                           [u16Transaction](const Request *request) {
+                             return request->u16Transaction == u16Transaction;
+                           });
+    if (it == link->inFlight.end())
+      continue;
+    Request *request = *it;
+    link->inFlight.erase(it);
+    if (au8Frame[6] != request->u8Unit)
+      complete(request, ku8MBInvalidSlaveID, nullptr, 0);
+    else
+      complete(request, ku8MBSuccess, au8Frame + ku8MBAPHeaderSize,
+               u16Frame - ku8MBAPHeaderSize);
+  }
+  memmove(link->au8Rx, link->au8Rx + u16Head, link->u16Rx - u16Head);
+  link->u16Rx -= u16Head;
+
+  // answered requests made room for queued ones
+  dispatch(link->target, millis());
+  return true;
+}
+
+bool ModbusTcpServer::transmit(Link *link) {
+  while (link->backlog()) {
+    ssize_t n = send(link->fd, &link->tx[link->txHead], link->backlog(),
+                     MSG_NOSIGNAL);
+    if (n > 0) {
+      link->txHead += n;
+    } else if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      return true;
+    } else {
+      return false;
+    }
+  }
+  link->tx.clear();
+  link->txHead = 0;
+  return true;
+}
+
+// Wait for output room only while requests are left unsent.
+void ModbusTcpServer::watch(Link *link) {
+  uint32_t u32Events = EPOLLIN;
+  if (link->backlog())
+    u32Events |= EPOLLOUT;
+  if (u32Events == link->u32Events)
+    return;
+  struct epoll_event event;
+  event.events = u32Events;
+  event.data.ptr = link;
+  if (!epoll_ctl(_fdEpoll, EPOLL_CTL_MOD, link->fd, &event))
+    link->u32Events = u32Events;
+}
+
+// Send the requests dispatched since the last call, one system call per
+// connection.
+void ModbusTcpServer::flush() {
+  std::vector<Link *> dirty;
+  dirty.swap(_dirty);
+  for (Link *link : dirty) {
+    link->bDirty = false;
+    if (!link->bConnected)
+      continue;
+    if (!transmit(link))
+      fail(link, ku8MBConnectionFailed);
+    else
+      watch(link);
+  }
+}
+
+// Decode a response, or record a failure, and queue the completion.
+void ModbusTcpServer::complete(Request *request, uint8_t u8Status,
+                               const uint8_t *au8Pdu, uint16_t u16Length) {
+  request->complete(u8Status, au8Pdu, u16Length);
+  _done.push_back(request);
+}
+
+// Close a connection; its requests in flight complete with u8Status and
+// the queued ones move to another connection.
+void ModbusTcpServer::fail(Link *link, uint8_t u8Status) {
+  Target *target = link->target;
+  if (!link->bConnected) {
+    target->bBackoff = true;
+    target->u32RetryAt = millis() + kRetryMs;
+  }
+
+  epoll_ctl(_fdEpoll, EPOLL_CTL_DEL, link->fd, nullptr);
+  close(link->fd);
+  for (Request *request : link->inFlight)
+    complete(request, u8Status, nullptr, 0);
+  target->links.erase(
+      std::find(target->links.begin(), target->links.end(), link));
+  if (link->bDirty)
+    _dirty.erase(std::find(_dirty.begin(), _dirty.end(), link));
+  delete link;
+
+  dispatch(target, millis());
+}
+
+// Time out requests, whether queued or in flight.
+void ModbusTcpServer::expire(uint32_t u32Now) {
+  for (Target *target : _targets) {
+    while (!target->queue.empty() &&
+           reached(u32Now, target->queue.front()->u32Deadline)) {
+      complete(target->queue.front(), ku8MBResponseTimedOut, nullptr, 0);
+      target->queue.pop_front();
+    }
+    for (Link *link : target->links) {
+      for (auto it = link->inFlight.begin(); it != link->inFlight.end();) {
+        if (reached(u32Now, (*it)->u32Deadline)) {
+          complete(*it, ku8MBResponseTimedOut, nullptr, 0);
+          it = link->inFlight.erase(it);
+        } else {
+          ++it;
+        }
+      }
+    }
+    dispatch(target, u32Now);
+  }
+}
+
+// Call the callbacks of completed requests, which may queue new ones.
+int ModbusTcpServer::report() {
+  std::vector<Request *> done;
+  done.swap(_done);
+  for (Request *request : done) {
+    _pending--;
+    request->report();
+    _free.push_back(request);
+  }
+  return (int)done.size();
+}
+
+// Time poll() may sleep before the earliest request deadline.
+int ModbusTcpServer::nextTimeout(uint32_t u32Now, int timeoutMs) const {
+  bool bAny = false;
+  uint32_t u32First = 0;
+  auto consider = [&](const Request *request) {
+    if (!bAny || (int32_t)(request->u32Deadline - u32First) < 0)
+      u32First = request->u32Deadline;
+    bAny = true;
+  };
+  for (const Target *target : _targets) {
+    if (!target->queue.empty())
+      consider(target->queue.front());
+    for (const Link *link : target->links) {
+      if (!link->inFlight.empty())
+        consider(link->inFlight.front());
+    }
+  }
+  if (!bAny)
+    return timeoutMs;
+
+  int32_t i32Left = (int32_t)(u32First - u32Now);
+  int left = i32Left > 0 ? (int)i32Left : 0;
+  return timeoutMs < 0 || left < timeoutMs ? left : timeoutMs;
+}
@@ -0,0 +1,83 @@
+#ifndef MODBUSTER_TCP_SERVER_H
+#define MODBUSTER_TCP_SERVER_H
+
+#include "ModbusterAsync.h"
+#include "ModbusterMbap.h"
+
+#include <deque>
+#include <stddef.h>
+#include <vector>
+
+namespace ModBuster {
+
+// Completion of a ModbusTcpServer request
+typedef ModbusCallback ModbusTcpCallback;
+
+/**
+Pipelined Modbus TCP master.
+
+Requests to any number of slaves are queued without blocking and sent
+ahead of their responses, up to pipelineDepth() per connection; responses
+are matched to requests by the MBAP transaction ID, in whatever order they
+arrive. Each target keeps a pool of connectionsPerTarget() connections.
+The request functions are those of ModbusAsyncServer; their first argument
+is a handle returned by addTarget().
+
+Everything, callbacks included, runs in the thread calling poll(); the
+object is not thread-safe.
+*/
+class ModbusTcpServer : public ModbusAsyncServer {
+public:
+  ModbusTcpServer();
+  ~ModbusTcpServer();
+
+  bool begin();
+  void end();
+
+  int addTarget(const char *host, uint16_t u16Port = ku16MBTcpPort);
+  void setResponseTimeOut(uint16_t u16TimeoutMs);
+  void pipelineDepth(uint8_t u8Depth);
+  void connectionsPerTarget(uint8_t u8Connections);
+
+  int poll(int timeoutMs);
+  size_t pending() const { return _pending; }
+
+private:
+  struct Request;
+  struct Link;
+  struct Target;
+
+  ModbusTcpServer(const ModbusTcpServer &) = delete;
+  ModbusTcpServer &operator=(const ModbusTcpServer &) = delete;
+
+  int _fdEpoll;                    ///< epoll instance, -1 when closed
+  uint16_t _u16ResponseTimeout;    ///< request deadline [milliseconds]
+  uint8_t _u8PipelineDepth;        ///< requests in flight per connection
+  uint8_t _u8Connections;          ///< connections per target
+  size_t _pending;                 ///< requests not completed yet
+  std::vector<Target *> _targets;  ///< slaves, indexed by addTarget()
+  std::vector<Link *> _dirty;      ///< connections with unsent requests
+  std::vector<Request *> _done;    ///< completions to report
+  std::vector<Request *> _free;    ///< recycled requests
+
+  ModbusRequest *request(int target, uint8_t u8Unit,
+                         uint8_t u8Function) override;
+  bool submit(ModbusRequest *request) override;
+  void dispatch(Target *target, uint32_t u32Now);
+  bool connect(Target *target);
+  void established(Link *link);
+  bool receive(Link *link);
+  bool transmit(Link *link);
+  void watch(Link *link);
+  void complete(Request *request, uint8_t u8Status, const uint8_t *au8Pdu,
+                uint16_t u16Length);
+  void fail(Link *link, uint8_t u8Status);
+  void flush();
+  void expire(uint32_t u32Now);
+  int report();
+  int nextTimeout(uint32_t u32Now, int timeoutMs) const;
+};
+
+} // namespace ModBuster
+
+#endif // MODBUSTER_TCP_SERVER_H
@@ -0,0 +1,155 @@
+/*
+
+  gateway_loopback.cpp - runs a ModbusGateway between a pipelined Modbus
+  TCP master and two RTU slaves on pseudo-terminal pairs.
+
+  Units 1 and 2 are routed to bus 0, unit 3 to bus 1; only units 1 and 3
+  answer. The master reads and writes through the gateway, then checks
+  the gateway exceptions: 0x0B for the silent unit 2, 0x0A for the
+  unrouted unit 9 and for requests beyond the queue limit.
+
+*/
+
+#include "ModbusterClient.h"
+#include "ModbusterGateway.h"
+#include "ModbusterPosix.h"
+#include "ModbusterTcpServer.h"
+
+#include <atomic>
+#include <stdio.h>
+#include <thread>
+
+using namespace ModBuster;
+
+static std::atomic<bool> stop(false);
+
+// RTU slave serving one map until stop
+static void slave(PosixStream *serial, uint8_t u8Unit, ModbusRegisterMap *map) {
+  ModbusClient rtu;
+  rtu.begin(u8Unit, *serial);
+  while (!stop) {
+    uint32_t u32Timeout = rtu.pollTimeout();
+    serial->waitAvailable(u32Timeout < 10000 ? u32Timeout : 10000);
+    uint8_t result;
+    rtu.poll(*map, result);
+  }
+}
+
+// submit a read of one holding register, counting the statuses seen
+static void readOne(ModbusTcpServer &master, uint8_t u8Unit,
+                    uint16_t u16Address, int counts[256]) {
+  master.readHoldingRegisters(
+      0, u8Unit, u16Address, 1,
+      [counts](uint8_t u8Status, const uint16_t *, uint16_t) {
+        counts[u8Status]++;
+      });
+}
+
+static void drain(ModbusTcpServer &master) {
+  while (master.pending())
+    master.poll(-1);
+}
+
+int main() {
+  uint16_t au16Holding[2][10];
+  ModbusRegion regions[2][1];
+  ModbusRegisterMap map0(regions[0], 1), map1(regions[1], 1);
+  for (uint16_t i = 0; i < 10; i++) {
+    au16Holding[0][i] = 100 + i;
+    au16Holding[1][i] = 300 + i;
+  }
+  map0.addHoldingRegisters(0, 10, au16Holding[0]);
+  map1.addHoldingRegisters(0, 10, au16Holding[1]);
+
+  PosixStream gatewaySide[2], slaveSide[2];
+  for (int bus = 0; bus < 2; bus++) {
+    if (!PosixStream::openPtyPair(gatewaySide[bus], slaveSide[bus])) {
+      perror("pty");
+      return 1;
+    }
+  }
+  std::thread slave0(slave, &slaveSide[0], 1, &map0);
+  std::thread slave1(slave, &slaveSide[1], 3, &map1);
+
+  ModbusGateway gateway;
+  for (int bus = 0; bus < 2; bus++) {
+    gateway.addBus(gatewaySide[bus]);
+    gateway.master(bus).timing().begin(115200);
+    gateway.master(bus).setResponseTimeOut(50);
+  }
+  gateway.route(1, 2, 0);
+  gateway.route(3, 3, 1);
+  gateway.queueLimit(8);
+  if (!gateway.begin(0, "127.0.0.1")) {
+    perror("listen");
+    return 1;
+  }
+
+  ModbusTcpServer master;
+  master.begin();
+  master.setResponseTimeOut(2000);
+  master.addTarget("127.0.0.1", gateway.port());
+
+  int failures = 0;
+  auto expect = [&failures](bool ok, const char *what) {
+    printf("%-40s %s\n", what, ok ? "ok" : "FAILED");
+    failures += !ok;
+  };
+
+  // reads and writes on both buses
+  uint16_t au16Read[2] = {0, 0};
+  master.readHoldingRegisters(
+      0, 1, 2, 1, [&au16Read](uint8_t u8Status, const uint16_t *au16Data,
+                              uint16_t) {
+        au16Read[0] = u8Status == ku8MBSuccess ? au16Data[0] : 0;
+      });
+  master.readHoldingRegisters(
+      0, 3, 2, 1, [&au16Read](uint8_t u8Status, const uint16_t *au16Data,
+                              uint16_t) {
+        au16Read[1] = u8Status == ku8MBSuccess ? au16Data[0] : 0;
+      });
+  drain(master);
+  expect(au16Read[0] == 102 && au16Read[1] == 302, "read unit 1 and unit 3");
+
+  uint8_t u8Written = 0xFF;
+  master.writeSingleRegister(0, 3, 5, 0x1234,
+                             [&u8Written](uint8_t u8Status, const uint16_t *,
+                                          uint16_t) { u8Written = u8Status; });
+  drain(master);
+  expect(u8Written == ku8MBSuccess && au16Holding[1][5] == 0x1234,
+         "write unit 3");
+
+  // gateway exceptions
+  static int counts[256];
+  readOne(master, 2, 0, counts);
+  drain(master);
+  expect(counts[ku8MBGatewayTargetFailed] == 1, "silent unit 2: 0x0B");
+
+  readOne(master, 9, 0, counts);
+  drain(master);
+  expect(counts[ku8MBGatewayPathUnavailable] == 1, "unrouted unit 9: 0x0A");
+
+  // a burst larger than the queue: the excess is refused, the rest served
+  master.pipelineDepth(32);
+  for (int i = 0; i < 32; i++)
+    readOne(master, 1, 0, counts);
+  drain(master);
+  expect(counts[ku8MBSuccess] == 32 - (counts[ku8MBGatewayPathUnavailable] - 1)
+             && counts[ku8MBGatewayPathUnavailable] > 1,
+         "burst of 32, queue of 8: excess 0x0A");
+
+  for (int bus = 0; bus < gateway.buses(); bus++) {
+    ModbusGatewayStats s = gateway.stats(bus);
+    printf("bus %d: %u forwarded, %u answered, %u failed, %u refused, "
+           "max queue %u, max wait %.1f ms\n",
+           bus, s.u32Forwarded, s.u32Answered, s.u32Failed, s.u32Rejected,
+           s.u16MaxQueued, s.u32MaxWaitUs / 1000.0);
+  }
+
+  master.end();
+  gateway.end();
+  stop = true;
+  slave0.join();
+  slave1.join();
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,130 @@
+/*
+
+  multiport_scan.cpp - scans several RTU buses one after the other with a
+  ModbusServer each, then all at once with a ModbusMultiServer.
+
+  usage: multiport_scan [ports] [baud]
+
+  Every bus is a pseudo-terminal pair with a ModbusClient (slave) thread on
+  the far side. Pseudo-terminals carry bytes at once, so the slaves hold
+  each response for the time it would spend on a line of the given speed.
+  A scan reads four blocks of 32 holding registers from every bus.
+
+*/
+
+#include "ModbusterClient.h"
+#include "ModbusterMultiServer.h"
+#include "ModbusterServer.h"
+
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <vector>
+
+using namespace ModBuster;
+
+// Slave side of a simulated line: writes take as long as on the wire.
+class LineStream : public PosixStream {
+public:
+  uint32_t u32CharUs = 0;
+
+  size_t write(const uint8_t *buffer, size_t size) override {
+    delayMicroseconds(size * u32CharUs);
+    return PosixStream::write(buffer, size);
+  }
+};
+
+static std::atomic<bool> stop(false);
+
+static void slave(LineStream *serial, ModbusRegisterMap *map) {
+  ModbusClient rtu;
+  rtu.begin(1, *serial);
+  while (!stop) {
+    uint32_t u32Timeout = rtu.pollTimeout();
+    serial->waitAvailable(u32Timeout < 10000 ? u32Timeout : 10000);
+    uint8_t result;
+    rtu.poll(*map, result);
+  }
+}
+
+int main(int argc, char **argv) {
+  int ports = argc > 1 ? atoi(argv[1]) : 8;
+  uint32_t u32Baud = argc > 2 ? (uint32_t)atol(argv[2]) : 19200;
+
+  static uint16_t au16Holding[128];
+  for (uint16_t i = 0; i < 128; i++)
+    au16Holding[i] = i;
+  ModbusRegion regions[1];
+  ModbusRegisterMap map(regions, 1);
+  map.addHoldingRegisters(0, 128, au16Holding);
+
+  std::vector<PosixStream *> lines;
+  std::vector<LineStream *> fars;
+  std::vector<std::thread> slaves;
+  for (int i = 0; i < ports; i++) {
+    PosixStream *line = new PosixStream();
+    LineStream *far = new LineStream();
+    if (!PosixStream::openPtyPair(*line, *far)) {
+      perror("pty");
+      return 1;
+    }
+    far->u32CharUs = ku8RTUCharBits * 1000000UL / u32Baud;
+    lines.push_back(line);
+    fars.push_back(far);
+    slaves.emplace_back(slave, far, &map);
+  }
+
+  int failures = 0;
+
+  // one bus after the other
+  uint32_t u32Start = micros();
+  for (int i = 0; i < ports; i++) {
+    ModbusServer master;
+    master.begin(1, *lines[i]);
+    master.timing().begin(u32Baud);
+    for (uint16_t u16Block = 0; u16Block < 4; u16Block++) {
+      if (master.readHoldingRegisters(32 * u16Block, 32) != ku8MBSuccess ||
+          master.getResponseBuffer(0) != 32 * u16Block)
+        failures++;
+    }
+  }
+  uint32_t u32Serial = micros() - u32Start;
+
+  // every bus at once
+  ModbusMultiServer multi;
+  multi.begin();
+  for (int i = 0; i < ports; i++)
+    multi.addPort(*lines[i], u32Baud);
+  u32Start = micros();
+  for (int i = 0; i < ports; i++) {
+    for (uint16_t u16Block = 0; u16Block < 4; u16Block++) {
+      multi.readHoldingRegisters(
+          i, 1, 32 * u16Block, 32,
+          [&failures, u16Block](uint8_t u8Status, const uint16_t *au16Data,
+                                uint16_t u16Count) {
+            if (u8Status != ku8MBSuccess || u16Count != 32 ||
+                au16Data[0] != 32 * u16Block)
+              failures++;
+          });
+    }
+  }
+  while (multi.pending())
+    multi.poll(-1);
+  uint32_t u32Multi = micros() - u32Start;
+
+  printf("%d buses at %u bit/s, %d requests per scan\n", ports, u32Baud,
+         4 * ports);
+  printf("  one bus at a time: %8.2f ms\n", u32Serial / 1000.0);
+  printf("  all buses at once: %8.2f ms\n", u32Multi / 1000.0);
+  printf("  failures: %d\n", failures);
+
+  multi.end();
+  stop = true;
+  for (int i = 0; i < ports; i++) {
+    slaves[i].join();
+    delete fars[i];
+    delete lines[i];
+  }
+  return failures ? 1 : 0;
+}
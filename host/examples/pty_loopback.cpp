@@ -0,0 +1,135 @@
+/*
+
+  pty_loopback.cpp - runs a ModbusServer (master) and a ModbusClient
+  (slave) on the two sides of a pseudo-terminal, so the whole RTU stack can
+  be exercised on a Linux machine without serial hardware. Both sides
+  record ModbusMetrics, printed at the end. With a file name as argument,
+  the frames of both sides are traced and dumped there for modbus_trace.
+
+*/
+
+#include "ModbusterClient.h"
+#include "ModbusterPosix.h"
+#include "ModbusterServer.h"
+
+#include <atomic>
+#include <fcntl.h>
+#include <stdio.h>
+#include <thread>
+
+using namespace ModBuster;
+
+static void printStats(const char *name, const ModbusStats &stats) {
+  printf("%-8s %5u %5u %4u %4u %4u %4u %7u %7u %8u %8u %8u\n", name,
+         (unsigned)stats.u32Requests, (unsigned)stats.u32Responses,
+         (unsigned)stats.u32Exceptions, (unsigned)stats.u32CrcErrors,
+         (unsigned)stats.u32Timeouts, (unsigned)stats.u32Errors,
+         (unsigned)stats.u32BytesSent, (unsigned)stats.u32BytesReceived,
+         (unsigned)stats.firstByte.percentile(50),
+         (unsigned)stats.turnaround.percentile(50),
+         (unsigned)stats.turnaround.percentile(99));
+}
+
+static void printMetrics(const char *title, const ModbusMetrics &metrics) {
+  static const uint8_t au8Functions[] = {
+      ku8MBReadHoldingRegisters, ku8MBWriteMultipleRegisters,
+      ku8MBMaskWriteRegister};
+  char name[16];
+
+  printf("%s\n%-8s %5s %5s %4s %4s %4s %4s %7s %7s %8s %8s %8s\n", title, "",
+         "req", "resp", "exc", "crc", "tmo", "err", "tx", "rx", "first50",
+         "turn50", "turn99");
+  printStats("total", metrics.total());
+  for (uint8_t u8Function : au8Functions) {
+    snprintf(name, sizeof(name), "FC%02X", u8Function);
+    printStats(name, metrics.function(u8Function));
+  }
+  for (uint8_t i = 0; i < metrics.slaveCount(); i++) {
+    snprintf(name, sizeof(name), "slave %u", metrics.slaveAt(i).u8Slave);
+    printStats(name, metrics.slaveAt(i).stats);
+  }
+}
+
+int main(int argc, char **argv) {
+  PosixStream masterPort, slavePort;
+  if (!PosixStream::openPtyPair(masterPort, slavePort)) {
+    perror("openPtyPair");
+    return 1;
+  }
+
+  std::atomic<bool> stop(false);
+  uint16_t regs[16] = {0};
+  ModbusSlaveStats slaveTable[1], masterTable[4];
+  ModbusMetrics slaveMetrics(slaveTable, 1), masterMetrics(masterTable, 4);
+  // one ring per side: a tracer belongs to the thread recording into it
+  static uint8_t au8SlaveRing[1024], au8MasterRing[1024];
+  ModbusTracer slaveTracer(au8SlaveRing, sizeof(au8SlaveRing));
+  ModbusTracer masterTracer(au8MasterRing, sizeof(au8MasterRing));
+  bool bTrace = argc > 1;
+
+  std::thread slave([&]() {
+    ModbusClient client;
+    client.begin(1, slavePort);
+    client.setMetrics(&slaveMetrics);
+    if (bTrace)
+      client.setTracer(&slaveTracer, 1);
+    while (!stop) {
+      // sleep until the master talks to us or the pending frame is sealed
+      uint32_t u32Timeout = client.pollTimeout();
+      slavePort.waitAvailable(u32Timeout < 100000 ? u32Timeout : 100000);
+      uint8_t result;
+      client.poll(regs, 16, result);
+    }
+  });
+
+  ModbusServer master;
+  master.begin(1, masterPort);
+  master.setResponseTimeOut(500);
+  master.setMetrics(&masterMetrics);
+  if (bTrace)
+    master.setTracer(&masterTracer, 0);
+
+  int failures = 0;
+  for (uint16_t i = 0; i < 4; i++)
+    master.setTransmitBuffer(i, 0x1111 * (i + 1));
+  uint8_t result = master.writeMultipleRegisters(2, 4);
+  printf("write 4 registers at 2: 0x%02X\n", result);
+  failures += result != ku8MBSuccess;
+
+  result = master.readHoldingRegisters(0, 8);
+  printf("read 8 registers at 0:  0x%02X\n", result);
+  failures += result != ku8MBSuccess;
+  if (result == ku8MBSuccess) {
+    for (uint8_t i = 0; i < 8; i++)
+      printf("  reg[%u] = 0x%04X\n", i, master.getResponseBuffer(i));
+  }
+
+  // answered with an exception, and a slave that is not there
+  result = master.readHoldingRegisters(100, 1);
+  printf("read register 100:      0x%02X\n", result);
+  failures += result != ku8MBIllegalDataAddress;
+  master.setSlaveID(2);
+  master.setResponseTimeOut(50);
+  result = master.maskWriteRegister(0, 0xFF00, 0x0012);
+  printf("mask write on slave 2:  0x%02X\n", result);
+  failures += result != ku8MBResponseTimedOut;
+
+  stop = true;
+  slave.join();
+
+  // latencies in microseconds, to bucket precision
+  printMetrics("master", masterMetrics);
+  printMetrics("slave", slaveMetrics);
+
+  if (bTrace) {
+    PosixStream file;
+    if (!file.begin(open(argv[1], O_WRONLY | O_CREAT | O_TRUNC, 0644))) {
+      perror(argv[1]);
+      return 1;
+    }
+    masterTracer.dump(file);
+    printf("%u master frames traced to %s\n", masterTracer.records(),
+           argv[1]);
+  }
+  return failures ? 1 : 0;
+}
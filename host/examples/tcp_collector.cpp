@@ -0,0 +1,90 @@
+/*
+
+  tcp_collector.cpp - scans many Modbus TCP slaves with a pipelined
+  ModbusTcpServer (master).
+
+  usage: tcp_collector [targets] [depth]
+
+  A ModbusTcpClient (slave) in a thread of its own stands in for the
+  devices; every target is a separate connection to it. Each scan reads
+  four blocks of 125 holding registers from every target, first one
+  request at a time per connection, then pipelined.
+
+*/
+
+#include "Arduino.h"
+#include "ModbusterTcpClient.h"
+#include "ModbusterTcpServer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+
+using namespace ModBuster;
+
+static uint32_t scan(ModbusTcpServer &master, int targets, int &failures) {
+  uint32_t u32Start = micros();
+  for (int target = 0; target < targets; target++) {
+    for (uint16_t u16Block = 0; u16Block < 4; u16Block++) {
+      master.readHoldingRegisters(
+          target, 1, 125 * u16Block, 125,
+          [&failures, u16Block](uint8_t u8Status, const uint16_t *au16Data,
+                                uint16_t u16Count) {
+            if (u8Status != ku8MBSuccess || u16Count != 125 ||
+                au16Data[0] != 125 * u16Block)
+              failures++;
+          });
+    }
+  }
+  while (master.pending())
+    master.poll(-1);
+  return micros() - u32Start;
+}
+
+int main(int argc, char **argv) {
+  int targets = argc > 1 ? atoi(argv[1]) : 200;
+  uint8_t u8Depth = argc > 2 ? (uint8_t)atoi(argv[2]) : 16;
+
+  // one descriptor per target on each side
+  struct rlimit limit;
+  if (!getrlimit(RLIMIT_NOFILE, &limit) && limit.rlim_cur < limit.rlim_max) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+
+  static uint16_t au16Holding[500];
+  for (uint16_t i = 0; i < 500; i++)
+    au16Holding[i] = i;
+  ModbusRegion regions[1];
+  ModbusRegisterMap map(regions, 1);
+  map.addHoldingRegisters(0, 500, au16Holding);
+
+  ModbusTcpClient slave;
+  if (!slave.begin(map, 0, "127.0.0.1")) {
+    perror("listen");
+    return 1;
+  }
+  slave.start();
+
+  ModbusTcpServer master;
+  master.begin();
+  for (int i = 0; i < targets; i++)
+    master.addTarget("127.0.0.1", slave.port());
+
+  int failures = 0;
+  scan(master, targets, failures); // connect
+
+  master.pipelineDepth(1);
+  uint32_t u32Serial = scan(master, targets, failures);
+  master.pipelineDepth(u8Depth);
+  uint32_t u32Pipelined = scan(master, targets, failures);
+
+  printf("%d targets, %d requests per scan\n", targets, 4 * targets);
+  printf("  one at a time: %7.2f ms\n", u32Serial / 1000.0);
+  printf("  depth %-3u      %7.2f ms\n", u8Depth, u32Pipelined / 1000.0);
+  printf("  failures: %d\n", failures);
+
+  master.end();
+  slave.end();
+  return failures ? 1 : 0;
+}
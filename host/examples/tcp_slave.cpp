@@ -0,0 +1,74 @@
+/*
+
+  tcp_slave.cpp - serves one register map to Modbus TCP masters and to an
+  RTU master on a pseudo-terminal at the same time.
+
+  usage: tcp_slave [port]
+
+  The TCP slave runs in a thread of its own; both slaves lock the same
+  mutex while they touch the map. Input register 0 counts the seconds
+  since start.
+
+*/
+
+#include "ModbusterClient.h"
+#include "ModbusterPosix.h"
+#include "ModbusterTcpClient.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace ModBuster;
+
+static volatile sig_atomic_t stop = 0;
+
+static void onSignal(int) { stop = 1; }
+
+int main(int argc, char **argv) {
+  uint16_t u16Port = argc > 1 ? (uint16_t)atoi(argv[1]) : 1502;
+
+  uint8_t au8Coils[8] = {0};
+  uint16_t au16Holding[100] = {0};
+  uint16_t au16Input[10] = {0};
+  ModbusRegion regions[4];
+  ModbusRegisterMap map(regions, 4);
+  map.addCoils(0, 64, au8Coils);
+  map.addHoldingRegisters(0, 100, au16Holding);
+  map.addInputRegisters(0, 10, au16Input);
+  std::mutex mapMutex;
+
+  ModbusTcpClient tcp;
+  if (!tcp.begin(map, u16Port)) {
+    perror("listen");
+    return 1;
+  }
+  tcp.guard(mapMutex);
+  tcp.start();
+
+  char name[64];
+  PosixStream serial;
+  if (!serial.beginPty(name, sizeof(name))) {
+    perror("pty");
+    return 1;
+  }
+  ModbusClient rtu;
+  rtu.begin(1, serial);
+
+  printf("Modbus TCP on port %u, RTU slave 1 on %s\n", tcp.port(), name);
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+
+  while (!stop) {
+    uint32_t u32Timeout = rtu.pollTimeout();
+    serial.waitAvailable(u32Timeout < 100000 ? u32Timeout : 100000);
+
+    std::lock_guard<std::mutex> lock(mapMutex);
+    au16Input[0] = (uint16_t)(millis() / 1000);
+    uint8_t result;
+    rtu.poll(map, result);
+  }
+
+  tcp.end();
+  return 0;
+}
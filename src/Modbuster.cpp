@@ -1,30 +1,50 @@
 #include "Modbuster.h"
 
+#include "Arduino.h"
+
 using namespace ModBuster;
 
-uint16_t ModBuster::crc(uint8_t *au8Buffer, uint8_t u8length) {
-  unsigned int temp, temp2, flag;
-  temp = 0xFFFF;
-  for (unsigned char i = 0; i < u8length; i++) {
-    temp = temp ^ au8Buffer[i];
-    for (unsigned char j = 1; j <= 8; j++) {
-      flag = temp & 0x0001;
-      temp >>= 1;
-      if (flag)
-        temp ^= 0xA001;
-    }
-  }
-  // Reverse byte order.
-  temp2 = temp >> 8;
-  temp = (temp << 8) | temp2;
-  temp &= 0xFFFF;
-  // the returned value is already swapped
-  // crcLo byte is first & crcHi byte is last
-  return temp;
+/**
+Compute the CRC of a complete buffer.
+
+@param au8Buffer bytes to checksum
+@param u16Length number of bytes
+@return CRC with the low byte in the high position, i.e. highByte() is the
+first byte on the wire
+*/
+uint16_t ModBuster::crc(const uint8_t *au8Buffer, uint16_t u16Length) {
+  return crc_final(crc_update(ku16CRCInit, au8Buffer, u16Length));
 }
 
 ModbusBase::ModbusBase() {}
 
+/**
+Wait step of the receive loops.
+
+Runs the optional user-defined idle work step. Host builds without one
+sleep in the transport until data arrives or the timeout expires, instead
+of spinning on available().
+
+@param serial stream being received from
+@param u32TimeoutUs maximum time to wait [microseconds]
+@return true if the bus was watched until now, so that bytes pending now
+arrived at the very end of the wait; false if the user-defined step ran
+and they may have been pending for all of it
+*/
+bool ModbusBase::idle(Stream *serial, uint32_t u32TimeoutUs) {
+  if (_idleRead) {
+    _idleRead();
+    return false;
+  }
+#if MODBUSTER_HOST
+  serial->waitAvailable(u32TimeoutUs);
+#else
+  (void)serial;
+  (void)u32TimeoutUs;
+#endif
+  return true;
+}
+
 void ModbusBase::preRead(void (*preRead)()) { _preRead = preRead; }
 
 void ModbusBase::idleRead(void (*idleRead)()) { _idleRead = idleRead; }
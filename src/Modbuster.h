@@ -3,12 +3,10 @@
 
 #include <stdint.h>
 
-// Uncomment MODBUS_DEBUG to print the message content to the serial port
-//#define MODBUS_DEBUG
-
-#ifndef debugSerialPort
-#define debugSerialPort Serial
-#endif
+#include "ModbusterCrc.h"
+#include "ModbusterMetrics.h"
+#include "ModbusterTiming.h"
+#include "ModbusterTracer.h"
 
 // Set to 1 to enable debugging features within class:
 // PIN A cycles for each byte read in the Modbus response
@@ -17,6 +15,8 @@
 #define __MODBUSMASTER_DEBUG_PIN_A__ 4
 #define __MODBUSMASTER_DEBUG_PIN_B__ 5
 
+class Stream;
+
 namespace ModBuster {
 
 // Modbus exception codes
@@ -80,6 +80,26 @@ enum ModbusExpectionCodes {
   */
   ku8MBSlaveDeviceFailure = 0x04,
 
+  /**
+  Modbus protocol gateway path unavailable exception.
+
+  The gateway could not allocate a path to the target device: no bus is
+  configured for the unit ID, or the bus is overloaded.
+
+  @ingroup constant
+  */
+  ku8MBGatewayPathUnavailable = 0x0A,
+
+  /**
+  Modbus protocol gateway target device failed to respond exception.
+
+  The gateway forwarded the request but received no valid response from
+  the target device.
+
+  @ingroup constant
+  */
+  ku8MBGatewayTargetFailed = 0x0B,
+
   // Class-defined success/exception codes
   /**
   ModbusServer success.
@@ -107,7 +127,8 @@ enum ModbusExpectionCodes {
   /**
   ModbusServer invalid response function exception.
 
-  The function code in the response does not match that of the request.
+  The function code in the response does not match that of the request, or
+  a read response does not carry the quantity asked for.
 
   @ingroup constant
   */
@@ -131,6 +152,36 @@ enum ModbusExpectionCodes {
   @ingroup constant
   */
   ku8MBInvalidCRC = 0xE3,
+
+  /**
+  ModbusServer frame too large exception.
+
+  The request or the expected response does not fit the buffers the master
+  has been instantiated with.
+
+  @ingroup constant
+  */
+  ku8MBFrameTooLarge = 0xE4,
+
+  /**
+  ModbusTcpServer connection failed exception.
+
+  The TCP connection to the slave could not be opened, or was lost before
+  the response arrived.
+
+  @ingroup constant
+  */
+  ku8MBConnectionFailed = 0xE5,
+
+  /**
+  ModbusServer slave quarantined exception.
+
+  The slave stopped answering and is quarantined by the ModbusHealth
+  attached to the master; the request was not sent.
+
+  @ingroup constant
+  */
+  ku8MBSlaveQuarantined = 0xE6,
 };
 
 // Modbus function codes for bit access
@@ -155,6 +206,29 @@ enum ModbusFunction16bit {
       0x17, ///< Modbus function 0x17 Read Write Multiple Registers
 };
 
+// Modbus function codes for serial line diagnostics
+enum ModbusDiagnosticFunction {
+  ku8MBDiagnostics = 0x08,         ///< Modbus function 0x08 Diagnostics
+  ku8MBGetCommEventCounter = 0x0B, ///< Modbus function 0x0B Get Comm Event
+                                   ///< Counter
+};
+
+// Sub-functions of Modbus function 0x08 Diagnostics
+enum ModbusDiagnosticSubFunction {
+  ku16MBReturnQueryData = 0x00,          ///< echo the data field
+  ku16MBReturnDiagnosticRegister = 0x02, ///< diagnostic register, always 0
+  ku16MBClearCounters = 0x0A,            ///< clear every counter
+  ku16MBBusMessageCount = 0x0B,          ///< frames seen on the bus
+  ku16MBBusCommErrorCount = 0x0C,        ///< frames with a bad CRC
+  ku16MBSlaveExceptionCount = 0x0D,      ///< exception responses
+  ku16MBSlaveMessageCount = 0x0E,        ///< requests to this slave
+  ku16MBSlaveNoResponseCount = 0x0F,     ///< requests left unanswered
+  ku16MBSlaveNAKCount = 0x10,            ///< negative acknowledges, always 0
+  ku16MBSlaveBusyCount = 0x11,           ///< busy exceptions, always 0
+  ku16MBBusCharOverrunCount = 0x12,      ///< requests too long to hold
+  ku16MBClearOverrunCounter = 0x14,      ///< clear the overrun counter
+};
+
 /**
  * @enum MESSAGE
  * @brief
@@ -170,8 +244,22 @@ enum ModbusFramePosition {
   BYTE_CNT //!< byte counter
 };
 
-// Size of response/transmit buffers
+// Default size of response/transmit buffers [words]; host builds default
+// to the full 125 registers of a single read
+#ifdef MODBUSTER_HOST
+const uint8_t ku8MaxBufferSize = 125;
+#else
 const uint8_t ku8MaxBufferSize = 64;
+#endif
+
+// Largest RTU frame: address, 253 byte PDU and CRC [bytes]
+const uint16_t ku16MaxADUSize = 256;
+
+// Largest quantity of registers a single read may return
+const uint8_t ku8MaxReadRegisters = 125;
+
+// Largest quantity of registers a single FC10 write may carry
+const uint8_t ku8MaxWriteRegisters = 123;
 
 // Slave to master response size
 const uint8_t ku8ResponseSize = 6;
@@ -179,6 +267,10 @@ const uint8_t ku8ResponseSize = 6;
 // Modbus default timeout [milliseconds]
 const uint16_t ku16MBResponseTimeout = 2000;
 
+// Bus silence that ends a frame until ModbusTiming is configured
+// [microseconds]
+const uint16_t ku16MBFrameSilence = 5000;
+
 class ModbusBase {
 protected:
   // Optional additional user-defined work step.
@@ -188,17 +280,59 @@ protected:
   void (*_preWrite)() = nullptr;
   void (*_postWrite)() = nullptr;
 
+  ModbusTiming _timing; ///< frame delimiting
+  ModbusMetrics *_metrics = nullptr; ///< transaction figures, if attached
+  ModbusTracer *_tracer = nullptr;   ///< frame trace, if attached
+  uint8_t _u8TracePort = 0;          ///< port number in the trace
+
   ModbusBase();
 
+  bool idle(Stream *serial, uint32_t u32TimeoutUs);
+
+  void trace(uint32_t u32Time, uint8_t u8Flags, uint8_t u8Status,
+             const uint8_t *au8Frame, uint16_t u16Length) {
+    _tracer->record(u32Time, u8Flags, _u8TracePort, u8Status, au8Frame,
+                    u16Length);
+  }
+
 public:
   void preRead(void (*)());
   void idleRead(void (*)());
   void postRead(void (*)());
   void preWrite(void (*)());
   void postWrite(void (*)());
+
+  /**
+  Frame delimiting timer; configure it with the line speed, e.g.
+  timing().begin(19200), right after begin().
+
+  @ingroup setup
+  */
+  ModbusTiming &timing() { return _timing; }
+
+  /**
+  Record every transaction in metrics from now on; nullptr stops
+  recording.
+
+  @ingroup setup
+  */
+  void setMetrics(ModbusMetrics *metrics) { _metrics = metrics; }
+  ModbusMetrics *metrics() const { return _metrics; }
+
+  /**
+  Copy every frame sent or received into tracer from now on; nullptr
+  stops tracing.
+
+  @param u8Port number telling this bus apart from others sharing tracer
+  @ingroup setup
+  */
+  void setTracer(ModbusTracer *tracer, uint8_t u8Port = 0) {
+    _tracer = tracer;
+    _u8TracePort = u8Port;
+  }
 };
 
-uint16_t crc(uint8_t *au8Buffer, uint8_t u8length);
+uint16_t crc(const uint8_t *au8Buffer, uint16_t u16Length);
 
 } // namespace ModBuster
 
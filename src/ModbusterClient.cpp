@@ -1,19 +1,40 @@
 #include "ModbusterClient.h"
 
 #include "Arduino.h"
-#include "util/word.h"
+#include "ModbusterPdu.h"
+
+#include <string.h>
 
 using namespace ModBuster;
 
+// The legacy API serves all four tables from one word array. Bits are
+// numbered LSB first within each word, which on the little-endian targets
+// the library runs on is the byte layout of ModbusRegion bit tables.
+static void mapLegacy(ModbusRegisterMap &map, uint16_t *regs, uint8_t u8size) {
+  uint8_t *pu8Bits = reinterpret_cast<uint8_t *>(regs);
+
+  map.addCoils(0, 16 * u8size, pu8Bits);
+  map.addDiscreteInputs(0, 16 * u8size, pu8Bits);
+  map.addHoldingRegisters(0, u8size, regs);
+  map.addInputRegisters(0, u8size, regs);
+}
+
 /* _____PUBLIC FUNCTIONS_____________________________________________________ */
 /**
 Constructor.
 
-Creates class object; initialize it using ModbusClient::begin().
+Binds the frame buffer supplied by ModbusClientT; initialize the object
+using ModbusClientBase::begin().
 
+@param au8ModbusADU frame buffer, u16ADUSize bytes
+@param u16ADUSize number of bytes in au8ModbusADU
+@param u8MaxRegisters largest register quantity served by one request
 @ingroup setup
 */
-ModbusClient::ModbusClient(void) : ModbusBase() {}
+ModbusClientBase::ModbusClientBase(uint8_t *au8ModbusADU, uint16_t u16ADUSize,
+                                   uint8_t u8MaxRegisters)
+    : ModbusBase(), u8ModbusADU(au8ModbusADU), _u16ADUSize(u16ADUSize),
+      _u8MaxRegisters(u8MaxRegisters) {}
 
 /**
 Initialize class object.
@@ -25,8 +46,7 @@ Call once class has been instantiated, typically within setup().
 @param &serial reference to serial port object (Serial, Serial1, ... Serial3)
 @ingroup setup
 */
-void ModbusClient::begin(uint8_t slave, Stream &serial) {
-  //  txBuffer = (uint16_t*) calloc(ku8MaxBufferSize, sizeof(uint16_t));
+void ModbusClientBase::begin(uint8_t slave, Stream &serial) {
   _u8MBSlave = slave;
   _serial = &serial;
   _u8TransmitBufferIndex = 0;
@@ -38,343 +58,365 @@ void ModbusClient::begin(uint8_t slave, Stream &serial) {
 #endif
 }
 
-/* _____PRIVATE FUNCTIONS____________________________________________________ */
 /**
-Modbus slave transaction engine.
-This method checks if there is any incoming query
-Afterwards, it would shoot a validation routine plus a register query
-Avoid any delay() function !!!!
-After a successful frame between the Master and the Slave, the time-out timer is
-reset. Sequence:
-  - poll for master request
-  - evaluate/disassemble request
+Reset the serial line counters, as FC08 sub-function 0x0A does.
+
+@ingroup setup
+*/
+void ModbusClientBase::clearCounters() {
+  memset(&_counters, 0, sizeof(_counters));
+}
+
+/**
+Modbus slave transaction engine, non-blocking.
+
+Consumes whatever bytes are available, keeps the partial frame in the
+object and returns immediately. The frame is complete as soon as the
+length announced by its header has arrived with a valid CRC, or else once
+it is sealed by the inter-frame silence; it is then validated, dispatched
+and answered. Call it from loop() as often as possible; it never waits for
+the bus. Bytes that queued up while the application was busy cannot be
+timed, so T1.5 is not enforced: broken frames are caught by their CRC.
+Sequence:
+  - collect available bytes of the master request
+  - once the frame is complete, evaluate/disassemble request
   - return status (success/exception)
 
+@param &map registers served to the master
+@param 0 on success; exception number on failure
+@return true, if request has been handled; false otherwise
+*/
+bool ModbusClientBase::poll(ModbusRegisterMap &map, uint8_t &u8MBStatus) {
+  u8MBStatus = ku8MBSuccess;
+  if (!receive(false))
+    return false;
+  return dispatch(map, u8MBStatus);
+}
+
+/**
+Modbus slave transaction engine, non-blocking, legacy register table.
+
+Serves coils, discrete inputs, holding and input registers from the same
+array: registers 0..u8size-1 and bits 0..16*u8size-1, numbered LSB first
+within each word. Requests outside the array are answered with
+ku8MBIllegalDataAddress.
+
 @param *regs register table for communication exchange
 @param u8size size of the register table
 @param 0 on success; exception number on failure
-@return true, if request has been handled; false otherwiser
+@return true, if request has been handled; false otherwise
 */
-bool ModbusClient::ModbusClientTransaction(uint16_t *regs, uint8_t u8size,
-                                           uint8_t &u8MBStatus) {
+bool ModbusClientBase::poll(uint16_t *regs, uint8_t u8size,
+                            uint8_t &u8MBStatus) {
   u8MBStatus = ku8MBSuccess;
-
-  if (!_serial->available())
+  if (!receive(false))
     return false;
 
-  // Optional additional user-defined work step.
-  if (_preRead) {
-    _preRead();
-  }
+  ModbusRegion regions[4];
+  ModbusRegisterMap map(regions, 4);
+  mapLegacy(map, regs, u8size);
+  return dispatch(map, u8MBStatus);
+}
 
-#ifdef MODBUS_DEBUG
-  debugSerialPort.println();
-#endif
+/**
+Collect the available bytes of the request being received.
 
-  // loop until the frame is sealed by a T35 delay.
-  uint8_t u8BytesLeft = 8;
-  const uint8_t T35 = 5;
-  uint32_t u32StartTime = millis();
-  do {
-    if (_serial->available()) {
-#if __MODBUSMASTER_DEBUG__
-      digitalWrite(__MODBUSMASTER_DEBUG_PIN_A__, true);
-#endif
-      uint8_t ch = _serial->read();
+Silence is only judged once everything pending has been read, since bytes
+may have waited in the receive buffer for longer than T3.5.
 
-#ifdef MODBUS_DEBUG
-      if (ch < 15)
-        debugSerialPort.print("0");
-      debugSerialPort.print(ch, HEX);
-      debugSerialPort.print("<");
-#endif
+@param bStrict true if the bus has been watched since the last call, so
+that gaps seen then can be held against T1.5 and T3.5
+@return true once the request is complete
+*/
+bool ModbusClientBase::receive(bool bStrict) {
+  bool bComplete = false;
 
-      u8ModbusADU[u8ModbusADUSize++] = ch;
-      u8BytesLeft--;
-      u32StartTime = millis();
+  while (_serial->available()) {
+    // T3.5 of silence seen since the last byte: the pending frame is
+    // complete, the next byte starts another one
+    if (bStrict && u16ModbusADUSize &&
+        (int32_t)(_u32IdleTime - _u32LastByteTime) >= (int32_t)_timing.t35())
+      break;
 
 #if __MODBUSMASTER_DEBUG__
-      digitalWrite(__MODBUSMASTER_DEBUG_PIN_A__, false);
-#endif
-    } else {
-#if __MODBUSMASTER_DEBUG__
-      digitalWrite(__MODBUSMASTER_DEBUG_PIN_B__, true);
+    digitalWrite(__MODBUSMASTER_DEBUG_PIN_A__, true);
 #endif
+    uint8_t ch = _serial->read();
+
+    // a gap longer than T1.5 inside a frame breaks it
+    if (bStrict && u16ModbusADUSize &&
+        _timing.charGapExceeded(_u32LastByteTime, _u32IdleTime))
+      _bCharGap = true;
+
+    if (!u16ModbusADUSize) {
       // Optional additional user-defined work step.
-      if (_idleRead) {
-        _idleRead();
+      if (_preRead) {
+        _preRead();
       }
-#if __MODBUSMASTER_DEBUG__
-      digitalWrite(__MODBUSMASTER_DEBUG_PIN_B__, false);
-#endif
+      _u16RxCRC = ku16CRCInit;
+      _bOverrun = false;
+      _bCharGap = false;
+      if (_metrics)
+        _u32FirstByteTime = micros();
     }
-  } while ((millis() - u32StartTime) < T35);
-
-#ifdef MODBUS_DEBUG
-  debugSerialPort.println();
-#endif
-
-  uint8_t id = u8ModbusADU[ID];
-  if (id != _u8MBSlave)
-    return false;
 
-  // calculate CRC
-  uint16_t u16CRC = crc(u8ModbusADU, u8ModbusADUSize - 2);
+    // bytes that do not fit are still folded into the CRC, so an oversized
+    // but intact request can be answered with an exception
+    if (u16ModbusADUSize < _u16ADUSize)
+      u8ModbusADU[u16ModbusADUSize++] = ch;
+    else
+      _bOverrun = true;
+    _u16RxCRC = crc_update(_u16RxCRC, ch);
+    _u32LastByteTime = micros();
 
-  // verify CRC
-  if (highByte(u16CRC) != u8ModbusADU[u8ModbusADUSize - 2] ||
-      lowByte(u16CRC) != u8ModbusADU[u8ModbusADUSize - 1]) {
-    u8MBStatus = ku8MBInvalidCRC;
-    return false;
-  }
+#if __MODBUSMASTER_DEBUG__
+    digitalWrite(__MODBUSMASTER_DEBUG_PIN_A__, false);
+#endif
 
-  // Optional additional user-defined work step.
-  if (_postRead) {
-    _postRead();
+    // the header tells the request length; once that many bytes carry a
+    // valid CRC the request is complete without waiting for T3.5
+    if (u16ModbusADUSize == expectedLength() &&
+        _u16RxCRC == ku16CRCResidue) {
+      bComplete = true;
+      break;
+    }
   }
 
-  // Process request and prepare response of in the same buffer.
-  uint8_t u8MBFunction = u8ModbusADU[FUNC];
-  switch (u8MBFunction) {
-  case ku8MBReadCoils:
-  case ku8MBReadDiscreteInputs:
-    process_FC1(regs, u8size);
-    break;
-  case ku8MBReadInputRegisters:
-  case ku8MBReadHoldingRegisters:
-  case ku8MBReadWriteMultipleRegisters:
-    process_FC3(regs, u8size);
-    break;
-  case ku8MBWriteSingleCoil:
-    process_FC5(regs, u8size);
-    break;
-  case ku8MBWriteSingleRegister:
-    process_FC6(regs, u8size);
-    break;
-  case ku8MBWriteMultipleCoils:
-    process_FC15(regs, u8size);
-    break;
-  case ku8MBWriteMultipleRegisters:
-    process_FC16(regs, u8size);
-    break;
-  default:
-    break;
-  }
+  // otherwise wait until the frame is sealed by a T3.5 delay.
+  if (!bComplete)
+    _u32IdleTime = micros();
+  if (!u16ModbusADUSize || (!bComplete && pollTimeout()))
+    return false;
 
-  _u8TransmitBufferIndex = 0;
-  u16TransmitBufferLength = 0;
-  _u8ResponseBufferIndex = 0;
+  return true;
+}
 
-  // Optional additional user-defined work step.
-  if (_preWrite) {
-    _preWrite();
-  }
+/**
+Length of the request being received, predicted from its header.
 
-  // flush receive buffer before transmitting request
-  while (_serial->read() != -1)
-    continue;
+@return request length including the CRC [bytes]; 0 while the header is
+incomplete, for unknown function codes and for requests that do not fit
+u8ModbusADU, which are all delimited by T3.5 instead
+*/
+uint16_t ModbusClientBase::expectedLength() const {
+  if (u16ModbusADUSize < 2)
+    return 0;
+  // slave ID and CRC around the PDU
+  uint16_t u16Length =
+      ModbusPduHandler::requestLength(u8ModbusADU + FUNC, u16ModbusADUSize - 1);
+  if (!u16Length)
+    return 0;
+  u16Length += 3;
+  return u16Length <= _u16ADUSize ? u16Length : 0;
+}
 
-  sendTxBuffer();
+/**
+Time left until the frame being received is sealed.
 
-  // Optional additional user-defined work step.
-  if (_postWrite) {
-    _postWrite();
-  }
+Host applications can sleep this long in the transport before calling
+poll() again.
 
-  return true;
+@return 0 if poll() would process a complete frame now; time left until
+the frame is sealed [microseconds]; 0xFFFFFFFF if no frame is pending
+*/
+uint32_t ModbusClientBase::pollTimeout() const {
+  if (!u16ModbusADUSize)
+    return 0xFFFFFFFF;
+  return _timing.silenceLeft(_u32LastByteTime);
 }
 
 /**
- * @brief
- * This method processes functions 1 & 2
- * This method reads a bit array and transfers it to the master
- *
- * @return u8ModbusADUSize Response to master length
- * @ingroup discrete
- */
-void ModbusClient::process_FC1(uint16_t *regs, uint8_t /*u8size*/) {
-  uint8_t u8currentRegister, u8currentBit, u8bytesno, u8bitsno;
-  uint16_t u16currentCoil, u16coil;
-
-  // get the first and last coil from the message
-  uint16_t u16StartCoil = word(u8ModbusADU[ADD_HI], u8ModbusADU[ADD_LO]);
-  uint16_t u16Coilno = word(u8ModbusADU[NB_HI], u8ModbusADU[NB_LO]);
-
-  // put the number of bytes in the outcoming message
-  u8bytesno = (uint8_t)(u16Coilno / 8);
-  if (u16Coilno % 8 != 0)
-    u8bytesno++;
-  u8ModbusADU[ADD_HI] = u8bytesno;
-  u8ModbusADUSize = ADD_LO;
-  u8ModbusADU[u8ModbusADUSize + u8bytesno - 1] = 0;
-
-  // read each coil from the register map and put its value inside the outcoming
-  // message
-  u8bitsno = 0;
-
-  // Clear all data bits in outgoing message.
-  memset(u8ModbusADU + u8ModbusADUSize, 0,
-         sizeof(u8ModbusADU) - u8ModbusADUSize);
-
-  for (u16currentCoil = 0; u16currentCoil < u16Coilno; u16currentCoil++) {
-    u16coil = u16StartCoil + u16currentCoil;
-    u8currentRegister = (uint8_t)(u16coil / 16);
-    u8currentBit = (uint8_t)(u16coil % 16);
-
-    bitWrite(u8ModbusADU[u8ModbusADUSize], u8bitsno,
-             bitRead(regs[u8currentRegister], u8currentBit));
-    u8bitsno++;
-
-    if (u8bitsno > 7) {
-      u8bitsno = 0;
-      u8ModbusADUSize++;
-    }
-  }
+Modbus slave transaction engine, blocking.
 
-  // send outcoming message
-  if (u16Coilno % 8 != 0)
-    u8ModbusADUSize++;
-}
+Same as poll(), but once a request has started to arrive it waits for the
+rest of it, so the whole frame is handled in one call. The bus is watched
+while waiting, so gaps longer than T1.5 break the frame.
 
-/**
- * @brief
- * This method processes functions 3 & 4
- * This method reads a word array and transfers it to the master
- *
- * @return u8ModbusADUSize Response to master length
- * @ingroup register
- */
-void ModbusClient::process_FC3(uint16_t *regs, uint8_t /*u8size*/) {
+@param &map registers served to the master
+@param 0 on success; exception number on failure
+@return true, if request has been handled; false otherwise
+*/
+bool ModbusClientBase::ModbusClientTransaction(ModbusRegisterMap &map,
+                                               uint8_t &u8MBStatus) {
+  u8MBStatus = ku8MBSuccess;
+
+  if (!u16ModbusADUSize && !_serial->available())
+    return false;
 
-  uint8_t u8StartAdd = word(u8ModbusADU[ADD_HI], u8ModbusADU[ADD_LO]);
-  uint8_t u8regsno = word(u8ModbusADU[NB_HI], u8ModbusADU[NB_LO]);
-  uint8_t i;
+  // whatever is pending already cannot be timed
+  bool bWatched = false;
+  for (;;) {
+    if (receive(bWatched))
+      return dispatch(map, u8MBStatus);
 
-  u8ModbusADU[2] = u8regsno * 2;
-  u8ModbusADUSize = 3;
+    // frame was dropped
+    if (!u16ModbusADUSize)
+      return false;
 
-  for (i = u8StartAdd; i < u8StartAdd + u8regsno; i++) {
-    u8ModbusADU[u8ModbusADUSize] = highByte(regs[i]);
-    u8ModbusADUSize++;
-    u8ModbusADU[u8ModbusADUSize] = lowByte(regs[i]);
-    u8ModbusADUSize++;
+#if __MODBUSMASTER_DEBUG__
+    digitalWrite(__MODBUSMASTER_DEBUG_PIN_B__, true);
+#endif
+    // Optional additional user-defined work step.
+    if (idle(_serial, pollTimeout()))
+      _u32IdleTime = micros();
+    bWatched = true;
+#if __MODBUSMASTER_DEBUG__
+    digitalWrite(__MODBUSMASTER_DEBUG_PIN_B__, false);
+#endif
   }
 }
 
 /**
- * @brief
- * This method processes function 5
- * This method writes a value assigned by the master to a single bit
- *
- * @return u8ModbusADUSize Response to master length
- * @ingroup discrete
- */
-void ModbusClient::process_FC5(uint16_t *regs, uint8_t /*u8size*/) {
-  uint8_t u8currentRegister, u8currentBit;
-  uint8_t u8CopyBufferSize;
-  uint16_t u16coil = word(u8ModbusADU[ADD_HI], u8ModbusADU[ADD_LO]);
+Modbus slave transaction engine, blocking, legacy register table.
 
-  // point to the register and its bit
-  u8currentRegister = (uint8_t)(u16coil / 16);
-  u8currentBit = (uint8_t)(u16coil % 16);
+@see ModbusClientBase::poll(uint16_t *, uint8_t, uint8_t &)
+@param *regs register table for communication exchange
+@param u8size size of the register table
+@param 0 on success; exception number on failure
+@return true, if request has been handled; false otherwise
+*/
+bool ModbusClientBase::ModbusClientTransaction(uint16_t *regs, uint8_t u8size,
+                                               uint8_t &u8MBStatus) {
+  u8MBStatus = ku8MBSuccess;
 
-  // write to coil
-  bitWrite(regs[u8currentRegister], u8currentBit, u8ModbusADU[NB_HI] == 0xff);
+  if (!u16ModbusADUSize && !_serial->available())
+    return false;
 
-  // send answer to master
-  u8ModbusADUSize = 6;
+  ModbusRegion regions[4];
+  ModbusRegisterMap map(regions, 4);
+  mapLegacy(map, regs, u8size);
+  return ModbusClientTransaction(map, u8MBStatus);
 }
 
+/* _____PRIVATE FUNCTIONS____________________________________________________ */
 /**
- * @brief
- * This method processes function 6
- * This method writes a value assigned by the master to a single word
- *
- * @return u8ModbusADUSize Response to master length
- * @ingroup register
- */
-void ModbusClient::process_FC6(uint16_t *regs, uint8_t /*u8size*/) {
+Validate and answer the complete request held in u8ModbusADU.
 
-  uint8_t u8add = word(u8ModbusADU[ADD_HI], u8ModbusADU[ADD_LO]);
-  uint8_t u8CopyBufferSize;
-  uint16_t u16val = word(u8ModbusADU[NB_HI], u8ModbusADU[NB_LO]);
+@param &map registers served to the master
+@param 0 on success; exception number on failure
+@return true, if request has been handled; false otherwise
+*/
+bool ModbusClientBase::dispatch(ModbusRegisterMap &map, uint8_t &u8MBStatus) {
+  uint8_t id = u8ModbusADU[ID];
+  uint8_t u8Function = u8ModbusADU[FUNC];
+  uint16_t u16Received = u16ModbusADUSize;
+  // verify CRC folded in while the frame was received
+  bool bIntact =
+      u16ModbusADUSize >= 4 && _u16RxCRC == ku16CRCResidue && !_bCharGap;
+
+  // every frame on the bus is traced, whoever it is for
+  if (_tracer)
+    trace(_u32LastByteTime, 0, bIntact ? ku8MBSuccess : ku8MBInvalidCRC,
+          u8ModbusADU, u16Received);
+  // and counted, which locates noisy segments from any slave on them
+  if (!bIntact)
+    _counters.u16BusErrors++;
+  else
+    _counters.u16BusMessages++;
+  // broadcasts are executed too, if they are writes, but never answered
+  bool bBroadcast = !id && ModbusPduHandler::broadcastable(u8Function);
+  if (id != _u8MBSlave && !bBroadcast) {
+    u16ModbusADUSize = 0;
+    return false;
+  }
 
-  regs[u8add] = u16val;
+  if (!bIntact) {
+    u16ModbusADUSize = 0;
+    u8MBStatus = ku8MBInvalidCRC;
+    if (_metrics)
+      record(u8Function, u8MBStatus, 0, u16Received, 0);
+    return false;
+  }
 
-  // keep the same header
-  u8ModbusADUSize = ku8ResponseSize;
-}
+  _counters.u16SlaveMessages++;
+  if (_bOverrun)
+    _counters.u16Overruns++;
 
-/**
- * @brief
- * This method processes function 15
- * This method writes a bit array assigned by the master
- *
- * @return u8ModbusADUSize Response to master length
- * @ingroup discrete
- */
-void ModbusClient::process_FC15(uint16_t *regs, uint8_t /*u8size*/) {
-  uint8_t u8currentRegister, u8currentBit, u8frameByte, u8bitsno;
-  uint16_t u16currentCoil, u16coil;
-  boolean bTemp;
+  // Optional additional user-defined work step.
+  if (_postRead) {
+    _postRead();
+  }
 
-  // get the first and last coil from the message
-  uint16_t u16StartCoil = word(u8ModbusADU[ADD_HI], u8ModbusADU[ADD_LO]);
-  uint16_t u16Coilno = word(u8ModbusADU[NB_HI], u8ModbusADU[NB_LO]);
+  // the event counter skips FC0B and the request clearing it
+  bool bEvent = u8Function != ku8MBGetCommEventCounter &&
+                !(u8Function == ku8MBDiagnostics && u16ModbusADUSize >= 4 &&
+                  word(u8ModbusADU[FUNC + 1], u8ModbusADU[FUNC + 2]) ==
+                      ku16MBClearCounters);
 
-  // read each coil from the register map and put its value inside the outcoming
-  // message
-  u8bitsno = 0;
-  u8frameByte = 7;
-  for (u16currentCoil = 0; u16currentCoil < u16Coilno; u16currentCoil++) {
+  // Process request and prepare response of in the same buffer.
+  ModbusPduHandler pdu(u8ModbusADU + FUNC, _u16ADUSize - 3, _u8MaxRegisters,
+                       &_counters);
+  uint8_t u8Exception = pdu.serve(map, u16ModbusADUSize - 3, _bOverrun);
+  if (u8Exception) {
+    u8MBStatus = u8Exception;
+    _counters.u16Exceptions++;
+  } else if (bEvent) {
+    _counters.u16Events++;
+  }
+  u16ModbusADUSize = 1 + pdu.length();
 
-    u16coil = u16StartCoil + u16currentCoil;
-    u8currentRegister = (uint8_t)(u16coil / 16);
-    u8currentBit = (uint8_t)(u16coil % 16);
+  _u8TransmitBufferIndex = 0;
+  u16TransmitBufferLength = 0;
+  _u8ResponseBufferIndex = 0;
+
+  if (bBroadcast) {
+    u16ModbusADUSize = 0;
+    _counters.u16NoResponses++;
+    if (_metrics)
+      record(u8Function, u8MBStatus, 0, u16Received, 0);
+    return true;
+  }
 
-    bTemp = bitRead(u8ModbusADU[u8frameByte], u8bitsno);
+  // Optional additional user-defined work step.
+  if (_preWrite) {
+    _preWrite();
+  }
 
-    bitWrite(regs[u8currentRegister], u8currentBit, bTemp);
+  // flush receive buffer before transmitting request
+  while (_serial->read() != -1)
+    continue;
 
-    u8bitsno++;
+  uint16_t u16Sent = u16ModbusADUSize + 2;
+  uint32_t u32ReplyTime = _metrics ? micros() : 0;
+  sendTxBuffer();
 
-    if (u8bitsno > 7) {
-      u8bitsno = 0;
-      u8frameByte++;
-    }
+  // Optional additional user-defined work step.
+  if (_postWrite) {
+    _postWrite();
   }
 
-  // send outcoming message
-  // it's just a copy of the incomping frame until 6th byte
-  u8ModbusADUSize = 6;
+  if (_tracer)
+    trace(micros(), ku8TraceTx, u8MBStatus, u8ModbusADU, u16Sent);
+  if (_metrics)
+    record(u8Function, u8MBStatus, u16Sent, u16Received, u32ReplyTime);
+  return true;
 }
 
 /**
- * @brief
- * This method processes function 16
- * This method writes a word array assigned by the master
- *
- * @return u8ModbusADUSize Response to master length
- * @ingroup register
- */
-void ModbusClient::process_FC16(uint16_t *regs, uint8_t /*u8size*/) {
-  uint8_t u8StartAdd = u8ModbusADU[ADD_HI] << 8 | u8ModbusADU[ADD_LO];
-  uint8_t u8regsno = u8ModbusADU[NB_HI] << 8 | u8ModbusADU[NB_LO];
-  uint8_t i;
-  uint16_t temp;
-
-  // build header
-  u8ModbusADU[NB_HI] = 0;
-  u8ModbusADU[NB_LO] = u8regsno;
-  u8ModbusADUSize = ku8ResponseSize;
-
-  // write registers
-  for (i = 0; i < u8regsno; i++) {
-    temp = word(u8ModbusADU[(BYTE_CNT + 1) + i * 2],
-                u8ModbusADU[(BYTE_CNT + 2) + i * 2]);
-
-    regs[u8StartAdd + i] = temp;
-  }
+Report a request addressed to this slave to the attached metrics.
+
+@param u8Function function code of the request
+@param u8Status outcome: ku8MBSuccess, the exception answered or
+ku8MBInvalidCRC
+@param u16Sent response length; 0 if there was no response [bytes]
+@param u16Received request length [bytes]
+@param u32ReplyTime micros() when the response started going out
+*/
+void ModbusClientBase::record(uint8_t u8Function, uint8_t u8Status,
+                              uint16_t u16Sent, uint16_t u16Received,
+                              uint32_t u32ReplyTime) {
+  uint32_t u32Now = micros();
+  ModbusSample sample;
+  sample.u8Slave = _u8MBSlave;
+  sample.u8Function = u8Function;
+  sample.u8Status = u8Status;
+  sample.u16Sent = u16Sent;
+  sample.u16Received = u16Received;
+  sample.u32TurnaroundUs = u32Now - _u32LastByteTime;
+  sample.u32FirstByteUs = u32ReplyTime - _u32LastByteTime;
+  sample.u32FrameUs = _u32LastByteTime - _u32FirstByteTime;
+  sample.u32BusyUs = u32Now - _u32FirstByteTime;
+  _metrics->record(sample);
 }
 
 /**
@@ -389,35 +431,18 @@ void ModbusClient::process_FC16(uint16_t *regs, uint8_t /*u8size*/) {
  * @return nothing
  * @ingroup buffer
  */
-void ModbusClient::sendTxBuffer() {
+void ModbusClientBase::sendTxBuffer() {
   // append CRC to message
-  uint16_t u16crc = crc(u8ModbusADU, u8ModbusADUSize);
-  u8ModbusADU[u8ModbusADUSize] = u16crc >> 8;
-  u8ModbusADUSize++;
-  u8ModbusADU[u8ModbusADUSize] = u16crc & 0x00ff;
-  u8ModbusADUSize++;
-
-#ifdef MODBUS_DEBUG
-  debugSerialPort.println();
-#endif
+  uint16_t u16crc = crc(u8ModbusADU, u16ModbusADUSize);
+  u8ModbusADU[u16ModbusADUSize] = u16crc >> 8;
+  u16ModbusADUSize++;
+  u8ModbusADU[u16ModbusADUSize] = u16crc & 0x00ff;
+  u16ModbusADUSize++;
 
   // transfer buffer to serial line
-  for (uint8_t i = 0; i < u8ModbusADUSize; i++) {
-    _serial->write(u8ModbusADU[i]);
-
-#ifdef MODBUS_DEBUG
-    if (u8ModbusADU[i] < 15)
-      debugSerialPort.print("0");
-    debugSerialPort.print(u8ModbusADU[i], HEX);
-    debugSerialPort.print(">");
-#endif
-  }
-
-#ifdef MODBUS_DEBUG
-  debugSerialPort.println();
-#endif
+  _serial->write(u8ModbusADU, u16ModbusADUSize);
 
-  u8ModbusADUSize = 0;
+  u16ModbusADUSize = 0;
 
   // flush transmit buffer
   _serial->flush();
@@ -2,41 +2,98 @@
 #define MODBUSTER_CLIENT_H
 
 #include "Modbuster.h"
-
-class Stream;
+#include "ModbusterPdu.h"
+#include "ModbusterRegisterMap.h"
 
 namespace ModBuster {
 
-class ModbusClient : public ModbusBase {
-public:
-  ModbusClient();
+/**
+Modbus RTU slave.
 
+Holds the protocol logic; the frame buffer is owned by ModbusClientT, which
+sets its size at compile time.
+*/
+class ModbusClientBase : public ModbusBase {
+public:
   void begin(uint8_t, Stream &serial);
 
-  // slave function that conducts Modbus transactions
+  // slave functions that conduct Modbus transactions
+  bool poll(ModbusRegisterMap &map, uint8_t &result);
+  bool poll(uint16_t *regs, uint8_t u8size, uint8_t &result);
+  uint32_t pollTimeout() const;
+  bool ModbusClientTransaction(ModbusRegisterMap &map, uint8_t &result);
   bool ModbusClientTransaction(uint16_t *regs, uint8_t u8size, uint8_t &result);
 
+  /**
+  Serial line counters, as served to the master by FC08 and FC0B.
+  */
+  const ModbusCounters &counters() const { return _counters; }
+  void clearCounters();
+
 private:
   Stream *_serial;    ///< reference to serial port object
   uint8_t _u8MBSlave; ///< Modbus slave (1..247) initialized in begin()
-  uint8_t u8ModbusADU[ku8MaxBufferSize]; ///< send/receive data buffer
-  uint8_t u8ModbusADUSize = 0;
+  uint8_t *u8ModbusADU;          ///< send/receive data buffer
+  uint16_t _u16ADUSize;          ///< bytes in u8ModbusADU
+  uint8_t _u8MaxRegisters;       ///< largest register quantity served
+  uint16_t u16ModbusADUSize = 0; ///< bytes of the frame received so far
+  bool _bOverrun;                ///< frame did not fit u8ModbusADU
+  bool _bCharGap;                ///< frame broken by a gap longer than T1.5
+  uint16_t _u16RxCRC;          ///< CRC folded over the received bytes
+  uint32_t _u32LastByteTime;   ///< micros() when the last byte was read
+  uint32_t _u32IdleTime;       ///< micros() when no byte was pending last
+  uint32_t _u32FirstByteTime;  ///< micros() when the frame started, if
+                               ///< metrics are attached
+  ModbusCounters _counters = {}; ///< bus and slave counters
 
   uint8_t _u8TransmitBufferIndex;
   uint16_t u16TransmitBufferLength;
   uint8_t _u8ResponseBufferIndex;
   uint8_t _u8ResponseBufferLength;
 
-  void process_FC1(uint16_t *regs, uint8_t u8size);
-  void process_FC3(uint16_t *regs, uint8_t u8size);
-  void process_FC5(uint16_t *regs, uint8_t u8size);
-  void process_FC6(uint16_t *regs, uint8_t u8size);
-  void process_FC15(uint16_t *regs, uint8_t u8size);
-  void process_FC16(uint16_t *regs, uint8_t u8size);
+  bool receive(bool bStrict);
+  bool dispatch(ModbusRegisterMap &map, uint8_t &result);
+  uint16_t expectedLength() const;
 
   void sendTxBuffer();
+  void record(uint8_t u8Function, uint8_t u8Status, uint16_t u16Sent,
+              uint16_t u16Received, uint32_t u32ReplyTime);
+
+protected:
+  ModbusClientBase(uint8_t *au8ModbusADU, uint16_t u16ADUSize,
+                   uint8_t u8MaxRegisters);
 };
 
+/**
+Modbus RTU slave with its frame buffer sized at compile time.
+
+@tparam NRegs largest quantity of registers served by one request
+(1..125); larger requests are answered with ku8MBIllegalDataValue
+@tparam NAdu bytes in the frame buffer (8..256); defaults to the largest
+frame NRegs registers can produce, a FC17 request
+*/
+template <uint8_t NRegs,
+          uint16_t NAdu = (13 + 2 * NRegs < ku16MaxADUSize ? 13 + 2 * NRegs
+                                                           : ku16MaxADUSize)>
+class ModbusClientT : public ModbusClientBase {
+  static_assert(NRegs >= 1 && NRegs <= ku8MaxReadRegisters,
+                "NRegs must be 1..125");
+  static_assert(NAdu >= 8 && NAdu <= ku16MaxADUSize, "NAdu must be 8..256");
+
+public:
+  ModbusClientT() : ModbusClientBase(_au8ADU, NAdu, NRegs) {}
+
+private:
+  uint8_t _au8ADU[NAdu];
+};
+
+#ifdef MODBUSTER_HOST
+typedef ModbusClientT<ku8MaxReadRegisters> ModbusClient;
+#else
+// 64 byte frame buffer, as in earlier releases
+typedef ModbusClientT<25, 64> ModbusClient;
+#endif
+
 } // namespace ModBuster
 
 #endif // MODBUSTER_CLIENT_H
@@ -0,0 +1,82 @@
+#ifndef MODBUSTER_CRC_H
+#define MODBUSTER_CRC_H
+
+#include <stdint.h>
+
+// CRC-16/MODBUS engine variants, selectable at compile time with
+// -DMODBUSTER_CRC=<variant>:
+//   MODBUSTER_CRC_BITWISE - reference loop, 8 shift/xor steps per byte
+//   MODBUSTER_CRC_NIBBLE  - 16-entry table, 32 bytes of flash (AVR default)
+//   MODBUSTER_CRC_TABLE   - 256-entry table, 512 bytes of flash
+//   MODBUSTER_CRC_SLICE8  - 8x256-entry tables, 8 bytes per step on bulk
+//                           buffers, per-byte updates use the 256-entry table
+//                           (host default)
+#define MODBUSTER_CRC_BITWISE 0
+#define MODBUSTER_CRC_NIBBLE 1
+#define MODBUSTER_CRC_TABLE 2
+#define MODBUSTER_CRC_SLICE8 3
+
+#ifndef MODBUSTER_CRC
+#if defined(__AVR__)
+#define MODBUSTER_CRC MODBUSTER_CRC_NIBBLE
+#elif defined(ARDUINO)
+#define MODBUSTER_CRC MODBUSTER_CRC_TABLE
+#else
+#define MODBUSTER_CRC MODBUSTER_CRC_SLICE8
+#endif
+#endif
+
+namespace ModBuster {
+
+// Initial value of the running CRC state.
+const uint16_t ku16CRCInit = 0xFFFF;
+
+// Running CRC state after folding in a complete frame including its two
+// trailing CRC bytes; any other value means the frame is corrupted.
+const uint16_t ku16CRCResidue = 0x0000;
+
+uint16_t crc_update_bitwise(uint16_t u16State, uint8_t u8Byte);
+uint16_t crc_update_nibble(uint16_t u16State, uint8_t u8Byte);
+uint16_t crc_update_table(uint16_t u16State, uint8_t u8Byte);
+#if !defined(__AVR__)
+uint16_t crc_update_slice8(uint16_t u16State, const uint8_t *au8Buffer,
+                           uint16_t u16Length);
+#endif
+
+/**
+Fold one byte into a running CRC state.
+
+Start from ku16CRCInit and feed every byte of the frame as it arrives; no
+second pass over the frame is needed once it ends.
+
+@param u16State running CRC state
+@param u8Byte next frame byte
+@return updated CRC state
+*/
+static inline uint16_t crc_update(uint16_t u16State, uint8_t u8Byte) {
+#if MODBUSTER_CRC == MODBUSTER_CRC_BITWISE
+  return crc_update_bitwise(u16State, u8Byte);
+#elif MODBUSTER_CRC == MODBUSTER_CRC_NIBBLE
+  return crc_update_nibble(u16State, u8Byte);
+#else
+  return crc_update_table(u16State, u8Byte);
+#endif
+}
+
+uint16_t crc_update(uint16_t u16State, const uint8_t *au8Buffer,
+                    uint16_t u16Length);
+
+/**
+Convert a running CRC state into the value returned by ModBuster::crc().
+
+@param u16State running CRC state
+@return CRC with the low byte in the high position, i.e. highByte() is the
+first byte on the wire
+*/
+static inline uint16_t crc_final(uint16_t u16State) {
+  return (uint16_t)((u16State << 8) | (u16State >> 8));
+}
+
+} // namespace ModBuster
+
+#endif // MODBUSTER_CRC_H
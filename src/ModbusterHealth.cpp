@@ -0,0 +1,193 @@
+#include "ModbusterHealth.h"
+
+#include <string.h>
+
+using namespace ModBuster;
+
+/**
+Constructor.
+
+@param slaves per-slave table, filled in the order slaves are first seen
+@param u8Capacity number of entries in slaves
+@ingroup setup
+*/
+ModbusHealth::ModbusHealth(ModbusSlaveHealth *slaves, uint8_t u8Capacity)
+    : _slaves(slaves), _u8Capacity(slaves ? u8Capacity : 0) {
+  reset();
+}
+
+/**
+Bounds of the learnt timeouts.
+
+@param u16MinMs shortest wait for a response to start [ms]; default 50,
+leaves room for a slave busy with something else now and then
+@param u16MaxMs longest wait, also used for slaves not heard from yet
+[ms]; default 0, the master's response timeout
+@ingroup setup
+*/
+void ModbusHealth::setTimeoutBounds(uint16_t u16MinMs, uint16_t u16MaxMs) {
+  _u16MinMs = u16MinMs;
+  _u16MaxMs = u16MaxMs;
+}
+
+/**
+When and for how long slaves are quarantined.
+
+@param u8Failures consecutive requests left without any response before
+the quarantine; default 3, 0 never quarantines
+@param u16FirstMs first quarantine [ms]; default 1000
+@param u16MaxMs longest quarantine, reached by doubling after each failed
+probe [ms]; default 60000
+@ingroup setup
+*/
+void ModbusHealth::setQuarantine(uint8_t u8Failures, uint16_t u16FirstMs,
+                                 uint16_t u16MaxMs) {
+  _u8Failures = u8Failures;
+  _u16FirstMs = u16FirstMs;
+  _u16LimitMs = u16MaxMs;
+}
+
+/**
+Whether a request may go to a slave; called by the master.
+
+@param u8Slave Modbus slave ID
+@param u32Now millis()
+@return false while the slave is quarantined; true otherwise, including
+the probe once the quarantine is over
+*/
+bool ModbusHealth::admit(uint8_t u8Slave, uint32_t u32Now) {
+  const ModbusSlaveHealth *entry = slave(u8Slave);
+  if (!entry || !entry->u16Backoff)
+    return true;
+  return (int32_t)(u32Now - entry->u32Retry) >= 0;
+}
+
+/**
+Time to wait for a response to start; called by the master.
+
+@param u8Slave Modbus slave ID
+@param u16ResponseTimeout the master's response timeout [ms]
+@return srtt + 4 * rttvar, doubled for each consecutive failure and
+kept within the bounds [ms]
+*/
+uint16_t ModbusHealth::timeout(uint8_t u8Slave, uint16_t u16ResponseTimeout) {
+  uint16_t u16Max = _u16MaxMs ? _u16MaxMs : u16ResponseTimeout;
+  ModbusSlaveHealth *entry = findSlave(u8Slave, true);
+  if (!entry || !entry->u16Srtt)
+    return u16Max;
+
+  // at least 1 ms of slack, in 1/8 ms until rounded up to ms
+  uint32_t u32Slack = 4UL * entry->u16Rttvar;
+  if (u32Slack < 8)
+    u32Slack = 8;
+  uint32_t u32Ms = (entry->u16Srtt + u32Slack + 7) >> 3;
+  for (uint8_t i = 0; i < entry->u8Failures && u32Ms < u16Max; i++)
+    u32Ms <<= 1;
+
+  if (u32Ms < _u16MinMs)
+    u32Ms = _u16MinMs;
+  if (u32Ms > u16Max)
+    u32Ms = u16Max;
+  return (uint16_t)u32Ms;
+}
+
+/**
+Account for one request; called by the master.
+
+@param u8Slave Modbus slave ID
+@param bAnswered true if any response came back, valid or not
+@param u32FirstByteUs end of the request to the first response byte [µs]
+@param u32Now millis()
+*/
+void ModbusHealth::record(uint8_t u8Slave, bool bAnswered,
+                          uint32_t u32FirstByteUs, uint32_t u32Now) {
+  ModbusSlaveHealth *entry = findSlave(u8Slave, true);
+  if (!entry)
+    return;
+
+  if (bAnswered) {
+    // 1/8 ms, rounded
+    uint32_t u32Sample = (u32FirstByteUs + 62) / 125;
+    if (u32Sample > 0x7FFF)
+      u32Sample = 0x7FFF;
+    if (!u32Sample)
+      u32Sample = 1;
+    if (!entry->u16Srtt) {
+      entry->u16Srtt = (uint16_t)u32Sample;
+      entry->u16Rttvar = (uint16_t)(u32Sample / 2);
+    } else {
+      // rttvar += (|delta| - rttvar) / 4, srtt += delta / 8
+      int32_t i32Delta = (int32_t)u32Sample - entry->u16Srtt;
+      int32_t i32Deviation = i32Delta < 0 ? -i32Delta : i32Delta;
+      entry->u16Rttvar =
+          (uint16_t)(entry->u16Rttvar + (i32Deviation - entry->u16Rttvar) / 4);
+      entry->u16Srtt = (uint16_t)(entry->u16Srtt + i32Delta / 8);
+      if (!entry->u16Srtt)
+        entry->u16Srtt = 1;
+    }
+    entry->u8Failures = 0;
+    entry->u16Backoff = 0;
+    return;
+  }
+
+  if (entry->u8Failures < 0xFF)
+    entry->u8Failures++;
+  if (entry->u16Backoff) {
+    // failed probe
+    uint32_t u32Backoff = 2UL * entry->u16Backoff;
+    entry->u16Backoff =
+        (uint16_t)(u32Backoff < _u16LimitMs ? u32Backoff : _u16LimitMs);
+  } else if (_u8Failures && entry->u8Failures >= _u8Failures) {
+    entry->u16Backoff = _u16FirstMs ? _u16FirstMs : 1;
+  } else {
+    return;
+  }
+  entry->u32Retry = u32Now + entry->u16Backoff;
+}
+
+/**
+State of one slave.
+
+@param u8Slave Modbus slave ID
+@return its entry; nullptr if the slave has not been addressed or did not
+fit the table
+*/
+const ModbusSlaveHealth *ModbusHealth::slave(uint8_t u8Slave) const {
+  for (uint8_t i = 0; i < _u8Slaves; i++) {
+    if (_slaves[i].u8Slave == u8Slave)
+      return &_slaves[i];
+  }
+  return nullptr;
+}
+
+/**
+@param u8Slave Modbus slave ID
+@return true if requests to the slave are being skipped
+*/
+bool ModbusHealth::quarantined(uint8_t u8Slave) const {
+  const ModbusSlaveHealth *entry = slave(u8Slave);
+  return entry && entry->u16Backoff;
+}
+
+/**
+Forget every slave, lifting all quarantines.
+*/
+void ModbusHealth::reset() { _u8Slaves = 0; }
+
+/**
+Entry of a slave, added if asked to and there is room.
+
+@return nullptr if not found
+*/
+ModbusSlaveHealth *ModbusHealth::findSlave(uint8_t u8Slave, bool bAdd) {
+  for (uint8_t i = 0; i < _u8Slaves; i++) {
+    if (_slaves[i].u8Slave == u8Slave)
+      return &_slaves[i];
+  }
+  if (!bAdd || _u8Slaves == _u8Capacity)
+    return nullptr;
+  ModbusSlaveHealth &entry = _slaves[_u8Slaves++];
+  memset(&entry, 0, sizeof(entry));
+  entry.u8Slave = u8Slave;
+  return &entry;
+}
@@ -0,0 +1,80 @@
+#ifndef MODBUSTER_HEALTH_H
+#define MODBUSTER_HEALTH_H
+
+#include <stdint.h>
+
+namespace ModBuster {
+
+// Entry of the per-slave table handed to ModbusHealth.
+struct ModbusSlaveHealth {
+  uint8_t u8Slave;     ///< Modbus slave ID
+  uint8_t u8Failures;  ///< consecutive requests left without any response
+  uint16_t u16Srtt;    ///< smoothed time to the first response byte
+                       ///< [1/8 ms]; 0 until the slave has answered
+  uint16_t u16Rttvar;  ///< mean deviation of that time [1/8 ms]
+  uint16_t u16Backoff; ///< current quarantine [ms]; 0 if not quarantined
+  uint32_t u32Retry;   ///< millis() of the next probe while quarantined
+};
+
+/**
+Per-slave response timeouts learnt from the traffic, and quarantine of
+slaves that stopped answering.
+
+Attach it with setHealth() to a ModbusServer. For every slave the master
+then keeps a smoothed time to the first byte of the response and its
+mean deviation (exponentially weighted, as TCP does for round trips), and
+waits srtt + 4 * rttvar for a response to start instead of the fixed
+response timeout, within the bounds given to setTimeoutBounds(). Once the
+response has started, the response timeout applies again. Each request
+left without any response doubles that slave's timeout, up to the upper
+bound.
+
+After setQuarantine()'s number of consecutive failures, the slave is
+quarantined: requests to it return ku8MBSlaveQuarantined at once, without
+touching the bus, except for one probe request once the quarantine is
+over. A failed probe doubles the quarantine, up to its limit; any
+response lifts it. One dead drop thus costs a probe now and then instead
+of a full timeout on every poll.
+
+The per-slave table is supplied by the application; slaves beyond its
+capacity keep the master's response timeout and are never quarantined.
+Broadcasts are not tracked. Nothing is synchronised: use it from the
+thread running the transactions.
+*/
+class ModbusHealth {
+public:
+  ModbusHealth(ModbusSlaveHealth *slaves, uint8_t u8Capacity);
+
+  void setTimeoutBounds(uint16_t u16MinMs, uint16_t u16MaxMs);
+  void setQuarantine(uint8_t u8Failures, uint16_t u16FirstMs,
+                     uint16_t u16MaxMs);
+
+  bool admit(uint8_t u8Slave, uint32_t u32Now);
+  uint16_t timeout(uint8_t u8Slave, uint16_t u16ResponseTimeout);
+  void record(uint8_t u8Slave, bool bAnswered, uint32_t u32FirstByteUs,
+              uint32_t u32Now);
+
+  const ModbusSlaveHealth *slave(uint8_t u8Slave) const;
+  bool quarantined(uint8_t u8Slave) const;
+  uint8_t slaveCount() const { return _u8Slaves; }
+  const ModbusSlaveHealth &slaveAt(uint8_t u8Index) const {
+    return _slaves[u8Index];
+  }
+  void reset();
+
+private:
+  ModbusSlaveHealth *_slaves; ///< slaves in the order first seen
+  uint8_t _u8Capacity;        ///< entries in _slaves
+  uint8_t _u8Slaves;          ///< entries in use
+  uint16_t _u16MinMs = 50;    ///< lower bound of the timeouts [ms]
+  uint16_t _u16MaxMs = 0;     ///< upper bound [ms]; 0: response timeout
+  uint8_t _u8Failures = 3;    ///< failures before the quarantine
+  uint16_t _u16FirstMs = 1000;  ///< first quarantine [ms]
+  uint16_t _u16LimitMs = 60000; ///< longest quarantine [ms]
+
+  ModbusSlaveHealth *findSlave(uint8_t u8Slave, bool bAdd);
+};
+
+} // namespace ModBuster
+
+#endif // MODBUSTER_HEALTH_H
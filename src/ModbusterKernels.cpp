@@ -0,0 +1,262 @@
+#include "ModbusterKernels.h"
+
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+using namespace ModBuster;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ ||   \
+    defined(__AVR__) || defined(_M_IX86) || defined(_M_X64)
+#define MODBUSTER_LITTLE_ENDIAN 1
+#else
+#define MODBUSTER_LITTLE_ENDIAN 0
+#endif
+
+// 8-bit cores gain nothing from wider words; elsewhere a register-sized
+// word carries sizeof(BitWord) output bytes per shift
+#if MODBUSTER_LITTLE_ENDIAN && !defined(__AVR__)
+#define MODBUSTER_BIT_WORDS 1
+#if UINTPTR_MAX > 0xFFFFFFFFu
+typedef uint64_t BitWord;
+#else
+typedef uint32_t BitWord;
+#endif
+#else
+#define MODBUSTER_BIT_WORDS 0
+#endif
+
+// Copy u16Count bits starting at bit u8Shift of au8Src to bit 0 of au8Dst.
+// Whole destination bytes are overwritten, the bits past u16Count in the
+// last partial byte are kept.
+static void shiftCopy(uint8_t *au8Dst, const uint8_t *au8Src, uint8_t u8Shift,
+                      uint16_t u16Count) {
+  uint16_t u16Full = u16Count >> 3;
+  uint8_t u8Rem = u16Count & 7;
+  uint16_t i = 0;
+
+  if (!u8Shift) {
+    memcpy(au8Dst, au8Src, u16Full);
+    i = u16Full;
+  }
+
+  // with u8Shift > 0 a full output byte i spans source bytes i and i + 1,
+  // so every source byte read below lies within the u16Count bits
+#if defined(__SSE2__)
+  if (u8Shift) {
+    const __m128i kRight = _mm_cvtsi32_si128(u8Shift);
+    const __m128i kLeft = _mm_cvtsi32_si128(8 - u8Shift);
+    const __m128i kRightMask = _mm_set1_epi8((char)(0xFF >> u8Shift));
+    const __m128i kLeftMask = _mm_set1_epi8((char)(0xFF << (8 - u8Shift)));
+    for (; i + 16 <= u16Full; i += 16) {
+      __m128i lo = _mm_loadu_si128((const __m128i *)(au8Src + i));
+      __m128i hi = _mm_loadu_si128((const __m128i *)(au8Src + i + 1));
+      // 16-bit lane shifts, masked so no bit crosses a byte boundary
+      lo = _mm_and_si128(_mm_srl_epi16(lo, kRight), kRightMask);
+      hi = _mm_and_si128(_mm_sll_epi16(hi, kLeft), kLeftMask);
+      _mm_storeu_si128((__m128i *)(au8Dst + i), _mm_or_si128(lo, hi));
+    }
+  }
+#endif
+#if MODBUSTER_BIT_WORDS
+  if (u8Shift) {
+    for (; i + sizeof(BitWord) <= u16Full; i += sizeof(BitWord)) {
+      BitWord word;
+      memcpy(&word, au8Src + i, sizeof(word));
+      word = (word >> u8Shift) |
+             ((BitWord)au8Src[i + sizeof(BitWord)] << (8 * sizeof(BitWord) -
+                                                       u8Shift));
+      memcpy(au8Dst + i, &word, sizeof(word));
+    }
+  }
+#endif
+  for (; i < u16Full; i++) {
+    au8Dst[i] =
+        (uint8_t)((au8Src[i] >> u8Shift) | (au8Src[i + 1] << (8 - u8Shift)));
+  }
+
+  if (u8Rem) {
+    uint8_t u8Bits = au8Src[u16Full] >> u8Shift;
+    if (u8Shift + u8Rem > 8)
+      u8Bits |= au8Src[u16Full + 1] << (8 - u8Shift);
+    uint8_t u8Mask = (uint8_t)((1 << u8Rem) - 1);
+    au8Dst[u16Full] = (au8Dst[u16Full] & ~u8Mask) | (u8Bits & u8Mask);
+  }
+}
+
+/**
+Copy a run of bits to the start of a buffer, e.g. coils into a response.
+
+@param au8Dst destination, (u16Count + 7) / 8 bytes; unused bits of the
+last byte are cleared
+@param au8Src bit table
+@param u16SrcBit first bit to copy
+@param u16Count number of bits
+*/
+void ModBuster::bits_extract(uint8_t *au8Dst, const uint8_t *au8Src,
+                             uint16_t u16SrcBit, uint16_t u16Count) {
+  if (u16Count & 7)
+    au8Dst[u16Count >> 3] = 0;
+  shiftCopy(au8Dst, au8Src + (u16SrcBit >> 3), u16SrcBit & 7, u16Count);
+}
+
+/**
+Copy bits from the start of a buffer into a bit table, e.g. a FC0F
+request into the coils. Bits of au8Dst outside the run are kept.
+
+@param au8Dst bit table
+@param u16DstBit first bit to write
+@param au8Src source, (u16Count + 7) / 8 bytes
+@param u16Count number of bits
+*/
+void ModBuster::bits_insert(uint8_t *au8Dst, uint16_t u16DstBit,
+                            const uint8_t *au8Src, uint16_t u16Count) {
+  uint8_t u8Shift = u16DstBit & 7;
+  au8Dst += u16DstBit >> 3;
+
+  if (u8Shift && u16Count) {
+    // fill the partial first byte, then the rest is byte aligned
+    uint8_t u8Head = 8 - u8Shift;
+    if (u8Head > u16Count)
+      u8Head = (uint8_t)u16Count;
+    uint8_t u8Mask = (uint8_t)(((1 << u8Head) - 1) << u8Shift);
+    au8Dst[0] = (au8Dst[0] & ~u8Mask) | ((au8Src[0] << u8Shift) & u8Mask);
+    shiftCopy(au8Dst + 1, au8Src, u8Head, u16Count - u8Head);
+    return;
+  }
+  shiftCopy(au8Dst, au8Src, 0, u16Count);
+}
+
+/**
+Pack the bits of a word table, 16 per word, into frame bytes.
+
+@param au8Dst destination, (u16Count + 7) / 8 bytes; unused bits of the
+last byte are cleared
+@param au16Src bit table, bit i in word i / 16
+@param u16Count number of bits
+*/
+void ModBuster::bits_from_words(uint8_t *au8Dst, const uint16_t *au16Src,
+                                uint16_t u16Count) {
+#if MODBUSTER_LITTLE_ENDIAN
+  bits_extract(au8Dst, reinterpret_cast<const uint8_t *>(au16Src), 0,
+               u16Count);
+#else
+  uint16_t u16Bytes = (u16Count + 7) >> 3;
+  for (uint16_t i = 0; i < u16Bytes; i++) {
+    au8Dst[i] = (uint8_t)(au16Src[i >> 1] >> ((i & 1) << 3));
+  }
+  if (u16Count & 7)
+    au8Dst[u16Bytes - 1] &= (uint8_t)((1 << (u16Count & 7)) - 1);
+#endif
+}
+
+/**
+Unpack frame bytes into a word table, 16 bits per word.
+
+@param au16Dst destination, (u16Count + 15) / 16 words; unused bits of the
+last word are cleared
+@param au8Src source, (u16Count + 7) / 8 bytes
+@param u16Count number of bits
+*/
+void ModBuster::bits_to_words(uint16_t *au16Dst, const uint8_t *au8Src,
+                              uint16_t u16Count) {
+  if (!u16Count)
+    return;
+#if MODBUSTER_LITTLE_ENDIAN
+  au16Dst[(u16Count - 1) >> 4] = 0;
+  bits_extract(reinterpret_cast<uint8_t *>(au16Dst), au8Src, 0, u16Count);
+#else
+  uint16_t u16Bytes = (u16Count + 7) >> 3;
+  for (uint16_t i = 0; i < u16Bytes; i++) {
+    uint8_t u8Byte = au8Src[i];
+    if (i == u16Bytes - 1 && (u16Count & 7))
+      u8Byte &= (uint8_t)((1 << (u16Count & 7)) - 1);
+    if (i & 1)
+      au16Dst[i >> 1] |= (uint16_t)u8Byte << 8;
+    else
+      au16Dst[i >> 1] = u8Byte;
+  }
+#endif
+}
+
+// Copy u16Count words, swapping the two bytes of each: wire order (high
+// byte first) to little-endian memory order and back.
+static void swapCopy(uint8_t *au8Dst, const uint8_t *au8Src,
+                     uint16_t u16Count) {
+  uint16_t u16Bytes = 2 * u16Count;
+  uint16_t i = 0;
+
+#if defined(__AVX2__)
+  const __m256i kSwap = _mm256_setr_epi8(
+      1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14, 1, 0, 3, 2, 5, 4,
+      7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+  for (; i + 32 <= u16Bytes; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(au8Src + i));
+    _mm256_storeu_si256((__m256i *)(au8Dst + i), _mm256_shuffle_epi8(v, kSwap));
+  }
+#endif
+#if defined(__SSE2__)
+  for (; i + 16 <= u16Bytes; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(au8Src + i));
+    v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+    _mm_storeu_si128((__m128i *)(au8Dst + i), v);
+  }
+#elif defined(__ARM_NEON)
+  for (; i + 16 <= u16Bytes; i += 16) {
+    vst1q_u8(au8Dst + i, vrev16q_u8(vld1q_u8(au8Src + i)));
+  }
+#endif
+#if MODBUSTER_BIT_WORDS
+  const BitWord kLow = (BitWord)0x00FF00FF00FF00FFull;
+  for (; i + sizeof(BitWord) <= u16Bytes; i += sizeof(BitWord)) {
+    BitWord word;
+    memcpy(&word, au8Src + i, sizeof(word));
+    word = ((word & kLow) << 8) | ((word >> 8) & kLow);
+    memcpy(au8Dst + i, &word, sizeof(word));
+  }
+#endif
+  for (; i < u16Bytes; i += 2) {
+    uint8_t u8High = au8Src[i];
+    au8Dst[i] = au8Src[i + 1];
+    au8Dst[i + 1] = u8High;
+  }
+}
+
+/**
+Encode registers into frame bytes, high byte first.
+
+@param au8Dst destination, 2 * u16Count bytes
+@param au16Src register values
+@param u16Count number of registers
+*/
+void ModBuster::words_to_wire(uint8_t *au8Dst, const uint16_t *au16Src,
+                              uint16_t u16Count) {
+#if MODBUSTER_LITTLE_ENDIAN
+  swapCopy(au8Dst, reinterpret_cast<const uint8_t *>(au16Src), u16Count);
+#else
+  memcpy(au8Dst, au16Src, 2 * u16Count);
+#endif
+}
+
+/**
+Decode frame bytes, high byte first, into registers.
+
+@param au16Dst destination, u16Count registers
+@param au8Src source, 2 * u16Count bytes
+@param u16Count number of registers
+*/
+void ModBuster::words_from_wire(uint16_t *au16Dst, const uint8_t *au8Src,
+                                uint16_t u16Count) {
+#if MODBUSTER_LITTLE_ENDIAN
+  swapCopy(reinterpret_cast<uint8_t *>(au16Dst), au8Src, u16Count);
+#else
+  memcpy(au16Dst, au8Src, 2 * u16Count);
+#endif
+}
@@ -0,0 +1,34 @@
+#ifndef MODBUSTER_KERNELS_H
+#define MODBUSTER_KERNELS_H
+
+#include <stdint.h>
+
+// Bulk data movement between application memory and Modbus frames.
+//
+// Bits are numbered LSB first within each byte, as in coil and discrete
+// input frames, and within each word of a uint16_t bit table. Every kernel
+// works on whole bytes or machine words with shifts and masks; host builds
+// with SSE2 move 16 bytes per step.
+//
+// Registers travel high byte first. The word kernels swap whole spans at
+// once (AVX2/SSE2/NEON on host, machine words elsewhere) and reduce to a
+// plain copy on big-endian targets.
+
+namespace ModBuster {
+
+void bits_extract(uint8_t *au8Dst, const uint8_t *au8Src, uint16_t u16SrcBit,
+                  uint16_t u16Count);
+void bits_insert(uint8_t *au8Dst, uint16_t u16DstBit, const uint8_t *au8Src,
+                 uint16_t u16Count);
+void bits_from_words(uint8_t *au8Dst, const uint16_t *au16Src,
+                     uint16_t u16Count);
+void bits_to_words(uint16_t *au16Dst, const uint8_t *au8Src,
+                   uint16_t u16Count);
+void words_to_wire(uint8_t *au8Dst, const uint16_t *au16Src,
+                   uint16_t u16Count);
+void words_from_wire(uint16_t *au16Dst, const uint8_t *au8Src,
+                     uint16_t u16Count);
+
+} // namespace ModBuster
+
+#endif // MODBUSTER_KERNELS_H
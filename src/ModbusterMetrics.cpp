@@ -0,0 +1,222 @@
+#include "ModbusterMetrics.h"
+
+#include "Modbuster.h"
+
+#include <string.h>
+
+using namespace ModBuster;
+
+// Function codes with an entry of their own, in entry order.
+static const uint8_t kFunctions[ku8MetricsFunctions] = {
+    ku8MBReadCoils,
+    ku8MBReadDiscreteInputs,
+    ku8MBReadHoldingRegisters,
+    ku8MBReadInputRegisters,
+    ku8MBWriteSingleCoil,
+    ku8MBWriteSingleRegister,
+    ku8MBDiagnostics,
+    ku8MBGetCommEventCounter,
+    ku8MBWriteMultipleCoils,
+    ku8MBWriteMultipleRegisters,
+    ku8MBMaskWriteRegister,
+    ku8MBReadWriteMultipleRegisters,
+};
+
+/**
+Count one duration.
+
+@param u32Us duration [microseconds]
+*/
+void ModbusHistogram::add(uint32_t u32Us) {
+  uint8_t u8Bucket = 0;
+  for (u32Us >>= 8; u32Us && u8Bucket < ku8MetricsBuckets - 1; u32Us >>= 1)
+    u8Bucket++;
+  au32Count[u8Bucket]++;
+}
+
+/**
+@return durations counted
+*/
+uint32_t ModbusHistogram::count() const {
+  uint32_t u32Count = 0;
+  for (uint8_t i = 0; i < ku8MetricsBuckets; i++)
+    u32Count += au32Count[i];
+  return u32Count;
+}
+
+/**
+Duration not exceeded by a share of the counts, to bucket precision.
+
+@param u8Percent share of the counts (0..100)
+@return upper bound of the bucket holding that share [microseconds]; 0
+for an empty histogram, 0xFFFFFFFF if it falls into the last bucket
+*/
+uint32_t ModbusHistogram::percentile(uint8_t u8Percent) const {
+  uint32_t u32Count = count();
+  if (!u32Count)
+    return 0;
+  // rank of the count sought, rounded up
+  uint64_t u64Rank = ((uint64_t)u32Count * u8Percent + 99) / 100;
+  if (!u64Rank)
+    u64Rank = 1;
+  uint64_t u64Seen = 0;
+  for (uint8_t i = 0; i < ku8MetricsBuckets; i++) {
+    u64Seen += au32Count[i];
+    if (u64Seen >= u64Rank)
+      return upperBound(i);
+  }
+  return upperBound(ku8MetricsBuckets - 1);
+}
+
+/**
+@param u8Bucket bucket index (0..ku8MetricsBuckets-1)
+@return durations of the bucket are below this [microseconds]; 0xFFFFFFFF
+for the last bucket
+*/
+uint32_t ModbusHistogram::upperBound(uint8_t u8Bucket) {
+  if (u8Bucket >= ku8MetricsBuckets - 1)
+    return 0xFFFFFFFF;
+  return 256UL << u8Bucket;
+}
+
+/**
+Constructor.
+
+@param slaves per-slave table, filled in the order slaves are first seen
+@param u8Capacity number of entries in slaves
+@ingroup setup
+*/
+ModbusMetrics::ModbusMetrics(ModbusSlaveStats *slaves, uint8_t u8Capacity)
+    : _slaves(slaves), _u8Capacity(slaves ? u8Capacity : 0) {
+  reset();
+}
+
+/**
+Account for one transaction; called by the transport.
+
+@param sample what the transaction sent, received and how long it took
+*/
+void ModbusMetrics::record(const ModbusSample &sample) {
+  add(_total, sample);
+  add(_functions[functionIndex(sample.u8Function)], sample);
+  ModbusStats *stats = findSlave(sample.u8Slave);
+  if (stats)
+    add(*stats, sample);
+}
+
+/**
+Traffic of one function code.
+
+@param u8Function function code
+@return its entry; codes other than the twelve the library speaks share
+one
+*/
+const ModbusStats &ModbusMetrics::function(uint8_t u8Function) const {
+  return _functions[functionIndex(u8Function)];
+}
+
+/**
+Traffic of one slave.
+
+@param u8Slave Modbus slave ID
+@return its entry; nullptr if the slave has not been seen or did not fit
+the table
+*/
+const ModbusStats *ModbusMetrics::slave(uint8_t u8Slave) const {
+  for (uint8_t i = 0; i < _u8Slaves; i++) {
+    if (_slaves[i].u8Slave == u8Slave)
+      return &_slaves[i].stats;
+  }
+  return nullptr;
+}
+
+/**
+Copy the figures into another object, e.g. to report them while this one
+keeps counting.
+
+@param copy destination; takes as many slaves as its table holds
+*/
+void ModbusMetrics::snapshot(ModbusMetrics &copy) const {
+  copy._total = _total;
+  memcpy(copy._functions, _functions, sizeof(_functions));
+  uint8_t u8Slaves = _u8Slaves < copy._u8Capacity ? _u8Slaves
+                                                   : copy._u8Capacity;
+  if (u8Slaves)
+    memcpy(copy._slaves, _slaves, u8Slaves * sizeof(ModbusSlaveStats));
+  copy._u8Slaves = u8Slaves;
+  copy._u8LastSlave = 0;
+}
+
+/**
+Clear all figures and forget the slaves seen.
+*/
+void ModbusMetrics::reset() {
+  memset(&_total, 0, sizeof(_total));
+  memset(_functions, 0, sizeof(_functions));
+  _u8Slaves = 0;
+  _u8LastSlave = 0;
+}
+
+/**
+Entry of a slave, added if there is room.
+
+@return nullptr if the table is full
+*/
+ModbusStats *ModbusMetrics::findSlave(uint8_t u8Slave) {
+  // consecutive transactions mostly address the same slave
+  if (_u8LastSlave < _u8Slaves && _slaves[_u8LastSlave].u8Slave == u8Slave)
+    return &_slaves[_u8LastSlave].stats;
+  for (uint8_t i = 0; i < _u8Slaves; i++) {
+    if (_slaves[i].u8Slave == u8Slave) {
+      _u8LastSlave = i;
+      return &_slaves[i].stats;
+    }
+  }
+  if (_u8Slaves == _u8Capacity)
+    return nullptr;
+  ModbusSlaveStats &entry = _slaves[_u8Slaves];
+  memset(&entry, 0, sizeof(entry));
+  entry.u8Slave = u8Slave;
+  _u8LastSlave = _u8Slaves++;
+  return &entry.stats;
+}
+
+/**
+@return entry of a function code in _functions
+*/
+uint8_t ModbusMetrics::functionIndex(uint8_t u8Function) {
+  for (uint8_t i = 0; i < ku8MetricsFunctions; i++) {
+    if (kFunctions[i] == u8Function)
+      return i;
+  }
+  return ku8MetricsFunctions;
+}
+
+/**
+Fold a transaction into one entry.
+*/
+void ModbusMetrics::add(ModbusStats &stats, const ModbusSample &sample) {
+  uint8_t u8Status = sample.u8Status;
+  bool bException = u8Status && u8Status < ku8MBInvalidSlaveID;
+
+  stats.u32Requests++;
+  stats.u32BytesSent += sample.u16Sent;
+  stats.u32BytesReceived += sample.u16Received;
+  stats.u64BusyUs += sample.u32BusyUs;
+
+  if (u8Status == ku8MBInvalidCRC)
+    stats.u32CrcErrors++;
+  else if (u8Status == ku8MBResponseTimedOut)
+    stats.u32Timeouts++;
+  else if (u8Status && !bException)
+    stats.u32Errors++;
+  // broadcasts are neither answered nor timed
+  else if (sample.u16Sent && sample.u16Received) {
+    stats.u32Responses++;
+    if (bException)
+      stats.u32Exceptions++;
+    stats.turnaround.add(sample.u32TurnaroundUs);
+    stats.firstByte.add(sample.u32FirstByteUs);
+    stats.frame.add(sample.u32FrameUs);
+  }
+}
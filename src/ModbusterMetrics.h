@@ -0,0 +1,125 @@
+#ifndef MODBUSTER_METRICS_H
+#define MODBUSTER_METRICS_H
+
+#include <stdint.h>
+
+namespace ModBuster {
+
+// Buckets of a ModbusHistogram; bucket i < 13 holds durations below
+// 256 << i microseconds, the last one everything from 1.048 s on
+const uint8_t ku8MetricsBuckets = 14;
+
+// Function codes with an entry of their own in ModbusMetrics; all others
+// share one more entry
+const uint8_t ku8MetricsFunctions = 12;
+
+/**
+Fixed-bucket latency histogram, doubling bucket width from 256 µs.
+*/
+struct ModbusHistogram {
+  uint32_t au32Count[ku8MetricsBuckets]; ///< durations per bucket
+
+  void add(uint32_t u32Us);
+  uint32_t count() const;
+  uint32_t percentile(uint8_t u8Percent) const;
+  static uint32_t upperBound(uint8_t u8Bucket);
+};
+
+/**
+Traffic of a ModbusServer or ModbusClient, in total, for one function code
+or for one slave.
+
+The master counts the requests it sends and the responses it receives;
+turnaround runs from the end of the request to the last byte of the
+response, first byte to its first byte, frame from first to last byte.
+The slave counts the requests it receives and the responses it sends;
+frame is the duration of the request, first byte the time from its last
+byte until the response goes out, turnaround until the response has been
+sent. Histograms only hold transactions that produced a response.
+*/
+struct ModbusStats {
+  uint32_t u32Requests;      ///< requests sent (master) or received (slave)
+  uint32_t u32Responses;     ///< responses received or sent, exceptions included
+  uint32_t u32Exceptions;    ///< exception responses
+  uint32_t u32CrcErrors;     ///< frames dropped for a bad CRC or a T1.5 gap
+  uint32_t u32Timeouts;      ///< requests left without a complete response
+  uint32_t u32Errors;        ///< other failures, e.g. ku8MBInvalidFunction
+  uint32_t u32BytesSent;     ///< bytes written to the line, CRC included
+  uint32_t u32BytesReceived; ///< bytes read from the line, CRC included
+  uint64_t u64BusyUs;        ///< time the transactions held the bus [µs]
+  ModbusHistogram turnaround; ///< end of request to end of response
+  ModbusHistogram firstByte;  ///< end of request to start of response
+  ModbusHistogram frame;      ///< duration of the response (master) or
+                              ///< request (slave)
+};
+
+// Entry of the per-slave table handed to ModbusMetrics.
+struct ModbusSlaveStats {
+  uint8_t u8Slave;  ///< Modbus slave ID
+  ModbusStats stats;
+};
+
+/**
+One transaction as reported by the transport to ModbusMetrics::record().
+*/
+struct ModbusSample {
+  uint8_t u8Slave;          ///< Modbus slave ID
+  uint8_t u8Function;       ///< function code of the request
+  uint8_t u8Status;         ///< ku8MBSuccess, exception or status code
+  uint16_t u16Sent;         ///< bytes written [bytes]
+  uint16_t u16Received;     ///< bytes read; 0 if nothing came back [bytes]
+  uint32_t u32TurnaroundUs; ///< see ModbusStats::turnaround [µs]
+  uint32_t u32FirstByteUs;  ///< see ModbusStats::firstByte [µs]
+  uint32_t u32FrameUs;      ///< see ModbusStats::frame [µs]
+  uint32_t u32BusyUs;       ///< bus time of the whole transaction [µs]
+};
+
+/**
+Transaction counters and latency histograms, in total, per function code
+and per slave ID.
+
+Attach it with setMetrics() to a ModbusServer or ModbusClient, which then
+reports every transaction; without one, nothing is recorded. Recording is
+a handful of increments and a table lookup, no division and no
+allocation. The twelve function codes the library speaks (FC01-06, FC08,
+FC0B, FC0F, FC10, FC16, FC17) get an entry each, all others share one; the
+per-slave table is supplied by the application, and slaves beyond its
+capacity are only counted in total(). That table aside, the object takes
+about 3 kB, which rules out the smallest AVR boards.
+
+Nothing is synchronised: take snapshots and reset from the thread running
+the transactions.
+*/
+class ModbusMetrics {
+public:
+  ModbusMetrics(ModbusSlaveStats *slaves = nullptr, uint8_t u8Capacity = 0);
+
+  void record(const ModbusSample &sample);
+
+  const ModbusStats &total() const { return _total; }
+  const ModbusStats &function(uint8_t u8Function) const;
+  const ModbusStats *slave(uint8_t u8Slave) const;
+  uint8_t slaveCount() const { return _u8Slaves; }
+  const ModbusSlaveStats &slaveAt(uint8_t u8Index) const {
+    return _slaves[u8Index];
+  }
+
+  void snapshot(ModbusMetrics &copy) const;
+  void reset();
+
+private:
+  ModbusStats _total;
+  ModbusStats _functions[ku8MetricsFunctions + 1]; ///< last: other codes
+  ModbusSlaveStats *_slaves; ///< slaves in the order first seen
+  uint8_t _u8Capacity;       ///< entries in _slaves
+  uint8_t _u8Slaves;         ///< entries in use
+  uint8_t _u8LastSlave;      ///< index of the slave recorded last
+
+  ModbusStats *findSlave(uint8_t u8Slave);
+  static uint8_t functionIndex(uint8_t u8Function);
+  static void add(ModbusStats &stats, const ModbusSample &sample);
+};
+
+} // namespace ModBuster
+
+#endif // MODBUSTER_METRICS_H
@@ -0,0 +1,616 @@
+#include "ModbusterPdu.h"
+
+#include "Arduino.h"
+#include "ModbusterKernels.h"
+
+#include <string.h>
+
+using namespace ModBuster;
+
+/**
+Constructor.
+
+@param au8Pdu PDU buffer holding the request, function code first
+@param u16Capacity number of bytes in au8Pdu; responses that would not fit
+are refused with ku8MBIllegalDataValue
+@param u8MaxRegisters largest register quantity served by one request
+@param counters serial line counters served by FC08 and FC0B, which
+FC08 may clear; nullptr refuses both functions
+@ingroup setup
+*/
+ModbusPduHandler::ModbusPduHandler(uint8_t *au8Pdu, uint16_t u16Capacity,
+                                   uint8_t u8MaxRegisters,
+                                   ModbusCounters *counters)
+    : _au8Pdu(au8Pdu), _u16Capacity(u16Capacity),
+      _u8MaxRegisters(u8MaxRegisters), _counters(counters), _u16Length(0) {}
+
+/**
+Whether a request may be broadcast to slave ID 0.
+
+Only writes qualify: slaves execute a broadcast without answering it, so
+there is no response to carry data back.
+
+@param u8Function function code
+@return true for FC05, FC06, FC0Fh, FC10h and FC16h
+*/
+bool ModbusPduHandler::broadcastable(uint8_t u8Function) {
+  switch (u8Function) {
+  case ku8MBWriteSingleCoil:
+  case ku8MBWriteSingleRegister:
+  case ku8MBWriteMultipleCoils:
+  case ku8MBWriteMultipleRegisters:
+  case ku8MBMaskWriteRegister:
+    return true;
+  default:
+    return false;
+  }
+}
+
+/**
+Length of a request, predicted from its header.
+
+@param au8Pdu request received so far, function code first
+@param u16Received number of bytes received so far
+@return request PDU length [bytes]; 0 while the header is incomplete and
+for unknown function codes
+*/
+uint16_t ModbusPduHandler::requestLength(const uint8_t *au8Pdu,
+                                         uint16_t u16Received) {
+  if (!u16Received)
+    return 0;
+  switch (au8Pdu[PDU_FUNC]) {
+  case ku8MBReadCoils:
+  case ku8MBReadDiscreteInputs:
+  case ku8MBReadHoldingRegisters:
+  case ku8MBReadInputRegisters:
+  case ku8MBWriteSingleCoil:
+  case ku8MBWriteSingleRegister:
+  case ku8MBDiagnostics:
+    return 5;
+  case ku8MBGetCommEventCounter:
+    return 1;
+  case ku8MBMaskWriteRegister:
+    return 7;
+  case ku8MBWriteMultipleCoils:
+  case ku8MBWriteMultipleRegisters:
+    if (u16Received <= PDU_BYTE_CNT)
+      return 0;
+    return 6 + au8Pdu[PDU_BYTE_CNT];
+  case ku8MBReadWriteMultipleRegisters:
+    if (u16Received <= 9)
+      return 0;
+    return 10 + au8Pdu[9];
+  default:
+    return 0;
+  }
+}
+
+/**
+Length of a response, predicted from its header.
+
+@param au8Pdu response received so far, function code first
+@param u16Received number of bytes received so far
+@return response PDU length [bytes]; 0 while the header is incomplete and
+for unknown function codes
+*/
+uint16_t ModbusPduHandler::responseLength(const uint8_t *au8Pdu,
+                                          uint16_t u16Received) {
+  if (!u16Received)
+    return 0;
+  if (au8Pdu[PDU_FUNC] & 0x80)
+    return 2;
+  switch (au8Pdu[PDU_FUNC]) {
+  case ku8MBReadCoils:
+  case ku8MBReadDiscreteInputs:
+  case ku8MBReadHoldingRegisters:
+  case ku8MBReadInputRegisters:
+  case ku8MBReadWriteMultipleRegisters:
+    if (u16Received < 2)
+      return 0;
+    return 2 + au8Pdu[1];
+  case ku8MBWriteSingleCoil:
+  case ku8MBWriteSingleRegister:
+  case ku8MBWriteMultipleCoils:
+  case ku8MBWriteMultipleRegisters:
+  case ku8MBDiagnostics:
+  case ku8MBGetCommEventCounter:
+    return 5;
+  case ku8MBMaskWriteRegister:
+    return 7;
+  default:
+    return 0;
+  }
+}
+
+/**
+Validate a complete request and answer it from the register map.
+
+The response, or the exception response, replaces the request; its length
+is returned by length().
+
+@param &map registers served to the master
+@param u16Length request length [bytes]
+@param bOverrun true if the request was longer than the buffer and has
+been truncated
+@return 0 on success; Modbus exception code otherwise
+*/
+uint8_t ModbusPduHandler::serve(ModbusRegisterMap &map, uint16_t u16Length,
+                                bool bOverrun) {
+  uint8_t u8Exception = checkRequest(u16Length, bOverrun);
+  if (!u8Exception) {
+    switch (_au8Pdu[PDU_FUNC]) {
+    case ku8MBReadCoils:
+    case ku8MBReadDiscreteInputs:
+      u8Exception = process_FC1(map);
+      break;
+    case ku8MBReadInputRegisters:
+    case ku8MBReadHoldingRegisters:
+      u8Exception = process_FC3(map);
+      break;
+    case ku8MBWriteSingleCoil:
+      u8Exception = process_FC5(map);
+      break;
+    case ku8MBWriteSingleRegister:
+      u8Exception = process_FC6(map);
+      break;
+    case ku8MBDiagnostics:
+      u8Exception = process_FC8();
+      break;
+    case ku8MBGetCommEventCounter:
+      u8Exception = process_FC11();
+      break;
+    case ku8MBWriteMultipleCoils:
+      u8Exception = process_FC15(map);
+      break;
+    case ku8MBWriteMultipleRegisters:
+      u8Exception = process_FC16(map);
+      break;
+    case ku8MBMaskWriteRegister:
+      u8Exception = process_FC22(map);
+      break;
+    case ku8MBReadWriteMultipleRegisters:
+      u8Exception = process_FC23(map);
+      break;
+    }
+  }
+  if (u8Exception)
+    buildException(u8Exception);
+  return u8Exception;
+}
+
+/**
+Check the request against the protocol limits and the capacity of the
+buffer.
+
+@param u16Length request length [bytes]
+@param bOverrun true if the request has been truncated
+@return 0 if the request can be served; ku8MBIllegalFunction for
+unsupported function codes, diagnostics included when there are no
+counters; ku8MBIllegalDataValue for malformed requests or quantities out
+of range
+*/
+uint8_t ModbusPduHandler::checkRequest(uint16_t u16Length,
+                                       bool bOverrun) const {
+  uint16_t u16Qty, u16WriteQty, u16ResponseSize;
+
+  if (!u16Length)
+    return ku8MBIllegalDataValue;
+  switch (_au8Pdu[PDU_FUNC]) {
+  case ku8MBReadCoils:
+  case ku8MBReadDiscreteInputs:
+  case ku8MBReadHoldingRegisters:
+  case ku8MBReadInputRegisters:
+  case ku8MBWriteSingleCoil:
+  case ku8MBWriteSingleRegister:
+  case ku8MBWriteMultipleCoils:
+  case ku8MBWriteMultipleRegisters:
+  case ku8MBMaskWriteRegister:
+  case ku8MBReadWriteMultipleRegisters:
+    break;
+  case ku8MBDiagnostics:
+  case ku8MBGetCommEventCounter:
+    if (!_counters)
+      return ku8MBIllegalFunction;
+    break;
+  default:
+    return ku8MBIllegalFunction;
+  }
+
+  // the request must be as long as its header announces
+  if (bOverrun || u16Length != requestLength(_au8Pdu, u16Length))
+    return ku8MBIllegalDataValue;
+
+  u16Qty = word(_au8Pdu[PDU_NB_HI], _au8Pdu[PDU_NB_LO]);
+  switch (_au8Pdu[PDU_FUNC]) {
+  case ku8MBReadCoils:
+  case ku8MBReadDiscreteInputs:
+    if (!u16Qty || u16Qty > 2000)
+      return ku8MBIllegalDataValue;
+    u16ResponseSize = 2 + ((u16Qty + 7) >> 3);
+    break;
+  case ku8MBReadWriteMultipleRegisters:
+    u16WriteQty = word(_au8Pdu[7], _au8Pdu[8]);
+    if (!u16WriteQty || u16WriteQty > 121 || u16WriteQty > _u8MaxRegisters ||
+        _au8Pdu[9] != 2 * u16WriteQty)
+      return ku8MBIllegalDataValue;
+    // fall through
+  case ku8MBReadInputRegisters:
+  case ku8MBReadHoldingRegisters:
+    if (!u16Qty || u16Qty > _u8MaxRegisters)
+      return ku8MBIllegalDataValue;
+    u16ResponseSize = 2 + 2 * u16Qty;
+    break;
+  case ku8MBWriteSingleCoil:
+    if (u16Qty != 0xFF00 && u16Qty != 0x0000)
+      return ku8MBIllegalDataValue;
+    u16ResponseSize = 5;
+    break;
+  case ku8MBDiagnostics:
+  case ku8MBGetCommEventCounter:
+    u16ResponseSize = 5;
+    break;
+  case ku8MBWriteMultipleCoils:
+    if (!u16Qty || u16Qty > 1968 ||
+        _au8Pdu[PDU_BYTE_CNT] != (u16Qty + 7) >> 3)
+      return ku8MBIllegalDataValue;
+    u16ResponseSize = 5;
+    break;
+  case ku8MBWriteMultipleRegisters:
+    if (!u16Qty || u16Qty > 123 || u16Qty > _u8MaxRegisters ||
+        _au8Pdu[PDU_BYTE_CNT] != 2 * u16Qty)
+      return ku8MBIllegalDataValue;
+    u16ResponseSize = 5;
+    break;
+  default:
+    u16ResponseSize = 7;
+    break;
+  }
+  return u16ResponseSize > _u16Capacity ? ku8MBIllegalDataValue : 0;
+}
+
+/**
+Replace the request with an exception response.
+
+@param u8Exception Modbus exception code
+*/
+void ModbusPduHandler::buildException(uint8_t u8Exception) {
+  _au8Pdu[PDU_FUNC] |= 0x80;
+  _au8Pdu[1] = u8Exception;
+  _u16Length = 2;
+}
+
+/**
+ * @brief
+ * This method processes functions 1 & 2
+ * This method reads a bit array and transfers it to the master
+ *
+ * @param &map registers served to the master
+ * @return 0 on success; Modbus exception code otherwise
+ * @ingroup discrete
+ */
+uint8_t ModbusPduHandler::process_FC1(ModbusRegisterMap &map) {
+  uint8_t u8Table = _au8Pdu[PDU_FUNC] == ku8MBReadCoils
+                        ? ku8MBTableCoils
+                        : ku8MBTableDiscreteInputs;
+  uint16_t u16StartCoil = word(_au8Pdu[PDU_ADD_HI], _au8Pdu[PDU_ADD_LO]);
+  uint16_t u16Coilno = word(_au8Pdu[PDU_NB_HI], _au8Pdu[PDU_NB_LO]);
+
+  const ModbusRegion *region = map.find(u8Table, u16StartCoil, u16Coilno);
+  if (!region)
+    return ku8MBIllegalDataAddress;
+
+  // put the number of bytes in the outcoming message
+  uint8_t u8bytesno = (uint8_t)((u16Coilno + 7) >> 3);
+  _au8Pdu[1] = u8bytesno;
+
+  // copy the coils of the region into the outcoming message
+  bits_extract(_au8Pdu + 2, region->pu8Bits,
+               u16StartCoil - region->u16Address, u16Coilno);
+  _u16Length = 2 + u8bytesno;
+  return 0;
+}
+
+/**
+ * @brief
+ * This method processes functions 3 & 4
+ * This method reads a word array and transfers it to the master
+ *
+ * @param &map registers served to the master
+ * @return 0 on success; Modbus exception code otherwise
+ * @ingroup register
+ */
+uint8_t ModbusPduHandler::process_FC3(ModbusRegisterMap &map) {
+  uint8_t u8Table = _au8Pdu[PDU_FUNC] == ku8MBReadHoldingRegisters
+                        ? ku8MBTableHoldingRegisters
+                        : ku8MBTableInputRegisters;
+  uint16_t u16StartAdd = word(_au8Pdu[PDU_ADD_HI], _au8Pdu[PDU_ADD_LO]);
+  uint16_t u16regsno = word(_au8Pdu[PDU_NB_HI], _au8Pdu[PDU_NB_LO]);
+
+  const ModbusRegion *region = map.find(u8Table, u16StartAdd, u16regsno);
+  if (!region)
+    return ku8MBIllegalDataAddress;
+
+  putRegisters(region, u16StartAdd - region->u16Address, u16regsno);
+  return 0;
+}
+
+/**
+ * @brief
+ * This method processes function 5
+ * This method writes a value assigned by the master to a single bit
+ *
+ * @param &map registers served to the master
+ * @return 0 on success; Modbus exception code otherwise
+ * @ingroup discrete
+ */
+uint8_t ModbusPduHandler::process_FC5(ModbusRegisterMap &map) {
+  uint16_t u16coil = word(_au8Pdu[PDU_ADD_HI], _au8Pdu[PDU_ADD_LO]);
+
+  const ModbusRegion *region = map.find(ku8MBTableCoils, u16coil, 1);
+  if (!region)
+    return ku8MBIllegalDataAddress;
+
+  // write to coil
+  uint16_t u16Bit = u16coil - region->u16Address;
+  bitWrite(region->pu8Bits[u16Bit >> 3], u16Bit & 7,
+           _au8Pdu[PDU_NB_HI] == 0xff);
+
+  // send answer to master
+  _u16Length = 5;
+  return 0;
+}
+
+/**
+ * @brief
+ * This method processes function 6
+ * This method writes a value assigned by the master to a single word
+ *
+ * @param &map registers served to the master
+ * @return 0 on success; Modbus exception code otherwise
+ * @ingroup register
+ */
+uint8_t ModbusPduHandler::process_FC6(ModbusRegisterMap &map) {
+  uint16_t u16add = word(_au8Pdu[PDU_ADD_HI], _au8Pdu[PDU_ADD_LO]);
+
+  const ModbusRegion *region =
+      map.find(ku8MBTableHoldingRegisters, u16add, 1);
+  if (!region)
+    return ku8MBIllegalDataAddress;
+
+  getRegisters(region, u16add - region->u16Address, 1, PDU_NB_HI);
+
+  // keep the same header
+  _u16Length = 5;
+  return 0;
+}
+
+/**
+ * @brief
+ * This method processes function 8
+ * This method answers a serial line diagnostics sub-function: it echoes
+ * the request, with the data field replaced by the counter asked for
+ *
+ * @return 0 on success; ku8MBIllegalFunction for sub-functions not
+ * supported, Restart Communications Option and Force Listen Only Mode
+ * among them
+ * @ingroup diagnostics
+ */
+uint8_t ModbusPduHandler::process_FC8() {
+  uint16_t u16SubFunction = word(_au8Pdu[1], _au8Pdu[2]);
+  uint16_t u16Data;
+
+  switch (u16SubFunction) {
+  case ku16MBReturnQueryData:
+    u16Data = word(_au8Pdu[3], _au8Pdu[4]);
+    break;
+  case ku16MBClearCounters:
+    u16Data = word(_au8Pdu[3], _au8Pdu[4]);
+    memset(_counters, 0, sizeof(*_counters));
+    break;
+  case ku16MBClearOverrunCounter:
+    u16Data = word(_au8Pdu[3], _au8Pdu[4]);
+    _counters->u16Overruns = 0;
+    break;
+  case ku16MBBusMessageCount:
+    u16Data = _counters->u16BusMessages;
+    break;
+  case ku16MBBusCommErrorCount:
+    u16Data = _counters->u16BusErrors;
+    break;
+  case ku16MBSlaveExceptionCount:
+    u16Data = _counters->u16Exceptions;
+    break;
+  case ku16MBSlaveMessageCount:
+    u16Data = _counters->u16SlaveMessages;
+    break;
+  case ku16MBSlaveNoResponseCount:
+    u16Data = _counters->u16NoResponses;
+    break;
+  case ku16MBBusCharOverrunCount:
+    u16Data = _counters->u16Overruns;
+    break;
+  case ku16MBReturnDiagnosticRegister:
+  case ku16MBSlaveNAKCount:
+  case ku16MBSlaveBusyCount:
+    // nothing to report: no diagnostic bits, never NAK, never busy
+    u16Data = 0;
+    break;
+  default:
+    return ku8MBIllegalFunction;
+  }
+
+  _au8Pdu[3] = highByte(u16Data);
+  _au8Pdu[4] = lowByte(u16Data);
+  _u16Length = 5;
+  return 0;
+}
+
+/**
+ * @brief
+ * This method processes function 11
+ * This method returns a status word, 0 as the slave is never busy
+ * between requests, and the event counter
+ *
+ * @return 0
+ * @ingroup diagnostics
+ */
+uint8_t ModbusPduHandler::process_FC11() {
+  _au8Pdu[1] = 0;
+  _au8Pdu[2] = 0;
+  _au8Pdu[3] = highByte(_counters->u16Events);
+  _au8Pdu[4] = lowByte(_counters->u16Events);
+  _u16Length = 5;
+  return 0;
+}
+
+/**
+ * @brief
+ * This method processes function 15
+ * This method writes a bit array assigned by the master
+ *
+ * @param &map registers served to the master
+ * @return 0 on success; Modbus exception code otherwise
+ * @ingroup discrete
+ */
+uint8_t ModbusPduHandler::process_FC15(ModbusRegisterMap &map) {
+  uint16_t u16StartCoil = word(_au8Pdu[PDU_ADD_HI], _au8Pdu[PDU_ADD_LO]);
+  uint16_t u16Coilno = word(_au8Pdu[PDU_NB_HI], _au8Pdu[PDU_NB_LO]);
+
+  const ModbusRegion *region =
+      map.find(ku8MBTableCoils, u16StartCoil, u16Coilno);
+  if (!region)
+    return ku8MBIllegalDataAddress;
+
+  // copy the coils of the incoming message into the region
+  bits_insert(region->pu8Bits, u16StartCoil - region->u16Address,
+              _au8Pdu + PDU_BYTE_CNT + 1, u16Coilno);
+
+  // send outcoming message
+  // it's just a copy of the incomping PDU until 5th byte
+  _u16Length = 5;
+  return 0;
+}
+
+/**
+ * @brief
+ * This method processes function 16
+ * This method writes a word array assigned by the master
+ *
+ * @param &map registers served to the master
+ * @return 0 on success; Modbus exception code otherwise
+ * @ingroup register
+ */
+uint8_t ModbusPduHandler::process_FC16(ModbusRegisterMap &map) {
+  uint16_t u16StartAdd = word(_au8Pdu[PDU_ADD_HI], _au8Pdu[PDU_ADD_LO]);
+  uint16_t u16regsno = word(_au8Pdu[PDU_NB_HI], _au8Pdu[PDU_NB_LO]);
+
+  const ModbusRegion *region =
+      map.find(ku8MBTableHoldingRegisters, u16StartAdd, u16regsno);
+  if (!region)
+    return ku8MBIllegalDataAddress;
+
+  getRegisters(region, u16StartAdd - region->u16Address, u16regsno,
+               PDU_BYTE_CNT + 1);
+
+  // keep the same header
+  _u16Length = 5;
+  return 0;
+}
+
+/**
+ * @brief
+ * This method processes function 22
+ * This method modifies a single word with an AND and an OR mask:
+ * (value AND and_mask) OR (or_mask AND NOT and_mask)
+ *
+ * @param &map registers served to the master
+ * @return 0 on success; Modbus exception code otherwise
+ * @ingroup register
+ */
+uint8_t ModbusPduHandler::process_FC22(ModbusRegisterMap &map) {
+  uint16_t u16add = word(_au8Pdu[PDU_ADD_HI], _au8Pdu[PDU_ADD_LO]);
+  uint16_t u16AndMask = word(_au8Pdu[3], _au8Pdu[4]);
+  uint16_t u16OrMask = word(_au8Pdu[5], _au8Pdu[6]);
+
+  const ModbusRegion *region =
+      map.find(ku8MBTableHoldingRegisters, u16add, 1);
+  if (!region)
+    return ku8MBIllegalDataAddress;
+
+  uint16_t u16Offset = u16add - region->u16Address;
+  if (region->access) {
+    region->access->modify(u16Offset, u16AndMask, u16OrMask);
+  } else {
+    uint16_t &u16Reg = region->pu16Words[u16Offset];
+    u16Reg = (u16Reg & u16AndMask) | (u16OrMask & ~u16AndMask);
+  }
+
+  // the response echoes the request
+  _u16Length = 7;
+  return 0;
+}
+
+/**
+ * @brief
+ * This method processes function 23
+ * This method writes a word array assigned by the master, then reads a
+ * word array and transfers it to the master
+ *
+ * @param &map registers served to the master
+ * @return 0 on success; Modbus exception code otherwise
+ * @ingroup register
+ */
+uint8_t ModbusPduHandler::process_FC23(ModbusRegisterMap &map) {
+  uint16_t u16ReadAdd = word(_au8Pdu[1], _au8Pdu[2]);
+  uint16_t u16ReadQty = word(_au8Pdu[3], _au8Pdu[4]);
+  uint16_t u16WriteAdd = word(_au8Pdu[5], _au8Pdu[6]);
+  uint16_t u16WriteQty = word(_au8Pdu[7], _au8Pdu[8]);
+
+  // both ranges are checked before anything is written
+  const ModbusRegion *read =
+      map.find(ku8MBTableHoldingRegisters, u16ReadAdd, u16ReadQty);
+  const ModbusRegion *write =
+      map.find(ku8MBTableHoldingRegisters, u16WriteAdd, u16WriteQty);
+  if (!read || !write)
+    return ku8MBIllegalDataAddress;
+
+  // the write is performed before the read
+  getRegisters(write, u16WriteAdd - write->u16Address, u16WriteQty, 10);
+  putRegisters(read, u16ReadAdd - read->u16Address, u16ReadQty);
+  return 0;
+}
+
+/**
+Copy registers from the request into the map.
+
+@param region destination
+@param u16Register first register, counted from the start of the region
+@param u16Qty number of registers
+@param u8Offset position of the first value in the PDU
+*/
+void ModbusPduHandler::getRegisters(const ModbusRegion *region,
+                                    uint16_t u16Register, uint16_t u16Qty,
+                                    uint8_t u8Offset) {
+  if (region->access)
+    region->access->store(u16Register, _au8Pdu + u8Offset, u16Qty);
+  else
+    words_from_wire(region->pu16Words + u16Register, _au8Pdu + u8Offset,
+                    u16Qty);
+}
+
+/**
+Build a read response from registers of the map.
+
+@param region source
+@param u16Register first register, counted from the start of the region
+@param u16Qty number of registers
+*/
+void ModbusPduHandler::putRegisters(const ModbusRegion *region,
+                                    uint16_t u16Register, uint16_t u16Qty) {
+  _au8Pdu[1] = (uint8_t)(2 * u16Qty);
+  if (region->access)
+    region->access->load(u16Register, _au8Pdu + 2, u16Qty);
+  else
+    words_to_wire(_au8Pdu + 2, region->pu16Words + u16Register, u16Qty);
+  _u16Length = 2 + 2 * u16Qty;
+}
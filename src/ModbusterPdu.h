@@ -0,0 +1,97 @@
+#ifndef MODBUSTER_PDU_H
+#define MODBUSTER_PDU_H
+
+#include "Modbuster.h"
+#include "ModbusterRegisterMap.h"
+
+namespace ModBuster {
+
+/**
+Indexes to protocol data unit positions: the RTU frame positions without
+the slave ID, shared by every transport.
+*/
+enum ModbusPduPosition {
+  PDU_FUNC = 0, //!< Function code position
+  PDU_ADD_HI,   //!< Address high byte
+  PDU_ADD_LO,   //!< Address low byte
+  PDU_NB_HI,    //!< Number of coils or registers high byte
+  PDU_NB_LO,    //!< Number of coils or registers low byte
+  PDU_BYTE_CNT  //!< byte counter
+};
+
+// Largest PDU: 256 byte RTU frame less address and CRC [bytes]
+const uint16_t ku16MaxPDUSize = 253;
+
+/**
+Serial line counters kept by a slave and served through FC08 and FC0B.
+They wrap around at 65535, as the protocol has them.
+*/
+struct ModbusCounters {
+  uint16_t u16BusMessages;   ///< intact frames on the bus, whoever for
+  uint16_t u16BusErrors;     ///< frames with a bad CRC, too short or broken
+                             ///< by a gap
+  uint16_t u16Exceptions;    ///< exception responses
+  uint16_t u16SlaveMessages; ///< requests to this slave, broadcasts included
+  uint16_t u16NoResponses;   ///< requests left unanswered: broadcasts
+  uint16_t u16Overruns;      ///< requests longer than the frame buffer
+  uint16_t u16Events;        ///< requests completed without an exception,
+                             ///< FC0B and Clear Counters aside
+};
+
+/**
+Slave request handlers working on a bare PDU, independent of the transport
+framing it: the RTU slave serves the PDU inside its serial frame, the TCP
+slave the PDU following an MBAP header. The response replaces the request
+in the same buffer.
+
+The serial line diagnostics, FC08 and FC0B, are served only if counters
+are supplied; they are refused with ku8MBIllegalFunction otherwise.
+*/
+class ModbusPduHandler {
+public:
+  ModbusPduHandler(uint8_t *au8Pdu, uint16_t u16Capacity,
+                   uint8_t u8MaxRegisters,
+                   ModbusCounters *counters = nullptr);
+
+  static uint16_t requestLength(const uint8_t *au8Pdu, uint16_t u16Received);
+  static uint16_t responseLength(const uint8_t *au8Pdu,
+                                 uint16_t u16Received);
+  static bool broadcastable(uint8_t u8Function);
+
+  uint8_t serve(ModbusRegisterMap &map, uint16_t u16Length,
+                bool bOverrun = false);
+
+  /**
+  Length of the response built by serve() [bytes].
+  */
+  uint16_t length() const { return _u16Length; }
+
+private:
+  uint8_t *_au8Pdu;          ///< request, then response
+  uint16_t _u16Capacity;     ///< bytes available in _au8Pdu
+  uint8_t _u8MaxRegisters;   ///< largest register quantity served
+  ModbusCounters *_counters; ///< served by FC08 and FC0B, if any
+  uint16_t _u16Length;       ///< response length
+
+  uint8_t checkRequest(uint16_t u16Length, bool bOverrun) const;
+  void buildException(uint8_t u8Exception);
+
+  uint8_t process_FC1(ModbusRegisterMap &map);
+  uint8_t process_FC3(ModbusRegisterMap &map);
+  uint8_t process_FC5(ModbusRegisterMap &map);
+  uint8_t process_FC6(ModbusRegisterMap &map);
+  uint8_t process_FC8();
+  uint8_t process_FC11();
+  uint8_t process_FC15(ModbusRegisterMap &map);
+  uint8_t process_FC16(ModbusRegisterMap &map);
+  uint8_t process_FC22(ModbusRegisterMap &map);
+  uint8_t process_FC23(ModbusRegisterMap &map);
+  void getRegisters(const ModbusRegion *region, uint16_t u16Register,
+                    uint16_t u16Qty, uint8_t u8Offset);
+  void putRegisters(const ModbusRegion *region, uint16_t u16Register,
+                    uint16_t u16Qty);
+};
+
+} // namespace ModBuster
+
+#endif // MODBUSTER_PDU_H
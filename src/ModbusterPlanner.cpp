@@ -0,0 +1,323 @@
+#include "ModbusterPlanner.h"
+
+#include "Arduino.h"
+
+using namespace ModBuster;
+
+static bool isBitFunction(uint8_t u8Function) {
+  return u8Function == ku8MBReadCoils || u8Function == ku8MBReadDiscreteInputs;
+}
+
+// Largest quantity one frame may carry: the protocol limit, what the
+// master's response buffer holds or what fits its ADU buffer next to slave
+// ID, function code, byte count and CRC, whichever is smallest.
+static uint16_t frameLimit(uint8_t u8Function, uint8_t u8BufferSize,
+                           uint16_t u16FrameSize) {
+  uint16_t u16Data = u16FrameSize > 5 ? u16FrameSize - 5 : 0;
+  uint32_t u32Limit;
+  if (isBitFunction(u8Function)) {
+    u32Limit = 16 * u8BufferSize < 2000 ? 16 * u8BufferSize : 2000;
+    if (8 * (uint32_t)u16Data < u32Limit)
+      u32Limit = 8 * (uint32_t)u16Data;
+  } else {
+    u32Limit = u8BufferSize < ku8MaxReadRegisters ? u8BufferSize
+                                                  : ku8MaxReadRegisters;
+    if (u16Data / 2 < u32Limit)
+      u32Limit = u16Data / 2;
+  }
+  return (uint16_t)u32Limit;
+}
+
+// true if request a sorts before request b
+static bool before(const ModbusReadRequest &a, const ModbusReadRequest &b) {
+  if (a.u8Slave != b.u8Slave)
+    return a.u8Slave < b.u8Slave;
+  if (a.u8Function != b.u8Function)
+    return a.u8Function < b.u8Function;
+  return a.u16Address < b.u16Address;
+}
+
+/**
+Constructor.
+
+@param requests storage for the requested reads
+@param u8Capacity number of elements in requests
+@param frames storage for the planned frames
+@param u8FrameCapacity number of elements in frames; add() accepts no more
+requests than this, as in the worst case no two requests can be merged
+@ingroup setup
+*/
+ModbusReadPlanner::ModbusReadPlanner(ModbusReadRequest *requests,
+                                     uint8_t u8Capacity,
+                                     ModbusReadFrame *frames,
+                                     uint8_t u8FrameCapacity)
+    : _requests(requests), _u8Capacity(u8Capacity), _u8Count(0),
+      _frames(frames), _u8FrameCapacity(u8FrameCapacity), _u8FrameCount(0),
+      _u16RegisterGap(10), _u16CoilGap(128),
+      _u8BufferSize(ku8MaxBufferSize), _u16FrameSize(ku16MaxADUSize) {}
+
+/**
+Set how far apart two ranges may be and still be read in one frame.
+
+Each unneeded register read costs two bytes on the wire, while a frame
+costs about a dozen bytes of framing plus the slave's turnaround, so the
+default gaps are 10 registers and 128 coils. Use 0 for devices whose maps
+have holes that answer with ku8MBIllegalDataAddress.
+
+@param u16RegisterGap largest gap bridged for register reads
+@param u16CoilGap largest gap bridged for coil/discrete input reads
+@ingroup setup
+*/
+void ModbusReadPlanner::setGap(uint16_t u16RegisterGap, uint16_t u16CoilGap) {
+  _u16RegisterGap = u16RegisterGap;
+  _u16CoilGap = u16CoilGap;
+}
+
+/**
+Set the buffer sizes of the master the plan is made for.
+
+Default to ku8MaxBufferSize and ku16MaxADUSize, the sizes of ModbusServer.
+execute() replans for the master it is given if either is smaller.
+
+@param u8BufferSize ModbusServerBase::bufferSize() of the master [words]
+@param u16FrameSize ModbusServerBase::frameSize() of the master [bytes]
+@ingroup setup
+*/
+void ModbusReadPlanner::setBufferSize(uint8_t u8BufferSize,
+                                      uint16_t u16FrameSize) {
+  _u8BufferSize = u8BufferSize;
+  _u16FrameSize = u16FrameSize;
+  _u8FrameCount = 0;
+}
+
+/**
+Forget every request and frame.
+
+@ingroup setup
+*/
+void ModbusReadPlanner::clear() {
+  _u8Count = 0;
+  _u8FrameCount = 0;
+}
+
+/**
+Add a read to the plan.
+
+@param u8Slave Modbus slave ID (1..247)
+@param u8Function ku8MBReadCoils, ku8MBReadDiscreteInputs,
+ku8MBReadHoldingRegisters or ku8MBReadInputRegisters
+@param u16Address address of the first coil/register
+@param u16Qty quantity of coils/registers
+@param pu16Data destination; coils are packed 16 per word like in the
+response buffer
+@return true if the request has been added
+@ingroup setup
+*/
+bool ModbusReadPlanner::add(uint8_t u8Slave, uint8_t u8Function,
+                            uint16_t u16Address, uint16_t u16Qty,
+                            uint16_t *pu16Data) {
+  switch (u8Function) {
+  case ku8MBReadCoils:
+  case ku8MBReadDiscreteInputs:
+  case ku8MBReadHoldingRegisters:
+  case ku8MBReadInputRegisters:
+    break;
+  default:
+    return false;
+  }
+  if (_u8Count >= _u8Capacity || _u8Count >= _u8FrameCapacity || !u16Qty ||
+      u16Qty > frameLimit(u8Function, _u8BufferSize, _u16FrameSize) ||
+      (uint32_t)u16Address + u16Qty > 0x10000 || !pu16Data)
+    return false;
+
+  ModbusReadRequest request;
+  request.u8Slave = u8Slave;
+  request.u8Function = u8Function;
+  request.u16Address = u16Address;
+  request.u16Qty = u16Qty;
+  request.pu16Data = pu16Data;
+  request.u8Frame = 0xFF;
+  request.u8Status = ku8MBSuccess;
+
+  // keep the requests sorted by slave, function and address
+  uint8_t i = _u8Count++;
+  while (i && before(request, _requests[i - 1])) {
+    _requests[i] = _requests[i - 1];
+    i--;
+  }
+  _requests[i] = request;
+  _u8FrameCount = 0;
+  return true;
+}
+
+/**
+Merge the requests into frames.
+
+Walks the sorted requests and extends the current frame as long as the
+next range belongs to the same slave and function, starts at most one gap
+past the frame's end and keeps the frame within the size limit.
+
+@return number of frames
+@ingroup setup
+*/
+uint8_t ModbusReadPlanner::plan() {
+  ModbusReadFrame *current = nullptr;
+
+  _u8FrameCount = 0;
+  for (uint8_t i = 0; i < _u8Count; i++) {
+    ModbusReadRequest &request = _requests[i];
+    uint32_t u32Start = request.u16Address;
+    uint32_t u32End = u32Start + request.u16Qty;
+
+    if (current && current->u8Slave == request.u8Slave &&
+        current->u8Function == request.u8Function) {
+      uint32_t u32FrameStart = current->u16Address;
+      uint32_t u32FrameEnd = u32FrameStart + current->u16Qty;
+      uint16_t u16Gap = isBitFunction(request.u8Function) ? _u16CoilGap
+                                                          : _u16RegisterGap;
+      if (u32End < u32FrameEnd)
+        u32End = u32FrameEnd;
+      if (u32Start <= u32FrameEnd + u16Gap &&
+          u32End - u32FrameStart <=
+              frameLimit(request.u8Function, _u8BufferSize,
+                         _u16FrameSize)) {
+        current->u16Qty = (uint16_t)(u32End - u32FrameStart);
+        request.u8Frame = _u8FrameCount - 1;
+        continue;
+      }
+    }
+
+    current = &_frames[_u8FrameCount];
+    current->u8Slave = request.u8Slave;
+    current->u8Function = request.u8Function;
+    current->u16Address = request.u16Address;
+    current->u16Qty = request.u16Qty;
+    request.u8Frame = _u8FrameCount++;
+  }
+  return _u8FrameCount;
+}
+
+/**
+Run the planned frames and scatter the data to every request.
+
+If a merged frame is rejected with ku8MBIllegalDataAddress, e.g. because
+the bridged gap hits a hole in the slave's map, each of its requests is
+retried on its own.
+
+@param &server master driving the bus; its slave ID is changed per frame
+@return ku8MBSuccess if every request was served; the status of the last
+failure otherwise, per-request results are in ModbusReadRequest::u8Status
+@ingroup setup
+*/
+uint8_t ModbusReadPlanner::execute(ModbusServerBase &server) {
+  uint8_t u8Result = ku8MBSuccess;
+
+  if (server.bufferSize() < _u8BufferSize ||
+      server.frameSize() < _u16FrameSize)
+    setBufferSize(server.bufferSize() < _u8BufferSize ? server.bufferSize()
+                                                      : _u8BufferSize,
+                  server.frameSize() < _u16FrameSize ? server.frameSize()
+                                                     : _u16FrameSize);
+  if (!_u8FrameCount && _u8Count)
+    plan();
+
+  uint8_t i = 0;
+  for (uint8_t f = 0; f < _u8FrameCount; f++) {
+    const ModbusReadFrame &frame = _frames[f];
+    // a frame serving one request whole is decoded straight into its
+    // destination; merged frames are scattered from the response buffer
+    ModbusReadRequest &first = _requests[i];
+    bool bDirect = (i + 1 == _u8Count || _requests[i + 1].u8Frame != f) &&
+                   first.u16Address == frame.u16Address &&
+                   first.u16Qty == frame.u16Qty;
+    uint8_t u8Status = read(server, frame, bDirect ? first.pu16Data : nullptr);
+
+    // requests of a frame are contiguous as both follow the sort order
+    for (; i < _u8Count && _requests[i].u8Frame == f; i++) {
+      ModbusReadRequest &request = _requests[i];
+
+      if (u8Status == ku8MBIllegalDataAddress &&
+          (frame.u16Address != request.u16Address ||
+           frame.u16Qty != request.u16Qty)) {
+        ModbusReadFrame own = {request.u8Slave, request.u8Function,
+                               request.u16Address, request.u16Qty};
+        request.u8Status = read(server, own, request.pu16Data);
+      } else {
+        request.u8Status = u8Status;
+        if (u8Status == ku8MBSuccess && !bDirect)
+          scatter(server, frame, request);
+      }
+      if (request.u8Status != ku8MBSuccess)
+        u8Result = request.u8Status;
+    }
+  }
+  return u8Result;
+}
+
+/**
+Requested read, in sorted order.
+
+@param u8Index 0..count()-1
+@ingroup setup
+*/
+const ModbusReadRequest &ModbusReadPlanner::request(uint8_t u8Index) const {
+  return _requests[u8Index];
+}
+
+/**
+Planned frame.
+
+@param u8Index 0..frameCount()-1
+@ingroup setup
+*/
+const ModbusReadFrame &ModbusReadPlanner::frame(uint8_t u8Index) const {
+  return _frames[u8Index];
+}
+
+// Read a frame into pu16Data, or into the response buffer if it is null.
+uint8_t ModbusReadPlanner::read(ModbusServerBase &server,
+                                const ModbusReadFrame &frame,
+                                uint16_t *pu16Data) {
+  server.setSlaveID(frame.u8Slave);
+  switch (frame.u8Function) {
+  case ku8MBReadCoils:
+    return pu16Data
+               ? server.readCoils(frame.u16Address, frame.u16Qty, pu16Data)
+               : server.readCoils(frame.u16Address, frame.u16Qty);
+  case ku8MBReadDiscreteInputs:
+    return pu16Data ? server.readDiscreteInputs(frame.u16Address,
+                                                frame.u16Qty, pu16Data)
+                    : server.readDiscreteInputs(frame.u16Address,
+                                                frame.u16Qty);
+  case ku8MBReadInputRegisters:
+    return pu16Data ? server.readInputRegisters(frame.u16Address,
+                                                frame.u16Qty, pu16Data)
+                    : server.readInputRegisters(frame.u16Address,
+                                                frame.u16Qty);
+  default:
+    return pu16Data ? server.readHoldingRegisters(frame.u16Address,
+                                                  frame.u16Qty, pu16Data)
+                    : server.readHoldingRegisters(frame.u16Address,
+                                                  frame.u16Qty);
+  }
+}
+
+void ModbusReadPlanner::scatter(ModbusServerBase &server,
+                                const ModbusReadFrame &frame,
+                                const ModbusReadRequest &request) {
+  uint16_t u16Offset = request.u16Address - frame.u16Address;
+
+  if (!isBitFunction(request.u8Function)) {
+    for (uint16_t i = 0; i < request.u16Qty; i++)
+      request.pu16Data[i] = server.getResponseBuffer(u16Offset + i);
+    return;
+  }
+
+  for (uint16_t i = 0; i < ((request.u16Qty + 15) >> 4); i++)
+    request.pu16Data[i] = 0;
+  for (uint16_t i = 0; i < request.u16Qty; i++) {
+    uint16_t u16Bit = u16Offset + i;
+    if (bitRead(server.getResponseBuffer(u16Bit >> 4), u16Bit & 0x0F))
+      bitSet(request.pu16Data[i >> 4], i & 0x0F);
+  }
+}
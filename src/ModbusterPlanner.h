@@ -0,0 +1,81 @@
+#ifndef MODBUSTER_PLANNER_H
+#define MODBUSTER_PLANNER_H
+
+#include "ModbusterServer.h"
+
+namespace ModBuster {
+
+// Read requested by the application through ModbusReadPlanner::add().
+struct ModbusReadRequest {
+  uint8_t u8Slave;     ///< Modbus slave ID (1..247)
+  uint8_t u8Function;  ///< ku8MBReadCoils .. ku8MBReadInputRegisters
+  uint16_t u16Address; ///< first coil/register
+  uint16_t u16Qty;     ///< quantity of coils/registers
+  uint16_t *pu16Data;  ///< destination; coils are packed 16 per word
+  uint8_t u8Frame;     ///< index of the frame serving this request
+  uint8_t u8Status;    ///< status of that frame after execute()
+};
+
+// Merged read frame produced by ModbusReadPlanner::plan().
+struct ModbusReadFrame {
+  uint8_t u8Slave;
+  uint8_t u8Function;
+  uint16_t u16Address;
+  uint16_t u16Qty;
+};
+
+/**
+Read coalescing planner for ModbusServer (master).
+
+Collects the reads an application needs, per slave and function, and
+merges adjacent or nearby ranges into the fewest frames that fit the
+master's response buffer (at most 125 registers or 2000 coils per frame).
+Ranges separated by up to the configured gap are merged too, reading the
+unneeded registers in between in exchange for one round trip less. After
+execute() every request's destination holds its own slice of the data.
+
+Storage is supplied by the application, no memory is allocated. Requests
+are kept sorted by slave, function and address, so their order may differ
+from the order of add() calls.
+*/
+class ModbusReadPlanner {
+public:
+  ModbusReadPlanner(ModbusReadRequest *requests, uint8_t u8Capacity,
+                    ModbusReadFrame *frames, uint8_t u8FrameCapacity);
+
+  void setGap(uint16_t u16RegisterGap, uint16_t u16CoilGap);
+  void setBufferSize(uint8_t u8BufferSize,
+                     uint16_t u16FrameSize = ku16MaxADUSize);
+  void clear();
+  bool add(uint8_t u8Slave, uint8_t u8Function, uint16_t u16Address,
+           uint16_t u16Qty, uint16_t *pu16Data);
+
+  uint8_t plan();
+  uint8_t execute(ModbusServerBase &server);
+
+  uint8_t count() const { return _u8Count; }
+  const ModbusReadRequest &request(uint8_t u8Index) const;
+  uint8_t frameCount() const { return _u8FrameCount; }
+  const ModbusReadFrame &frame(uint8_t u8Index) const;
+
+private:
+  ModbusReadRequest *_requests;
+  uint8_t _u8Capacity;
+  uint8_t _u8Count;
+  ModbusReadFrame *_frames;
+  uint8_t _u8FrameCapacity;
+  uint8_t _u8FrameCount;
+  uint16_t _u16RegisterGap;
+  uint16_t _u16CoilGap;
+  uint8_t _u8BufferSize;
+  uint16_t _u16FrameSize;
+
+  static uint8_t read(ModbusServerBase &server, const ModbusReadFrame &frame,
+                      uint16_t *pu16Data);
+  static void scatter(ModbusServerBase &server, const ModbusReadFrame &frame,
+                      const ModbusReadRequest &request);
+};
+
+} // namespace ModBuster
+
+#endif // MODBUSTER_PLANNER_H
@@ -0,0 +1,191 @@
+#include "ModbusterRegisterMap.h"
+
+using namespace ModBuster;
+
+// true if the region sorts before table/address
+static bool before(const ModbusRegion &region, uint8_t u8Table,
+                   uint16_t u16Address) {
+  if (region.u8Table != u8Table)
+    return region.u8Table < u8Table;
+  return region.u16Address < u16Address;
+}
+
+// true if the region sorts after table/address
+static bool after(const ModbusRegion &region, uint8_t u8Table,
+                  uint16_t u16Address) {
+  if (region.u8Table != u8Table)
+    return region.u8Table > u8Table;
+  return region.u16Address > u16Address;
+}
+
+/**
+Constructor.
+
+@param regions storage for the regions
+@param u8Capacity number of elements in regions
+@ingroup setup
+*/
+ModbusRegisterMap::ModbusRegisterMap(ModbusRegion *regions, uint8_t u8Capacity)
+    : _regions(regions), _u8Capacity(u8Capacity), _u8Count(0) {}
+
+/**
+Bind coils to application memory.
+
+@param u16Address address of the first coil
+@param u16Count number of coils
+@param pu8Bits coil values, 8 per byte, LSB first
+@return true if the region has been added; false if it overlaps another
+coil region or there is no room left
+@ingroup setup
+*/
+bool ModbusRegisterMap::addCoils(uint16_t u16Address, uint16_t u16Count,
+                                 uint8_t *pu8Bits) {
+  return add(ku8MBTableCoils, u16Address, u16Count, pu8Bits);
+}
+
+/**
+Bind discrete inputs to application memory.
+
+@param u16Address address of the first input
+@param u16Count number of inputs
+@param pu8Bits input values, 8 per byte, LSB first; never written
+@return true if the region has been added
+@ingroup setup
+*/
+bool ModbusRegisterMap::addDiscreteInputs(uint16_t u16Address,
+                                          uint16_t u16Count,
+                                          const uint8_t *pu8Bits) {
+  return add(ku8MBTableDiscreteInputs, u16Address, u16Count,
+             const_cast<uint8_t *>(pu8Bits));
+}
+
+/**
+Bind holding registers to application memory.
+
+@param u16Address address of the first register
+@param u16Count number of registers
+@param pu16Words register values
+@return true if the region has been added
+@ingroup setup
+*/
+bool ModbusRegisterMap::addHoldingRegisters(uint16_t u16Address,
+                                            uint16_t u16Count,
+                                            uint16_t *pu16Words) {
+  return add(ku8MBTableHoldingRegisters, u16Address, u16Count, pu16Words);
+}
+
+/**
+Bind input registers to application memory.
+
+@param u16Address address of the first register
+@param u16Count number of registers
+@param pu16Words register values; never written
+@return true if the region has been added
+@ingroup setup
+*/
+bool ModbusRegisterMap::addInputRegisters(uint16_t u16Address,
+                                          uint16_t u16Count,
+                                          const uint16_t *pu16Words) {
+  return add(ku8MBTableInputRegisters, u16Address, u16Count,
+             const_cast<uint16_t *>(pu16Words));
+}
+
+/**
+Serve holding registers through functions, e.g. from a bank shared with
+other threads.
+
+@param u16Address address of the first register
+@param u16Count number of registers
+@param access reads and writes the registers; offsets passed to it count
+from u16Address
+@return true if the region has been added
+@ingroup setup
+*/
+bool ModbusRegisterMap::addHoldingRegisters(uint16_t u16Address,
+                                            uint16_t u16Count,
+                                            ModbusRegisterAccess &access) {
+  return add(ku8MBTableHoldingRegisters, u16Address, u16Count, nullptr,
+             &access);
+}
+
+/**
+Serve input registers through functions.
+
+@param u16Address address of the first register
+@param u16Count number of registers
+@param access reads the registers; never written
+@return true if the region has been added
+@ingroup setup
+*/
+bool ModbusRegisterMap::addInputRegisters(uint16_t u16Address,
+                                          uint16_t u16Count,
+                                          ModbusRegisterAccess &access) {
+  return add(ku8MBTableInputRegisters, u16Address, u16Count, nullptr,
+             &access);
+}
+
+/**
+Look up the region serving a request.
+
+@param u8Table ModbusTable addressed by the request
+@param u16Address first coil/register of the request
+@param u16Qty number of coils/registers of the request
+@return region holding the whole range; nullptr if there is none
+*/
+const ModbusRegion *ModbusRegisterMap::find(uint8_t u8Table,
+                                            uint16_t u16Address,
+                                            uint16_t u16Qty) const {
+  // last region starting at or before the address
+  uint8_t u8Low = 0, u8High = _u8Count;
+  while (u8Low < u8High) {
+    uint8_t u8Mid = (u8Low + u8High) / 2;
+    if (after(_regions[u8Mid], u8Table, u16Address))
+      u8High = u8Mid;
+    else
+      u8Low = u8Mid + 1;
+  }
+  if (!u8Low)
+    return nullptr;
+
+  const ModbusRegion &region = _regions[u8Low - 1];
+  if (region.u8Table != u8Table ||
+      (uint32_t)u16Address + u16Qty >
+          (uint32_t)region.u16Address + region.u16Count)
+    return nullptr;
+  return &region;
+}
+
+bool ModbusRegisterMap::add(uint8_t u8Table, uint16_t u16Address,
+                            uint16_t u16Count, void *pData,
+                            ModbusRegisterAccess *access) {
+  if (_u8Count >= _u8Capacity || !u16Count || (!pData && !access) ||
+      (uint32_t)u16Address + u16Count > 0x10000)
+    return false;
+
+  // keep the regions sorted by table and address, rejecting overlaps
+  uint8_t i = _u8Count;
+  while (i && !before(_regions[i - 1], u8Table, u16Address)) {
+    i--;
+  }
+  if (i && _regions[i - 1].u8Table == u8Table &&
+      (uint32_t)_regions[i - 1].u16Address + _regions[i - 1].u16Count >
+          u16Address)
+    return false;
+  if (i < _u8Count && _regions[i].u8Table == u8Table &&
+      (uint32_t)u16Address + u16Count > _regions[i].u16Address)
+    return false;
+
+  for (uint8_t j = _u8Count; j > i; j--) {
+    _regions[j] = _regions[j - 1];
+  }
+  ModbusRegion &region = _regions[i];
+  region.u8Table = u8Table;
+  region.u16Address = u16Address;
+  region.u16Count = u16Count;
+  region.pu8Bits = static_cast<uint8_t *>(pData);
+  if (u8Table >= ku8MBTableHoldingRegisters)
+    region.pu16Words = static_cast<uint16_t *>(pData);
+  region.access = access;
+  _u8Count++;
+  return true;
+}
@@ -0,0 +1,117 @@
+#ifndef MODBUSTER_REGISTER_MAP_H
+#define MODBUSTER_REGISTER_MAP_H
+
+#include <stdint.h>
+
+namespace ModBuster {
+
+// Address spaces of a Modbus slave
+enum ModbusTable {
+  ku8MBTableCoils = 0,            ///< read/write bits, FC01/05/0F
+  ku8MBTableDiscreteInputs = 1,   ///< read-only bits, FC02
+  ku8MBTableHoldingRegisters = 2, ///< read/write words, FC03/06/10/16/17
+  ku8MBTableInputRegisters = 3,   ///< read-only words, FC04
+};
+
+/**
+Registers served through functions instead of bound memory, e.g. a bank
+shared with other threads. Values travel in frame byte order, high byte
+first, so an implementation can copy straight between its storage and the
+request or response.
+*/
+class ModbusRegisterAccess {
+public:
+  /**
+  Copy registers into a response.
+
+  @param u16Offset first register, counted from the start of the region
+  @param au8Wire destination, 2 * u16Qty bytes
+  @param u16Qty number of registers
+  */
+  virtual void load(uint16_t u16Offset, uint8_t *au8Wire,
+                    uint16_t u16Qty) = 0;
+
+  /**
+  Copy registers from a request.
+
+  @param u16Offset first register, counted from the start of the region
+  @param au8Wire source, 2 * u16Qty bytes
+  @param u16Qty number of registers
+  */
+  virtual void store(uint16_t u16Offset, const uint8_t *au8Wire,
+                     uint16_t u16Qty) = 0;
+
+  /**
+  Apply a FC22 mask write: (value AND and_mask) OR (or_mask AND NOT
+  and_mask), as one update.
+
+  @param u16Offset register, counted from the start of the region
+  @param u16AndMask AND mask
+  @param u16OrMask OR mask
+  */
+  virtual void modify(uint16_t u16Offset, uint16_t u16AndMask,
+                      uint16_t u16OrMask) = 0;
+
+protected:
+  ~ModbusRegisterAccess() {}
+};
+
+// Block of consecutive coils/registers bound to application memory.
+struct ModbusRegion {
+  uint8_t u8Table;     ///< ModbusTable the region belongs to
+  uint16_t u16Address; ///< first coil/register
+  uint16_t u16Count;   ///< number of coils/registers
+  union {
+    uint8_t *pu8Bits;    ///< coils/discrete inputs, 8 per byte, LSB first
+    uint16_t *pu16Words; ///< holding/input registers
+  };
+  ModbusRegisterAccess *access; ///< registers served through functions;
+                                ///< nullptr when bound to memory
+};
+
+/**
+Register map of a ModbusClient (slave).
+
+Coils, discrete inputs, holding and input registers are four separate
+address spaces, each made of any number of regions bound to application
+memory; nothing is copied. Register regions may instead be served through
+a ModbusRegisterAccess. Regions are kept sorted, so a request is
+resolved with one binary search and bounds checked once. A request must
+lie within a single region, otherwise it is answered with
+ku8MBIllegalDataAddress.
+
+Region storage is supplied by the application, no memory is allocated.
+*/
+class ModbusRegisterMap {
+public:
+  ModbusRegisterMap(ModbusRegion *regions, uint8_t u8Capacity);
+
+  bool addCoils(uint16_t u16Address, uint16_t u16Count, uint8_t *pu8Bits);
+  bool addDiscreteInputs(uint16_t u16Address, uint16_t u16Count,
+                         const uint8_t *pu8Bits);
+  bool addHoldingRegisters(uint16_t u16Address, uint16_t u16Count,
+                           uint16_t *pu16Words);
+  bool addInputRegisters(uint16_t u16Address, uint16_t u16Count,
+                         const uint16_t *pu16Words);
+  bool addHoldingRegisters(uint16_t u16Address, uint16_t u16Count,
+                           ModbusRegisterAccess &access);
+  bool addInputRegisters(uint16_t u16Address, uint16_t u16Count,
+                         ModbusRegisterAccess &access);
+  void clear() { _u8Count = 0; }
+
+  uint8_t count() const { return _u8Count; }
+  const ModbusRegion *find(uint8_t u8Table, uint16_t u16Address,
+                           uint16_t u16Qty) const;
+
+private:
+  ModbusRegion *_regions; ///< sorted by table and address
+  uint8_t _u8Capacity;
+  uint8_t _u8Count;
+
+  bool add(uint8_t u8Table, uint16_t u16Address, uint16_t u16Count,
+           void *pData, ModbusRegisterAccess *access = nullptr);
+};
+
+} // namespace ModBuster
+
+#endif // MODBUSTER_REGISTER_MAP_H
@@ -0,0 +1,303 @@
+#include "ModbusterScheduler.h"
+
+#include "Arduino.h"
+
+using namespace ModBuster;
+
+// running average with a weight of 1/8 for the new sample
+static uint16_t average(uint16_t u16Avg, uint16_t u16Sample) {
+  return (uint16_t)((int32_t)u16Avg + ((int32_t)u16Sample - u16Avg) / 8);
+}
+
+/**
+Constructor.
+
+@param items storage for the poll items
+@param u8Capacity number of elements in items
+@param writes storage for the write queue
+@param u8WriteCapacity number of elements in writes
+@ingroup setup
+*/
+ModbusScheduler::ModbusScheduler(ModbusPollItem *items, uint8_t u8Capacity,
+                                 ModbusWriteItem *writes,
+                                 uint8_t u8WriteCapacity)
+    : _server(nullptr), _items(items), _u8Capacity(u8Capacity), _u8Count(0),
+      _writes(writes), _u8WriteCapacity(u8WriteCapacity), _u8WriteHead(0),
+      _u8WriteCount(0) {}
+
+/**
+Attach the scheduler to an initialized master.
+
+@param &server master driving the bus; its slave ID is changed per item
+@ingroup setup
+*/
+void ModbusScheduler::begin(ModbusServerBase &server) { _server = &server; }
+
+/**
+Register a cyclic read.
+
+@param u8Slave Modbus slave ID (1..247)
+@param u8Function ku8MBReadCoils, ku8MBReadDiscreteInputs,
+ku8MBReadHoldingRegisters or ku8MBReadInputRegisters
+@param u16Address address of the first coil/register
+@param u16Qty quantity of coils/registers (1..2000 coils, 1..125
+registers); the response is decoded straight into pu16Data, so it only has
+to fit the master's frame buffer: call begin() first
+@param u16Period period [milliseconds]
+@param u8Priority 0 is the most urgent; among due items the most urgent one
+runs first, then the most overdue one
+@param pu16Data destination, updated after every successful poll; coils
+are packed 16 per word like in the response buffer
+@return index of the item; -1 if it is invalid or there is no room left
+@ingroup setup
+*/
+int8_t ModbusScheduler::addPoll(uint8_t u8Slave, uint8_t u8Function,
+                                uint16_t u16Address, uint16_t u16Qty,
+                                uint16_t u16Period, uint8_t u8Priority,
+                                uint16_t *pu16Data) {
+  // response: slave ID, function, byte count, data and CRC
+  uint16_t u16Response;
+  switch (u8Function) {
+  case ku8MBReadCoils:
+  case ku8MBReadDiscreteInputs:
+    if (u16Qty > 2000)
+      return -1;
+    u16Response = 5 + ((u16Qty + 7) >> 3);
+    break;
+  case ku8MBReadHoldingRegisters:
+  case ku8MBReadInputRegisters:
+    if (u16Qty > ku8MaxReadRegisters)
+      return -1;
+    u16Response = 5 + 2 * u16Qty;
+    break;
+  default:
+    return -1;
+  }
+  if (_u8Count >= _u8Capacity || !u16Qty || u16Response > frameSize() ||
+      !pu16Data)
+    return -1;
+
+  ModbusPollItem &item = _items[_u8Count];
+  memset(&item, 0, sizeof(item));
+  item.u8Slave = u8Slave;
+  item.u8Function = u8Function;
+  item.u16Address = u16Address;
+  item.u16Qty = u16Qty;
+  item.u16Period = u16Period;
+  item.u8Priority = u8Priority;
+  item.pu16Data = pu16Data;
+  item.u32Due = millis();
+  return (int8_t)_u8Count++;
+}
+
+/**
+Queue a one-shot write that runs ahead of every pending read.
+
+@param u8Slave Modbus slave ID (1..247), or 0 to broadcast it
+@param u8Function ku8MBWriteSingleCoil, ku8MBWriteSingleRegister,
+ku8MBWriteMultipleCoils or ku8MBWriteMultipleRegisters
+@param u16Address address of the first coil/register
+@param u16Qty quantity of coils/registers (ignored by single writes)
+@param pu16Data values, must stay valid until the write has run; coils are
+packed 16 per word, a single coil is ON if pu16Data[0] is non-zero;
+registers are sent straight from pu16Data, up to ku8MaxWriteRegisters
+whatever the size of the transmit buffer
+@return true if the write has been queued
+@ingroup setup
+*/
+bool ModbusScheduler::queueWrite(uint8_t u8Slave, uint8_t u8Function,
+                                 uint16_t u16Address, uint16_t u16Qty,
+                                 const uint16_t *pu16Data) {
+  if (_u8WriteCount >= _u8WriteCapacity || !pu16Data)
+    return false;
+  switch (u8Function) {
+  case ku8MBWriteSingleCoil:
+  case ku8MBWriteSingleRegister:
+    break;
+  case ku8MBWriteMultipleCoils:
+    if (!u16Qty || ((u16Qty + 15) >> 4) > bufferSize())
+      return false;
+    break;
+  case ku8MBWriteMultipleRegisters:
+    // encoded straight from pu16Data, the transmit buffer is not involved
+    if (!u16Qty || u16Qty > ku8MaxWriteRegisters)
+      return false;
+    break;
+  default:
+    return false;
+  }
+
+  ModbusWriteItem &write =
+      _writes[(_u8WriteHead + _u8WriteCount) % _u8WriteCapacity];
+  write.u8Slave = u8Slave;
+  write.u8Function = u8Function;
+  write.u16Address = u16Address;
+  write.u16Qty = u16Qty;
+  write.pu16Data = pu16Data;
+  _u8WriteCount++;
+  return true;
+}
+
+/**
+Run the most urgent pending transaction, if any.
+
+Queued writes go first, in order. Otherwise the due poll item with the
+lowest priority value runs, the most overdue one among equals. Call it
+from loop() as often as possible to keep the bus busy.
+
+@return status of the transaction that ran; ku8MBSuccess if none was due
+@ingroup setup
+*/
+uint8_t ModbusScheduler::task() {
+  if (!_server)
+    return ku8MBSuccess;
+
+  if (_u8WriteCount) {
+    const ModbusWriteItem &write = _writes[_u8WriteHead];
+    _u8WriteHead = (_u8WriteHead + 1) % _u8WriteCapacity;
+    _u8WriteCount--;
+    return runWrite(write);
+  }
+
+  uint32_t u32Now = millis();
+  ModbusPollItem *next = nullptr;
+  for (uint8_t i = 0; i < _u8Count; i++) {
+    ModbusPollItem &item = _items[i];
+    int32_t i32Late = (int32_t)(u32Now - item.u32Due);
+    if (i32Late < 0)
+      continue;
+    if (!next || item.u8Priority < next->u8Priority ||
+        (item.u8Priority == next->u8Priority &&
+         i32Late > (int32_t)(u32Now - next->u32Due))) {
+      next = &item;
+    }
+  }
+  if (!next)
+    return ku8MBSuccess;
+  return runPoll(*next, u32Now);
+}
+
+/**
+Time until the next transaction is due.
+
+@return 0 if task() has work to do now; otherwise [milliseconds]
+@ingroup setup
+*/
+uint32_t ModbusScheduler::nextDue() const {
+  if (_u8WriteCount)
+    return 0;
+
+  uint32_t u32Now = millis();
+  uint32_t u32Next = 0xFFFFFFFF;
+  for (uint8_t i = 0; i < _u8Count; i++) {
+    int32_t i32Left = (int32_t)(_items[i].u32Due - u32Now);
+    if (i32Left <= 0)
+      return 0;
+    if ((uint32_t)i32Left < u32Next)
+      u32Next = (uint32_t)i32Left;
+  }
+  return u32Next;
+}
+
+/**
+Achieved timing of a poll item.
+
+@param u8Index index returned by addPoll()
+@ingroup setup
+*/
+const ModbusPollStats &ModbusScheduler::stats(uint8_t u8Index) const {
+  return _items[u8Index].stats;
+}
+
+/**
+Clear the statistics of every poll item.
+
+@ingroup setup
+*/
+void ModbusScheduler::resetStats() {
+  for (uint8_t i = 0; i < _u8Count; i++) {
+    memset(&_items[i].stats, 0, sizeof(ModbusPollStats));
+  }
+}
+
+uint8_t ModbusScheduler::bufferSize() const {
+  return _server ? _server->bufferSize() : ku8MaxBufferSize;
+}
+
+uint16_t ModbusScheduler::frameSize() const {
+  return _server ? _server->frameSize() : ku16MaxADUSize;
+}
+
+uint8_t ModbusScheduler::runWrite(const ModbusWriteItem &write) {
+  _server->setSlaveID(write.u8Slave);
+  switch (write.u8Function) {
+  case ku8MBWriteSingleCoil:
+    return _server->writeSingleCoil(write.u16Address, write.pu16Data[0] != 0);
+  case ku8MBWriteSingleRegister:
+    return _server->writeSingleRegister(write.u16Address, write.pu16Data[0]);
+  case ku8MBWriteMultipleCoils:
+    for (uint8_t i = 0; i < ((write.u16Qty + 15) >> 4); i++)
+      _server->setTransmitBuffer(i, write.pu16Data[i]);
+    return _server->writeMultipleCoils(write.u16Address, write.u16Qty);
+  default:
+    return _server->writeMultipleRegisters(write.u16Address, write.pu16Data,
+                                           write.u16Qty);
+  }
+}
+
+uint8_t ModbusScheduler::runPoll(ModbusPollItem &item, uint32_t u32Now) {
+  ModbusPollStats &stats = item.stats;
+
+  // achieved period and jitter, measured start to start
+  if (stats.u32Polls) {
+    uint32_t u32Cycle = u32Now - item.u32Start;
+    stats.u16Cycle = u32Cycle > 0xFFFF ? 0xFFFF : (uint16_t)u32Cycle;
+    uint16_t u16Jitter = stats.u16Cycle > item.u16Period
+                             ? stats.u16Cycle - item.u16Period
+                             : item.u16Period - stats.u16Cycle;
+    if (stats.u32Polls == 1) {
+      stats.u16CycleAvg = stats.u16Cycle;
+      stats.u16JitterAvg = u16Jitter;
+    } else {
+      stats.u16CycleAvg = average(stats.u16CycleAvg, stats.u16Cycle);
+      stats.u16JitterAvg = average(stats.u16JitterAvg, u16Jitter);
+    }
+    if (u16Jitter > stats.u16JitterMax)
+      stats.u16JitterMax = u16Jitter;
+  }
+  item.u32Start = u32Now;
+
+  // keep a fixed rate; if a whole period was missed, restart from now
+  // rather than firing a burst of catch-up polls
+  item.u32Due += item.u16Period;
+  if ((int32_t)(u32Now - item.u32Due) >= 0)
+    item.u32Due = u32Now + item.u16Period;
+
+  _server->setSlaveID(item.u8Slave);
+  // decoded straight into pu16Data, which is left alone on failure
+  uint8_t u8Status;
+  switch (item.u8Function) {
+  case ku8MBReadCoils:
+    u8Status = _server->readCoils(item.u16Address, item.u16Qty,
+                                  item.pu16Data);
+    break;
+  case ku8MBReadDiscreteInputs:
+    u8Status = _server->readDiscreteInputs(item.u16Address, item.u16Qty,
+                                           item.pu16Data);
+    break;
+  case ku8MBReadInputRegisters:
+    u8Status = _server->readInputRegisters(item.u16Address, item.u16Qty,
+                                           item.pu16Data);
+    break;
+  default:
+    u8Status = _server->readHoldingRegisters(item.u16Address, item.u16Qty,
+                                             item.pu16Data);
+    break;
+  }
+
+  stats.u32Polls++;
+  stats.u8LastStatus = u8Status;
+  if (u8Status != ku8MBSuccess)
+    stats.u32Errors++;
+  return u8Status;
+}
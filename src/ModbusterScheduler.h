@@ -0,0 +1,91 @@
+#ifndef MODBUSTER_SCHEDULER_H
+#define MODBUSTER_SCHEDULER_H
+
+#include "ModbusterServer.h"
+
+namespace ModBuster {
+
+// Achieved timing of one poll item.
+struct ModbusPollStats {
+  uint32_t u32Polls;     ///< transactions executed
+  uint32_t u32Errors;    ///< transactions that did not return ku8MBSuccess
+  uint8_t u8LastStatus;  ///< status of the last transaction
+  uint16_t u16Cycle;     ///< last achieved period [milliseconds]
+  uint16_t u16CycleAvg;  ///< running average of the period [milliseconds]
+  uint16_t u16JitterMax; ///< largest deviation from the period [milliseconds]
+  uint16_t u16JitterAvg; ///< running average deviation [milliseconds]
+};
+
+// Cyclic read registered with ModbusScheduler::addPoll().
+struct ModbusPollItem {
+  uint8_t u8Slave;     ///< Modbus slave ID (1..247)
+  uint8_t u8Function;  ///< ku8MBReadCoils .. ku8MBReadInputRegisters
+  uint16_t u16Address; ///< first coil/register
+  uint16_t u16Qty;     ///< quantity of coils/registers
+  uint16_t u16Period;  ///< requested period [milliseconds]
+  uint8_t u8Priority;  ///< 0 is the most urgent
+  uint16_t *pu16Data;  ///< destination; coils are packed 16 per word
+  uint32_t u32Due;     ///< millis() when the next poll is due
+  uint32_t u32Start;   ///< millis() when the last poll started
+  ModbusPollStats stats;
+};
+
+// One-shot write queued with ModbusScheduler::queueWrite().
+struct ModbusWriteItem {
+  uint8_t u8Slave;        ///< Modbus slave ID (1..247)
+  uint8_t u8Function;     ///< ku8MBWriteSingleCoil .. ku8MBWriteMultipleRegisters
+  uint16_t u16Address;    ///< first coil/register
+  uint16_t u16Qty;        ///< quantity of coils/registers
+  const uint16_t *pu16Data; ///< values; coils are packed 16 per word
+};
+
+/**
+Cyclic polling scheduler driving one ModbusServer (master) bus.
+
+Poll items carry their own slave ID, function, address range, period and
+priority. Each call to task() runs the most urgent transaction that is due
+right away, so consecutive polls go out back-to-back. Queued writes
+preempt pending reads at the next transaction boundary.
+
+Item storage is supplied by the application, no memory is allocated.
+*/
+class ModbusScheduler {
+public:
+  ModbusScheduler(ModbusPollItem *items, uint8_t u8Capacity,
+                  ModbusWriteItem *writes = nullptr,
+                  uint8_t u8WriteCapacity = 0);
+
+  void begin(ModbusServerBase &server);
+
+  int8_t addPoll(uint8_t u8Slave, uint8_t u8Function, uint16_t u16Address,
+                 uint16_t u16Qty, uint16_t u16Period, uint8_t u8Priority,
+                 uint16_t *pu16Data);
+  bool queueWrite(uint8_t u8Slave, uint8_t u8Function, uint16_t u16Address,
+                  uint16_t u16Qty, const uint16_t *pu16Data);
+
+  uint8_t task();
+  uint32_t nextDue() const;
+
+  uint8_t count() const { return _u8Count; }
+  const ModbusPollStats &stats(uint8_t u8Index) const;
+  void resetStats();
+
+private:
+  ModbusServerBase *_server;
+  ModbusPollItem *_items;
+  uint8_t _u8Capacity;
+  uint8_t _u8Count;
+  ModbusWriteItem *_writes; ///< ring of pending writes
+  uint8_t _u8WriteCapacity;
+  uint8_t _u8WriteHead;
+  uint8_t _u8WriteCount;
+
+  uint8_t bufferSize() const;
+  uint16_t frameSize() const;
+  uint8_t runWrite(const ModbusWriteItem &write);
+  uint8_t runPoll(ModbusPollItem &item, uint32_t u32Now);
+};
+
+} // namespace ModBuster
+
+#endif // MODBUSTER_SCHEDULER_H
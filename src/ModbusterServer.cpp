@@ -1,11 +1,32 @@
 #include "ModbusterServer.h"
 
 #include "Arduino.h"
+#include "ModbusterKernels.h"
+#include "ModbusterPdu.h"
 #include "util/word.h"
 
 using namespace ModBuster;
 
-ModbusServer::ModbusServer(void) : ModbusBase() {}
+/**
+Constructor.
+
+Binds the buffers supplied by ModbusServerT; initialize the object using
+ModbusServerBase::begin().
+
+@param au16ResponseBuffer response buffer, u8BufferSize words
+@param au16TransmitBuffer transmit buffer, u8BufferSize words
+@param u8BufferSize number of words in each buffer
+@param au8ModbusADU ADU buffer, u16ADUSize bytes
+@param u16ADUSize number of bytes in au8ModbusADU
+@ingroup setup
+*/
+ModbusServerBase::ModbusServerBase(uint16_t *au16ResponseBuffer,
+                                   uint16_t *au16TransmitBuffer,
+                                   uint8_t u8BufferSize, uint8_t *au8ModbusADU,
+                                   uint16_t u16ADUSize)
+    : ModbusBase(), _u16ResponseBuffer(au16ResponseBuffer),
+      _u16TransmitBuffer(au16TransmitBuffer), _u8BufferSize(u8BufferSize),
+      _u8ModbusADU(au8ModbusADU), _u16ADUSize(u16ADUSize) {}
 
 /**
 Initialize class object.
@@ -17,8 +38,7 @@ Call once class has been instantiated, typically within setup().
 @param &serial reference to serial port object (Serial, Serial1, ... Serial3)
 @ingroup setup
 */
-void ModbusServer::begin(uint8_t slave, Stream &serial) {
-  //  txBuffer = (uint16_t*) calloc(ku8MaxBufferSize, sizeof(uint16_t));
+void ModbusServerBase::begin(uint8_t slave, Stream &serial) {
   _u8MBSlave = slave;
   _serial = &serial;
   _u8TransmitBufferIndex = 0;
@@ -30,26 +50,56 @@ void ModbusServer::begin(uint8_t slave, Stream &serial) {
 #endif
 }
 
-uint16_t ModbusServer::getResponseTimeOut() const {
+/**
+Slave addressed by the next transactions.
+
+@return Modbus slave ID (1..255)
+@ingroup setup
+*/
+uint8_t ModbusServerBase::getSlaveID() const { return _u8MBSlave; }
+
+/**
+Address another slave on the same bus.
+
+@param u8MBSlave Modbus slave ID (1..255)
+@ingroup setup
+*/
+void ModbusServerBase::setSlaveID(uint8_t u8MBSlave) { _u8MBSlave = u8MBSlave; }
+
+uint16_t ModbusServerBase::getResponseTimeOut() const {
   return _u16MBResponseTimeout;
 }
 
-void ModbusServer::setResponseTimeOut(uint16_t u16MBResponseTimeout) {
+void ModbusServerBase::setResponseTimeOut(uint16_t u16MBResponseTimeout) {
   _u16MBResponseTimeout = u16MBResponseTimeout;
 }
 
-void ModbusServer::beginTransmission(uint16_t u16Address) {
+/**
+Time the slaves get to execute a broadcast.
+
+Broadcasts return as soon as they have been sent; the next request waits
+until this much time has passed since, instead of T3.5.
+
+@param u16TurnaroundDelay delay after a broadcast [milliseconds]; 100 by
+default, the protocol suggests 100 to 200
+@ingroup setup
+*/
+void ModbusServerBase::setTurnaroundDelay(uint16_t u16TurnaroundDelay) {
+  _u16TurnaroundDelay = u16TurnaroundDelay;
+}
+
+void ModbusServerBase::beginTransmission(uint16_t u16Address) {
   _u16WriteAddress = u16Address;
   _u8TransmitBufferIndex = 0;
   u16TransmitBufferLength = 0;
 }
 
 // eliminate this function in favor of using existing MB request functions
-uint8_t ModbusServer::requestFrom(uint16_t address, uint16_t quantity) {
+uint8_t ModbusServerBase::requestFrom(uint16_t address, uint16_t quantity) {
   uint8_t read;
   // clamp to buffer length
-  if (quantity > ku8MaxBufferSize) {
-    quantity = ku8MaxBufferSize;
+  if (quantity > _u8BufferSize) {
+    quantity = _u8BufferSize;
   }
   // set rx buffer iterator vars
   _u8ResponseBufferIndex = 0;
@@ -58,9 +108,9 @@ uint8_t ModbusServer::requestFrom(uint16_t address, uint16_t quantity) {
   return read;
 }
 
-void ModbusServer::sendBit(bool data) {
+void ModbusServerBase::sendBit(bool data) {
   uint8_t txBitIndex = u16TransmitBufferLength % 16;
-  if ((u16TransmitBufferLength >> 4) < ku8MaxBufferSize) {
+  if ((u16TransmitBufferLength >> 4) < _u8BufferSize) {
     if (0 == txBitIndex) {
       _u16TransmitBuffer[_u8TransmitBufferIndex] = 0;
     }
@@ -70,25 +120,25 @@ void ModbusServer::sendBit(bool data) {
   }
 }
 
-void ModbusServer::send(uint16_t data) {
-  if (_u8TransmitBufferIndex < ku8MaxBufferSize) {
+void ModbusServerBase::send(uint16_t data) {
+  if (_u8TransmitBufferIndex < _u8BufferSize) {
     _u16TransmitBuffer[_u8TransmitBufferIndex++] = data;
     u16TransmitBufferLength = _u8TransmitBufferIndex << 4;
   }
 }
 
-void ModbusServer::send(uint32_t data) {
+void ModbusServerBase::send(uint32_t data) {
   send(lowWord(data));
   send(highWord(data));
 }
 
-void ModbusServer::send(uint8_t data) { send(word(data)); }
+void ModbusServerBase::send(uint8_t data) { send(word(data)); }
 
-uint8_t ModbusServer::available(void) {
+uint8_t ModbusServerBase::available(void) {
   return _u8ResponseBufferLength - _u8ResponseBufferIndex;
 }
 
-uint16_t ModbusServer::receive(void) {
+uint16_t ModbusServerBase::receive(void) {
   if (_u8ResponseBufferIndex < _u8ResponseBufferLength) {
     return _u16ResponseBuffer[_u8ResponseBufferIndex++];
   } else {
@@ -99,13 +149,13 @@ uint16_t ModbusServer::receive(void) {
 /**
 Retrieve data from response buffer.
 
-@see ModbusServer::clearResponseBuffer()
-@param u8Index index of response buffer array (0x00..0x3F)
+@see ModbusServerBase::clearResponseBuffer()
+@param u8Index index of response buffer array (0..bufferSize()-1)
 @return value in position u8Index of response buffer (0x0000..0xFFFF)
 @ingroup buffer
 */
-uint16_t ModbusServer::getResponseBuffer(uint8_t u8Index) {
-  if (u8Index < ku8MaxBufferSize) {
+uint16_t ModbusServerBase::getResponseBuffer(uint8_t u8Index) {
+  if (u8Index < _u8BufferSize) {
     return _u16ResponseBuffer[u8Index];
   } else {
     return 0xFFFF;
@@ -115,13 +165,13 @@ uint16_t ModbusServer::getResponseBuffer(uint8_t u8Index) {
 /**
 Clear Modbus response buffer.
 
-@see ModbusServer::getResponseBuffer(uint8_t u8Index)
+@see ModbusServerBase::getResponseBuffer(uint8_t u8Index)
 @ingroup buffer
 */
-void ModbusServer::clearResponseBuffer() {
+void ModbusServerBase::clearResponseBuffer() {
   uint8_t i;
 
-  for (i = 0; i < ku8MaxBufferSize; i++) {
+  for (i = 0; i < _u8BufferSize; i++) {
     _u16ResponseBuffer[i] = 0;
   }
 }
@@ -129,15 +179,15 @@ void ModbusServer::clearResponseBuffer() {
 /**
 Place data in transmit buffer.
 
-@see ModbusServer::clearTransmitBuffer()
-@param u8Index index of transmit buffer array (0x00..0x3F)
+@see ModbusServerBase::clearTransmitBuffer()
+@param u8Index index of transmit buffer array (0..bufferSize()-1)
 @param u16Value value to place in position u8Index of transmit buffer
 (0x0000..0xFFFF)
 @return 0 on success; exception number on failure
 @ingroup buffer
 */
-uint8_t ModbusServer::setTransmitBuffer(uint8_t u8Index, uint16_t u16Value) {
-  if (u8Index < ku8MaxBufferSize) {
+uint8_t ModbusServerBase::setTransmitBuffer(uint8_t u8Index, uint16_t u16Value) {
+  if (u8Index < _u8BufferSize) {
     _u16TransmitBuffer[u8Index] = u16Value;
     return ku8MBSuccess;
   } else {
@@ -148,13 +198,13 @@ uint8_t ModbusServer::setTransmitBuffer(uint8_t u8Index, uint16_t u16Value) {
 /**
 Clear Modbus transmit buffer.
 
-@see ModbusServer::setTransmitBuffer(uint8_t u8Index, uint16_t u16Value)
+@see ModbusServerBase::setTransmitBuffer(uint8_t u8Index, uint16_t u16Value)
 @ingroup buffer
 */
-void ModbusServer::clearTransmitBuffer() {
+void ModbusServerBase::clearTransmitBuffer() {
   uint8_t i;
 
-  for (i = 0; i < ku8MaxBufferSize; i++) {
+  for (i = 0; i < _u8BufferSize; i++) {
     _u16TransmitBuffer[i] = 0;
   }
 }
@@ -182,12 +232,39 @@ order end of the word).
 @return 0 on success; exception number on failure
 @ingroup discrete
 */
-uint8_t ModbusServer::readCoils(uint16_t u16ReadAddress, uint16_t u16BitQty) {
+uint8_t ModbusServerBase::readCoils(uint16_t u16ReadAddress, uint16_t u16BitQty) {
   _u16ReadAddress = u16ReadAddress;
   _u16ReadQty = u16BitQty;
   return ModbusServerTransaction(ku8MBReadCoils);
 }
 
+/**
+Modbus function 0x01 Read Coils, straight into application memory.
+
+The coils are unpacked from the response directly into au16Bits, once its
+CRC has been checked, without going through the response buffer: up to
+2000 coils fit whatever the size of the response buffer, as long as the
+response fits the frame buffer. The response buffer is left empty.
+
+@param u16ReadAddress address of first coil (0x0000..0xFFFF)
+@param u16BitQty quantity of coils to read (1..2000, enforced by remote
+device)
+@param au16Bits destination, (u16BitQty + 15) / 16 words; coils are packed
+16 per word like in the response buffer, unused bits of the last word are
+cleared
+@return 0 on success; exception number on failure
+@ingroup discrete
+*/
+uint8_t ModbusServerBase::readCoils(uint16_t u16ReadAddress,
+                                    uint16_t u16BitQty, uint16_t *au16Bits) {
+  _u16ReadAddress = u16ReadAddress;
+  _u16ReadQty = u16BitQty;
+  _pu16ReadValues = au16Bits;
+  uint8_t u8Status = ModbusServerTransaction(ku8MBReadCoils);
+  _pu16ReadValues = nullptr;
+  return u8Status;
+}
+
 /**
 Modbus function 0x02 Read Discrete Inputs.
 
@@ -212,13 +289,38 @@ remote device)
 @return 0 on success; exception number on failure
 @ingroup discrete
 */
-uint8_t ModbusServer::readDiscreteInputs(uint16_t u16ReadAddress,
+uint8_t ModbusServerBase::readDiscreteInputs(uint16_t u16ReadAddress,
                                          uint16_t u16BitQty) {
   _u16ReadAddress = u16ReadAddress;
   _u16ReadQty = u16BitQty;
   return ModbusServerTransaction(ku8MBReadDiscreteInputs);
 }
 
+/**
+Modbus function 0x02 Read Discrete Inputs, straight into application
+memory.
+
+Same as readCoils(uint16_t, uint16_t, uint16_t *) for discrete inputs.
+
+@param u16ReadAddress address of first discrete input (0x0000..0xFFFF)
+@param u16BitQty quantity of discrete inputs to read (1..2000, enforced by
+remote device)
+@param au16Bits destination, (u16BitQty + 15) / 16 words, packed 16 inputs
+per word
+@return 0 on success; exception number on failure
+@ingroup discrete
+*/
+uint8_t ModbusServerBase::readDiscreteInputs(uint16_t u16ReadAddress,
+                                             uint16_t u16BitQty,
+                                             uint16_t *au16Bits) {
+  _u16ReadAddress = u16ReadAddress;
+  _u16ReadQty = u16BitQty;
+  _pu16ReadValues = au16Bits;
+  uint8_t u8Status = ModbusServerTransaction(ku8MBReadDiscreteInputs);
+  _pu16ReadValues = nullptr;
+  return u8Status;
+}
+
 /**
 Modbus function 0x03 Read Holding Registers.
 
@@ -236,13 +338,40 @@ remote device)
 @return 0 on success; exception number on failure
 @ingroup register
 */
-uint8_t ModbusServer::readHoldingRegisters(uint16_t u16ReadAddress,
+uint8_t ModbusServerBase::readHoldingRegisters(uint16_t u16ReadAddress,
                                            uint16_t u16ReadQty) {
   _u16ReadAddress = u16ReadAddress;
   _u16ReadQty = u16ReadQty;
   return ModbusServerTransaction(ku8MBReadHoldingRegisters);
 }
 
+/**
+Modbus function 0x03 Read Holding Registers, straight into application
+memory.
+
+The registers are decoded from the response directly into au16Values,
+once its CRC has been checked, without going through the response buffer:
+up to 125 registers fit whatever the size of the response buffer, as long
+as the response fits the frame buffer. The response buffer is left empty.
+
+@param u16ReadAddress address of the first holding register (0x0000..0xFFFF)
+@param u16ReadQty quantity of holding registers to read (1..125, enforced by
+remote device)
+@param au16Values destination, u16ReadQty words
+@return 0 on success; exception number on failure
+@ingroup register
+*/
+uint8_t ModbusServerBase::readHoldingRegisters(uint16_t u16ReadAddress,
+                                               uint16_t u16ReadQty,
+                                               uint16_t *au16Values) {
+  _u16ReadAddress = u16ReadAddress;
+  _u16ReadQty = u16ReadQty;
+  _pu16ReadValues = au16Values;
+  uint8_t u8Status = ModbusServerTransaction(ku8MBReadHoldingRegisters);
+  _pu16ReadValues = nullptr;
+  return u8Status;
+}
+
 /**
 Modbus function 0x04 Read Input Registers.
 
@@ -260,13 +389,38 @@ remote device)
 @return 0 on success; exception number on failure
 @ingroup register
 */
-uint8_t ModbusServer::readInputRegisters(uint16_t u16ReadAddress,
+uint8_t ModbusServerBase::readInputRegisters(uint16_t u16ReadAddress,
                                          uint8_t u16ReadQty) {
   _u16ReadAddress = u16ReadAddress;
   _u16ReadQty = u16ReadQty;
   return ModbusServerTransaction(ku8MBReadInputRegisters);
 }
 
+/**
+Modbus function 0x04 Read Input Registers, straight into application
+memory.
+
+Same as readHoldingRegisters(uint16_t, uint16_t, uint16_t *) for input
+registers.
+
+@param u16ReadAddress address of the first input register (0x0000..0xFFFF)
+@param u16ReadQty quantity of input registers to read (1..125, enforced by
+remote device)
+@param au16Values destination, u16ReadQty words
+@return 0 on success; exception number on failure
+@ingroup register
+*/
+uint8_t ModbusServerBase::readInputRegisters(uint16_t u16ReadAddress,
+                                             uint16_t u16ReadQty,
+                                             uint16_t *au16Values) {
+  _u16ReadAddress = u16ReadAddress;
+  _u16ReadQty = u16ReadQty;
+  _pu16ReadValues = au16Values;
+  uint8_t u8Status = ModbusServerTransaction(ku8MBReadInputRegisters);
+  _pu16ReadValues = nullptr;
+  return u8Status;
+}
+
 /**
 Modbus function 0x05 Write Single Coil.
 
@@ -281,7 +435,7 @@ address of the coil to be forced. Coils are addressed starting at zero.
 @return 0 on success; exception number on failure
 @ingroup discrete
 */
-uint8_t ModbusServer::writeSingleCoil(uint16_t u16WriteAddress,
+uint8_t ModbusServerBase::writeSingleCoil(uint16_t u16WriteAddress,
                                       uint8_t u8State) {
   _u16WriteAddress = u16WriteAddress;
   _u16WriteQty = (u8State ? 0xFF00 : 0x0000);
@@ -300,14 +454,92 @@ written. Registers are addressed starting at zero.
 @return 0 on success; exception number on failure
 @ingroup register
 */
-uint8_t ModbusServer::writeSingleRegister(uint16_t u16WriteAddress,
+uint8_t ModbusServerBase::writeSingleRegister(uint16_t u16WriteAddress,
                                           uint16_t u16WriteValue) {
   _u16WriteAddress = u16WriteAddress;
-  _u16WriteQty = 0;
-  _u16TransmitBuffer[0] = u16WriteValue;
+  _u16WriteQty = u16WriteValue;
   return ModbusServerTransaction(ku8MBWriteSingleRegister);
 }
 
+/**
+Modbus function 0x08 Diagnostics.
+
+This function code tests the communication between the master and a
+serial line slave, and reads the counters the slave keeps about the bus.
+The sub-function selects the test or counter (ku16MBReturnQueryData,
+ku16MBBusCommErrorCount, ku16MBClearCounters, ...); the slave echoes the
+request, with the data field replaced by the counter asked for.
+
+The data field of the response is placed in the response buffer.
+
+@param u16SubFunction sub-function (0x0000..0xFFFF)
+@param u16Data data field: the value to echo for ku16MBReturnQueryData,
+0 for every other sub-function
+@return 0 on success; exception number on failure
+@ingroup diagnostics
+*/
+uint8_t ModbusServerBase::diagnostics(uint16_t u16SubFunction,
+                                      uint16_t u16Data) {
+  // the fields travel like a single register write
+  _u16WriteAddress = u16SubFunction;
+  _u16WriteQty = u16Data;
+  return ModbusServerTransaction(ku8MBDiagnostics);
+}
+
+/**
+Modbus function 0x08 Diagnostics, straight into application memory.
+
+@param u16SubFunction sub-function (0x0000..0xFFFF)
+@param u16Data data field: the value to echo for ku16MBReturnQueryData,
+0 for every other sub-function
+@param pu16Result destination of the data field of the response, 1 word
+@return 0 on success; exception number on failure
+@ingroup diagnostics
+*/
+uint8_t ModbusServerBase::diagnostics(uint16_t u16SubFunction,
+                                      uint16_t u16Data,
+                                      uint16_t *pu16Result) {
+  _pu16ReadValues = pu16Result;
+  uint8_t u8Status = diagnostics(u16SubFunction, u16Data);
+  _pu16ReadValues = nullptr;
+  return u8Status;
+}
+
+/**
+Modbus function 0x0B Get Comm Event Counter.
+
+This function code gets a status word and the event counter of a serial
+line slave: the number of requests it completed without an exception
+since its counters were last cleared. Comparing the counter before and
+after a series of requests tells whether the slave carried them out.
+
+The status word, 0xFFFF while the slave is still busy with a previous
+request, and the event counter are placed in the response buffer, in
+this order.
+
+@return 0 on success; exception number on failure
+@ingroup diagnostics
+*/
+uint8_t ModbusServerBase::getCommEventCounter() {
+  return ModbusServerTransaction(ku8MBGetCommEventCounter);
+}
+
+/**
+Modbus function 0x0B Get Comm Event Counter, straight into application
+memory.
+
+@param pu16Result destination of the status word and the event counter,
+2 words
+@return 0 on success; exception number on failure
+@ingroup diagnostics
+*/
+uint8_t ModbusServerBase::getCommEventCounter(uint16_t *pu16Result) {
+  _pu16ReadValues = pu16Result;
+  uint8_t u8Status = ModbusServerTransaction(ku8MBGetCommEventCounter);
+  _pu16ReadValues = nullptr;
+  return u8Status;
+}
+
 /**
 Modbus function 0x0F Write Multiple Coils.
 
@@ -324,17 +556,44 @@ corresponding output to be ON. A logical '0' requests it to be OFF.
 @return 0 on success; exception number on failure
 @ingroup discrete
 */
-uint8_t ModbusServer::writeMultipleCoils(uint16_t u16WriteAddress,
+uint8_t ModbusServerBase::writeMultipleCoils(uint16_t u16WriteAddress,
                                          uint16_t u16BitQty) {
   _u16WriteAddress = u16WriteAddress;
   _u16WriteQty = u16BitQty;
   return ModbusServerTransaction(ku8MBWriteMultipleCoils);
 }
-uint8_t ModbusServer::writeMultipleCoils() {
+uint8_t ModbusServerBase::writeMultipleCoils() {
   _u16WriteQty = u16TransmitBufferLength;
   return ModbusServerTransaction(ku8MBWriteMultipleCoils);
 }
 
+/**
+Modbus function 0x0F Write Multiple Coils, straight from application
+memory.
+
+The coil states are packed into the request directly from au8Bits, without
+going through the transmit buffer, so the write is bounded by the frame
+buffer rather than by the transmit buffer.
+
+@param u16WriteAddress address of the first coil (0x0000..0xFFFF)
+@param au8Bits coil states, packed LSB first as in the frame: coil i is
+bit i % 8 of byte i / 8
+@param u16BitQty quantity of coils to write (1..1968, enforced by remote
+device)
+@return 0 on success; exception number on failure
+@ingroup discrete
+*/
+uint8_t ModbusServerBase::writeMultipleCoils(uint16_t u16WriteAddress,
+                                             const uint8_t *au8Bits,
+                                             uint16_t u16BitQty) {
+  _u16WriteAddress = u16WriteAddress;
+  _u16WriteQty = u16BitQty;
+  _pu8WriteBits = au8Bits;
+  uint8_t u8Status = ModbusServerTransaction(ku8MBWriteMultipleCoils);
+  _pu8WriteBits = nullptr;
+  return u8Status;
+}
+
 /**
 Modbus function 0x10 Write Multiple Registers.
 
@@ -350,7 +609,7 @@ remote device)
 @return 0 on success; exception number on failure
 @ingroup register
 */
-uint8_t ModbusServer::writeMultipleRegisters(uint16_t u16WriteAddress,
+uint8_t ModbusServerBase::writeMultipleRegisters(uint16_t u16WriteAddress,
                                              uint16_t u16WriteQty) {
   _u16WriteAddress = u16WriteAddress;
   _u16WriteQty = u16WriteQty;
@@ -358,11 +617,37 @@ uint8_t ModbusServer::writeMultipleRegisters(uint16_t u16WriteAddress,
 }
 
 // new version based on Wire.h
-uint8_t ModbusServer::writeMultipleRegisters() {
+uint8_t ModbusServerBase::writeMultipleRegisters() {
   _u16WriteQty = _u8TransmitBufferIndex;
   return ModbusServerTransaction(ku8MBWriteMultipleRegisters);
 }
 
+/**
+Modbus function 0x10 Write Multiple Registers, straight from application
+memory.
+
+The values are encoded into the request directly from au16Values, without
+going through the transmit buffer, so the write is bounded by the frame
+buffer rather than by the transmit buffer.
+
+@param u16WriteAddress address of the holding register (0x0000..0xFFFF)
+@param au16Values values to write, one word per register
+@param u16WriteQty quantity of holding registers to write (1..123,
+enforced by remote device)
+@return 0 on success; exception number on failure
+@ingroup register
+*/
+uint8_t ModbusServerBase::writeMultipleRegisters(uint16_t u16WriteAddress,
+                                                 const uint16_t *au16Values,
+                                                 uint16_t u16WriteQty) {
+  _u16WriteAddress = u16WriteAddress;
+  _u16WriteQty = u16WriteQty;
+  _pu16WriteValues = au16Values;
+  uint8_t u8Status = ModbusServerTransaction(ku8MBWriteMultipleRegisters);
+  _pu16WriteValues = nullptr;
+  return u8Status;
+}
+
 /**
 Modbus function 0x16 Mask Write Register.
 
@@ -385,12 +670,13 @@ Result = (Current Contents && And_Mask) || (Or_Mask && (~And_Mask))
 @return 0 on success; exception number on failure
 @ingroup register
 */
-uint8_t ModbusServer::maskWriteRegister(uint16_t u16WriteAddress,
+uint8_t ModbusServerBase::maskWriteRegister(uint16_t u16WriteAddress,
                                         uint16_t u16AndMask,
                                         uint16_t u16OrMask) {
+  // the masks travel in the write fields, so no buffer is involved
   _u16WriteAddress = u16WriteAddress;
-  _u16TransmitBuffer[0] = u16AndMask;
-  _u16TransmitBuffer[1] = u16OrMask;
+  _u16WriteQty = u16AndMask;
+  _u16ReadQty = u16OrMask;
   return ModbusServerTransaction(ku8MBMaskWriteRegister);
 }
 
@@ -416,7 +702,7 @@ remote device)
 @return 0 on success; exception number on failure
 @ingroup register
 */
-uint8_t ModbusServer::readWriteMultipleRegisters(uint16_t u16ReadAddress,
+uint8_t ModbusServerBase::readWriteMultipleRegisters(uint16_t u16ReadAddress,
                                                  uint16_t u16ReadQty,
                                                  uint16_t u16WriteAddress,
                                                  uint16_t u16WriteQty) {
@@ -426,7 +712,7 @@ uint8_t ModbusServer::readWriteMultipleRegisters(uint16_t u16ReadAddress,
   _u16WriteQty = u16WriteQty;
   return ModbusServerTransaction(ku8MBReadWriteMultipleRegisters);
 }
-uint8_t ModbusServer::readWriteMultipleRegisters(uint16_t u16ReadAddress,
+uint8_t ModbusServerBase::readWriteMultipleRegisters(uint16_t u16ReadAddress,
                                                  uint16_t u16ReadQty) {
   _u16ReadAddress = u16ReadAddress;
   _u16ReadQty = u16ReadQty;
@@ -448,17 +734,64 @@ Sequence:
 @param u8MBFunction Modbus function (0x01..0xFF)
 @return 0 on success; exception number on failure
 */
-uint8_t ModbusServer::ModbusServerTransaction(uint8_t u8MBFunction) {
-  uint8_t u8ModbusADU[256];
-  uint8_t u8ModbusADUSize = 0;
-  uint8_t i, u8Qty;
-  uint32_t u32StartTime;
-  uint8_t u8BytesLeft = 8;
-  uint8_t u8MBStatus = ku8MBSuccess;
+uint8_t ModbusServerBase::ModbusServerTransaction(uint8_t u8MBFunction) {
+  uint8_t *u8ModbusADU = _u8ModbusADU;
+  uint16_t u16ModbusADUSize = 0;
+  uint32_t u32ResponseSize;
+  uint16_t u16Bytes, u16Words;
+  uint8_t u8Qty;
+  uint8_t u8MBStatus;
+  uint16_t u16CRC;
+  uint16_t u16Timeout;
+
+  // the request and the expected response must fit the ADU buffer
+  switch (u8MBFunction) {
+  case ku8MBReadCoils:
+  case ku8MBReadDiscreteInputs:
+    u32ResponseSize = 5 + ((_u16ReadQty + 7) >> 3);
+    break;
+  case ku8MBReadInputRegisters:
+  case ku8MBReadHoldingRegisters:
+  case ku8MBReadWriteMultipleRegisters:
+    u32ResponseSize = 5 + 2 * (uint32_t)_u16ReadQty;
+    break;
+  case ku8MBDiagnostics:
+  case ku8MBGetCommEventCounter:
+    u32ResponseSize = 8;
+    break;
+  default:
+    u32ResponseSize = 0;
+    break;
+  }
+  switch (u8MBFunction) {
+  case ku8MBWriteMultipleCoils:
+    if ((!_pu8WriteBits && ((_u16WriteQty + 15) >> 4) > _u8BufferSize) ||
+        9 + ((_u16WriteQty + 7) >> 3) > _u16ADUSize)
+      return ku8MBFrameTooLarge;
+    break;
+  case ku8MBWriteMultipleRegisters:
+    if ((!_pu16WriteValues && _u16WriteQty > _u8BufferSize) ||
+        9 + 2 * (uint32_t)_u16WriteQty > _u16ADUSize)
+      return ku8MBFrameTooLarge;
+    break;
+  case ku8MBReadWriteMultipleRegisters:
+    if (_u16WriteQty > _u8BufferSize || 13 + 2 * _u16WriteQty > _u16ADUSize)
+      return ku8MBFrameTooLarge;
+    break;
+  }
+  // buffered reads need a response buffer, which compact masters lack
+  if (u32ResponseSize > _u16ADUSize ||
+      (u32ResponseSize && !_pu16ReadValues && !_u8BufferSize))
+    return ku8MBFrameTooLarge;
+  // only writes can be broadcast, nothing answers them
+  if (!_u8MBSlave && !ModbusPduHandler::broadcastable(u8MBFunction))
+    return ku8MBInvalidSlaveID;
+  if (admit(u16Timeout))
+    return ku8MBSlaveQuarantined;
 
   // assemble Modbus Request Application Data Unit
-  u8ModbusADU[u8ModbusADUSize++] = _u8MBSlave;
-  u8ModbusADU[u8ModbusADUSize++] = u8MBFunction;
+  u8ModbusADU[u16ModbusADUSize++] = _u8MBSlave;
+  u8ModbusADU[u16ModbusADUSize++] = u8MBFunction;
 
   switch (u8MBFunction) {
   case ku8MBReadCoils:
@@ -466,10 +799,10 @@ uint8_t ModbusServer::ModbusServerTransaction(uint8_t u8MBFunction) {
   case ku8MBReadInputRegisters:
   case ku8MBReadHoldingRegisters:
   case ku8MBReadWriteMultipleRegisters:
-    u8ModbusADU[u8ModbusADUSize++] = highByte(_u16ReadAddress);
-    u8ModbusADU[u8ModbusADUSize++] = lowByte(_u16ReadAddress);
-    u8ModbusADU[u8ModbusADUSize++] = highByte(_u16ReadQty);
-    u8ModbusADU[u8ModbusADUSize++] = lowByte(_u16ReadQty);
+    u8ModbusADU[u16ModbusADUSize++] = highByte(_u16ReadAddress);
+    u8ModbusADU[u16ModbusADUSize++] = lowByte(_u16ReadAddress);
+    u8ModbusADU[u16ModbusADUSize++] = highByte(_u16ReadQty);
+    u8ModbusADU[u16ModbusADUSize++] = lowByte(_u16ReadQty);
     break;
   }
 
@@ -480,242 +813,144 @@ uint8_t ModbusServer::ModbusServerTransaction(uint8_t u8MBFunction) {
   case ku8MBWriteSingleRegister:
   case ku8MBWriteMultipleRegisters:
   case ku8MBReadWriteMultipleRegisters:
-    u8ModbusADU[u8ModbusADUSize++] = highByte(_u16WriteAddress);
-    u8ModbusADU[u8ModbusADUSize++] = lowByte(_u16WriteAddress);
+  case ku8MBDiagnostics:
+    u8ModbusADU[u16ModbusADUSize++] = highByte(_u16WriteAddress);
+    u8ModbusADU[u16ModbusADUSize++] = lowByte(_u16WriteAddress);
     break;
   }
 
   switch (u8MBFunction) {
   case ku8MBWriteSingleCoil:
-    u8ModbusADU[u8ModbusADUSize++] = highByte(_u16WriteQty);
-    u8ModbusADU[u8ModbusADUSize++] = lowByte(_u16WriteQty);
-    break;
-
   case ku8MBWriteSingleRegister:
-    u8ModbusADU[u8ModbusADUSize++] = highByte(_u16TransmitBuffer[0]);
-    u8ModbusADU[u8ModbusADUSize++] = lowByte(_u16TransmitBuffer[0]);
+  case ku8MBDiagnostics:
+    u8ModbusADU[u16ModbusADUSize++] = highByte(_u16WriteQty);
+    u8ModbusADU[u16ModbusADUSize++] = lowByte(_u16WriteQty);
     break;
 
   case ku8MBWriteMultipleCoils:
-    u8ModbusADU[u8ModbusADUSize++] = highByte(_u16WriteQty);
-    u8ModbusADU[u8ModbusADUSize++] = lowByte(_u16WriteQty);
+    u8ModbusADU[u16ModbusADUSize++] = highByte(_u16WriteQty);
+    u8ModbusADU[u16ModbusADUSize++] = lowByte(_u16WriteQty);
     u8Qty =
         (_u16WriteQty % 8) ? ((_u16WriteQty >> 3) + 1) : (_u16WriteQty >> 3);
-    u8ModbusADU[u8ModbusADUSize++] = u8Qty;
-    for (i = 0; i < u8Qty; i++) {
-      switch (i % 2) {
-      case 0: // i is even
-        u8ModbusADU[u8ModbusADUSize++] = lowByte(_u16TransmitBuffer[i >> 1]);
-        break;
-
-      case 1: // i is odd
-        u8ModbusADU[u8ModbusADUSize++] = highByte(_u16TransmitBuffer[i >> 1]);
-        break;
-      }
-    }
+    u8ModbusADU[u16ModbusADUSize++] = u8Qty;
+    // pack the coils, 16 per word, into bytes, or copy them as packed by
+    // the caller; unused bits are cleared
+    if (_pu8WriteBits)
+      bits_extract(u8ModbusADU + u16ModbusADUSize, _pu8WriteBits, 0,
+                   _u16WriteQty);
+    else
+      bits_from_words(u8ModbusADU + u16ModbusADUSize, _u16TransmitBuffer,
+                      _u16WriteQty);
+    u16ModbusADUSize += u8Qty;
     break;
 
   case ku8MBWriteMultipleRegisters:
   case ku8MBReadWriteMultipleRegisters:
-    u8ModbusADU[u8ModbusADUSize++] = highByte(_u16WriteQty);
-    u8ModbusADU[u8ModbusADUSize++] = lowByte(_u16WriteQty);
-    u8ModbusADU[u8ModbusADUSize++] = lowByte(_u16WriteQty << 1);
-
-    for (i = 0; i < lowByte(_u16WriteQty); i++) {
-      u8ModbusADU[u8ModbusADUSize++] = highByte(_u16TransmitBuffer[i]);
-      u8ModbusADU[u8ModbusADUSize++] = lowByte(_u16TransmitBuffer[i]);
-    }
+    u8ModbusADU[u16ModbusADUSize++] = highByte(_u16WriteQty);
+    u8ModbusADU[u16ModbusADUSize++] = lowByte(_u16WriteQty);
+    u8ModbusADU[u16ModbusADUSize++] = lowByte(_u16WriteQty << 1);
+
+    words_to_wire(u8ModbusADU + u16ModbusADUSize,
+                  _pu16WriteValues ? _pu16WriteValues : _u16TransmitBuffer,
+                  _u16WriteQty);
+    u16ModbusADUSize += 2 * _u16WriteQty;
     break;
 
   case ku8MBMaskWriteRegister:
-    u8ModbusADU[u8ModbusADUSize++] = highByte(_u16TransmitBuffer[0]);
-    u8ModbusADU[u8ModbusADUSize++] = lowByte(_u16TransmitBuffer[0]);
-    u8ModbusADU[u8ModbusADUSize++] = highByte(_u16TransmitBuffer[1]);
-    u8ModbusADU[u8ModbusADUSize++] = lowByte(_u16TransmitBuffer[1]);
+    u8ModbusADU[u16ModbusADUSize++] = highByte(_u16WriteQty);
+    u8ModbusADU[u16ModbusADUSize++] = lowByte(_u16WriteQty);
+    u8ModbusADU[u16ModbusADUSize++] = highByte(_u16ReadQty);
+    u8ModbusADU[u16ModbusADUSize++] = lowByte(_u16ReadQty);
     break;
   }
 
   // append CRC
-  uint16_t u16CRC = crc(u8ModbusADU, u8ModbusADUSize);
-  u8ModbusADU[u8ModbusADUSize++] = highByte(u16CRC);
-  u8ModbusADU[u8ModbusADUSize++] = lowByte(u16CRC);
-  u8ModbusADU[u8ModbusADUSize] = 0;
+  u16CRC = crc(u8ModbusADU, u16ModbusADUSize);
+  u8ModbusADU[u16ModbusADUSize++] = highByte(u16CRC);
+  u8ModbusADU[u16ModbusADUSize++] = lowByte(u16CRC);
 
-  // Optional additional user-defined work step.
-  if (_preWrite) {
-    _preWrite();
-  }
+  u8MBStatus = exchange(u8MBFunction, u16ModbusADUSize, 0, u16Timeout,
+                        u16ModbusADUSize);
 
-  // flush receive buffer before transmitting request
-  while (_serial->read() != -1)
-    ;
-
-#ifdef MODBUS_DEBUG
-  debugSerialPort.println();
-#endif
+  // check whether Modbus exception occurred; return Modbus Exception Code
+  if (!u8MBStatus && u16ModbusADUSize && bitRead(u8ModbusADU[FUNC], 7))
+    u8MBStatus = u8ModbusADU[FUNC + 1];
 
-  for (i = 0; i < u8ModbusADUSize; i++) {
-    _serial->write(u8ModbusADU[i]);
-
-#ifdef MODBUS_DEBUG
-    if (u8ModbusADU[i] < 15)
-      debugSerialPort.print("0");
-    debugSerialPort.print(u8ModbusADU[i], HEX);
-    debugSerialPort.print(">");
-#endif
-  }
-
-#ifdef MODBUS_DEBUG
-  debugSerialPort.println();
-#endif
-
-  u8ModbusADUSize = 0;
-  _serial->flush(); // flush transmit buffer
-
-  // Optional additional user-defined work step.
-  if (_postWrite) {
-    _postWrite();
-  }
-
-  // Optional additional user-defined work step.
-  if (_preRead) {
-    _preRead();
-  }
-
-  // loop until we run out of time or bytes, or an error occurs
-  u32StartTime = millis();
-  while (u8BytesLeft && !u8MBStatus) {
-    if (_serial->available()) {
-#if __MODBUSMASTER_DEBUG__
-      digitalWrite(__MODBUSMASTER_DEBUG_PIN_A__, true);
-#endif
-      uint8_t ch = _serial->read();
-
-#ifdef MODBUS_DEBUG
-      if (ch < 15)
-        debugSerialPort.print("0");
-      debugSerialPort.print(ch, HEX);
-      debugSerialPort.print("<");
-#endif
-
-      if ((ch == _u8MBSlave) || u8ModbusADUSize) {
-        u8ModbusADU[u8ModbusADUSize++] = ch;
-        u8BytesLeft--;
-      }
-#if __MODBUSMASTER_DEBUG__
-      digitalWrite(__MODBUSMASTER_DEBUG_PIN_A__, false);
-#endif
-    } else {
-#if __MODBUSMASTER_DEBUG__
-      digitalWrite(__MODBUSMASTER_DEBUG_PIN_B__, true);
-#endif
-      // Optional additional user-defined work step.
-      if (_idleRead) {
-        _idleRead();
-      }
-#if __MODBUSMASTER_DEBUG__
-      digitalWrite(__MODBUSMASTER_DEBUG_PIN_B__, false);
-#endif
-    }
-
-    // evaluate slave ID, function code once enough bytes have been read
-    if (u8ModbusADUSize == 5) {
-      // verify response is for correct Modbus function code (mask exception bit
-      // 7)
-      if ((u8ModbusADU[1] & 0x7F) != u8MBFunction) {
+  // reads must return the quantity asked for, no less: the tail of the
+  // destination would keep stale data
+  if (!u8MBStatus && u16ModbusADUSize) {
+    switch (u8MBFunction) {
+    case ku8MBReadCoils:
+    case ku8MBReadDiscreteInputs:
+    case ku8MBReadInputRegisters:
+    case ku8MBReadHoldingRegisters:
+    case ku8MBReadWriteMultipleRegisters:
+      if (u8ModbusADU[2] != u32ResponseSize - 5)
         u8MBStatus = ku8MBInvalidFunction;
-        break;
-      }
-
-      // check whether Modbus exception occurred; return Modbus Exception Code
-      if (bitRead(u8ModbusADU[1], 7)) {
-        u8MBStatus = u8ModbusADU[2];
-        break;
-      }
-
-      // evaluate returned Modbus function code
-      switch (u8ModbusADU[1]) {
-      case ku8MBReadCoils:
-      case ku8MBReadDiscreteInputs:
-      case ku8MBReadInputRegisters:
-      case ku8MBReadHoldingRegisters:
-      case ku8MBReadWriteMultipleRegisters:
-        u8BytesLeft = u8ModbusADU[2];
-        break;
-
-      case ku8MBWriteSingleCoil:
-      case ku8MBWriteMultipleCoils:
-      case ku8MBWriteSingleRegister:
-      case ku8MBWriteMultipleRegisters:
-        u8BytesLeft = 3;
-        break;
-
-      case ku8MBMaskWriteRegister:
-        u8BytesLeft = 5;
-        break;
-      }
-    }
-    if ((millis() - u32StartTime) > _u16MBResponseTimeout) {
-      u8MBStatus = ku8MBResponseTimedOut;
+      break;
     }
   }
 
-  // verify response is large enough to inspect further
-  if (!u8MBStatus && u8ModbusADUSize >= 5) {
-    // calculate CRC
-    uint16_t u16CRC = crc(u8ModbusADU, u8ModbusADUSize - 2);
+  // disassemble ADU into words, only now that the CRC has been checked;
+  // broadcasts leave nothing to disassemble
+  if (u8MBStatus || !u16ModbusADUSize) {
+  } else if (_pu16ReadValues) {
+    // straight into application memory, exactly the quantity asked for
+    _u8ResponseBufferLength = 0;
+    switch (u8ModbusADU[1]) {
+    case ku8MBReadCoils:
+    case ku8MBReadDiscreteInputs:
+      bits_to_words(_pu16ReadValues, u8ModbusADU + 3, _u16ReadQty);
+      break;
 
-    // verify CRC
-    if (!u8MBStatus && (highByte(u16CRC) != u8ModbusADU[u8ModbusADUSize - 2] ||
-                        lowByte(u16CRC) != u8ModbusADU[u8ModbusADUSize - 1])) {
-      u8MBStatus = ku8MBInvalidCRC;
-    }
-  }
+    case ku8MBReadInputRegisters:
+    case ku8MBReadHoldingRegisters:
+      words_from_wire(_pu16ReadValues, u8ModbusADU + 3, _u16ReadQty);
+      break;
 
-  // Optional additional user-defined work step.
-  if (_postRead) {
-    _postRead();
-  }
+    case ku8MBDiagnostics:
+      // the data field follows the echoed sub-function
+      words_from_wire(_pu16ReadValues, u8ModbusADU + 4, 1);
+      break;
 
-  // disassemble ADU into words
-  if (!u8MBStatus) {
+    case ku8MBGetCommEventCounter:
+      words_from_wire(_pu16ReadValues, u8ModbusADU + 2, 2);
+      break;
+    }
+  } else {
     // evaluate returned Modbus function code
     switch (u8ModbusADU[1]) {
     case ku8MBReadCoils:
     case ku8MBReadDiscreteInputs:
-      // load bytes into word; response bytes are ordered L, H, L, H, ...
-      for (i = 0; i < (u8ModbusADU[2] >> 1); i++) {
-        if (i < ku8MaxBufferSize) {
-          _u16ResponseBuffer[i] =
-              word(u8ModbusADU[2 * i + 4], u8ModbusADU[2 * i + 3]);
-        }
-
-        _u8ResponseBufferLength = i;
-      }
-
-      // in the event of an odd number of bytes, load last byte into zero-padded
-      // word
-      if (u8ModbusADU[2] % 2) {
-        if (i < ku8MaxBufferSize) {
-          _u16ResponseBuffer[i] = word(0, u8ModbusADU[2 * i + 3]);
-        }
-
-        _u8ResponseBufferLength = i + 1;
-      }
+      // unpack the bytes into words, 16 bits per word; an odd last byte
+      // ends up in a zero-padded word
+      u16Bytes = u8ModbusADU[2];
+      if (u16Bytes > 2 * _u8BufferSize)
+        u16Bytes = 2 * _u8BufferSize;
+      bits_to_words(_u16ResponseBuffer, u8ModbusADU + 3, 8 * u16Bytes);
+      _u8ResponseBufferLength = (uint8_t)((u16Bytes + 1) >> 1);
       break;
 
     case ku8MBReadInputRegisters:
     case ku8MBReadHoldingRegisters:
     case ku8MBReadWriteMultipleRegisters:
-      // load bytes into word; response bytes are ordered H, L, H, L, ...
-      for (i = 0; i < (u8ModbusADU[2] >> 1); i++) {
-        if (i < ku8MaxBufferSize) {
-          _u16ResponseBuffer[i] =
-              word(u8ModbusADU[2 * i + 3], u8ModbusADU[2 * i + 4]);
-        }
+      // load bytes into words; response bytes are ordered H, L, H, L, ...
+      u16Words = u8ModbusADU[2] >> 1;
+      if (u16Words > _u8BufferSize)
+        u16Words = _u8BufferSize;
+      words_from_wire(_u16ResponseBuffer, u8ModbusADU + 3, u16Words);
+      _u8ResponseBufferLength = (uint8_t)u16Words;
+      break;
 
-        _u8ResponseBufferLength = i;
-      }
+    case ku8MBDiagnostics:
+      words_from_wire(_u16ResponseBuffer, u8ModbusADU + 4, 1);
+      _u8ResponseBufferLength = 1;
+      break;
+
+    case ku8MBGetCommEventCounter:
+      u16Words = _u8BufferSize < 2 ? _u8BufferSize : 2;
+      words_from_wire(_u16ResponseBuffer, u8ModbusADU + 2, u16Words);
+      _u8ResponseBufferLength = (uint8_t)u16Words;
       break;
     }
   }
@@ -726,6 +961,76 @@ uint8_t ModbusServer::ModbusServerTransaction(uint8_t u8MBFunction) {
   return u8MBStatus;
 }
 
+/**
+Check the attached health before addressing the slave.
+
+@param u16Timeout set to the time to wait for the response to start [ms]
+@return ku8MBSlaveQuarantined if the request must not be sent,
+ku8MBSuccess otherwise
+*/
+uint8_t ModbusServerBase::admit(uint16_t &u16Timeout) {
+  u16Timeout = _u16MBResponseTimeout;
+  // broadcasts are not answered, so there is nothing to learn from them
+  if (!_health || !_u8MBSlave)
+    return ku8MBSuccess;
+  if (!_health->admit(_u8MBSlave, millis()))
+    return ku8MBSlaveQuarantined;
+  u16Timeout = _health->timeout(_u8MBSlave, _u16MBResponseTimeout);
+  return ku8MBSuccess;
+}
+
+/**
+Report to the attached health whether and how fast the slave answered.
+
+@param u16Received response bytes received [bytes]
+@param u32SentTime micros() when the request had been sent
+@param u32FirstByteTime micros() when the response started to arrive
+*/
+void ModbusServerBase::learn(uint16_t u16Received, uint32_t u32SentTime,
+                             uint32_t u32FirstByteTime) {
+  if (_u8MBSlave)
+    _health->record(_u8MBSlave, u16Received != 0,
+                    u32FirstByteTime - u32SentTime, millis());
+}
+
+/**
+Wait until the bus has been silent for T3.5 since the last frame, or for
+the turnaround delay after a broadcast.
+*/
+void ModbusServerBase::waitBusSilence() {
+  uint32_t u32Wait = _timing.silenceLeft(_u32BusTime);
+  if (_bBroadcast) {
+    uint32_t u32Elapsed = micros() - _u32BusTime;
+    uint32_t u32Turnaround = 1000UL * _u16TurnaroundDelay;
+    if (u32Elapsed < u32Turnaround && u32Turnaround - u32Elapsed > u32Wait)
+      u32Wait = u32Turnaround - u32Elapsed;
+    _bBroadcast = false;
+  }
+  if (u32Wait) {
+    delay(u32Wait / 1000);
+    delayMicroseconds(u32Wait % 1000);
+  }
+}
+
+/**
+How long the receive loops may sleep.
+
+@param u16Received bytes of the response received so far
+@param u32TimeoutMs time left until the response timeout [milliseconds]
+@return time to wait for the next byte [microseconds]; once the response
+has started, no longer than the T3.5 that would end it
+*/
+uint32_t ModbusServerBase::idleTimeout(uint16_t u16Received,
+                                       uint32_t u32TimeoutMs) const {
+  uint32_t u32Wait = (u32TimeoutMs + 1) * 1000UL;
+  if (u16Received) {
+    uint32_t u32Silence = _timing.silenceLeft(_u32BusTime);
+    if (u32Silence < u32Wait)
+      u32Wait = u32Silence;
+  }
+  return u32Wait;
+}
+
 /**
 Modbus-like protocols transaction engine.
 Sequence:
@@ -734,6 +1039,9 @@ Sequence:
   - wait for/retrieve response
   - return status (success/exception)
 
+The request and the response go through the frame buffer, so both must fit
+it; the response is copied back into u8ModbusADU.
+
 @param u8ModbusADU - pointer to buffer
 @param u8ModbusADUSize - request  size
 @param u8BytesLeft - how many bytes to be collected back (include CRC) - should
@@ -741,131 +1049,311 @@ be less then buffer size
 @return 0 on success; exception number on failure
 
 */
-uint8_t ModbusServer::ModbusRawTransaction(uint8_t *u8ModbusADU,
+uint8_t ModbusServerBase::ModbusRawTransaction(uint8_t *u8ModbusADU,
                                            uint8_t u8ModbusADUSize,
                                            uint8_t u8BytesLeft) {
-  uint32_t u32StartTime;
+  uint16_t u16Size = u8ModbusADUSize;
+  uint16_t u16Timeout;
+  uint8_t u8MBStatus;
 
-  uint8_t u8MBStatus = ku8MBSuccess;
+  if (u16Size < 2 || u16Size + 2 > _u16ADUSize || u8BytesLeft > _u16ADUSize)
+    return ku8MBFrameTooLarge;
+  if (admit(u16Timeout))
+    return ku8MBSlaveQuarantined;
+
+  // the whole buffer goes out, followed by the CRC of all but its last two
+  // bytes
   u8ModbusADU[0] = _u8MBSlave;
+  memcpy(_u8ModbusADU, u8ModbusADU, u16Size);
+  uint16_t u16CRC = crc(_u8ModbusADU, u16Size - 2);
+  _u8ModbusADU[u16Size++] = highByte(u16CRC);
+  _u8ModbusADU[u16Size++] = lowByte(u16CRC);
 
-  // calculate CRC
-  uint16_t u16CRC = crc(u8ModbusADU, u8ModbusADUSize - 2);
+  u8MBStatus = exchange(u8ModbusADU[FUNC], u16Size, u8BytesLeft, u16Timeout,
+                        u16Size);
+  memcpy(u8ModbusADU, _u8ModbusADU, u16Size);
 
-  // flush receive buffer before transmitting request
-  while (_serial->read() != -1)
-    ;
+  _u8TransmitBufferIndex = 0;
+  u16TransmitBufferLength = 0;
+  _u8ResponseBufferIndex = 0;
+  return u8MBStatus;
+}
 
-  // Optional additional user-defined work step.
-  if (_preWrite) {
-    _preWrite();
-  }
+/**
+Forward a bare PDU to the slave and return its response, e.g. for a
+gateway.
+
+The request is framed with the slave ID set by begin()/setSlaveID() and a
+CRC. Exception responses are returned like any other response PDU.
+Broadcasts (slave ID 0) return an empty response once sent; only writes
+can be broadcast.
+
+@param au8Pdu request, function code first; replaced by the response
+@param u16Length request length; set to the response length [bytes]
+@param u16Capacity number of bytes in au8Pdu
+@return 0 on success; ku8MBInvalidSlaveID for broadcasts of anything but
+writes, ku8MBSlaveQuarantined, ku8MBResponseTimedOut, ku8MBInvalidCRC,
+ku8MBInvalidFunction or ku8MBFrameTooLarge otherwise
+*/
+uint8_t ModbusServerBase::ModbusPduTransaction(uint8_t *au8Pdu,
+                                               uint16_t &u16Length,
+                                               uint16_t u16Capacity) {
+  uint8_t *u8ModbusADU = _u8ModbusADU;
+  uint16_t u16ModbusADUSize = 0;
+  uint8_t u8MBFunction = au8Pdu[PDU_FUNC];
+  uint8_t u8MBStatus;
+  uint16_t u16Timeout;
+
+  if (!u16Length || u16Length + 3 > _u16ADUSize)
+    return ku8MBFrameTooLarge;
+  // only writes can be broadcast, nothing answers them
+  if (!_u8MBSlave && !ModbusPduHandler::broadcastable(u8MBFunction))
+    return ku8MBInvalidSlaveID;
+  if (admit(u16Timeout))
+    return ku8MBSlaveQuarantined;
 
-#ifdef MODBUS_DEBUG
-  debugSerialPort.println();
-#endif
+  // assemble Modbus Request Application Data Unit
+  u8ModbusADU[u16ModbusADUSize++] = _u8MBSlave;
+  memcpy(u8ModbusADU + u16ModbusADUSize, au8Pdu, u16Length);
+  u16ModbusADUSize += u16Length;
+  uint16_t u16CRC = crc(u8ModbusADU, u16ModbusADUSize);
+  u8ModbusADU[u16ModbusADUSize++] = highByte(u16CRC);
+  u8ModbusADU[u16ModbusADUSize++] = lowByte(u16CRC);
+
+  u8MBStatus = exchange(u8MBFunction, u16ModbusADUSize, 0, u16Timeout,
+                        u16ModbusADUSize);
+  if (u8MBStatus)
+    return u8MBStatus;
+
+  // slave ID and CRC around the PDU
+  if (u16ModbusADUSize && u16ModbusADUSize - 3 > u16Capacity)
+    return ku8MBFrameTooLarge;
+  u16Length = u16ModbusADUSize ? u16ModbusADUSize - 3 : 0;
+  memcpy(au8Pdu, u8ModbusADU + FUNC, u16Length);
+  return ku8MBSuccess;
+}
 
-  for (uint8_t i = 0; i < u8ModbusADUSize; i++) {
-    _serial->write(u8ModbusADU[i]);
+/**
+Send the request assembled in the ADU buffer, then receive the response
+into it.
+
+Unless given, the response length is predicted from its header, so the
+transaction ends as soon as the last byte arrives; responses of unknown
+function codes end with T3.5 of silence. Exception responses succeed like
+any other response. Broadcasts (slave ID 0) succeed once sent, with
+nothing received.
+
+@param u8MBFunction function code of the request
+@param u16Sent request length, CRC included [bytes]
+@param u16Length response length, CRC included [bytes]; 0 to predict it
+and check the function code it carries
+@param u16Timeout time to wait for the response to start [ms]
+@param u16Received set to the response length, CRC included [bytes]
+@return 0 on success; ku8MBResponseTimedOut, ku8MBInvalidCRC,
+ku8MBInvalidFunction or ku8MBFrameTooLarge otherwise
+*/
+uint8_t ModbusServerBase::exchange(uint8_t u8MBFunction, uint16_t u16Sent,
+                                   uint16_t u16Length, uint16_t u16Timeout,
+                                   uint16_t &u16Received) {
+  uint8_t *u8ModbusADU = _u8ModbusADU;
+  uint16_t u16ModbusADUSize = 0;
+  uint16_t u16Expected = u16Length;
+  uint8_t u8MBStatus = ku8MBSuccess;
+  uint32_t u32StartTime, u32SendTime = 0, u32SentTime, u32FirstByteTime = 0;
+  uint32_t u32IdleTime;
+  uint16_t u16CRC;
 
-#ifdef MODBUS_DEBUG
-    if (u8ModbusADU[i] < 15)
-      debugSerialPort.print("0");
-    debugSerialPort.print(u8ModbusADU[i], HEX);
-    debugSerialPort.print(">");
-#endif
-  }
+  u16Received = 0;
 
-  _serial->write(highByte(u16CRC));
-  _serial->write(lowByte(u16CRC));
+  // keep the bus silent for T3.5 after the previous frame
+  waitBusSilence();
 
-#ifdef MODBUS_DEBUG
-  if (highByte(u16CRC) < 15)
-    debugSerialPort.print("0");
-  debugSerialPort.print(lowByte(u16CRC), HEX);
+  // Optional additional user-defined work step.
+  if (_preWrite) {
+    _preWrite();
+  }
 
-  if (lowByte(u16CRC) < 15)
-    debugSerialPort.print("0");
-  debugSerialPort.print(highByte(u16CRC), HEX);
-  debugSerialPort.print(">");
+  // flush receive buffer before transmitting request
+  while (_serial->read() != -1)
+    ;
 
-  debugSerialPort.println();
-#endif
+  if (_metrics)
+    u32SendTime = micros();
+  _serial->write(u8ModbusADU, u16Sent);
 
-  u8ModbusADUSize = 0;
   _serial->flush(); // flush transmit buffer
+  _u32BusTime = micros();
+  u32SentTime = _u32BusTime;
+  u32IdleTime = u32SentTime;
 
   // Optional additional user-defined work step.
   if (_postWrite) {
     _postWrite();
   }
 
+  if (_tracer)
+    trace(u32SentTime, ku8TraceTx, ku8MBSuccess, u8ModbusADU, u16Sent);
+
+  // slaves do not answer broadcasts; the next request waits for the
+  // turnaround delay instead
+  if (!_u8MBSlave) {
+    _bBroadcast = true;
+    if (_metrics)
+      record(u8MBFunction, ku8MBSuccess, u16Sent, 0, u32SendTime, u32SentTime,
+             u32FirstByteTime);
+    return ku8MBSuccess;
+  }
+
   // Optional additional user-defined work step.
   if (_preRead) {
     _preRead();
   }
 
-  // loop until we run out of time or bytes, or an error occurs
+  // loop until the predicted length has arrived, the response stalls or
+  // an error occurs
   u32StartTime = millis();
-  while (u8BytesLeft && !u8MBStatus) {
+  u16CRC = ku16CRCInit;
+  while (!u8MBStatus) {
     if (_serial->available()) {
-      uint8_t ch;
 #if __MODBUSMASTER_DEBUG__
       digitalWrite(__MODBUSMASTER_DEBUG_PIN_A__, true);
 #endif
-      ch = _serial->read();
+      uint8_t ch = _serial->read();
 
-#ifdef MODBUS_DEBUG
-      if (ch < 15)
-        debugSerialPort.print("0");
-      debugSerialPort.print(ch, HEX);
-      debugSerialPort.print("<");
-#endif
+      if (u16ModbusADUSize >= _u16ADUSize) {
+        u8MBStatus = ku8MBFrameTooLarge;
+        break;
+      }
+      // a gap longer than T1.5 inside the response breaks it
+      if (u16ModbusADUSize &&
+          _timing.charGapExceeded(_u32BusTime, u32IdleTime)) {
+        u8MBStatus = ku8MBResponseTimedOut;
+      }
+      _u32BusTime = micros();
 
-      if ((ch == _u8MBSlave) || u8ModbusADUSize) {
-        u8ModbusADU[u8ModbusADUSize++] = ch;
-        u8BytesLeft--;
+      if ((ch == _u8MBSlave) || u16ModbusADUSize) {
+        // the learnt timeout only covers the wait for the first byte
+        if (!u16ModbusADUSize) {
+          u32FirstByteTime = _u32BusTime;
+          u16Timeout = _u16MBResponseTimeout;
+        }
+        u8ModbusADU[u16ModbusADUSize++] = ch;
+        u16CRC = crc_update(u16CRC, ch);
       }
 #if __MODBUSMASTER_DEBUG__
       digitalWrite(__MODBUSMASTER_DEBUG_PIN_A__, false);
 #endif
+
+      // slave ID and CRC around the PDU
+      if (!u16Expected && u16ModbusADUSize >= 2) {
+        u16Expected = ModbusPduHandler::responseLength(u8ModbusADU + FUNC,
+                                                       u16ModbusADUSize - 1);
+        if (u16Expected)
+          u16Expected += 3;
+      }
+      if (u16Expected && u16ModbusADUSize == u16Expected)
+        break;
     } else {
+      // bytes arriving from now on were not pending yet
+      u32IdleTime = micros();
 #if __MODBUSMASTER_DEBUG__
       digitalWrite(__MODBUSMASTER_DEBUG_PIN_B__, true);
 #endif
-      if (_idleRead) {
-        _idleRead();
+      // Optional additional user-defined work step.
+      uint32_t u32Elapsed = millis() - u32StartTime;
+      if (u32Elapsed <= u16Timeout) {
+        if (idle(_serial,
+                 idleTimeout(u16ModbusADUSize, u16Timeout - u32Elapsed)))
+          u32IdleTime = micros();
       }
 #if __MODBUSMASTER_DEBUG__
       digitalWrite(__MODBUSMASTER_DEBUG_PIN_B__, false);
 #endif
     }
 
-    if ((millis() - u32StartTime) > ku16MBResponseTimeout) {
+    if (u16ModbusADUSize && !_serial->available() &&
+        !_timing.silenceLeft(_u32BusTime)) {
+      // T3.5 delimits responses of unknown length; any other one stalled
+      if (!u16Expected && u16ModbusADUSize >= 4)
+        break;
+      u8MBStatus = ku8MBResponseTimedOut;
+    } else if ((millis() - u32StartTime) > u16Timeout) {
       u8MBStatus = ku8MBResponseTimedOut;
     }
   }
 
-  // verify response is large enough to inspect further
-  if (!u8MBStatus && u8ModbusADUSize >= 4) {
-    // calculate CRC
-    uint16_t u16CRC = crc(u8ModbusADU, u8ModbusADUSize - 2);
-
-    // verify CRC
-    if (!u8MBStatus && (highByte(u16CRC) != u8ModbusADU[u8ModbusADUSize - 2] ||
-                        lowByte(u16CRC) != u8ModbusADU[u8ModbusADUSize - 1])) {
-      u8MBStatus = ku8MBInvalidCRC;
-    }
-  }
-
-  _u8TransmitBufferIndex = 0;
-  u16TransmitBufferLength = 0;
-  _u8ResponseBufferIndex = 0;
+  // verify CRC folded in while the response was received
+  if (!u8MBStatus && u16CRC != ku16CRCResidue)
+    u8MBStatus = ku8MBInvalidCRC;
+  // verify response is for correct Modbus function code (mask exception bit 7)
+  if (!u8MBStatus && !u16Length &&
+      (u8ModbusADU[FUNC] & 0x7F) != u8MBFunction)
+    u8MBStatus = ku8MBInvalidFunction;
 
   // Optional additional user-defined work step.
   if (_postRead) {
     _postRead();
   }
 
+  // exception responses succeed here, but are counted and traced as such
+  uint8_t u8Outcome = u8MBStatus;
+  if (!u8Outcome && bitRead(u8ModbusADU[FUNC], 7))
+    u8Outcome = u8ModbusADU[FUNC + 1];
+  if (_health)
+    learn(u16ModbusADUSize, u32SentTime, u32FirstByteTime);
+  if (_metrics)
+    record(u8MBFunction, u8Outcome, u16Sent, u16ModbusADUSize, u32SendTime,
+           u32SentTime, u32FirstByteTime);
+  if (_tracer)
+    traceResponse(u8Outcome, u8ModbusADU, u16ModbusADUSize);
+
+  u16Received = u16ModbusADUSize;
   return u8MBStatus;
 }
+
+/**
+Report a transaction that went out on the line to the attached metrics.
+
+@param u8Function function code of the request
+@param u8Status outcome of the transaction
+@param u16Sent request length [bytes]
+@param u16Received response bytes received [bytes]
+@param u32SendTime micros() when the request started going out
+@param u32SentTime micros() when the request had been sent
+@param u32FirstByteTime micros() when the response started to arrive
+*/
+void ModbusServerBase::record(uint8_t u8Function, uint8_t u8Status,
+                              uint16_t u16Sent, uint16_t u16Received,
+                              uint32_t u32SendTime, uint32_t u32SentTime,
+                              uint32_t u32FirstByteTime) {
+  ModbusSample sample;
+  sample.u8Slave = _u8MBSlave;
+  sample.u8Function = u8Function;
+  sample.u8Status = u8Status;
+  sample.u16Sent = u16Sent;
+  sample.u16Received = u16Received;
+  // _u32BusTime is the last byte received
+  sample.u32TurnaroundUs = _u32BusTime - u32SentTime;
+  sample.u32FirstByteUs = u32FirstByteTime - u32SentTime;
+  sample.u32FrameUs = _u32BusTime - u32FirstByteTime;
+  sample.u32BusyUs = micros() - u32SendTime;
+  _metrics->record(sample);
+}
+
+/**
+Copy the response, or what arrived of it, to the attached tracer.
+
+Requests left without any response are traced as empty frames, so the
+status shows in the trace.
+
+@param u8Status outcome of the transaction
+@param au8Frame response bytes received
+@param u16Length number of bytes in au8Frame
+*/
+void ModbusServerBase::traceResponse(uint8_t u8Status, const uint8_t *au8Frame,
+                                     uint16_t u16Length) {
+  if (u16Length)
+    trace(_u32BusTime, 0, u8Status, au8Frame, u16Length);
+  else if (u8Status)
+    trace(micros(), 0, u8Status, au8Frame, 0);
+}
@@ -2,20 +2,39 @@
 #define MODBUSTER_SERVER_H
 
 #include "Modbuster.h"
-
-class Stream;
+#include "ModbusterHealth.h"
 
 namespace ModBuster {
 
-class ModbusServer : public ModbusBase {
-public:
-  ModbusServer();
+/**
+Modbus RTU master.
 
+Holds the protocol logic; the response, transmit and ADU buffers are owned
+by ModbusServerT, which sets their size at compile time. Pass objects of
+any capacity around as ModbusServerBase&.
+*/
+class ModbusServerBase : public ModbusBase {
+public:
   void begin(uint8_t, Stream &serial);
 
+  uint8_t getSlaveID() const;
+  void setSlaveID(uint8_t u8MBSlave);
   uint16_t getResponseTimeOut() const;
   void setResponseTimeOut(uint16_t u16MBResponseTimeout);
+  uint16_t getTurnaroundDelay() const { return _u16TurnaroundDelay; }
+  void setTurnaroundDelay(uint16_t u16TurnaroundDelay);
 
+  /**
+  Learn per-slave timeouts and quarantine silent slaves in health from
+  now on; nullptr goes back to the response timeout for every slave.
+
+  @ingroup setup
+  */
+  void setHealth(ModbusHealth *health) { _health = health; }
+  ModbusHealth *health() const { return _health; }
+
+  uint8_t bufferSize() const { return _u8BufferSize; }
+  uint16_t frameSize() const { return _u16ADUSize; }
   uint16_t getResponseBuffer(uint8_t);
   void clearResponseBuffer();
   uint8_t setTransmitBuffer(uint8_t, uint16_t);
@@ -31,46 +50,136 @@ public:
   uint16_t receive(void);
 
   uint8_t readCoils(uint16_t, uint16_t);
+  uint8_t readCoils(uint16_t, uint16_t, uint16_t *);
   uint8_t readDiscreteInputs(uint16_t, uint16_t);
+  uint8_t readDiscreteInputs(uint16_t, uint16_t, uint16_t *);
   uint8_t readHoldingRegisters(uint16_t, uint16_t);
+  uint8_t readHoldingRegisters(uint16_t, uint16_t, uint16_t *);
   uint8_t readInputRegisters(uint16_t, uint8_t);
+  uint8_t readInputRegisters(uint16_t, uint16_t, uint16_t *);
   uint8_t writeSingleCoil(uint16_t, uint8_t);
   uint8_t writeSingleRegister(uint16_t, uint16_t);
+  uint8_t diagnostics(uint16_t, uint16_t);
+  uint8_t diagnostics(uint16_t, uint16_t, uint16_t *);
+  uint8_t getCommEventCounter();
+  uint8_t getCommEventCounter(uint16_t *);
   uint8_t writeMultipleCoils(uint16_t, uint16_t);
   uint8_t writeMultipleCoils();
+  uint8_t writeMultipleCoils(uint16_t, const uint8_t *, uint16_t);
   uint8_t writeMultipleRegisters(uint16_t, uint16_t);
   uint8_t writeMultipleRegisters();
+  uint8_t writeMultipleRegisters(uint16_t, const uint16_t *, uint16_t);
   uint8_t maskWriteRegister(uint16_t, uint16_t, uint16_t);
   uint8_t readWriteMultipleRegisters(uint16_t, uint16_t, uint16_t, uint16_t);
   uint8_t readWriteMultipleRegisters(uint16_t, uint16_t);
   uint8_t ModbusRawTransaction(uint8_t *u8ModbusADU, uint8_t u8ModbusADUSize,
                                uint8_t u8BytesLeft);
+  uint8_t ModbusPduTransaction(uint8_t *au8Pdu, uint16_t &u16Length,
+                               uint16_t u16Capacity);
 
 private:
   Stream *_serial;    ///< reference to serial port object
   uint8_t _u8MBSlave; ///< Modbus slave (1..247) initialized in begin()
   uint16_t _u16MBResponseTimeout = ku16MBResponseTimeout; ///< Modbus timeout [milliseconds]
+  ModbusHealth *_health = nullptr; ///< per-slave timeouts, if attached
+  uint16_t _u16TurnaroundDelay = 100; ///< silence after a broadcast [ms]
+  bool _bBroadcast = false; ///< last request was a broadcast
   uint16_t _u16ReadAddress;  ///< slave register from which to read
   uint16_t _u16ReadQty;      ///< quantity of words to read
-  uint16_t _u16ResponseBuffer[ku8MaxBufferSize]; ///< buffer to store Modbus
-                                                 ///< slave response; read via
-                                                 ///< GetResponseBuffer()
   uint16_t _u16WriteAddress; ///< slave register to which to write
   uint16_t _u16WriteQty;     ///< quantity of words to write
-  uint16_t _u16TransmitBuffer[ku8MaxBufferSize]; ///< buffer containing data to
-                                            ///< transmit to Modbus slave; set
-                                            ///< via SetTransmitBuffer()
-  uint16_t *txBuffer; // from Wire.h -- need to clean this up Rx
+  uint16_t *_u16ResponseBuffer; ///< buffer to store Modbus slave response;
+                                ///< read via GetResponseBuffer()
+  uint16_t *_u16TransmitBuffer; ///< buffer containing data to transmit to
+                                ///< Modbus slave; set via SetTransmitBuffer()
+  uint8_t _u8BufferSize;        ///< words in each of the two buffers above
+  uint16_t *_pu16ReadValues = nullptr;        ///< read destination in
+                                              ///< application memory, if
+                                              ///< not buffered
+  const uint16_t *_pu16WriteValues = nullptr; ///< FC10 values in application
+                                              ///< memory, if not buffered
+  const uint8_t *_pu8WriteBits = nullptr;     ///< FC0F coils in application
+                                              ///< memory, if not buffered
+  uint8_t *_u8ModbusADU;        ///< send/receive frame
+  uint16_t _u16ADUSize;         ///< bytes in _u8ModbusADU
+  uint32_t _u32BusTime = 0;    ///< micros() when the bus was last active
   uint8_t _u8TransmitBufferIndex;
   uint16_t u16TransmitBufferLength;
-  uint16_t *rxBuffer; // from Wire.h -- need to clean this up Rx
   uint8_t _u8ResponseBufferIndex;
   uint8_t _u8ResponseBufferLength;
 
   // master function that conducts Modbus transactions
   uint8_t ModbusServerTransaction(uint8_t u8MBFunction);
+  uint8_t exchange(uint8_t u8MBFunction, uint16_t u16Sent, uint16_t u16Length,
+                   uint16_t u16Timeout, uint16_t &u16Received);
+  void waitBusSilence();
+  uint32_t idleTimeout(uint16_t u16Received, uint32_t u32TimeoutMs) const;
+  uint8_t admit(uint16_t &u16Timeout);
+  void learn(uint16_t u16Received, uint32_t u32SentTime,
+             uint32_t u32FirstByteTime);
+  void record(uint8_t u8Function, uint8_t u8Status, uint16_t u16Sent,
+              uint16_t u16Received, uint32_t u32SendTime,
+              uint32_t u32SentTime, uint32_t u32FirstByteTime);
+  void traceResponse(uint8_t u8Status, const uint8_t *au8Frame,
+                     uint16_t u16Length);
+
+protected:
+  ModbusServerBase(uint16_t *au16ResponseBuffer, uint16_t *au16TransmitBuffer,
+                   uint8_t u8BufferSize, uint8_t *au8ModbusADU,
+                   uint16_t u16ADUSize);
+};
+
+/**
+Modbus RTU master with buffers sized at compile time.
+
+@tparam NRegs words in the response and transmit buffers (1..125); reads of
+up to NRegs registers or 16 * NRegs coils fit in one transaction
+@tparam NAdu bytes in the frame buffer (8..256); defaults to the largest
+frame NRegs words can produce, a FC17 request
+*/
+template <uint8_t NRegs = ku8MaxBufferSize,
+          uint16_t NAdu = (13 + 2 * NRegs < ku16MaxADUSize ? 13 + 2 * NRegs
+                                                           : ku16MaxADUSize)>
+class ModbusServerT : public ModbusServerBase {
+  static_assert(NRegs >= 1 && NRegs <= ku8MaxReadRegisters,
+                "NRegs must be 1..125");
+  static_assert(NAdu >= 8 && NAdu <= ku16MaxADUSize, "NAdu must be 8..256");
+
+public:
+  ModbusServerT()
+      : ModbusServerBase(_au16Response, _au16Transmit, NRegs, _au8ADU, NAdu) {}
+
+private:
+  uint16_t _au16Response[NRegs];
+  uint16_t _au16Transmit[NRegs];
+  uint8_t _au8ADU[NAdu];
 };
 
+/**
+Compact Modbus RTU master: the frame buffer is all the RAM it holds.
+
+Requests are built and responses received in place in that one buffer, and
+data moves straight between it and application memory: use the read and
+write overloads taking a pointer, e.g. readHoldingRegisters(address, qty,
+values), and the single writes. Calls going through the response or
+transmit buffer return ku8MBFrameTooLarge.
+
+@tparam NAdu bytes in the frame buffer (8..256); reading N registers takes
+5 + 2 * N, writing them 9 + 2 * N
+*/
+template <uint16_t NAdu>
+class ModbusServerT<0, NAdu> : public ModbusServerBase {
+  static_assert(NAdu >= 8 && NAdu <= ku16MaxADUSize, "NAdu must be 8..256");
+
+public:
+  ModbusServerT() : ModbusServerBase(nullptr, nullptr, 0, _au8ADU, NAdu) {}
+
+private:
+  uint8_t _au8ADU[NAdu];
+};
+
+typedef ModbusServerT<> ModbusServer;
+
 } // namespace ModBuster
 
 #endif // MODBUSTER_SERVER_H
@@ -0,0 +1,82 @@
+#include "Modbuster.h"
+
+#include "Arduino.h"
+
+using namespace ModBuster;
+
+/**
+Constructor.
+
+Starts unconfigured: T3.5 is ku16MBFrameSilence, T1.5 is disabled.
+
+@ingroup setup
+*/
+ModbusTiming::ModbusTiming() : _u32T15(0), _u32T35(ku16MBFrameSilence) {}
+
+/**
+Derive T1.5 and T3.5 from the line speed.
+
+Below or at 19200 baud they are 1.5 and 3.5 character times; above it
+the spec fixes them at 750 and 1750 microseconds.
+
+@param u32Baud line speed [bits/s]
+@param u8CharBits bits per character, start and stop bits included; RTU
+uses 11 (8E1, 8O1 or 8N2), 10 for the common non-compliant 8N1
+@ingroup setup
+*/
+void ModbusTiming::begin(uint32_t u32Baud, uint8_t u8CharBits) {
+  if (!u32Baud)
+    return;
+  if (u32Baud > ku32RTUFixedTimingBaud) {
+    set(ku16RTUFixedT15, ku16RTUFixedT35);
+    return;
+  }
+  // rounded up, so a gap is never taken for a shorter one
+  uint32_t u32Bits = (uint32_t)u8CharBits * 1000000UL;
+  set((3 * u32Bits + 2 * u32Baud - 1) / (2 * u32Baud),
+      (7 * u32Bits + 2 * u32Baud - 1) / (2 * u32Baud));
+}
+
+/**
+Set T1.5 and T3.5 explicitly.
+
+Use it for transports that add latency of their own, e.g. a USB adapter
+that forwards received bytes every few milliseconds.
+
+@param u32T15 inter-character timeout [microseconds]; 0 disables it
+@param u32T35 inter-frame silence [microseconds]
+@ingroup setup
+*/
+void ModbusTiming::set(uint32_t u32T15, uint32_t u32T35) {
+  _u32T15 = u32T15;
+  _u32T35 = u32T35;
+}
+
+/**
+Time left until the bus has been silent for T3.5.
+
+@param u32Since micros() when the bus was last active
+@return 0 once T3.5 has elapsed; time left otherwise [microseconds]
+*/
+uint32_t ModbusTiming::silenceLeft(uint32_t u32Since) const {
+  uint32_t u32Elapsed = micros() - u32Since;
+  return u32Elapsed < _u32T35 ? _u32T35 - u32Elapsed : 0;
+}
+
+/**
+Check a character against the inter-character timeout.
+
+When a character is read says little about when it arrived: it may have
+waited in the receive buffer while the application was busy. The gap is
+taken from the last time nothing was pending instead, which never
+exceeds the real one.
+
+@param u32Since micros() when the previous character of the frame was read
+@param u32Idle micros() when no character was pending last
+@return true if T1.5 is enabled and the bus was seen idle for longer
+after u32Since, i.e. the frame is broken
+*/
+bool ModbusTiming::charGapExceeded(uint32_t u32Since,
+                                   uint32_t u32Idle) const {
+  return _u32T15 && (int32_t)(u32Idle - u32Since) > (int32_t)_u32T15;
+}
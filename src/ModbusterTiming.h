@@ -0,0 +1,61 @@
+#ifndef MODBUSTER_TIMING_H
+#define MODBUSTER_TIMING_H
+
+#include <stdint.h>
+
+namespace ModBuster {
+
+// Character bits of the RTU format: start, 8 data, parity or second stop
+// bit, stop.
+const uint8_t ku8RTUCharBits = 11;
+
+// Above this baud rate the spec fixes T1.5 and T3.5 [bits/s]
+const uint32_t ku32RTUFixedTimingBaud = 19200;
+
+// T1.5 and T3.5 above ku32RTUFixedTimingBaud [microseconds]
+const uint16_t ku16RTUFixedT15 = 750;
+const uint16_t ku16RTUFixedT35 = 1750;
+
+/**
+RTU frame delimiting timer.
+
+Holds T1.5, the longest gap allowed between two characters of a frame,
+and T3.5, the bus silence that ends a frame, both derived from the line
+speed. Times are compared against micros(), so every check is wrap safe.
+
+Until begin() or set() is called T3.5 is ku16MBFrameSilence and T1.5 is
+disabled, which suits transports of unknown speed such as USB adapters or
+pseudo-terminals that deliver a frame in bursts.
+*/
+class ModbusTiming {
+public:
+  ModbusTiming();
+
+  void begin(uint32_t u32Baud, uint8_t u8CharBits = ku8RTUCharBits);
+  void set(uint32_t u32T15, uint32_t u32T35);
+
+  /**
+  Longest gap between two characters of a frame.
+
+  @return T1.5 [microseconds]; 0 if the check is disabled
+  */
+  uint32_t t15() const { return _u32T15; }
+
+  /**
+  Bus silence that ends a frame.
+
+  @return T3.5 [microseconds]
+  */
+  uint32_t t35() const { return _u32T35; }
+
+  uint32_t silenceLeft(uint32_t u32Since) const;
+  bool charGapExceeded(uint32_t u32Since, uint32_t u32Idle) const;
+
+private:
+  uint32_t _u32T15; ///< inter-character timeout [microseconds]
+  uint32_t _u32T35; ///< inter-frame silence [microseconds]
+};
+
+} // namespace ModBuster
+
+#endif // MODBUSTER_TIMING_H
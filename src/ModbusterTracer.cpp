@@ -0,0 +1,130 @@
+#include "ModbusterTracer.h"
+
+#include "Arduino.h"
+
+using namespace ModBuster;
+
+/**
+Constructor.
+
+@param au8Buffer ring storage; a frame needs ku8TraceHeaderSize bytes
+more than its length
+@param u16Size number of bytes in au8Buffer
+@ingroup setup
+*/
+ModbusTracer::ModbusTracer(uint8_t *au8Buffer, uint16_t u16Size)
+    : _au8Buffer(au8Buffer), _u16Size(au8Buffer ? u16Size : 0) {
+  clear();
+}
+
+/**
+Keep a copy of a complete frame; called by the transport.
+
+The oldest records are dropped until the frame fits. A frame larger than
+the whole ring is dropped instead.
+
+@param u32Time micros() when the frame ended
+@param u8Flags ku8TraceTx for frames sent, 0 for frames received
+@param u8Port port number given to setTracer()
+@param u8Status ku8MBSuccess, exception or status code of the transaction
+@param au8Frame frame, slave ID to CRC
+@param u16Length number of bytes in au8Frame
+*/
+void ModbusTracer::record(uint32_t u32Time, uint8_t u8Flags, uint8_t u8Port,
+                          uint8_t u8Status, const uint8_t *au8Frame,
+                          uint16_t u16Length) {
+  uint32_t u32Need = (uint32_t)ku8TraceHeaderSize + u16Length;
+  if (u32Need > _u16Size) {
+    _u32Lost++;
+    return;
+  }
+  while ((uint32_t)(_u16Size - _u16Used) < u32Need) {
+    uint16_t u16Oldest = recordSize(_u16Head);
+    _u16Head = (uint16_t)(((uint32_t)_u16Head + u16Oldest) % _u16Size);
+    _u16Used -= u16Oldest;
+    _u16Records--;
+    _u32Lost++;
+  }
+
+  uint8_t au8Header[ku8TraceHeaderSize] = {
+      (uint8_t)u32Time,         (uint8_t)(u32Time >> 8),
+      (uint8_t)(u32Time >> 16), (uint8_t)(u32Time >> 24),
+      lowByte(u16Length),       highByte(u16Length),
+      u8Flags,                  u8Port,
+      u8Status};
+  uint16_t u16Tail = (uint16_t)(((uint32_t)_u16Head + _u16Used) % _u16Size);
+  put(u16Tail, au8Header, ku8TraceHeaderSize);
+  put((uint16_t)(((uint32_t)u16Tail + ku8TraceHeaderSize) % _u16Size),
+      au8Frame, u16Length);
+  _u16Used += (uint16_t)u32Need;
+  _u16Records++;
+}
+
+/**
+Write the records held, oldest first, as a binary trace for modbus_trace.
+
+@param out destination, e.g. Serial or a PosixStream on a file
+@return number of bytes written
+*/
+size_t ModbusTracer::dump(Print &out) const {
+  uint32_t u32Now = micros();
+  uint8_t au8Header[ku8TraceFileHeaderSize] = {
+      'M',
+      'B',
+      'T',
+      'R',
+      1,
+      0,
+      0,
+      0,
+      (uint8_t)u32Now,
+      (uint8_t)(u32Now >> 8),
+      (uint8_t)(u32Now >> 16),
+      (uint8_t)(u32Now >> 24),
+      lowByte(_u16Records),
+      highByte(_u16Records),
+      0,
+      0};
+  size_t written = out.write(au8Header, ku8TraceFileHeaderSize);
+
+  // the records wrap around the end of the ring at most once
+  uint16_t u16First = _u16Size - _u16Head;
+  if (u16First > _u16Used)
+    u16First = _u16Used;
+  if (u16First)
+    written += out.write(_au8Buffer + _u16Head, u16First);
+  if (_u16Used > u16First)
+    written += out.write(_au8Buffer, _u16Used - u16First);
+  return written;
+}
+
+/**
+Drop all records and reset lost().
+*/
+void ModbusTracer::clear() {
+  _u16Head = 0;
+  _u16Used = 0;
+  _u16Records = 0;
+  _u32Lost = 0;
+}
+
+/**
+Copy bytes into the ring, wrapping around its end.
+*/
+void ModbusTracer::put(uint16_t u16At, const uint8_t *au8Src,
+                       uint16_t u16Length) {
+  uint16_t u16First = _u16Size - u16At;
+  if (u16First > u16Length)
+    u16First = u16Length;
+  memcpy(_au8Buffer + u16At, au8Src, u16First);
+  memcpy(_au8Buffer, au8Src + u16First, u16Length - u16First);
+}
+
+/**
+@return bytes taken by the record starting at u16At, header included
+*/
+uint16_t ModbusTracer::recordSize(uint16_t u16At) const {
+  uint8_t u8Low = _au8Buffer[(u16At + 4U) % _u16Size];
+  uint8_t u8High = _au8Buffer[(u16At + 5U) % _u16Size];
+  return ku8TraceHeaderSize + word(u8High, u8Low);
+}
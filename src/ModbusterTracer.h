@@ -0,0 +1,64 @@
+#ifndef MODBUSTER_TRACER_H
+#define MODBUSTER_TRACER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+class Print;
+
+namespace ModBuster {
+
+// Direction flag of a traced frame
+const uint8_t ku8TraceTx = 0x01;
+
+// Bytes in front of every frame in the trace ring and in dumps: time
+// (uint32), length (uint16), flags, port and status, little-endian
+const uint8_t ku8TraceHeaderSize = 9;
+
+// Bytes in front of the records in a dump: "MBTR", version, 3 reserved
+// bytes, micros() at the time of the dump and the number of records, both
+// uint32 little-endian
+const uint8_t ku8TraceFileHeaderSize = 16;
+
+/**
+Frame tracer: complete frames with a timestamp, direction, port and status
+kept in a fixed ring of memory supplied by the application.
+
+Attach it with setTracer() to a ModbusServer or ModbusClient; each frame
+sent or received is then copied into the ring in one piece once it is
+complete, the oldest frames making room for new ones. Nothing is
+formatted or printed while the bus is live, so tracing leaves the frame
+timing alone. dump() writes the ring as a binary trace to any Print, e.g.
+Serial or a file on a host, and the modbus_trace tool prints it or turns
+it into a pcap file.
+
+Nothing is synchronised: dump and clear from the thread running the
+transactions.
+*/
+class ModbusTracer {
+public:
+  ModbusTracer(uint8_t *au8Buffer, uint16_t u16Size);
+
+  void record(uint32_t u32Time, uint8_t u8Flags, uint8_t u8Port,
+              uint8_t u8Status, const uint8_t *au8Frame, uint16_t u16Length);
+
+  uint16_t records() const { return _u16Records; }
+  uint32_t lost() const { return _u32Lost; }
+  size_t dump(Print &out) const;
+  void clear();
+
+private:
+  uint8_t *_au8Buffer;  ///< ring storage
+  uint16_t _u16Size;    ///< bytes in _au8Buffer
+  uint16_t _u16Head;    ///< oldest record
+  uint16_t _u16Used;    ///< bytes taken by records
+  uint16_t _u16Records; ///< records held
+  uint32_t _u32Lost;    ///< records overwritten or too large for the ring
+
+  void put(uint16_t u16At, const uint8_t *au8Src, uint16_t u16Length);
+  uint16_t recordSize(uint16_t u16At) const;
+};
+
+} // namespace ModBuster
+
+#endif // MODBUSTER_TRACER_H
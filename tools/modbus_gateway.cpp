@@ -0,0 +1,190 @@
+/*
+
+  modbus_gateway.cpp - Modbus TCP to RTU gateway.
+
+  usage: modbus_gateway [-p port] [-q queue] [-t timeout] [-i interval]
+                        -b device:baud[:format]:units ...
+
+    -p port      TCP port to listen on (default 502)
+    -q queue     requests that may wait for a bus (default 32)
+    -t timeout   RTU response timeout [ms] (default 1000)
+    -i interval  seconds between statistics lines, 0 for none (default 10)
+    -b bus       serial bus: device, baud rate, optional character format
+                 (8N1, 8E1, 8O1, 8N2; default 8E1) and the unit IDs it
+                 serves, e.g. /dev/ttyUSB0:19200:8E1:1-10,20
+
+  Statistics are printed per bus: requests per second, answered/failed/
+  refused requests, queue depth now and at most, mean and longest queue
+  wait and the share of time the bus was busy.
+
+*/
+
+#include "ModbusterGateway.h"
+#include "ModbusterPosix.h"
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+using namespace ModBuster;
+
+static volatile sig_atomic_t stop = 0;
+
+static void onSignal(int) { stop = 1; }
+
+static void usage() {
+  fprintf(stderr, "usage: modbus_gateway [-p port] [-q queue] [-t timeout] "
+                  "[-i interval] -b device:baud[:format]:units ...\n");
+  exit(2);
+}
+
+static bool parseFormat(const std::string &format, uint8_t &u8Config) {
+  static const struct {
+    const char *name;
+    uint8_t u8Config;
+  } formats[] = {{"8N1", SERIAL_8N1},
+                 {"8E1", SERIAL_8E1},
+                 {"8O1", SERIAL_8O1},
+                 {"8N2", SERIAL_8N2}};
+  for (const auto &f : formats) {
+    if (format == f.name) {
+      u8Config = f.u8Config;
+      return true;
+    }
+  }
+  return false;
+}
+
+// "1-10,20" into routes of the bus
+static bool parseUnits(ModbusGateway &gateway, int bus, std::string units) {
+  while (!units.empty()) {
+    size_t comma = units.find(',');
+    std::string range = units.substr(0, comma);
+    units = comma == std::string::npos ? "" : units.substr(comma + 1);
+
+    char *end;
+    long first = strtol(range.c_str(), &end, 10), last = first;
+    if (*end == '-')
+      last = strtol(end + 1, &end, 10);
+    if (*end || first < 0 || last > 255 ||
+        !gateway.route((uint8_t)first, (uint8_t)last, bus))
+      return false;
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  uint16_t u16Port = ku16MBTcpPort;
+  uint16_t u16Queue = 32, u16Timeout = 1000;
+  int interval = 10;
+  std::vector<std::string> buses;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "p:q:t:i:b:")) != -1) {
+    switch (opt) {
+    case 'p':
+      u16Port = (uint16_t)atoi(optarg);
+      break;
+    case 'q':
+      u16Queue = (uint16_t)atoi(optarg);
+      break;
+    case 't':
+      u16Timeout = (uint16_t)atoi(optarg);
+      break;
+    case 'i':
+      interval = atoi(optarg);
+      break;
+    case 'b':
+      buses.push_back(optarg);
+      break;
+    default:
+      usage();
+    }
+  }
+  if (buses.empty())
+    usage();
+
+  ModbusGateway gateway;
+  std::vector<PosixStream *> ports;
+  for (const std::string &spec : buses) {
+    // device:baud[:format]:units
+    std::vector<std::string> fields;
+    size_t start = 0, colon;
+    while ((colon = spec.find(':', start)) != std::string::npos) {
+      fields.push_back(spec.substr(start, colon - start));
+      start = colon + 1;
+    }
+    fields.push_back(spec.substr(start));
+
+    uint8_t u8Config = SERIAL_8E1;
+    if (fields.size() < 3 || fields.size() > 4 ||
+        (fields.size() == 4 && !parseFormat(fields[2], u8Config))) {
+      fprintf(stderr, "bad bus: %s\n", spec.c_str());
+      return 2;
+    }
+    uint32_t u32Baud = (uint32_t)atol(fields[1].c_str());
+
+    PosixStream *serial = new PosixStream();
+    if (!serial->begin(fields[0].c_str(), u32Baud, u8Config)) {
+      perror(fields[0].c_str());
+      return 1;
+    }
+    ports.push_back(serial);
+
+    int bus = gateway.addBus(*serial);
+    gateway.master(bus).timing().begin(u32Baud);
+    gateway.master(bus).setResponseTimeOut(u16Timeout);
+    if (!parseUnits(gateway, bus, fields.back())) {
+      fprintf(stderr, "bad units: %s\n", fields.back().c_str());
+      return 2;
+    }
+  }
+  gateway.queueLimit(u16Queue);
+
+  if (!gateway.begin(u16Port)) {
+    perror("listen");
+    return 1;
+  }
+  printf("listening on port %u, %d buses\n", gateway.port(), gateway.buses());
+  fflush(stdout);
+
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+
+  std::vector<ModbusGatewayStats> last(gateway.buses());
+  for (int bus = 0; bus < gateway.buses(); bus++)
+    last[bus] = gateway.stats(bus);
+  uint32_t u32Last = millis();
+  while (!stop) {
+    sleep(interval > 0 ? interval : 1);
+    if (interval <= 0 || stop)
+      continue;
+
+    uint32_t u32Now = millis();
+    double seconds = (u32Now - u32Last) / 1000.0;
+    u32Last = u32Now;
+    for (int bus = 0; bus < gateway.buses(); bus++) {
+      ModbusGatewayStats s = gateway.stats(bus);
+      uint32_t u32Forwarded = s.u32Forwarded - last[bus].u32Forwarded;
+      double busy = (s.u64BusyUs - last[bus].u64BusyUs) / 1e4 / seconds;
+      printf("bus %d %s: %.1f req/s, %u ok, %u failed, %u refused, "
+             "queue %u (max %u), wait %.1f/%.1f ms, busy %.0f%%\n",
+             bus, buses[bus].c_str(), u32Forwarded / seconds, s.u32Answered,
+             s.u32Failed, s.u32Rejected, s.u16Queued, s.u16MaxQueued,
+             s.u32Forwarded ? s.u64WaitUs / 1000.0 / s.u32Forwarded : 0.0,
+             s.u32MaxWaitUs / 1000.0, busy);
+      last[bus] = s;
+    }
+    fflush(stdout);
+  }
+
+  gateway.end();
+  for (PosixStream *serial : ports)
+    delete serial;
+  return 0;
+}
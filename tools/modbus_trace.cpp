@@ -0,0 +1,220 @@
+/*
+
+  modbus_trace.cpp - prints a binary frame trace written by
+  ModbusTracer::dump(), or converts it to a pcap file.
+
+  usage: modbus_trace [-w file.pcap] [-t time] trace
+
+    -w file  write the frames to a pcap file instead of printing them
+    -t time  wall-clock time of the dump [s since the epoch]; frame times
+             are relative to the first frame otherwise
+
+  Each line shows the time of the frame, the time since the previous one,
+  the port, the direction, the bytes and, for failed transactions or bad
+  CRCs, what went wrong.
+
+  pcap files use link type USER0 (147). Every packet starts with four
+  bytes: flags (1 for frames sent), port, status and a reserved 0,
+  followed by the RTU frame. In Wireshark, add USER0 to the DLT_USER
+  table with payload protocol "mbrtu" and header size 4 to decode them.
+
+*/
+
+#include "Modbuster.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <vector>
+
+using namespace ModBuster;
+
+// LINKTYPE_USER0
+static const uint32_t ku32LinkType = 147;
+
+struct Frame {
+  uint32_t u32Age;     ///< time before the dump [microseconds]
+  uint8_t u8Flags;     ///< ku8TraceTx or 0
+  uint8_t u8Port;      ///< port given to setTracer()
+  uint8_t u8Status;    ///< status of the transaction
+  std::vector<uint8_t> bytes;
+};
+
+static void usage() {
+  fprintf(stderr, "usage: modbus_trace [-w file.pcap] [-t time] trace\n");
+  exit(2);
+}
+
+static uint32_t get32(const uint8_t *au8) {
+  return au8[0] | (uint32_t)au8[1] << 8 | (uint32_t)au8[2] << 16 |
+         (uint32_t)au8[3] << 24;
+}
+
+static void put32(FILE *out, uint32_t u32) {
+  uint8_t au8[4] = {(uint8_t)u32, (uint8_t)(u32 >> 8), (uint8_t)(u32 >> 16),
+                    (uint8_t)(u32 >> 24)};
+  fwrite(au8, 1, 4, out);
+}
+
+static const char *statusText(uint8_t u8Status) {
+  switch (u8Status) {
+  case ku8MBIllegalFunction:
+    return "illegal function";
+  case ku8MBIllegalDataAddress:
+    return "illegal data address";
+  case ku8MBIllegalDataValue:
+    return "illegal data value";
+  case ku8MBSlaveDeviceFailure:
+    return "slave device failure";
+  case ku8MBGatewayPathUnavailable:
+    return "gateway path unavailable";
+  case ku8MBGatewayTargetFailed:
+    return "gateway target failed";
+  case ku8MBInvalidSlaveID:
+    return "invalid slave ID";
+  case ku8MBInvalidFunction:
+    return "invalid function";
+  case ku8MBResponseTimedOut:
+    return "timed out";
+  case ku8MBInvalidCRC:
+    return "invalid CRC";
+  case ku8MBFrameTooLarge:
+    return "frame too large";
+  case ku8MBConnectionFailed:
+    return "connection failed";
+  default:
+    return "unknown status";
+  }
+}
+
+static bool load(const char *path, std::vector<Frame> &frames) {
+  FILE *in = fopen(path, "rb");
+  if (!in) {
+    perror(path);
+    return false;
+  }
+  uint8_t au8Header[ku8TraceFileHeaderSize];
+  if (fread(au8Header, 1, sizeof(au8Header), in) != sizeof(au8Header) ||
+      memcmp(au8Header, "MBTR", 4) || au8Header[4] != 1) {
+    fprintf(stderr, "%s: not a Modbus trace\n", path);
+    fclose(in);
+    return false;
+  }
+  uint32_t u32Dump = get32(au8Header + 8);
+  uint32_t u32Records = get32(au8Header + 12);
+
+  for (uint32_t i = 0; i < u32Records; i++) {
+    uint8_t au8Record[ku8TraceHeaderSize];
+    if (fread(au8Record, 1, sizeof(au8Record), in) != sizeof(au8Record))
+      break;
+    Frame frame;
+    // micros() wraps after 71 minutes; ages stay right within that span
+    frame.u32Age = u32Dump - get32(au8Record);
+    frame.u8Flags = au8Record[6];
+    frame.u8Port = au8Record[7];
+    frame.u8Status = au8Record[8];
+    frame.bytes.resize(au8Record[4] | au8Record[5] << 8);
+    if (fread(frame.bytes.data(), 1, frame.bytes.size(), in) !=
+        frame.bytes.size())
+      break;
+    frames.push_back(frame);
+  }
+  fclose(in);
+  if (frames.size() != u32Records)
+    fprintf(stderr, "%s: truncated after %zu of %u frames\n", path,
+            frames.size(), (unsigned)u32Records);
+  return true;
+}
+
+static void print(const std::vector<Frame> &frames, uint64_t u64DumpUs) {
+  uint64_t u64Previous = 0;
+  for (size_t i = 0; i < frames.size(); i++) {
+    const Frame &frame = frames[i];
+    uint64_t u64Time = u64DumpUs - frame.u32Age;
+    printf("%10llu.%06llu %+10.6f  port %u %s ",
+           (unsigned long long)(u64Time / 1000000),
+           (unsigned long long)(u64Time % 1000000),
+           i ? (double)(int64_t)(u64Time - u64Previous) / 1e6 : 0.0,
+           frame.u8Port, frame.u8Flags & ku8TraceTx ? "tx" : "rx");
+    for (uint8_t u8Byte : frame.bytes)
+      printf(" %02X", u8Byte);
+    if (frame.u8Status)
+      printf("  [0x%02X %s]", frame.u8Status, statusText(frame.u8Status));
+    else if (frame.bytes.size() >= 4 &&
+             crc_update(ku16CRCInit, frame.bytes.data(),
+                        frame.bytes.size()) != ku16CRCResidue)
+      printf("  [bad CRC]");
+    printf("\n");
+    u64Previous = u64Time;
+  }
+}
+
+static bool writePcap(const char *path, const std::vector<Frame> &frames,
+                      uint64_t u64DumpUs) {
+  FILE *out = fopen(path, "wb");
+  if (!out) {
+    perror(path);
+    return false;
+  }
+  // global header: magic, version 2.4, GMT offset, accuracy, snap length
+  put32(out, 0xA1B2C3D4);
+  put32(out, 0x00040002);
+  put32(out, 0);
+  put32(out, 0);
+  put32(out, 65535);
+  put32(out, ku32LinkType);
+  for (const Frame &frame : frames) {
+    uint64_t u64Time = u64DumpUs - frame.u32Age;
+    uint32_t u32Length = 4 + (uint32_t)frame.bytes.size();
+    put32(out, (uint32_t)(u64Time / 1000000));
+    put32(out, (uint32_t)(u64Time % 1000000));
+    put32(out, u32Length);
+    put32(out, u32Length);
+    uint8_t au8Pseudo[4] = {frame.u8Flags, frame.u8Port, frame.u8Status, 0};
+    fwrite(au8Pseudo, 1, sizeof(au8Pseudo), out);
+    fwrite(frame.bytes.data(), 1, frame.bytes.size(), out);
+  }
+  if (fclose(out) != 0) {
+    perror(path);
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  const char *pcap = nullptr;
+  double dDumpTime = -1;
+  int opt;
+  while ((opt = getopt(argc, argv, "w:t:")) != -1) {
+    switch (opt) {
+    case 'w':
+      pcap = optarg;
+      break;
+    case 't':
+      dDumpTime = atof(optarg);
+      break;
+    default:
+      usage();
+    }
+  }
+  if (optind != argc - 1)
+    usage();
+
+  std::vector<Frame> frames;
+  if (!load(argv[optind], frames))
+    return 1;
+
+  // without a wall-clock time the oldest frame is at 0
+  uint64_t u64DumpUs = 0;
+  if (dDumpTime >= 0)
+    u64DumpUs = (uint64_t)(dDumpTime * 1e6);
+  else if (!frames.empty())
+    u64DumpUs = frames.front().u32Age;
+
+  if (pcap)
+    return writePcap(pcap, frames, u64DumpUs) ? 0 : 1;
+  print(frames, u64DumpUs);
+  return 0;
+}